@@ -0,0 +1,103 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/detail/fast_math.hpp>
+
+#include <array>
+#include <optional>
+
+namespace trc {
+
+/// A transform of the form <code>M * p + t</code>, stored as the images of the three axes (the columns of
+/// <code>M</code>) and of the origin (<code>t</code>).\n
+/// Unlike <code>mat4x4</code> it can be inverted, instances use the inverse to bring rays into object space.
+struct affine_transform {
+    std::array<vec3, 3> axes{vec3{1, 0, 0}, vec3{0, 1, 0}, vec3{0, 0, 1}};
+    vec3 origin{};
+
+    static constexpr auto identity() -> affine_transform { return {}; }
+
+    static constexpr auto translate(vec3 offset) -> affine_transform { return {.origin = offset}; }
+
+    static constexpr auto scale(vec3 factors) -> affine_transform {
+        return {.axes{vec3{factors[0], 0, 0}, vec3{0, factors[1], 0}, vec3{0, 0, factors[2]}}};
+    }
+
+    /// The rotation by the unit quaternion <code>x, y, z, w</code>
+    static constexpr auto rotate(vec4 quaternion) -> affine_transform {
+        const real x = quaternion[0];
+        const real y = quaternion[1];
+        const real z = quaternion[2];
+        const real w = quaternion[3];
+
+        return {.axes{
+          vec3{1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w)},
+          vec3{2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w)},
+          vec3{2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)},
+        }};
+    }
+
+    /// From the 16 elements of a 4x4 matrix in column-major order, the last row is assumed to be <code>0 0 0 1</code>
+    static constexpr auto from_columns(std::array<real, 16> const& elements) -> affine_transform {
+        return {
+          .axes{
+            vec3{elements[0], elements[1], elements[2]},
+            vec3{elements[4], elements[5], elements[6]},
+            vec3{elements[8], elements[9], elements[10]},
+          },
+          .origin{elements[12], elements[13], elements[14]},
+        };
+    }
+
+    constexpr auto apply_vector(vec3 vec) const -> vec3 { return axes[0] * vec[0] + axes[1] * vec[1] + axes[2] * vec[2]; }
+
+    constexpr auto apply_point(vec3 pt) const -> vec3 { return apply_vector(pt) + origin; }
+
+    constexpr auto determinant() const -> real { return dot(axes[0], cross(axes[1], axes[2])); }
+
+    /// The transform normals go through, the inverse transpose of <code>M</code>. Its results are not normalized.
+    /// @return nullopt if the transform is singular
+    constexpr auto normal_transform() const -> std::optional<affine_transform> {
+        const real det = determinant();
+        // std::isfinite is folded away under -ffast-math
+        if (det == 0 || !detail::is_finite(det)) {
+            return std::nullopt;
+        }
+
+        // the rows of the inverse are the cross products of the other two columns
+        return affine_transform{.axes{
+          cross(axes[1], axes[2]) / det,
+          cross(axes[2], axes[0]) / det,
+          cross(axes[0], axes[1]) / det,
+        }};
+    }
+
+    /// @return nullopt if the transform is singular
+    constexpr auto inverse() const -> std::optional<affine_transform> {
+        const std::optional<affine_transform> rows = normal_transform();
+        if (!rows) {
+            return std::nullopt;
+        }
+
+        auto const& [row_0, row_1, row_2] = rows->axes;
+
+        affine_transform ret{.axes{
+          vec3{row_0[0], row_1[0], row_2[0]},
+          vec3{row_0[1], row_1[1], row_2[1]},
+          vec3{row_0[2], row_1[2], row_2[2]},
+        }};
+        ret.origin = -ret.apply_vector(origin);
+
+        return ret;
+    }
+
+    /// Applies <code>rhs</code> first
+    friend constexpr auto operator*(affine_transform const& lhs, affine_transform const& rhs) -> affine_transform {
+        return {
+          .axes{lhs.apply_vector(rhs.axes[0]), lhs.apply_vector(rhs.axes[1]), lhs.apply_vector(rhs.axes[2])},
+          .origin = lhs.apply_point(rhs.origin),
+        };
+    }
+};
+
+}// namespace trc
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <tracer/common.hpp>
+
+#include <span>
+#include <vector>
+
+namespace trc {
+
+/// Walker/Vose alias table for drawing indices proportional to a set of non-negative weights in O(1).\n
+/// If all weights are zero (but there are some), the table degrades to a uniform distribution.
+struct alias_table {
+    constexpr alias_table() = default;
+
+    constexpr alias_table(std::span<const real> weights) { create(weights); }
+
+    constexpr void create(std::span<const real> weights) {
+        m_bins.clear();
+
+        if (weights.empty()) {
+            return;
+        }
+
+        const usize n = weights.size();
+
+        real sum = 0;
+        for (real weight: weights) {
+            sum += std::max<real>(weight, 0);
+        }
+
+        m_bins.resize(n);
+
+        std::vector<real> scaled(n);
+        for (usize i = 0; i < n; i++) {
+            real normalized = sum > 0 ? std::max<real>(weights[i], 0) / sum : real(1) / static_cast<real>(n);
+
+            m_bins[i].pdf = normalized;
+            scaled[i] = normalized * static_cast<real>(n);
+        }
+
+        std::vector<usize> small{};
+        std::vector<usize> large{};
+
+        for (usize i = 0; i < n; i++) {
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            usize lesser = small.back();
+            small.pop_back();
+            usize greater = large.back();
+            large.pop_back();
+
+            m_bins[lesser].threshold = scaled[lesser];
+            m_bins[lesser].alias = greater;
+
+            scaled[greater] = (scaled[greater] + scaled[lesser]) - 1;
+            (scaled[greater] < 1 ? small : large).push_back(greater);
+        }
+
+        // leftovers are (up to rounding errors) exactly 1
+        for (usize i: large) {
+            m_bins[i].threshold = 1;
+            m_bins[i].alias = i;
+        }
+
+        for (usize i: small) {
+            m_bins[i].threshold = 1;
+            m_bins[i].alias = i;
+        }
+    }
+
+    constexpr auto empty() const -> bool { return m_bins.empty(); }
+    constexpr auto size() const -> usize { return m_bins.size(); }
+
+    /// The probability of <code>sample</code> returning <code>index</code>
+    constexpr auto pdf(usize index) const -> real { return m_bins[index].pdf; }
+
+    /// Do NOT call this on an empty table
+    template<typename Gen>
+    constexpr auto sample(Gen& gen) const -> usize {
+        stf::random::erand48_distribution<real> dist{};
+
+        real scaled = dist(gen) * static_cast<real>(m_bins.size());
+        usize index = std::min(static_cast<usize>(scaled), m_bins.size() - 1);
+        real remainder = scaled - static_cast<real>(index);
+
+        bin const& selected = m_bins[index];
+
+        return remainder < selected.threshold ? index : selected.alias;
+    }
+
+private:
+    struct bin {
+        real pdf = 0;
+        real threshold = 1;
+        usize alias = 0;
+    };
+
+    std::vector<bin> m_bins{};
+};
+
+}// namespace trc
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/image.hpp>
+#include <tracer/intersection.hpp>
+
+#include <algorithm>
+#include <array>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace trc {
+
+/// Arbitrary output variables, i.e. the buffers an integrator can produce besides the rendered image itself.
+enum class aov : usize {
+    /// The rendered image, written through <code>image_like::set</code>
+    beauty = 0,
+    /// Albedo at the first hit, averaged over the samples
+    albedo,
+    /// Global shading normal at the first hit, averaged over the samples
+    normal,
+    /// Distance to the first hit in every channel, averaged over the samples that hit anything. Infinity otherwise.
+    depth,
+    /// Material index of the first hit of the first sample, -1 on misses
+    material_index,
+    /// Shape index (red) and primitive index (green) of the first hit of the first sample, -1 on misses
+    primitive_id,
+    /// The number of samples taken for the pixel
+    sample_count,
+};
+
+inline constexpr usize n_aovs = static_cast<usize>(aov::sample_count) + 1;
+
+constexpr auto aov_name(aov channel) -> std::string_view {
+    constexpr std::string_view names[n_aovs]{
+      "beauty",
+      "albedo",
+      "normal",
+      "depth",
+      "material_index",
+      "primitive_id",
+      "sample_count",
+    };
+
+    return names[static_cast<usize>(channel)];
+}
+
+/// An <code>image_like</code> that can receive AOVs in addition to the beauty image.\n
+/// Integrators check for this interface and skip the AOV bookkeeping entirely if it is absent or if none of the
+/// channels it reports through <code>has_aov</code> are wanted.
+struct aov_image_like : image_like {
+    constexpr auto as_aov_image() -> aov_image_like* final override { return this; }
+
+    virtual constexpr auto has_aov(aov channel) const -> bool = 0;
+
+    /// Like <code>image_like::set_tile</code>, for the non-beauty channels reported by <code>has_aov</code>
+    virtual constexpr void set_aov_tile(aov channel, usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) = 0;
+};
+
+/// The AOVs of a single tile, collected row-major while it renders and handed to the image once it is done.
+struct aov_tile {
+    /// Allocates the channels <code>image</code> has, the beauty image is not stored here
+    constexpr void create(aov_image_like const& image, usize width, usize height) {
+        m_width = width;
+        m_height = height;
+
+        for (usize i = 1; i < n_aovs; i++) {
+            if (image.has_aov(static_cast<aov>(i))) {
+                m_channels[i].resize(width * height);
+            }
+        }
+    }
+
+    constexpr auto any() const -> bool {
+        return std::ranges::any_of(m_channels, [](std::vector<color> const& channel) { return !channel.empty(); });
+    }
+
+    /// @param x, y Relative to the top-left corner of the tile
+    constexpr void set(aov channel, usize x, usize y, color c) {
+        std::vector<color>& pixels = m_channels[static_cast<usize>(channel)];
+
+        if (!pixels.empty()) {
+            pixels[y * m_width + x] = c;
+        }
+    }
+
+    /// Writes the tile to <code>image</code> with its top-left corner at (<code>x</code>, <code>y</code>)
+    constexpr void submit(aov_image_like& image, usize x, usize y) const {
+        for (usize i = 1; i < n_aovs; i++) {
+            if (!m_channels[i].empty()) {
+                image.set_aov_tile(static_cast<aov>(i), x, y, m_width, m_height, m_channels[i]);
+            }
+        }
+    }
+
+private:
+    usize m_width = 0;
+    usize m_height = 0;
+
+    std::array<std::vector<color>, n_aovs> m_channels{};
+};
+
+/// Storage for the non-beauty AOVs, only the enabled channels are allocated.
+struct aov_buffers {
+    constexpr aov_buffers() = default;
+
+    constexpr aov_buffers(usize width, usize height) { create(width, height); }
+
+    /// Resizes the enabled channels, the contents are undefined afterwards
+    constexpr void create(usize width, usize height) {
+        m_width = width;
+        m_height = height;
+
+        for (usize i = 1; i < n_aovs; i++) {
+            if (m_enabled[i]) {
+                allocate(i);
+            }
+        }
+    }
+
+    constexpr void enable(aov channel) {
+        usize index = static_cast<usize>(channel);
+        if (index == 0 || m_enabled[index]) {
+            return;
+        }
+
+        m_enabled[index] = true;
+        allocate(index);
+    }
+
+    constexpr void disable(aov channel) {
+        usize index = static_cast<usize>(channel);
+        if (index == 0) {
+            return;
+        }
+
+        m_enabled[index] = false;
+        m_channels[index].destroy();
+    }
+
+    constexpr auto enabled(aov channel) const -> bool { return m_enabled[static_cast<usize>(channel)]; }
+
+    constexpr auto width() const -> usize { return m_width; }
+    constexpr auto height() const -> usize { return m_height; }
+
+    /// Do NOT call this with <code>aov::beauty</code>, the beauty image is not stored here
+    constexpr auto channel(aov channel) -> image& { return m_channels[static_cast<usize>(channel)]; }
+    constexpr auto channel(aov channel) const -> image const& { return m_channels[static_cast<usize>(channel)]; }
+
+private:
+    usize m_width = 0;
+    usize m_height = 0;
+
+    std::array<bool, n_aovs> m_enabled{};
+    std::array<image, n_aovs> m_channels{};
+
+    constexpr void allocate(usize index) {
+        image& channel = m_channels[index];
+        if (channel.width() != m_width || channel.height() != m_height) {
+            channel.create(m_width, m_height);
+        }
+    }
+};
+
+/// Writes the beauty image to <code>beauty</code> and the enabled AOVs to <code>buffers</code>.\n
+/// As with all adapters, this adapter should be used as a temporary and not stored anywhere.
+struct image_adapter_aov : aov_image_like {
+    constexpr image_adapter_aov(image_like& beauty, aov_buffers& buffers)
+        : m_beauty(beauty)
+        , m_buffers(buffers) {}
+
+    virtual constexpr auto width() const -> usize override { return m_beauty.width(); }
+    virtual constexpr auto height() const -> usize override { return m_beauty.height(); }
+
+    virtual constexpr void set(usize x, usize y, color c) override { m_beauty.set(x, y, c); }
+    virtual constexpr auto get(usize x, usize y) const -> color override { return m_beauty.get(x, y); }
+
+    virtual constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        m_beauty.set_tile(x, y, tile_width, tile_height, pixels);
+    }
+
+    virtual constexpr auto has_aov(aov channel) const -> bool override {
+        return channel == aov::beauty || m_buffers.enabled(channel);
+    }
+
+    virtual constexpr void set_aov_tile(aov channel, usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        m_buffers.channel(channel).set_tile(x, y, tile_width, tile_height, pixels);
+    }
+
+private:
+    image_like& m_beauty;
+    aov_buffers& m_buffers;
+};
+
+/// What a single camera sample saw at its first hit
+struct aov_sample {
+    bool hit = false;
+
+    color albedo{};
+    vec3 normal{};
+    real depth = infinity;
+    u32 material_index = 0;
+    u32 shape_index = 0;
+    u32 primitive_index = 0;
+
+    constexpr void record(intersection const& isect, color albedo_at_hit) {
+        hit = true;
+        albedo = albedo_at_hit;
+        normal = isect.get_global_normal();
+        depth = isect.t;
+        material_index = isect.material_index;
+        shape_index = isect.shape_index;
+        primitive_index = isect.primitive_index;
+    }
+};
+
+/// Combines the <code>aov_sample</code>s of a pixel.
+struct aov_accumulator {
+    constexpr void add(aov_sample const& sample) {
+        if (m_samples++ == 0) {
+            m_first = sample;
+        }
+
+        if (!sample.hit) {
+            return;
+        }
+
+        m_hits++;
+        m_albedo = m_albedo + sample.albedo;
+        m_normal = m_normal + sample.normal;
+        m_depth += sample.depth;
+    }
+
+    constexpr void write(aov_tile& out, usize x, usize y) const {
+        real inv_samples = m_samples == 0 ? 0 : 1 / static_cast<real>(m_samples);
+
+        out.set(aov::albedo, x, y, m_albedo * inv_samples);
+        out.set(aov::normal, x, y, m_normal * inv_samples);
+        out.set(aov::depth, x, y, color(m_hits == 0 ? infinity : m_depth / static_cast<real>(m_hits)));
+
+        if (m_first.hit) {
+            out.set(aov::material_index, x, y, color(static_cast<real>(m_first.material_index)));
+            out.set(aov::primitive_id, x, y, color{static_cast<real>(m_first.shape_index), static_cast<real>(m_first.primitive_index), 0});
+        } else {
+            out.set(aov::material_index, x, y, color(-1));
+            out.set(aov::primitive_id, x, y, color{-1, -1, 0});
+        }
+
+        out.set(aov::sample_count, x, y, color(static_cast<real>(m_samples)));
+    }
+
+private:
+    usize m_samples = 0;
+    usize m_hits = 0;
+
+    aov_sample m_first{};
+
+    color m_albedo{};
+    vec3 m_normal{};
+    real m_depth = 0;
+};
+
+}// namespace trc
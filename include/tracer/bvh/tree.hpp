@@ -5,7 +5,12 @@
 #include <tracer/ray.hpp>
 #include <tracer/shape/box.hpp>
 
+#include <algorithm>
+#include <array>
+#include <span>
 #include <stack>
+#include <tuple>
+#include <vector>
 
 namespace trc {
 
@@ -26,10 +31,46 @@ static constexpr auto compute_bounds(std::span<T> objects, Fn&& bound_getter) ->
 
 }// namespace detail
 
+/// The contents of a <code>generic_bvh_node</code> as plain numbers without padding, for writing trees to files
+struct bvh_node_record {
+    u64 depth;
+    std::array<u64, 2> shape_extents;
+    std::array<real, 3> center;
+    std::array<real, 3> bounds_min;
+    std::array<real, 3> bounds_max;
+    u64 is_leaf;
+};
+
 template<typename ShapeT>
 struct generic_bvh_node {
     constexpr generic_bvh_node() = default;
 
+    static constexpr auto from_record(bvh_node_record const& record) -> generic_bvh_node {
+        generic_bvh_node ret{};
+
+        ret.m_depth = static_cast<usize>(record.depth);
+        ret.m_shape_extents = {static_cast<usize>(record.shape_extents[0]), static_cast<usize>(record.shape_extents[1])};
+        ret.m_center = vec3{record.center[0], record.center[1], record.center[2]};
+        ret.m_bounds = {
+          vec3{record.bounds_min[0], record.bounds_min[1], record.bounds_min[2]},
+          vec3{record.bounds_max[0], record.bounds_max[1], record.bounds_max[2]},
+        };
+        ret.m_is_leaf = record.is_leaf != 0;
+
+        return ret;
+    }
+
+    constexpr auto to_record() const -> bvh_node_record {
+        return {
+          .depth = m_depth,
+          .shape_extents{m_shape_extents.first, m_shape_extents.second},
+          .center{m_center[0], m_center[1], m_center[2]},
+          .bounds_min{m_bounds.first[0], m_bounds.first[1], m_bounds.first[2]},
+          .bounds_max{m_bounds.second[0], m_bounds.second[1], m_bounds.second[2]},
+          .is_leaf = m_is_leaf,
+        };
+    }
+
     template<typename CenterFn, typename BoundsFn>
     constexpr void construct(std::span<const ShapeT> all_shapes, std::pair<usize, usize> shape_extents, usize depth, CenterFn&& center_fn, BoundsFn&& bounds_fn) {
         m_depth = depth;
@@ -249,6 +290,49 @@ private:
     bool m_is_leaf = true;
 };
 
+/// Builds the nodes of a tree over <code>shapes</code> the way <code>generic_bvh::construct_tree</code> does, for trees
+/// whose shapes are not kept in a vector (e.g. ones built in a file mapping). The shapes are reordered so that every
+/// subtree is a contiguous run of them.
+/// @return The nodes of a complete binary tree in breadth-first order (see <code>generic_bvh::nodes</code>) and its depth
+template<typename ShapeT, typename CenterFn, typename BoundsFn>
+constexpr auto construct_bvh_nodes(std::span<ShapeT> shapes, usize depth, CenterFn&& center_fn, BoundsFn&& bounds_fn) -> std::pair<std::vector<generic_bvh_node<ShapeT>>, usize> {
+    usize n_layers = depth + 1;
+
+    std::vector<generic_bvh_node<ShapeT>> nodes((1uz << n_layers) - 1);
+    nodes[0].construct(shapes, std::pair{0uz, shapes.size()}, 0, std::forward<CenterFn>(center_fn), std::forward<BoundsFn>(bounds_fn));
+
+    // nodes in the last layer are not split, the children of node i are at 2i + 1 and 2i + 2
+    std::stack<usize> to_split{};
+    to_split.push(0);
+
+    while (!to_split.empty()) {
+        const usize handle = to_split.top();
+        to_split.pop();
+
+        if (handle >= nodes.size() / 2) {
+            continue;
+        }
+
+        if (nodes[handle].split(shapes, nodes[handle * 2 + 1], nodes[handle * 2 + 2], std::forward<CenterFn>(center_fn), std::forward<BoundsFn>(bounds_fn))) {
+            to_split.push(handle * 2 + 2);
+            to_split.push(handle * 2 + 1);
+        }
+    }
+
+    auto last_layer_is_vacant = [&nodes] {
+        return std::all_of(nodes.begin() + static_cast<isize>(nodes.size() / 2), nodes.end(), [](generic_bvh_node<ShapeT> const& node) { return node.empty(); });
+    };
+
+    while (!nodes.empty() && last_layer_is_vacant()) {
+        --n_layers;
+        nodes.resize(nodes.size() / 2);
+    }
+
+    nodes.shrink_to_fit();
+
+    return {std::move(nodes), n_layers};
+}
+
 template<typename ShapeT>
 struct generic_bvh {
     using node_handle = usize;
@@ -297,19 +381,7 @@ struct generic_bvh {
 
     template<typename CenterFn, typename BoundsFn>
     constexpr void construct_tree(usize depth, CenterFn&& center_fn, BoundsFn&& bounds_fn) {
-        m_depth = depth + 1;
-
-        m_nodes.clear();
-        m_nodes = std::vector<node_type>((1uz << m_depth) - 1);
-        m_nodes[0].construct(m_shapes, std::pair{0uz, m_shapes.size()}, 0, std::forward<CenterFn>(center_fn), std::forward<BoundsFn>(bounds_fn));
-
-        split_at<CenterFn, BoundsFn>(0, std::forward<CenterFn>(center_fn), std::forward<BoundsFn>(bounds_fn));
-
-        while (last_layer_is_vacant() && !m_nodes.empty()) {
-            trim_last_layer();
-        }
-
-        return;
+        std::tie(m_nodes, m_depth) = construct_bvh_nodes(std::span<ShapeT>(m_shapes), depth, std::forward<CenterFn>(center_fn), std::forward<BoundsFn>(bounds_fn));
     }
 
     constexpr auto deconstruct_tree() -> std::vector<ShapeT> {
@@ -363,37 +435,25 @@ struct generic_bvh {
         m_nodes.shrink_to_fit();
     }
 
+    /// The nodes of a complete binary tree in breadth-first order, the children of node <code>i</code> are at
+    /// <code>2i + 1</code> and <code>2i + 2</code>
+    constexpr auto nodes() const -> std::span<const node_type> { return m_nodes; }
+
+    constexpr auto depth() const -> usize { return m_depth; }
+
 protected:
     std::vector<ShapeT> m_shapes{};
 
+    /// Takes over a tree that <code>construct_tree</code> built before, in the order <code>shapes</code> were left in
+    constexpr void restore_tree(std::vector<ShapeT> shapes, std::vector<node_type> nodes, usize depth) {
+        m_shapes = std::move(shapes);
+        m_nodes = std::move(nodes);
+        m_depth = depth;
+    }
+
 private:
     usize m_depth = 0;
     std::vector<node_type> m_nodes{};
-
-    template<typename CenterFn, typename BoundsFn>
-    constexpr void split_at(node_handle handle, CenterFn&& center_fn, BoundsFn&& bounds_fn) {
-        if (node_is_at_max_depth(handle)) {
-            return;
-        }
-
-        node_type& cur_node = node_at_handle(handle);
-        node_type& left_candidate = node_at_handle(left_child(handle));
-        node_type& right_candidate = node_at_handle(right_child(handle));
-
-        if (!cur_node.split(
-              m_shapes, left_candidate, right_candidate,//
-              std::forward<CenterFn>(center_fn),        //
-              std::forward<BoundsFn>(bounds_fn)         //
-
-              //[](auto const& shape) { return VARIANT_CALL(shape, center); },
-              //[](auto const& shape) { return VARIANT_CALL(shape, bounds); }
-              )) {
-            return;
-        }
-
-        split_at<CenterFn, BoundsFn>(left_child(handle), std::forward<CenterFn>(center_fn), std::forward<BoundsFn>(bounds_fn));
-        split_at<CenterFn, BoundsFn>(right_child(handle), std::forward<CenterFn>(center_fn), std::forward<BoundsFn>(bounds_fn));
-    }
 };
 
 template<typename ShapeT>
@@ -421,7 +481,13 @@ struct binary_bvh final : generic_bvh<ShapeT>, dyn_shape<ShapeT> {
         };
 
         generic_bvh<ShapeT>::traverse_candidates(ray, [&](node_type const& node) {
-            iterate(node.intersect(this->m_shapes, ray, stats, best_t, [](auto const& shape, ::trc::ray const& ray, real best_t) { return VARIANT_CALL(shape, intersect, ray, best_t); }));
+            iterate(node.intersect(this->m_shapes, ray, stats, best_t, [this](auto const& shape, ::trc::ray const& ray, real best_t) {
+                std::optional<intersection> isect = VARIANT_CALL(shape, intersect, ray, best_t);
+                if (isect) {
+                    isect->shape_index = static_cast<u32>(std::distance(this->m_shapes.data(), &shape));
+                }
+                return isect;
+            }));
         });
 
         return best_isection;
@@ -441,6 +507,10 @@ struct binary_bvh final : generic_bvh<ShapeT>, dyn_shape<ShapeT> {
     constexpr auto deconstruct_tree() -> std::vector<ShapeT> final override {
         return generic_bvh<ShapeT>::deconstruct_tree();
     }
+
+    constexpr auto shapes() const -> std::span<const ShapeT> final override {
+        return this->m_shapes;
+    }
 };
 
 }// namespace trc
@@ -13,6 +13,28 @@ struct camera {
 
     virtual constexpr auto generate_ray(vec2 xy, default_rng& gen) const -> ray = 0;
 
+    /// Generates the ray through <code>xy</code> along with the rays one pixel to the right and one pixel up as its
+    /// differentials. The offset rays are generated from copies of <code>gen</code> so that cameras drawing random
+    /// numbers (e.g. for a lens) use the same ones for all three.
+    constexpr auto generate_ray_differential(vec2 xy, default_rng& gen) const -> std::pair<ray, ray_differentials> {
+        default_rng gen_x = gen;
+        default_rng gen_y = gen;
+
+        ray ret = generate_ray(xy, gen);
+        ray ray_x = generate_ray(xy + vec2{1, 0}, gen_x);
+        ray ray_y = generate_ray(xy + vec2{0, 1}, gen_y);
+
+        return {
+          ret,
+          ray_differentials{
+            .x_origin = ray_x.origin,
+            .x_direction = ray_x.direction,
+            .y_origin = ray_y.origin,
+            .y_direction = ray_y.direction,
+          },
+        };
+    }
+
     constexpr auto dimensions() const -> vec2 { return m_dimensions; }
 
 protected:
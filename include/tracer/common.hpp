@@ -41,8 +41,16 @@ constexpr auto homogeneous_to_cartesian(vec4 vec) -> vec3 {
 
 using color = vec3;
 
+/// Rec. 709 relative luminance of a linear RGB color
+constexpr auto luminance(color c) -> real {
+    return dot(c, color{0.2126, 0.7152, 0.0722});
+}
+
 using default_rng = stf::random::xoshiro_256p;
 
+/// Side length of the square tiles rendering is scheduled in, framebuffers lay their pixels out in tiles of this size
+inline constexpr usize default_tile_extent = 32;
+
 struct pixel_statistics {
     usize bound_intersection_tests = 0;
     usize shape_intersection_tests = 0;
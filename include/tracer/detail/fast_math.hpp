@@ -0,0 +1,64 @@
+#pragma once
+
+#include <tracer/common.hpp>
+
+#include <bit>
+#include <cmath>
+
+namespace trc::detail {
+
+// Single precision approximations for the per-pixel loops of post-processing.
+// They are branch-free and avoid library calls so that the loops using them get auto-vectorised.
+
+/// Whether <code>x</code> is neither infinite nor NaN, from its bits since <code>-ffinite-math-only</code> (part of
+/// <code>-ffast-math</code>) lets the compiler fold <code>std::isfinite</code>, <code>std::isinf</code> and
+/// <code>std::isnan</code> to constants
+inline auto is_finite(real x) -> bool {
+    constexpr u64 exponent_mask = 0x7ffull << 52;
+    return (std::bit_cast<u64>(x) & exponent_mask) != exponent_mask;
+}
+
+/// 2^x for any x, clamped to the range of normal floats, with a relative error around 1e-4
+inline auto fast_exp2(float x) -> float {
+    // max(x, -126) and min(x, 126) as arithmetic, both std::max and std::fmax end up blocking vectorisation
+    float above = x + 126.f;
+    x = (above + std::abs(above)) * 0.5f - 126.f;
+    float below = 126.f - x;
+    x = 126.f - (below + std::abs(below)) * 0.5f;
+
+    // floor(x) without std::floor, which is not vectorised unless trapping math is disabled
+    i32 truncated = static_cast<i32>(x);
+    i32 whole = truncated - static_cast<i32>(static_cast<float>(truncated) > x);
+    float f = x - static_cast<float>(whole);
+
+    // 2^f for f in [0, 1)
+    float p = 1.f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+
+    u32 exponent = static_cast<u32>(whole + 127) << 23;
+    return p * std::bit_cast<float>(exponent);
+}
+
+/// e^x for x <= 0, with a relative error around 1e-4
+inline auto fast_exp_neg(float x) -> float { return fast_exp2(x * 1.44269504f); }
+
+/// log2(x) for positive x with an absolute error below 1e-6, 0 maps to -127 instead of -infinity.\n
+/// Negative inputs and NaNs give meaningless but finite results.
+inline auto fast_log2(float x) -> float {
+    u32 bits = std::bit_cast<u32>(x);
+    i32 exponent = static_cast<i32>(bits >> 23) - 127;
+    float mantissa = std::bit_cast<float>((bits & 0x007FFFFFu) | 0x3F800000u);
+
+    // [1, 2) to [sqrt(1/2), sqrt(2)) so that the series below converges quickly
+    i32 upper = static_cast<i32>(mantissa > 1.41421356f);
+    mantissa *= 1.f - 0.5f * static_cast<float>(upper);
+    exponent += upper;
+
+    // ln(m) = 2 atanh((m - 1) / (m + 1)), |t| < 0.172
+    float t = (mantissa - 1.f) / (mantissa + 1.f);
+    float t2 = t * t;
+    float ln = 2.f * t * (1.f + t2 * (1.f / 3.f + t2 * (1.f / 5.f + t2 * (1.f / 7.f))));
+
+    return static_cast<float>(exponent) + ln * 1.44269504f;
+}
+
+}// namespace trc::detail
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <tracer/common.hpp>
+
+#include <array>
+#include <bit>
+#include <cstring>
+#include <span>
+
+namespace trc::detail {
+
+/// The finalizer of murmur3, spreads every input bit over the whole output
+constexpr auto mix_bits(u64 value) -> u64 {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+
+    return value;
+}
+
+/// A fast non-cryptographic hash for detecting changed files, not for adversarial inputs.\n
+/// Four independent lanes consume 32 bytes per step so that the multiplications of consecutive words overlap.
+/// @param seed Chains hashes, pass the hash of the preceding data
+inline auto hash_bytes(std::span<const std::byte> data, u64 seed = 0) -> u64 {
+    constexpr u64 prime_0 = 0x9e3779b185ebca87ull;
+    constexpr u64 prime_1 = 0xc2b2ae3d27d4eb4full;
+
+    auto round = [](u64 lane, u64 word) { return std::rotl(lane + word * prime_1, 31) * prime_0; };
+
+    auto load = [](const std::byte* ptr) {
+        u64 ret;
+        std::memcpy(&ret, ptr, sizeof(ret));
+        return ret;
+    };
+
+    std::array<u64, 4> lanes{seed + prime_0 + prime_1, seed + prime_1, seed, seed - prime_0};
+
+    usize position = 0;
+    for (; position + 32 <= data.size(); position += 32) {
+        for (usize lane = 0; lane < 4; lane++) {
+            lanes[lane] = round(lanes[lane], load(data.data() + position + lane * 8));
+        }
+    }
+
+    u64 ret = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+
+    for (; position + 8 <= data.size(); position += 8) {
+        ret = round(ret, load(data.data() + position));
+    }
+
+    for (; position < data.size(); position++) {
+        ret = round(ret, static_cast<u64>(data[position]));
+    }
+
+    return mix_bits(ret ^ static_cast<u64>(data.size()));
+}
+
+}// namespace trc::detail
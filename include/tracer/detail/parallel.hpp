@@ -0,0 +1,92 @@
+#pragma once
+
+#include <tracer/common.hpp>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace trc::detail {
+
+inline auto default_thread_count() -> usize {
+    return std::max<usize>(std::thread::hardware_concurrency(), 1);
+}
+
+/// Splits [0, n) into contiguous chunks and calls <code>fn(begin, end)</code> for each of them on its own thread.\n
+/// The calling thread processes the last chunk. Returns after all chunks are processed.
+/// @param n_threads The number of chunks/threads, 0 means <code>default_thread_count()</code>
+template<typename Fn>
+void parallel_for(usize n, usize n_threads, Fn&& fn) {
+    if (n_threads == 0) {
+        n_threads = default_thread_count();
+    }
+
+    n_threads = std::min(n_threads, n);
+
+    if (n_threads <= 1) {
+        if (n != 0) {
+            std::invoke(fn, usize(0), n);
+        }
+        return;
+    }
+
+    std::vector<std::thread> workers{};
+    workers.reserve(n_threads - 1);
+
+    usize chunk_size = n / n_threads;
+    usize remainder = n % n_threads;
+
+    usize begin = 0;
+    for (usize i = 0; i < n_threads; i++) {
+        usize end = begin + chunk_size + (i < remainder);
+
+        if (i + 1 == n_threads) {
+            std::invoke(fn, begin, end);
+        } else {
+            workers.emplace_back([&fn, begin, end] { std::invoke(fn, begin, end); });
+        }
+
+        begin = end;
+    }
+
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
+
+/// Calls <code>fn(i)</code> for every <code>i</code> in [0, n) on up to <code>n_threads</code> threads, each taking the next
+/// index when it is done with the previous one.\n
+/// For items of very different cost, which static chunks would leave some threads waiting for. Returns after all items are
+/// processed, the calling thread works on them too.
+/// @param n_threads 0 means <code>default_thread_count()</code>
+template<typename Fn>
+void parallel_for_each_index(usize n, usize n_threads, Fn&& fn) {
+    if (n_threads == 0) {
+        n_threads = default_thread_count();
+    }
+
+    n_threads = std::min(n_threads, n);
+
+    std::atomic<usize> next_index = 0;
+    auto work = [&fn, &next_index, n] {
+        for (usize i; (i = next_index.fetch_add(1, std::memory_order::relaxed)) < n;) {
+            std::invoke(fn, i);
+        }
+    };
+
+    std::vector<std::thread> workers{};
+    workers.reserve(n_threads > 0 ? n_threads - 1 : 0);
+
+    for (usize i = 1; i < n_threads; i++) {
+        workers.emplace_back(work);
+    }
+
+    work();
+
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
+
+}// namespace trc::detail
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/detail/fast_math.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace trc::detail {
+
+// The 8-bit encode shared by the image adapters and tone mapping, which builds on top of it.
+
+/// <code>srgb_oetf</code> in single precision with a relative error around 1e-4
+inline auto srgb_oetf_fast(float v) -> float {
+    constexpr float cutoff = 0.0031308f;
+
+    // the curve is evaluated at max(v, cutoff) and the segments are picked with a bit mask, GCC turns a select between
+    // the two into a branch and gives up on vectorising
+    float above = v - cutoff;
+    float curve_input = (above + std::abs(above)) * 0.5f + cutoff;
+
+    float higher = 1.055f * fast_exp2(fast_log2(curve_input) * (1.f / 2.4f)) - 0.055f;
+    float lower = v * 12.92f;
+
+    u32 mask = 0u - static_cast<u32>(v < cutoff);
+    return std::bit_cast<float>((std::bit_cast<u32>(lower) & mask) | (std::bit_cast<u32>(higher) & ~mask));
+}
+
+/// Applies the sRGB transfer function to <code>n_values</code> values in [0, 1] in place
+inline void srgb_encode_block(float* __restrict values, usize n_values) {
+    for (usize i = 0; i < n_values; i++) {
+        values[i] = srgb_oetf_fast(values[i]);
+    }
+}
+
+/// Quantises a block of <code>n_pixels</code> RGB values in [0, 1] to 8 bits with rounding to the nearest integer and
+/// interleaves them into RGBA with an alpha of 255
+inline void store_rgba8(const float* __restrict block, usize n_pixels, u8* __restrict rgba) {
+    for (usize i = 0; i < n_pixels; i++) {
+        for (usize c = 0; c < 3; c++) {
+            rgba[i * 4 + c] = static_cast<u8>(block[i * 3 + c] * 255.f + 0.5f);
+        }
+
+        rgba[i * 4 + 3] = 255;
+    }
+}
+
+/// Pixels are converted in blocks of this many so that the per-channel loops run over contiguous arrays
+inline constexpr usize encode_block_pixels = 256;
+
+/// Clamps the flat channel array of <code>n_pixels</code> colors to [0, 1], optionally applies the sRGB transfer
+/// function and quantises the result to 8 bits, NaNs end up as 255
+inline void encode_rgba8(const real* rgb, usize n_pixels, u8* rgba, bool srgb) {
+    float block[encode_block_pixels * 3];
+
+    for (usize begin = 0; begin < n_pixels; begin += encode_block_pixels) {
+        const usize n = std::min(encode_block_pixels, n_pixels - begin);
+        const real* source = rgb + begin * 3;
+
+        for (usize i = 0; i < n * 3; i++) {
+            float v = static_cast<float>(source[i]);
+
+            // NaNs fail the first comparison
+            v = v <= 1.f ? v : 1.f;
+            v = v >= 0.f ? v : 0.f;
+
+            block[i] = v;
+        }
+
+        if (srgb) {
+            srgb_encode_block(block, n * 3);
+        }
+
+        store_rgba8(block, n, rgba + begin * 4);
+    }
+}
+
+}// namespace trc::detail
@@ -2,139 +2,281 @@
 
 namespace trc {
 
+namespace detail {
+
+/// Linear values of all 8-bit sRGB encoded values
+inline auto srgb_decode_table() -> std::array<float, 256> const& {
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> ret{};
+
+        for (usize i = 0; i < ret.size(); i++) {
+            ret[i] = static_cast<float>(srgb_eotf(color(static_cast<real>(i) / 255))[0]);
+        }
+
+        return ret;
+    }();
+
+    return table;
+}
+
+/// Weights of the four taps of the cubic through them at <code>t</code> in [0, 1) between the middle two
+constexpr auto cubic_weights(float t) -> std::array<float, 4> {
+    const float t2 = t * t;
+    const float t3 = t2 * t;
+
+    return {
+      -t3 + 2 * t2 - t,
+      t3 - 2 * t2 + 1,
+      -t3 + t2 + t,
+      t3 - t2,
+    };
+}
+
+}// namespace detail
+
+constexpr texture::level::level(usize width, usize height)
+    : width(width)
+    , height(height)
+    , blocks_x((width + block_extent - 1) / block_extent) {
+    const usize blocks_y = (height + block_extent - 1) / block_extent;
+    texels.assign(blocks_x * blocks_y * block_extent * block_extent, texel{});
+}
+
+constexpr auto texture::level::index(usize x, usize y) const -> usize {
+    const usize block = (y / block_extent) * blocks_x + x / block_extent;
+    return block * block_extent * block_extent + (y % block_extent) * block_extent + x % block_extent;
+}
+
 template<typename Allocator>
 constexpr void texture::create(stf::qoi::image<Allocator>&& image, wrapping_mode wrapping_mode, scaling_method scaling_method) {
-    m_image = std::move(image);
     m_wrapping_mode = wrapping_mode;
     m_scaling_method = scaling_method;
 
-    m_width = static_cast<real>(m_image.width());
-    m_height = static_cast<real>(m_image.width());
-}
+    m_levels.clear();
 
-auto texture::from_file(std::string_view filename, wrapping_mode wrapping_mode, scaling_method scaling_method) -> stf::expected<void, std::string_view> {
-    stf::qoi::image<> image_copy = m_image;
+    if (image.empty()) {
+        compute_average();
+        return;
+    }
+
+    level& base = m_levels.emplace_back(image.width(), image.height());
 
-    stf::scope::scope_exit guard{[&] {
-        m_image = std::move(image_copy);
-    }};
+    std::array<float, 256> linear_table{};
+    for (usize i = 0; i < linear_table.size(); i++) {
+        linear_table[i] = static_cast<float>(i) / 255.f;
+    }
 
-    TRYX(m_image.from_file(filename));
+    // alpha is always linear
+    std::array<float, 256> const& rgb_table = image.get_color_space() == stf::qoi::color_space::srgb_linear_alpha ? detail::srgb_decode_table() : linear_table;
 
-    guard.release();
+    for (usize y = 0; y < base.height; y++) {
+        for (usize x = 0; x < base.width; x++) {
+            stf::qoi::color qoi_color = image.at(static_cast<u32>(x), static_cast<u32>(y));
 
-    m_wrapping_mode = wrapping_mode;
-    m_scaling_method = scaling_method;
+            base.at(x, y) = texel{{
+              rgb_table[qoi_color.r],
+              rgb_table[qoi_color.g],
+              rgb_table[qoi_color.b],
+              linear_table[qoi_color.a],
+            }};
+        }
+    }
+
+    build_pyramid();
+    compute_average();
+}
+
+auto texture::from_file(std::string_view filename, wrapping_mode wrapping_mode, scaling_method scaling_method) -> stf::expected<void, std::string_view> {
+    stf::qoi::image<> image{};
 
-    m_width = static_cast<real>(m_image.width());
-    m_height = static_cast<real>(m_image.width());
+    TRYX(image.from_file(filename));
+
+    create(std::move(image), wrapping_mode, scaling_method);
 
     return {};
 }
 
-constexpr auto texture::sample(vec2 uv) const -> color {
+constexpr void texture::compute_average() {
+    m_average = color{};
+
     if (empty()) {
-        return color{};
+        return;
     }
 
-    mat2x2 dims{static_cast<real>(m_image.width() - 1), 0, 0, static_cast<real>(m_image.height() - 1)};
-    vec2 scaled = dims * uv;
+    level const& base = m_levels.front();
+
+    for (usize y = 0; y < base.height; y++) {
+        for (usize x = 0; x < base.width; x++) {
+            texel const& t = base.at(x, y);
+            m_average = m_average + color{t.channels[0], t.channels[1], t.channels[2]};
+        }
+    }
+
+    m_average = m_average / (static_cast<real>(base.width) * static_cast<real>(base.height));
+}
+
+constexpr void texture::build_pyramid() {
+    while (m_levels.back().width > 1 || m_levels.back().height > 1) {
+        const usize width = std::max<usize>(m_levels.back().width / 2, 1);
+        const usize height = std::max<usize>(m_levels.back().height / 2, 1);
+
+        // may reallocate m_levels
+        level next(width, height);
+        level const& previous = m_levels.back();
+
+        for (usize y = 0; y < height; y++) {
+            // the last row and column of odd sized levels only take part through the clamping here
+            const std::array<usize, 2> rows{2 * y, std::min(2 * y + 1, previous.height - 1)};
+
+            for (usize x = 0; x < width; x++) {
+                const std::array<usize, 2> columns{2 * x, std::min(2 * x + 1, previous.width - 1)};
+
+                texel& out = next.at(x, y);
+
+                for (usize row : rows) {
+                    for (usize column : columns) {
+                        texel const& in = previous.at(column, row);
+
+                        for (usize c = 0; c < 4; c++) {
+                            out.channels[c] += in.channels[c] * 0.25f;
+                        }
+                    }
+                }
+            }
+        }
+
+        m_levels.emplace_back(std::move(next));
+    }
+}
+
+constexpr auto texture::wrap(i64 coord, usize extent) const -> usize {
+    const i64 signed_extent = static_cast<i64>(extent);
+
+    if (m_wrapping_mode == wrapping_mode::repeat) {
+        // the bicubic taps reach two texels past the texture, more than a period on levels this narrow, e.g. the top of
+        // the pyramid or the last levels of a non-square texture
+        if (signed_extent < 4) [[unlikely]] {
+            coord %= signed_extent;
+            return static_cast<usize>(coord < 0 ? coord + signed_extent : coord);
+        }
+
+        // sample_level reduces coordinates into the texture first, the taps are within a period of it
+        coord += coord < 0 ? signed_extent : 0;
+        coord -= coord >= signed_extent ? signed_extent : 0;
+        return static_cast<usize>(coord);
+    }
+
+    return static_cast<usize>(std::clamp<i64>(coord, 0, signed_extent - 1));
+}
+
+template<usize N>
+constexpr auto texture::filter(level const& level, i64 x, i64 y, std::array<float, N> const& weights_x, std::array<float, N> const& weights_y) const -> color {
+    std::array<usize, N> columns{};
+    std::array<usize, N> rows{};
+
+    for (usize i = 0; i < N; i++) {
+        columns[i] = wrap(x + static_cast<i64>(i), level.width);
+        rows[i] = wrap(y + static_cast<i64>(i), level.height);
+    }
+
+    // whole texels are accumulated at once, the channel loops become single vector operations
+    std::array<float, 4> sum{};
+
+    for (usize i = 0; i < N; i++) {
+        std::array<float, 4> row_sum{};
+
+        for (usize j = 0; j < N; j++) {
+            texel const& t = level.at(columns[j], rows[i]);
+
+            for (usize c = 0; c < 4; c++) {
+                row_sum[c] += t.channels[c] * weights_x[j];
+            }
+        }
+
+        for (usize c = 0; c < 4; c++) {
+            sum[c] += row_sum[c] * weights_y[i];
+        }
+    }
+
+    return color{sum[0], sum[1], sum[2]};
+}
+
+constexpr auto texture::sample_level(level const& level, vec2 uv) const -> color {
+    // texel centers lie at half-integer multiples of the texel size, so that the uv square spans exactly the texture
+    // and repeating it has a period of exactly one texture
+    vec2 scaled{uv[0] * static_cast<real>(level.width) - real(0.5), uv[1] * static_cast<real>(level.height) - real(0.5)};
+
+    // keeps the coordinates within range of the integer conversions below without changing the result, beyond one
+    // texel past the edges every filter tap of an extending texture lands on the edge
+    for (usize i = 0; i < 2; i++) {
+        const real extent = static_cast<real>(i == 0 ? level.width : level.height);
+
+        if (m_wrapping_mode == wrapping_mode::repeat) {
+            scaled[i] -= std::floor(scaled[i] / extent) * extent;
+        } else {
+            scaled[i] = std::clamp(scaled[i], real(-1), extent);
+        }
+    }
+
+    const real x_floor = std::floor(scaled[0]);
+    const real y_floor = std::floor(scaled[1]);
+
+    const i64 x = static_cast<i64>(x_floor);
+    const i64 y = static_cast<i64>(y_floor);
+
+    const float u_param = static_cast<float>(scaled[0] - x_floor);
+    const float v_param = static_cast<float>(scaled[1] - y_floor);
 
     switch (m_scaling_method) {
-        case scaling_method::nearest:
-            return sample_nearest(scaled);
-        case scaling_method::bilinear: {
-            vec3 uv_00 = {std::floor(scaled[0]), std::floor(scaled[1])};
-            vec3 uv_11 = {std::ceil(scaled[0]), std::ceil(scaled[1])};
-
-            real u_param = scaled[0] - uv_00[0];
-            real v_param = scaled[1] - uv_00[1];
-
-            color q_00 = sample_nearest({uv_00[0], uv_00[1]});
-            color q_01 = sample_nearest({uv_11[0], uv_00[1]});
-            color q_10 = sample_nearest({uv_00[0], uv_11[1]});
-            color q_11 = sample_nearest({uv_11[0], uv_11[1]});
-
-            color u_interp = q_00 * (1 - u_param) + q_01 * u_param;
-            color v_interp = q_10 * (1 - u_param) + q_11 * u_param;
-
-            return u_interp * (1 - v_param) + v_interp * v_param;
-        };
-        case scaling_method::bicubic: {
-            vec3 uv_00 = {std::floor(scaled[0]), std::floor(scaled[1])};
-            vec3 uv_11 = {std::ceil(scaled[0]), std::ceil(scaled[1])};
-
-            real u_param = scaled[0] - uv_00[0];
-            real v_param = scaled[1] - uv_00[1];
-
-            color q_00 = sample_nearest({uv_00[0] - 1, uv_00[1] - 1});
-            color q_01 = sample_nearest({uv_00[0], uv_00[1] - 1});
-            color q_02 = sample_nearest({uv_11[0], uv_00[1] - 1});
-            color q_03 = sample_nearest({uv_11[0] + 1, uv_00[1] - 1});
-
-            color q_10 = sample_nearest({uv_00[0] - 1, uv_00[1]});
-            color q_11 = sample_nearest({uv_00[0], uv_00[1]});
-            color q_12 = sample_nearest({uv_11[0], uv_00[1]});
-            color q_13 = sample_nearest({uv_11[0] + 1, uv_00[1]});
-
-            color q_20 = sample_nearest({uv_00[0] - 1, uv_11[1]});
-            color q_21 = sample_nearest({uv_00[0], uv_11[1]});
-            color q_22 = sample_nearest({uv_11[0], uv_11[1]});
-            color q_23 = sample_nearest({uv_11[0] + 1, uv_11[1]});
-
-            color q_30 = sample_nearest({uv_00[0] - 1, uv_11[1] + 1});
-            color q_31 = sample_nearest({uv_00[0], uv_11[1] + 1});
-            color q_32 = sample_nearest({uv_11[0], uv_11[1] + 1});
-            color q_33 = sample_nearest({uv_11[0] + 1, uv_11[1] + 1});
-
-            auto cerp = [](color x0, color x1, color x2, color x3, real t) -> color {
-                color a = (x3 - x2) - (x0 - x1);
-                color b = (x0 - x1) - a;
-                color c = x2 - x0;
-                color d = x1;
-
-                real t2 = t * t;
-                real t3 = t2 * t;
-
-                return a * t3 + b * t2 + c * t + d;
-            };
-
-            color ui_0 = cerp(q_00, q_01, q_02, q_03, u_param);
-            color ui_1 = cerp(q_10, q_11, q_12, q_13, u_param);
-            color ui_2 = cerp(q_20, q_21, q_22, q_23, u_param);
-            color ui_3 = cerp(q_30, q_31, q_32, q_33, u_param);
-
-            return cerp(ui_0, ui_1, ui_2, ui_3, v_param);
-        };
+        case scaling_method::nearest: {
+            // the texel whose center is closest, which lies up to a period away in wrapped coordinates
+            const i64 nearest_x = x + (u_param >= 0.5f ? 1 : 0);
+            const i64 nearest_y = y + (v_param >= 0.5f ? 1 : 0);
+
+            texel const& t = level.at(wrap(nearest_x, level.width), wrap(nearest_y, level.height));
+            return color{t.channels[0], t.channels[1], t.channels[2]};
+        }
+        case scaling_method::bilinear:
+            return filter<2>(level, x, y, {1 - u_param, u_param}, {1 - v_param, v_param});
+        case scaling_method::bicubic:
+            return filter<4>(level, x - 1, y - 1, detail::cubic_weights(u_param), detail::cubic_weights(v_param));
     }
 
-    return sample_nearest(dims * uv);
+    std::unreachable();
 }
 
-constexpr auto texture::sample_nearest(vec2 xy) const -> color {
-    switch (m_wrapping_mode) {
-        case wrapping_mode::extend:
-            xy[0] = std::clamp(xy[0], real(0), m_width - 1);
-            xy[1] = std::clamp(xy[1], real(0), m_height - 1);
-            break;
+constexpr auto texture::sample(vec2 uv, vec2 duvdx, vec2 duvdy) const -> color {
+    if (empty()) {
+        return color{};
+    }
+
+    level const& base = m_levels.front();
 
-        case wrapping_mode::repeat:
-            xy[0] = std::fabs(std::fmod(xy[0], m_width - 1));
-            xy[1] = std::fabs(std::fmod(xy[1], m_height - 1));
-            break;
+    // the longer axis of the footprint, in texels of the full resolution level
+    const vec2 base_extent{static_cast<real>(base.width), static_cast<real>(base.height)};
+    const real footprint = std::max(abs(duvdx * base_extent), abs(duvdy * base_extent));
 
-        default:
-            std::unreachable();
+    // also catches NaNs
+    if (!(footprint > 1) || m_levels.size() == 1) {
+        return sample_level(base, uv);
     }
 
-    stf::qoi::color qoi_albedo = m_image.at(static_cast<u32>(xy[0]), static_cast<u32>(xy[1]));
+    const real lod = std::min(std::log2(footprint), static_cast<real>(m_levels.size() - 1));
 
-    return color{
-      static_cast<real>(qoi_albedo.r) / 255,
-      static_cast<real>(qoi_albedo.g) / 255,
-      static_cast<real>(qoi_albedo.b) / 255,
-      static_cast<real>(qoi_albedo.a) / 255,
-    };
+    if (m_scaling_method == scaling_method::nearest) {
+        return sample_level(m_levels[static_cast<usize>(lod + real(0.5))], uv);
+    }
+
+    const usize finer = static_cast<usize>(lod);
+    const real blend = lod - static_cast<real>(finer);
+
+    color ret = sample_level(m_levels[finer], uv);
+
+    if (finer + 1 == m_levels.size() || blend == 0) {
+        return ret;
+    }
+
+    return ret * (1 - blend) + sample_level(m_levels[finer + 1], uv) * blend;
 }
 
 }
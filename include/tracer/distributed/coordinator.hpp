@@ -0,0 +1,367 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+#include <tracer/distributed/protocol.hpp>
+#include <tracer/distributed/socket.hpp>
+#include <tracer/image.hpp>
+#include <tracer/integrator/detail/task_integrator.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <poll.h>
+
+namespace trc::distributed {
+
+struct coordinator_settings {
+    std::pair<usize, usize> tile_size{default_tile_extent, default_tile_extent};
+
+    /// Tiles outstanding for longer than this are also handed to idle workers, whichever result arrives first wins
+    std::chrono::milliseconds tile_timeout = std::chrono::seconds(30);
+
+    /// Rendering fails if no worker is connected for this long
+    std::chrono::milliseconds idle_timeout = std::chrono::seconds(60);
+
+    /// Fail as soon as a worker cannot prepare the job instead of waiting for others, for when all workers are alike
+    bool fail_on_worker_error = false;
+};
+
+struct coordinator_stats {
+    usize workers_seen = 0;
+    usize tiles = 0;
+    /// Tiles handed out again after a worker disconnected or took too long
+    usize reassigned = 0;
+    /// Results for tiles that were already done
+    usize duplicates = 0;
+};
+
+/// Splits frames into tiles and hands them out to workers connecting at any time, see <code>run_worker</code>.\n
+/// Workers receive an opaque job description along with the seed and load the scene themselves.
+/// As pixels are seeded individually, the result is identical to that of a single process render with the same seed.
+struct coordinator {
+    static auto listen(std::string_view address) -> stf::expected<coordinator, std::string> {
+        auto res = socket::listen(address);
+        if (!res) {
+            return stf::unexpected{res.error()};
+        }
+
+        coordinator ret{};
+        ret.m_listener = std::move(*res);
+        return ret;
+    }
+
+    /// The port a TCP coordinator is listening on, useful when it was asked to pick one
+    auto port() const -> std::optional<u16> { return m_listener.port(); }
+
+    /// Blocks until every pixel of <code>out</code> is written.\n
+    /// Workers are released once the frame is done, they have to connect again for the next one.
+    auto render(image_like& out, std::string_view description, u64 seed, coordinator_settings settings = {}) -> stf::expected<coordinator_stats, std::string> {
+        using clock = std::chrono::steady_clock;
+
+        const usize width = out.width();
+        const usize height = out.height();
+
+        trc::detail::default_task_generator generator{settings.tile_size};
+        generator.set_dimensions(width, height);
+
+        struct tile_state {
+            trc::detail::default_task task;
+            bool done = false;
+            clock::time_point issued{};
+            /// Workers this tile is currently assigned to
+            std::vector<u64> holders{};
+        };
+
+        std::vector<tile_state> tiles(generator.n_tasks());
+        std::deque<u32> pending{};
+
+        for (usize i = 0; i < tiles.size(); i++) {
+            tiles[i].task = generator(i);
+            pending.push_back(static_cast<u32>(i));
+        }
+
+        struct connection {
+            socket sock;
+            frame_buffer buffer{};
+            u32 capacity = 0;
+            bool ready = false;
+            std::vector<u32> outstanding{};
+        };
+
+        std::map<u64, connection> workers{};
+        u64 next_worker_id = 0;
+
+        coordinator_stats stats{.tiles = tiles.size()};
+        usize n_done = 0;
+
+        clock::time_point last_worker_seen = clock::now();
+        std::string last_failure{};
+        bool worker_failed = false;
+
+        auto job_frame = message_writer(message_type::job)
+                           .put_u64(seed)
+                           .put_u32(static_cast<u32>(width))
+                           .put_u32(static_cast<u32>(height))
+                           .put_string(description);
+
+        auto drop = [&](u64 id) {
+            auto it = workers.find(id);
+            if (it == workers.end()) {
+                return;
+            }
+
+            for (u32 tile_id: it->second.outstanding) {
+                tile_state& tile = tiles[tile_id];
+                std::erase(tile.holders, id);
+
+                if (!tile.done && tile.holders.empty()) {
+                    pending.push_front(tile_id);
+                    stats.reassigned++;
+                }
+            }
+
+            spdlog::info("worker #{} left with {} tiles outstanding", id, it->second.outstanding.size());
+            workers.erase(it);
+        };
+
+        // returns false if the connection is to be dropped
+        auto handle_frame = [&](u64 id, connection& worker, frame const& received) -> bool {
+            message_reader reader = received.reader();
+
+            switch (received.type) {
+                case message_type::hello: {
+                    auto capacity = reader.get_u32();
+                    if (!capacity) {
+                        return false;
+                    }
+
+                    worker.capacity = std::max<u32>(*capacity, 1);
+                    return worker.sock.send_all(job_frame.finish());
+                }
+
+                case message_type::ready:
+                    worker.ready = true;
+                    spdlog::info("worker #{} is ready for {} tiles at a time", id, worker.capacity);
+                    return true;
+
+                case message_type::failed:
+                    last_failure = reader.get_string().value_or("");
+                    spdlog::warn("worker #{} could not prepare: {}", id, last_failure);
+                    worker_failed = true;
+                    return false;
+
+                case message_type::result: {
+                    auto tile_id = reader.get_u32();
+                    auto x = reader.get_u32();
+                    auto y = reader.get_u32();
+                    auto span_x = reader.get_u32();
+                    auto span_y = reader.get_u32();
+
+                    if (!tile_id || !x || !y || !span_x || !span_y || *tile_id >= tiles.size()) {
+                        return false;
+                    }
+
+                    tile_state& tile = tiles[*tile_id];
+                    const bool assigned = std::ranges::find(worker.outstanding, *tile_id) != worker.outstanding.end();
+
+                    // workers render the span of the task clamped to the frame, see tile_image::reset
+                    const usize expected_span_x = std::min(tile.task.span.first, width - std::min(tile.task.xy_start.first, width));
+                    const usize expected_span_y = std::min(tile.task.span.second, height - std::min(tile.task.xy_start.second, height));
+
+                    if (!assigned ||//
+                        *x != tile.task.xy_start.first || *y != tile.task.xy_start.second ||
+                        *span_x != expected_span_x || *span_y != expected_span_y ||
+                        reader.remaining() != static_cast<usize>(*span_x) * *span_y * 3 * sizeof(double)) {
+                        // dropping the worker hands the tile out again
+                        spdlog::warn("worker #{} sent a result that does not match tile {}", id, *tile_id);
+                        return false;
+                    }
+
+                    std::erase(worker.outstanding, *tile_id);
+                    std::erase(tile.holders, id);
+
+                    if (tile.done) {
+                        stats.duplicates++;
+                        return true;
+                    }
+
+                    std::vector<color> pixels(static_cast<usize>(*span_x) * *span_y);
+                    for (color& c: pixels) {
+                        for (usize i = 0; i < 3; i++) {
+                            c[i] = static_cast<real>(*reader.get_f64());
+                        }
+                    }
+
+                    out.set_tile(*x, *y, *span_x, *span_y, pixels);
+
+                    tile.done = true;
+                    n_done++;
+
+                    return true;
+                }
+
+                default:
+                    return false;
+            }
+        };
+
+        auto send_task = [&](u64 id, connection& worker, u32 tile_id) -> bool {
+            tile_state& tile = tiles[tile_id];
+            tile.holders.push_back(id);
+            tile.issued = clock::now();
+            worker.outstanding.push_back(tile_id);
+
+            auto task_frame = message_writer(message_type::task)
+                                .put_u32(tile_id)
+                                .put_u32(static_cast<u32>(tile.task.xy_start.first))
+                                .put_u32(static_cast<u32>(tile.task.xy_start.second))
+                                .put_u32(static_cast<u32>(tile.task.span.first))
+                                .put_u32(static_cast<u32>(tile.task.span.second));
+
+            return worker.sock.send_all(task_frame.finish());
+        };
+
+        // the oldest tile that has been out for too long and that the given worker is not working on already
+        auto find_straggler = [&](u64 id) -> std::optional<u32> {
+            clock::time_point deadline = clock::now() - settings.tile_timeout;
+            std::optional<u32> ret = std::nullopt;
+
+            for (usize i = 0; i < tiles.size(); i++) {
+                tile_state const& tile = tiles[i];
+                if (tile.done || tile.holders.empty() || tile.issued > deadline || std::ranges::find(tile.holders, id) != tile.holders.end()) {
+                    continue;
+                }
+
+                if (!ret || tile.issued < tiles[*ret].issued) {
+                    ret = static_cast<u32>(i);
+                }
+            }
+
+            return ret;
+        };
+
+        auto schedule = [&] {
+            std::vector<u64> to_drop{};
+
+            for (auto& [id, worker]: workers) {
+                while (worker.ready && worker.outstanding.size() < worker.capacity) {
+                    std::optional<u32> tile_id = std::nullopt;
+
+                    while (!pending.empty() && !tile_id) {
+                        u32 candidate = pending.front();
+                        pending.pop_front();
+
+                        if (!tiles[candidate].done) {
+                            tile_id = candidate;
+                        }
+                    }
+
+                    if (!tile_id) {
+                        tile_id = find_straggler(id);
+                        if (!tile_id) {
+                            break;
+                        }
+
+                        stats.reassigned++;
+                    }
+
+                    if (!send_task(id, worker, *tile_id)) {
+                        to_drop.push_back(id);
+                        break;
+                    }
+                }
+            }
+
+            for (u64 id: to_drop) {
+                drop(id);
+            }
+        };
+
+        while (n_done < tiles.size()) {
+            std::vector<pollfd> fds{};
+            std::vector<u64> fd_owners{};
+
+            fds.push_back(pollfd{.fd = m_listener.fd(), .events = POLLIN, .revents = 0});
+            for (auto const& [id, worker]: workers) {
+                fds.push_back(pollfd{.fd = worker.sock.fd(), .events = POLLIN, .revents = 0});
+                fd_owners.push_back(id);
+            }
+
+            // wakes up periodically for the timeouts
+            if (::poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) {
+                return stf::unexpected{fmt::format("poll failed: {}", std::strerror(errno))};
+            }
+
+            if ((fds[0].revents & POLLIN) != 0) {
+                if (auto res = m_listener.accept(); res) {
+                    u64 id = next_worker_id++;
+                    workers.emplace(id, connection{.sock = std::move(*res)});
+                    stats.workers_seen++;
+
+                    spdlog::info("worker #{} connected", id);
+                }
+            }
+
+            for (usize i = 1; i < fds.size(); i++) {
+                if (fds[i].revents == 0) {
+                    continue;
+                }
+
+                u64 id = fd_owners[i - 1];
+                connection& worker = workers.at(id);
+
+                bool keep = worker.buffer.fill_from(worker.sock);
+                bool malformed = false;
+
+                while (keep) {
+                    std::optional<frame> received = worker.buffer.next(malformed);
+                    if (!received) {
+                        keep = !malformed;
+                        break;
+                    }
+
+                    keep = handle_frame(id, worker, *received);
+                }
+
+                if (!keep) {
+                    drop(id);
+                }
+            }
+
+            if (worker_failed && settings.fail_on_worker_error) {
+                return stf::unexpected{fmt::format("a worker failed: {}", last_failure)};
+            }
+
+            schedule();
+
+            if (!workers.empty()) {
+                last_worker_seen = clock::now();
+            } else if (clock::now() - last_worker_seen > settings.idle_timeout) {
+                return stf::unexpected{last_failure.empty()//
+                                         ? std::string("no workers are connected")
+                                         : fmt::format("no workers are connected, the last one failed with: {}", last_failure)};
+            }
+        }
+
+        auto done_frame = message_writer(message_type::done);
+        for (auto& [id, worker]: workers) {
+            worker.sock.send_all(done_frame.finish());
+        }
+
+        return stats;
+    }
+
+private:
+    socket m_listener{};
+};
+
+}// namespace trc::distributed
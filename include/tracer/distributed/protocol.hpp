@@ -0,0 +1,230 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/distributed/socket.hpp>
+
+#include <array>
+#include <bit>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace trc::distributed {
+
+// Frames are a little-endian u32 payload length, a u8 message type and the payload.
+//
+// worker      -> coordinator: hello{u32 capacity}
+// coordinator -> worker:      job{u64 seed, u32 width, u32 height, string description}
+// worker      -> coordinator: ready{} or failed{string reason}
+// coordinator -> worker:      task{u32 id, u32 x, u32 y, u32 span_x, u32 span_y}, any number of times
+// worker      -> coordinator: result{u32 id, u32 x, u32 y, u32 span_x, u32 span_y, f64 rgb[span_x * span_y]}
+// coordinator -> worker:      done{}
+//
+// Strings are a u32 length followed by the characters.
+
+enum class message_type : u8 {
+    hello = 0,
+    job,
+    ready,
+    failed,
+    task,
+    result,
+    done,
+};
+
+inline constexpr u32 protocol_max_frame_size = 1u << 30;
+
+inline constexpr usize frame_header_size = 5;
+
+struct message_writer {
+    message_writer(message_type type) {
+        m_data.resize(frame_header_size);
+        m_data[4] = static_cast<std::byte>(type);
+    }
+
+    auto put_u8(u8 v) -> message_writer& {
+        m_data.push_back(static_cast<std::byte>(v));
+        return *this;
+    }
+
+    auto put_u32(u32 v) -> message_writer& { return put_le(v, 4); }
+    auto put_u64(u64 v) -> message_writer& { return put_le(v, 8); }
+    auto put_f64(double v) -> message_writer& { return put_le(std::bit_cast<u64>(v), 8); }
+
+    auto put_string(std::string_view str) -> message_writer& {
+        put_u32(static_cast<u32>(str.size()));
+        for (char c: str) {
+            m_data.push_back(static_cast<std::byte>(c));
+        }
+
+        return *this;
+    }
+
+    void reserve(usize payload_size) { m_data.reserve(frame_header_size + payload_size); }
+
+    /// Fills in the length and returns the whole frame
+    auto finish() -> std::span<const std::byte> {
+        u32 length = static_cast<u32>(m_data.size() - frame_header_size);
+        for (usize i = 0; i < 4; i++) {
+            m_data[i] = static_cast<std::byte>((length >> (i * 8)) & 0xFF);
+        }
+
+        return m_data;
+    }
+
+private:
+    std::vector<std::byte> m_data{};
+
+    auto put_le(u64 v, usize bytes) -> message_writer& {
+        for (usize i = 0; i < bytes; i++) {
+            m_data.push_back(static_cast<std::byte>((v >> (i * 8)) & 0xFF));
+        }
+
+        return *this;
+    }
+};
+
+/// Reads the payload of a single frame, every getter returns <code>std::nullopt</code> once the payload is exhausted.
+struct message_reader {
+    message_reader(std::span<const std::byte> payload)
+        : m_payload(payload) {}
+
+    auto get_u8() -> std::optional<u8> { return static_cast<u8>(TRYX(get_le(1))); }
+    auto get_u32() -> std::optional<u32> { return static_cast<u32>(TRYX(get_le(4))); }
+    auto get_u64() -> std::optional<u64> { return TRYX(get_le(8)); }
+    auto get_f64() -> std::optional<double> { return std::bit_cast<double>(TRYX(get_le(8))); }
+
+    auto get_string() -> std::optional<std::string> {
+        u32 length = TRYX(get_u32());
+        if (m_payload.size() < length) {
+            return std::nullopt;
+        }
+
+        std::string ret(length, '\0');
+        for (usize i = 0; i < length; i++) {
+            ret[i] = static_cast<char>(m_payload[i]);
+        }
+
+        m_payload = m_payload.subspan(length);
+        return ret;
+    }
+
+    auto remaining() const -> usize { return m_payload.size(); }
+
+private:
+    std::span<const std::byte> m_payload;
+
+    auto get_le(usize bytes) -> std::optional<u64> {
+        if (m_payload.size() < bytes) {
+            return std::nullopt;
+        }
+
+        u64 ret = 0;
+        for (usize i = 0; i < bytes; i++) {
+            ret |= static_cast<u64>(m_payload[i]) << (i * 8);
+        }
+
+        m_payload = m_payload.subspan(bytes);
+        return ret;
+    }
+};
+
+struct frame {
+    message_type type;
+    std::vector<std::byte> payload;
+
+    auto reader() const -> message_reader { return {payload}; }
+};
+
+namespace detail {
+
+inline auto parse_frame_header(std::span<const std::byte, frame_header_size> header) -> std::optional<std::pair<message_type, u32>> {
+    u32 length = 0;
+    for (usize i = 0; i < 4; i++) {
+        length |= static_cast<u32>(header[i]) << (i * 8);
+    }
+
+    auto type = static_cast<u8>(header[4]);
+    if (length > protocol_max_frame_size || type > static_cast<u8>(message_type::done)) {
+        return std::nullopt;
+    }
+
+    return std::pair{static_cast<message_type>(type), length};
+}
+
+}// namespace detail
+
+/// Blocks until a whole frame is received, returns <code>std::nullopt</code> on disconnects and malformed frames
+inline auto receive_frame(socket& sock) -> std::optional<frame> {
+    std::array<std::byte, frame_header_size> header;
+    if (!sock.recv_all(header)) {
+        return std::nullopt;
+    }
+
+    auto [type, length] = TRYX(detail::parse_frame_header(header));
+
+    frame ret{.type = type, .payload = std::vector<std::byte>(length)};
+    if (!sock.recv_all(ret.payload)) {
+        return std::nullopt;
+    }
+
+    return ret;
+}
+
+/// Reassembles frames from a stream that is read in arbitrary pieces, for use with <code>poll</code>.
+struct frame_buffer {
+    /// Reads whatever is available from <code>sock</code> without blocking further.
+    /// @return false if the connection was closed or failed
+    auto fill_from(socket& sock) -> bool {
+        constexpr usize chunk_size = 64 * 1024;
+
+        usize old_size = m_data.size();
+        m_data.resize(old_size + chunk_size);
+
+        isize res = sock.recv_some(std::span(m_data).subspan(old_size));
+        m_data.resize(old_size + static_cast<usize>(std::max<isize>(res, 0)));
+
+        return res > 0;
+    }
+
+    /// @return <code>std::nullopt</code> if there is no complete frame yet, sets <code>malformed</code> on garbage
+    auto next(bool& malformed) -> std::optional<frame> {
+        malformed = false;
+
+        if (m_data.size() - m_read_offset < frame_header_size) {
+            compact();
+            return std::nullopt;
+        }
+
+        auto header_res = detail::parse_frame_header(std::span(m_data).subspan(m_read_offset).first<frame_header_size>());
+        if (!header_res) {
+            malformed = true;
+            return std::nullopt;
+        }
+
+        auto [type, length] = *header_res;
+        if (m_data.size() - m_read_offset - frame_header_size < length) {
+            compact();
+            return std::nullopt;
+        }
+
+        auto payload_begin = m_data.begin() + static_cast<isize>(m_read_offset + frame_header_size);
+        frame ret{.type = type, .payload = std::vector<std::byte>(payload_begin, payload_begin + length)};
+        m_read_offset += frame_header_size + length;
+
+        return ret;
+    }
+
+private:
+    std::vector<std::byte> m_data{};
+    usize m_read_offset = 0;
+
+    void compact() {
+        m_data.erase(m_data.begin(), m_data.begin() + static_cast<isize>(m_read_offset));
+        m_read_offset = 0;
+    }
+};
+
+}// namespace trc::distributed
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace trc::distributed {
+
+/// A connected or listening stream socket, closed on destruction.\n
+/// Addresses are either <code>host:port</code> for TCP or <code>unix:/some/path</code> for a local socket. An empty
+/// host or <code>*</code> listens on all interfaces, port 0 lets the OS pick one, see <code>port()</code>.
+struct socket {
+    socket() = default;
+
+    explicit socket(int fd)
+        : m_fd(fd) {}
+
+    socket(socket const&) = delete;
+    auto operator=(socket const&) -> socket& = delete;
+
+    socket(socket&& other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1))
+        , m_unlink_path(std::move(other.m_unlink_path)) {
+        other.m_unlink_path.clear();
+    }
+
+    auto operator=(socket&& other) noexcept -> socket& {
+        close();
+
+        m_fd = std::exchange(other.m_fd, -1);
+        m_unlink_path = std::move(other.m_unlink_path);
+        other.m_unlink_path.clear();
+
+        return *this;
+    }
+
+    ~socket() { close(); }
+
+    static auto connect(std::string_view address) -> stf::expected<socket, std::string> {
+        if (address.starts_with("unix:")) {
+            auto addr_res = TRYX(unix_address(address.substr(5)));
+
+            socket ret{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+            if (!ret) {
+                return stf::unexpected{errno_string("socket")};
+            }
+
+            if (::connect(ret.m_fd, reinterpret_cast<sockaddr const*>(&addr_res), sizeof(addr_res)) != 0) {
+                return stf::unexpected{errno_string(fmt::format("connect to \"{}\"", address))};
+            }
+
+            return ret;
+        }
+
+        auto [host, port] = TRYX(split_host_port(address));
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* results = nullptr;
+        std::string host_str(host);
+        std::string port_str(port);
+        if (int res = ::getaddrinfo(host_str.c_str(), port_str.c_str(), &hints, &results); res != 0) {
+            return stf::unexpected{fmt::format("could not resolve \"{}\": {}", address, ::gai_strerror(res))};
+        }
+
+        std::string last_error = fmt::format("no addresses for \"{}\"", address);
+
+        for (addrinfo* info = results; info != nullptr; info = info->ai_next) {
+            socket ret{::socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol)};
+            if (!ret) {
+                last_error = errno_string("socket");
+                continue;
+            }
+
+            if (::connect(ret.m_fd, info->ai_addr, info->ai_addrlen) != 0) {
+                last_error = errno_string(fmt::format("connect to \"{}\"", address));
+                continue;
+            }
+
+            ::freeaddrinfo(results);
+            ret.set_no_delay();
+            return ret;
+        }
+
+        ::freeaddrinfo(results);
+        return stf::unexpected{last_error};
+    }
+
+    static auto listen(std::string_view address, int backlog = 64) -> stf::expected<socket, std::string> {
+        if (address.starts_with("unix:")) {
+            auto addr_res = TRYX(unix_address(address.substr(5)));
+
+            socket ret{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+            if (!ret) {
+                return stf::unexpected{errno_string("socket")};
+            }
+
+            // a stale socket file from a previous run would make bind fail
+            ::unlink(addr_res.sun_path);
+
+            if (::bind(ret.m_fd, reinterpret_cast<sockaddr const*>(&addr_res), sizeof(addr_res)) != 0) {
+                return stf::unexpected{errno_string(fmt::format("bind to \"{}\"", address))};
+            }
+
+            ret.m_unlink_path = addr_res.sun_path;
+
+            if (::listen(ret.m_fd, backlog) != 0) {
+                return stf::unexpected{errno_string("listen")};
+            }
+
+            return ret;
+        }
+
+        auto [host, port] = TRYX(split_host_port(address));
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        addrinfo* results = nullptr;
+        std::string host_str(host);
+        std::string port_str(port);
+        const char* node = host.empty() || host == "*" ? nullptr : host_str.c_str();
+        if (int res = ::getaddrinfo(node, port_str.c_str(), &hints, &results); res != 0) {
+            return stf::unexpected{fmt::format("could not resolve \"{}\": {}", address, ::gai_strerror(res))};
+        }
+
+        std::string last_error = fmt::format("no addresses for \"{}\"", address);
+
+        for (addrinfo* info = results; info != nullptr; info = info->ai_next) {
+            socket ret{::socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol)};
+            if (!ret) {
+                last_error = errno_string("socket");
+                continue;
+            }
+
+            int yes = 1;
+            ::setsockopt(ret.m_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+            if (::bind(ret.m_fd, info->ai_addr, info->ai_addrlen) != 0 || ::listen(ret.m_fd, backlog) != 0) {
+                last_error = errno_string(fmt::format("listen on \"{}\"", address));
+                continue;
+            }
+
+            ::freeaddrinfo(results);
+            return ret;
+        }
+
+        ::freeaddrinfo(results);
+        return stf::unexpected{last_error};
+    }
+
+    auto accept() -> stf::expected<socket, std::string> {
+        socket ret{::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC)};
+        if (!ret) {
+            return stf::unexpected{errno_string("accept")};
+        }
+
+        ret.set_no_delay();
+        return ret;
+    }
+
+    /// Blocks until all of <code>data</code> is sent
+    auto send_all(std::span<const std::byte> data) -> bool {
+        while (!data.empty()) {
+            // MSG_NOSIGNAL, a dead peer should not kill the process through SIGPIPE
+            isize res = ::send(m_fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (res <= 0) {
+                return false;
+            }
+
+            data = data.subspan(static_cast<usize>(res));
+        }
+
+        return true;
+    }
+
+    /// Receives whatever is available, blocking if nothing is.
+    /// @return The number of bytes received, 0 if the peer has closed the connection and a negative number on errors
+    auto recv_some(std::span<std::byte> buffer) -> isize {
+        for (;;) {
+            isize res = ::recv(m_fd, buffer.data(), buffer.size(), 0);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+
+            return res;
+        }
+    }
+
+    /// Blocks until <code>buffer</code> is filled
+    auto recv_all(std::span<std::byte> buffer) -> bool {
+        while (!buffer.empty()) {
+            isize res = recv_some(buffer);
+            if (res <= 0) {
+                return false;
+            }
+
+            buffer = buffer.subspan(static_cast<usize>(res));
+        }
+
+        return true;
+    }
+
+    /// The local port of a TCP socket
+    auto port() const -> std::optional<u16> {
+        sockaddr_storage storage{};
+        socklen_t length = sizeof(storage);
+
+        if (::getsockname(m_fd, reinterpret_cast<sockaddr*>(&storage), &length) != 0) {
+            return std::nullopt;
+        }
+
+        switch (storage.ss_family) {
+            case AF_INET: return ntohs(reinterpret_cast<sockaddr_in const&>(storage).sin_port);
+            case AF_INET6: return ntohs(reinterpret_cast<sockaddr_in6 const&>(storage).sin6_port);
+            default: return std::nullopt;
+        }
+    }
+
+    /// Makes blocking calls on this socket from other threads return
+    void shutdown() {
+        if (m_fd >= 0) {
+            ::shutdown(m_fd, SHUT_RDWR);
+        }
+    }
+
+    void close() {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+
+        if (!m_unlink_path.empty()) {
+            ::unlink(m_unlink_path.c_str());
+            m_unlink_path.clear();
+        }
+    }
+
+    auto fd() const -> int { return m_fd; }
+
+    explicit operator bool() const { return m_fd >= 0; }
+
+private:
+    int m_fd = -1;
+
+    /// Set for listening local sockets, the socket file is removed on close
+    std::string m_unlink_path{};
+
+    void set_no_delay() {
+        // tasks are tiny and latency-bound, fails harmlessly on local sockets
+        int yes = 1;
+        ::setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+
+    static auto errno_string(std::string_view what) -> std::string {
+        return fmt::format("{} failed: {}", what, std::strerror(errno));
+    }
+
+    static auto split_host_port(std::string_view address) -> stf::expected<std::pair<std::string_view, std::string_view>, std::string> {
+        usize colon = address.rfind(':');
+        if (colon == std::string_view::npos || colon + 1 == address.size()) {
+            return stf::unexpected{fmt::format("\"{}\" is not of the form host:port", address)};
+        }
+
+        std::string_view host = address.substr(0, colon);
+
+        // [::1]:1234
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+
+        return std::pair{host, address.substr(colon + 1)};
+    }
+
+    static auto unix_address(std::string_view path) -> stf::expected<sockaddr_un, std::string> {
+        sockaddr_un ret{};
+        ret.sun_family = AF_UNIX;
+
+        if (path.empty() || path.size() >= sizeof(ret.sun_path)) {
+            return stf::unexpected{fmt::format("bad local socket path \"{}\"", path)};
+        }
+
+        std::copy(path.begin(), path.end(), ret.sun_path);
+        return ret;
+    }
+};
+
+}// namespace trc::distributed
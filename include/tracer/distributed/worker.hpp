@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+#include <stuff/thread.hpp>
+
+#include <tracer/common.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/distributed/protocol.hpp>
+#include <tracer/distributed/socket.hpp>
+#include <tracer/image.hpp>
+#include <tracer/integrator/integrator.hpp>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace trc::distributed {
+
+struct worker_job {
+    std::shared_ptr<trc::integrator> integrator;
+    integration_settings settings;
+};
+
+/// Turns the job description sent by the coordinator into something that can render tiles, usually by loading the scene
+using worker_prepare_fn = std::function<stf::expected<worker_job, std::string>(std::string_view description)>;
+
+struct worker_stats {
+    usize tiles = 0;
+};
+
+/// Connects to a <code>coordinator</code> and renders the tiles it hands out until the frame is done.\n
+/// Tiles are rendered on <code>n_threads</code> threads (0 picks a default) with one tile per thread.
+inline auto run_worker(std::string_view address, worker_prepare_fn const& prepare, usize n_threads = 0) -> stf::expected<worker_stats, std::string> {
+    auto sock_res = socket::connect(address);
+    if (!sock_res) {
+        return stf::unexpected{sock_res.error()};
+    }
+
+    socket sock = std::move(*sock_res);
+
+    if (n_threads == 0) {
+        n_threads = trc::detail::default_thread_count();
+    }
+
+    // twice the thread count so that no thread idles while results are on their way
+    if (!sock.send_all(message_writer(message_type::hello).put_u32(static_cast<u32>(n_threads * 2)).finish())) {
+        return stf::unexpected{std::string("could not greet the coordinator")};
+    }
+
+    std::optional<frame> job_frame = receive_frame(sock);
+    if (!job_frame || job_frame->type != message_type::job) {
+        return stf::unexpected{std::string("did not receive a job from the coordinator")};
+    }
+
+    message_reader job_reader = job_frame->reader();
+    auto seed = job_reader.get_u64();
+    auto width = job_reader.get_u32();
+    auto height = job_reader.get_u32();
+    auto description = job_reader.get_string();
+
+    if (!seed || !width || !height || !description) {
+        return stf::unexpected{std::string("received a malformed job")};
+    }
+
+    auto job_res = prepare(*description);
+    if (!job_res) {
+        sock.send_all(message_writer(message_type::failed).put_string(job_res.error()).finish());
+        return stf::unexpected{job_res.error()};
+    }
+
+    worker_job job = std::move(*job_res);
+    // parallelism comes from rendering several tiles at once
+    job.settings.threads = 1;
+
+    if (!sock.send_all(message_writer(message_type::ready).finish())) {
+        return stf::unexpected{std::string("lost the coordinator")};
+    }
+
+    struct tile_task {
+        u32 id;
+        trc::detail::default_task task;
+    };
+
+    stf::channel<tile_task> tasks{};
+    std::mutex send_mutex{};
+
+    std::atomic_size_t n_rendered = 0;
+    std::atomic_bool failed = false;
+    std::atomic_bool finished = false;
+    std::string failure{};
+
+    auto render_thread = [&] {
+        tile_image tile{};
+
+        for (;;) {
+            auto res = receive(tasks);
+            if (!res) {
+                break;
+            }
+
+            // keep draining the channel so that the receiving thread does not block forever
+            if (failed.load(std::memory_order::relaxed) || finished.load(std::memory_order::relaxed)) {
+                continue;
+            }
+
+            auto [id, task] = *res;
+            tile.reset(*width, *height, task.xy_start, task.span);
+
+            if (!job.integrator->integrate_tile(tile, job.settings, *seed, task)) {
+                std::unique_lock lock{send_mutex};
+                failure = "the integrator cannot render tiles";
+                failed.store(true, std::memory_order::relaxed);
+                sock.shutdown();
+                continue;
+            }
+
+            auto [span_x, span_y] = tile.span();
+
+            message_writer result(message_type::result);
+            result.reserve(5 * sizeof(u32) + span_x * span_y * 3 * sizeof(double));
+            result.put_u32(id)
+              .put_u32(static_cast<u32>(tile.xy_start().first))
+              .put_u32(static_cast<u32>(tile.xy_start().second))
+              .put_u32(static_cast<u32>(span_x))
+              .put_u32(static_cast<u32>(span_y));
+
+            for (color c: tile.tile().pixels()) {
+                result.put_f64(c[0]).put_f64(c[1]).put_f64(c[2]);
+            }
+
+            std::unique_lock lock{send_mutex};
+            if (!sock.send_all(result.finish())) {
+                failure = "lost the coordinator";
+                failed.store(true, std::memory_order::relaxed);
+                sock.shutdown();
+                continue;
+            }
+
+            n_rendered.fetch_add(1, std::memory_order::relaxed);
+        }
+    };
+
+    std::vector<std::thread> threads{};
+    for (usize i = 0; i < n_threads; i++) {
+        threads.emplace_back(render_thread);
+    }
+
+    for (;;) {
+        std::optional<frame> received = receive_frame(sock);
+        if (!received) {
+            break;
+        }
+
+        if (received->type == message_type::done) {
+            // anything still being rendered was handed out to someone else as well and is not needed anymore
+            finished.store(true, std::memory_order::relaxed);
+            break;
+        }
+
+        if (received->type != message_type::task) {
+            continue;
+        }
+
+        message_reader reader = received->reader();
+        auto id = reader.get_u32();
+        auto x = reader.get_u32();
+        auto y = reader.get_u32();
+        auto span_x = reader.get_u32();
+        auto span_y = reader.get_u32();
+
+        if (!id || !x || !y || !span_x || !span_y) {
+            break;
+        }
+
+        send(tasks, tile_task{*id, {.xy_start{*x, *y}, .span{*span_x, *span_y}}});
+    }
+
+    tasks.close();
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    if (!finished.load(std::memory_order::relaxed)) {
+        return stf::unexpected{failed.load(std::memory_order::relaxed) ? failure : std::string("lost the coordinator")};
+    }
+
+    return worker_stats{.tiles = n_rendered.load(std::memory_order::relaxed)};
+}
+
+}// namespace trc::distributed
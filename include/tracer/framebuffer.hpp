@@ -0,0 +1,229 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/image.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+
+#if __has_include(<stdfloat>)
+#include <stdfloat>
+#endif
+
+namespace trc {
+
+/// The sum of the samples that landed in a pixel and their total weight
+template<typename Scalar>
+struct framebuffer_texel {
+    Scalar r;
+    Scalar g;
+    Scalar b;
+    Scalar weight;
+};
+
+/// Render target that stores an RGB sum and a weight per pixel in <code>Scalar</code> precision.\n
+/// Pixels are laid out tile by tile, tiles being square blocks of <code>tile_extent</code> pixels that are stored
+/// row-major and start on cache line boundaries. With the tile extent matching the one rendering is scheduled in
+/// (<code>default_tile_extent</code>), a tile handed over by an integrator is a single contiguous write and threads
+/// working on neighbouring tiles never touch the same cache line.\n
+/// <code>get</code> and <code>resolve_into</code> provide the weighted averages in row-major terms.
+template<typename Scalar = float>
+struct basic_framebuffer : image_like {
+    using scalar_type = Scalar;
+    using texel_type = framebuffer_texel<Scalar>;
+
+    static constexpr usize tile_alignment = 64;
+
+    basic_framebuffer() = default;
+
+    basic_framebuffer(usize width, usize height, usize tile_extent = default_tile_extent) {
+        create(width, height, tile_extent);
+    }
+
+    basic_framebuffer(basic_framebuffer const& other)
+        : basic_framebuffer() {
+        *this = other;
+    }
+
+    basic_framebuffer(basic_framebuffer&& other) noexcept
+        : basic_framebuffer() {
+        *this = std::move(other);
+    }
+
+    auto operator=(basic_framebuffer const& other) -> basic_framebuffer& {
+        if (this == &other) {
+            return *this;
+        }
+
+        create(other.m_width, other.m_height, other.m_tile_extent);
+        std::copy_n(other.m_data.get(), m_size, m_data.get());
+
+        return *this;
+    }
+
+    /// Leaves <code>other</code> empty, as if default constructed
+    auto operator=(basic_framebuffer&& other) noexcept -> basic_framebuffer& {
+        if (this == &other) {
+            return *this;
+        }
+
+        m_width = std::exchange(other.m_width, 0);
+        m_height = std::exchange(other.m_height, 0);
+        m_tile_extent = std::exchange(other.m_tile_extent, default_tile_extent);
+        m_tiles_x = std::exchange(other.m_tiles_x, 0);
+        m_tiles_y = std::exchange(other.m_tiles_y, 0);
+        m_tile_stride = std::exchange(other.m_tile_stride, 0);
+        m_size = std::exchange(other.m_size, 0);
+        m_data = std::move(other.m_data);
+
+        return *this;
+    }
+
+    ~basic_framebuffer() override = default;
+
+    /// Allocates exactly the tiles covering the image, only if the dimensions or the tile extent changed.\n
+    /// Clears the framebuffer either way.
+    void create(usize width, usize height, usize tile_extent = default_tile_extent) {
+        tile_extent = std::max<usize>(tile_extent, 1);
+
+        const usize tiles_x = (width + tile_extent - 1) / tile_extent;
+        const usize tiles_y = (height + tile_extent - 1) / tile_extent;
+
+        // keeps every tile on a cache line boundary
+        constexpr usize texels_per_line = std::max<usize>(tile_alignment / sizeof(texel_type), 1);
+        const usize tile_stride = (tile_extent * tile_extent + texels_per_line - 1) / texels_per_line * texels_per_line;
+
+        const usize size = tiles_x * tiles_y * tile_stride;
+
+        if (size != m_size) {
+            m_data.reset(size == 0 ? nullptr : static_cast<texel_type*>(::operator new(size * sizeof(texel_type), std::align_val_t{tile_alignment})));
+            m_size = size;
+        }
+
+        m_width = width;
+        m_height = height;
+        m_tile_extent = tile_extent;
+        m_tiles_x = tiles_x;
+        m_tiles_y = tiles_y;
+        m_tile_stride = tile_stride;
+
+        clear();
+    }
+
+    void clear() { std::fill_n(m_data.get(), m_size, texel_type{}); }
+
+    auto width() const -> usize override { return m_width; }
+    auto height() const -> usize override { return m_height; }
+
+    auto tile_extent() const -> usize { return m_tile_extent; }
+    auto tiles_x() const -> usize { return m_tiles_x; }
+    auto tiles_y() const -> usize { return m_tiles_y; }
+
+    auto texel(usize x, usize y) -> texel_type& { return m_data[index(x, y)]; }
+    auto texel(usize x, usize y) const -> texel_type const& { return m_data[index(x, y)]; }
+
+    /// Adds a sample to the pixel
+    void accumulate(usize x, usize y, color c, real weight = 1) {
+        texel_type& t = texel(x, y);
+        t.r += static_cast<Scalar>(c[0] * weight);
+        t.g += static_cast<Scalar>(c[1] * weight);
+        t.b += static_cast<Scalar>(c[2] * weight);
+        t.weight += static_cast<Scalar>(weight);
+    }
+
+    /// Overwrites the pixel with a single sample of weight 1
+    void set(usize x, usize y, color c) override { texel(x, y) = to_texel(c); }
+
+    /// The weighted average of the pixel, black if nothing was written to it
+    auto get(usize x, usize y) const -> color override { return resolve(texel(x, y)); }
+
+    void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        for (usize row = 0; row < tile_height; row++) {
+            const color* source = pixels.data() + row * tile_width;
+
+            // pixels are contiguous up until the next tile boundary
+            for (usize col = 0; col < tile_width;) {
+                usize run = std::min(tile_width - col, m_tile_extent - (x + col) % m_tile_extent);
+                texel_type* destination = &texel(x + col, y + row);
+
+                for (usize i = 0; i < run; i++) {
+                    destination[i] = to_texel(source[col + i]);
+                }
+
+                col += run;
+            }
+        }
+    }
+
+    /// Writes the weighted averages to <code>out</code> one tile at a time, <code>out</code> must be at least as large
+    void resolve_into(image_like& out) const {
+        std::vector<color> buffer(m_tile_extent * m_tile_extent);
+
+        for (usize tile_y = 0; tile_y < m_tiles_y; tile_y++) {
+            for (usize tile_x = 0; tile_x < m_tiles_x; tile_x++) {
+                const usize x = tile_x * m_tile_extent;
+                const usize y = tile_y * m_tile_extent;
+                const usize tile_width = std::min(m_tile_extent, m_width - x);
+                const usize tile_height = std::min(m_tile_extent, m_height - y);
+
+                const texel_type* tile = m_data.get() + (tile_y * m_tiles_x + tile_x) * m_tile_stride;
+
+                for (usize row = 0; row < tile_height; row++) {
+                    for (usize col = 0; col < tile_width; col++) {
+                        buffer[row * tile_width + col] = resolve(tile[row * m_tile_extent + col]);
+                    }
+                }
+
+                out.set_tile(x, y, tile_width, tile_height, std::span(buffer).first(tile_width * tile_height));
+            }
+        }
+    }
+
+private:
+    struct aligned_delete {
+        void operator()(texel_type* ptr) const { ::operator delete(ptr, std::align_val_t{tile_alignment}); }
+    };
+
+    usize m_width = 0;
+    usize m_height = 0;
+    usize m_tile_extent = default_tile_extent;
+    usize m_tiles_x = 0;
+    usize m_tiles_y = 0;
+    /// Texels between the starts of consecutive tiles, <code>m_tile_extent</code> squared rounded up to a cache line
+    usize m_tile_stride = 0;
+
+    usize m_size = 0;
+    std::unique_ptr<texel_type[], aligned_delete> m_data{nullptr};
+
+    auto index(usize x, usize y) const -> usize {
+        usize tile = (y / m_tile_extent) * m_tiles_x + x / m_tile_extent;
+        usize within = (y % m_tile_extent) * m_tile_extent + x % m_tile_extent;
+        return tile * m_tile_stride + within;
+    }
+
+    static auto to_texel(color c) -> texel_type {
+        return {static_cast<Scalar>(c[0]), static_cast<Scalar>(c[1]), static_cast<Scalar>(c[2]), Scalar(1)};
+    }
+
+    static auto resolve(texel_type const& t) -> color {
+        if (t.weight == Scalar(0)) {
+            return color{};
+        }
+
+        return color{static_cast<real>(t.r), static_cast<real>(t.g), static_cast<real>(t.b)} / static_cast<real>(t.weight);
+    }
+};
+
+using framebuffer = basic_framebuffer<float>;
+
+#ifdef __STDCPP_FLOAT16_T__
+/// Half the memory of <code>framebuffer</code>, the 11 bits of mantissa are plenty for display but not for
+/// accumulating thousands of samples through <code>accumulate</code>
+using framebuffer_half = basic_framebuffer<std::float16_t>;
+#endif
+
+}// namespace trc
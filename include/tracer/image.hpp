@@ -1,10 +1,14 @@
 #pragma once
 
 #include <tracer/common.hpp>
+#include <tracer/detail/srgb.hpp>
 
 #include <stuff/qoi.hpp>
 
-#ifdef TRACER_USING_SFML
+#include <span>
+#include <vector>
+
+#if TRACER_USING_SFML
 #include <SFML/Graphics/Image.hpp>
 #endif
 
@@ -28,14 +32,31 @@ constexpr auto srgb_eotf(color srgb) -> color {
     return mix(higher, lower, cutoff);
 }
 
+struct aov_image_like;
+
 struct image_like {
     virtual constexpr ~image_like() = default;
 
+    /// Images that receive AOVs return themselves, saves integrators a <code>dynamic_cast</code> per task
+    virtual constexpr auto as_aov_image() -> aov_image_like* { return nullptr; }
+
     virtual constexpr auto width() const -> usize = 0;
     virtual constexpr auto height() const -> usize = 0;
 
     virtual constexpr void set(usize x, usize y, color c) = 0;
     virtual constexpr auto get(usize x, usize y) const -> color = 0;
+
+    /// Writes a <code>tile_width</code>x<code>tile_height</code> block of row-major <code>pixels</code> whose top-left
+    /// corner is at (<code>x</code>, <code>y</code>). The block must lie within the image.\n
+    /// Integrators hand over whole tiles through this so that implementations can convert and store them in bulk instead
+    /// of paying for a virtual call and a conversion per pixel. The default falls back to <code>set</code>.
+    virtual constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) {
+        for (usize row = 0; row < tile_height; row++) {
+            for (usize col = 0; col < tile_width; col++) {
+                set(x + col, y + row, pixels[row * tile_width + col]);
+            }
+        }
+    }
 };
 
 /// Image adapter for images that contain sRGB data.\n
@@ -54,6 +75,24 @@ struct image_adapter_srgb : image_like {
     /// Converts the color retrieved from the adapted image from sRGB to linear RGB
     virtual constexpr auto get(usize x, usize y) const -> color override { return srgb_eotf(m_image.get(x, y)); }
 
+    /// Converts in single precision through <code>detail::srgb_oetf_fast</code>, good for anything down the line that
+    /// ends up with 8 bits per channel
+    virtual constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        if (pixels.empty()) {
+            return;
+        }
+
+        std::vector<color> converted(pixels.size());
+
+        const real* source = pixels.data()->data();
+        real* destination = converted.data()->data();
+        for (usize i = 0; i < pixels.size() * 3; i++) {
+            destination[i] = static_cast<real>(detail::srgb_oetf_fast(static_cast<float>(source[i])));
+        }
+
+        m_image.set_tile(x, y, tile_width, tile_height, converted);
+    }
+
 private:
     ImageLike& m_image;
 };
@@ -88,6 +127,12 @@ struct image_adapter_tee : image_like {
 
     virtual constexpr auto get(usize x, usize y) const -> color override { return {}; }
 
+    virtual constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        for (image_like* image: m_images) {
+            image->set_tile(x, y, tile_width, tile_height, pixels);
+        }
+    }
+
 private:
     std::vector<image_like*> m_images{};
 
@@ -128,6 +173,22 @@ struct image_adapter_sfml : image_like {
         return c / 255;
     }
 
+    virtual void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        if (pixels.empty()) {
+            return;
+        }
+
+        std::vector<u8> rgba(pixels.size() * 4);
+        detail::encode_rgba8(pixels.data()->data(), pixels.size(), rgba.data(), false);
+
+        for (usize row = 0; row < tile_height; row++) {
+            for (usize col = 0; col < tile_width; col++) {
+                const u8* p = rgba.data() + (row * tile_width + col) * 4;
+                m_image.setPixel(sf::Vector2u(x + col, y + row), sf::Color{p[0], p[1], p[2], p[3]});
+            }
+        }
+    }
+
 private:
     sf::Image& m_image;
 };
@@ -177,6 +238,22 @@ struct image_adapter_qoi : image_like {
         return c;
     }
 
+    virtual constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        if (pixels.empty()) {
+            return;
+        }
+
+        std::vector<u8> rgba(pixels.size() * 4);
+        detail::encode_rgba8(pixels.data()->data(), pixels.size(), rgba.data(), m_image.get_color_space() == stf::qoi::color_space::srgb_linear_alpha);
+
+        for (usize row = 0; row < tile_height; row++) {
+            for (usize col = 0; col < tile_width; col++) {
+                const u8* p = rgba.data() + (row * tile_width + col) * 4;
+                m_image.at(x + col, y + row) = stf::qoi::color{p[0], p[1], p[2], p[3]};
+            }
+        }
+    }
+
 private:
     stf::qoi::image<Allocator>& m_image;
 };
@@ -188,7 +265,8 @@ struct basic_image : public image_like {
     constexpr basic_image(Allocator const& allocator = {}) noexcept(noexcept(Allocator(allocator)))
         : m_allocator(allocator) {}
 
-    constexpr basic_image(usize width, usize height, Allocator const& allocator = {}) {
+    constexpr basic_image(usize width, usize height, Allocator const& allocator = {})
+        : m_allocator(allocator) {
         create(width, height);
     }
 
@@ -205,23 +283,33 @@ struct basic_image : public image_like {
     constexpr ~basic_image() { destroy(); }
 
     constexpr auto operator=(basic_image const& other) -> basic_image& {
+        if (this == &other) {
+            return *this;
+        }
+
+        destroy();
+
         m_allocator = other.m_allocator;
-        m_data = m_allocator.allocate(other.m_width * other.m_height);
-        m_width = other.m_width;
-        m_height = other.m_height;
+        create(other.m_width, other.m_height);
 
-        std::copy_n(other.m_data, size(), m_data);
+        if (!empty()) {
+            std::copy_n(other.m_data, size(), m_data);
+        }
 
         return *this;
     }
 
     constexpr auto operator=(basic_image&& other) -> basic_image& {
-        m_allocator = other.m_allocator;
-        m_data = other.m_data;
-        m_width = other.m_width;
-        m_height = other.m_height;
+        if (this == &other) {
+            return *this;
+        }
+
+        destroy();
 
-        other.m_data = nullptr;
+        m_allocator = other.m_allocator;
+        m_data = std::exchange(other.m_data, nullptr);
+        m_width = std::exchange(other.m_width, 0);
+        m_height = std::exchange(other.m_height, 0);
 
         return *this;
     }
@@ -229,12 +317,13 @@ struct basic_image : public image_like {
     constexpr auto empty() const -> bool { return m_data == nullptr || m_width == 0 || m_height == 0; }
 
     constexpr void destroy() noexcept {
-        if (!empty()) {
+        if (m_data != nullptr) {
             m_allocator.deallocate(m_data, m_width * m_height);
-            m_data = nullptr;
-            m_width = 0;
-            m_height = 0;
         }
+
+        m_data = nullptr;
+        m_width = 0;
+        m_height = 0;
     }
 
     constexpr void create(usize width, usize height) noexcept(noexcept(m_allocator.allocate(0))) {
@@ -247,7 +336,7 @@ struct basic_image : public image_like {
             return;
         }
 
-        m_data = m_allocator.allocate(width * height * 4);
+        m_data = m_allocator.allocate(width * height);
     }
 
     constexpr void fill(color_type c) { std::fill(m_data, m_data + m_width * m_height, c); }
@@ -267,6 +356,12 @@ struct basic_image : public image_like {
     constexpr void set(usize x, usize y, color c) override { at(x, y) = c; }
     constexpr auto get(usize x, usize y) const -> color override { return at(x, y); }
 
+    constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        for (usize row = 0; row < tile_height; row++) {
+            std::copy_n(pixels.data() + row * tile_width, tile_width, &at(x, y + row));
+        }
+    }
+
 private:
     Allocator m_allocator;
     color_type* m_data = nullptr;
@@ -329,6 +424,12 @@ struct basic_image_view : image_like {
     constexpr void set(usize x, usize y, color c) override { at(x, y) = c; }
     constexpr auto get(usize x, usize y) const -> color override { return at(x, y); }
 
+    constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        for (usize row = 0; row < tile_height; row++) {
+            std::copy_n(pixels.data() + row * tile_width, tile_width, &at(x, y + row));
+        }
+    }
+
 private:
     color_type* m_data = nullptr;
     std::pair<usize, usize> m_data_dims;
@@ -346,4 +447,73 @@ private:
 using image = basic_image<color, std::allocator<color>>;
 using image_view = basic_image_view<color>;
 
+/// Pretends to be a <code>width</code>x<code>height</code> image but only stores the pixels within a tile of it.\n
+/// Integrators need the dimensions of the whole frame to place camera rays, this lets them render a part of a frame
+/// without allocating the rest. Pixels outside the tile are dropped on writes and read as black.
+struct tile_image : image_like {
+    constexpr tile_image() = default;
+
+    constexpr tile_image(usize width, usize height, std::pair<usize, usize> xy_start, std::pair<usize, usize> span) {
+        reset(width, height, xy_start, span);
+    }
+
+    /// The span is clamped to the frame, the previous contents are undefined afterwards
+    constexpr void reset(usize width, usize height, std::pair<usize, usize> xy_start, std::pair<usize, usize> span) {
+        m_width = width;
+        m_height = height;
+
+        m_xy_start.first = std::min(xy_start.first, width);
+        m_xy_start.second = std::min(xy_start.second, height);
+        m_span.first = std::min(span.first, width - m_xy_start.first);
+        m_span.second = std::min(span.second, height - m_xy_start.second);
+
+        if (m_tile.width() != m_span.first || m_tile.height() != m_span.second) {
+            m_tile.create(m_span.first, m_span.second);
+        }
+    }
+
+    constexpr auto width() const -> usize override { return m_width; }
+    constexpr auto height() const -> usize override { return m_height; }
+
+    constexpr auto xy_start() const -> std::pair<usize, usize> { return m_xy_start; }
+    constexpr auto span() const -> std::pair<usize, usize> { return m_span; }
+
+    /// The pixels of the tile alone, row-major
+    constexpr auto tile() -> image& { return m_tile; }
+    constexpr auto tile() const -> image const& { return m_tile; }
+
+    constexpr void set(usize x, usize y, color c) override {
+        if (contains(x, y)) {
+            m_tile.at(x - m_xy_start.first, y - m_xy_start.second) = c;
+        }
+    }
+
+    constexpr auto get(usize x, usize y) const -> color override {
+        return contains(x, y) ? m_tile.at(x - m_xy_start.first, y - m_xy_start.second) : color{};
+    }
+
+    constexpr void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        if (x == m_xy_start.first && y == m_xy_start.second && tile_width == m_span.first && tile_height == m_span.second) {
+            std::copy(pixels.begin(), pixels.end(), m_tile.data());
+            return;
+        }
+
+        image_like::set_tile(x, y, tile_width, tile_height, pixels);
+    }
+
+private:
+    usize m_width = 0;
+    usize m_height = 0;
+
+    std::pair<usize, usize> m_xy_start{0, 0};
+    std::pair<usize, usize> m_span{0, 0};
+
+    image m_tile{};
+
+    constexpr auto contains(usize x, usize y) const -> bool {
+        return x >= m_xy_start.first && y >= m_xy_start.second &&//
+               x - m_xy_start.first < m_span.first && y - m_xy_start.second < m_span.second;
+    }
+};
+
 }// namespace trc
@@ -9,14 +9,13 @@ struct cosine_albedo_integrator : detail::pixel_integrator {
         : pixel_integrator(std::move(camera), std::move(scene)) {}
 
 protected:
-    virtual auto kernel(vec2 xy, default_rng& gen) noexcept -> color final override {
-        ray ray = m_camera->generate_ray(xy, gen);
-
-        auto isect_res = m_scene->intersect(ray);
+    virtual auto kernel(ray const& camera_ray, ray_differentials const& differentials, default_rng& gen, aov_sample* aovs) noexcept -> color final override {
+        auto isect_res = intersect_camera_ray(camera_ray, differentials);
         if (!isect_res)
             return {};
 
         intersection isect = *isect_res;
+        record_first_hit(aovs, isect);
 
         auto interaction = VARIANT_CALL(m_scene->material(isect.material_index), sample, isect, gen);
         auto const& [wi, wi_pdf, albedo, emittance, _] = interaction;
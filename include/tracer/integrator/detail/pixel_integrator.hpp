@@ -1,40 +1,132 @@
 #pragma once
 
+#include <tracer/aov.hpp>
 #include <tracer/integrator/detail/task_integrator.hpp>
 
 namespace trc::detail {
 
+/// Seeds the generator of a single pixel, SplitMix64 finalisers over the frame seed and the pixel coordinates.\n
+/// Pixels not sharing a generator is what makes renders independent of the number of threads and of how the frame is
+/// split into tiles, be it among threads or among processes.
+constexpr auto pixel_seed(u64 frame_seed, usize x, usize y) -> u64 {
+    auto mix = [](u64 z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    };
+
+    u64 ret = mix(frame_seed + 0x9E3779B97F4A7C15ull);
+    ret = mix(ret ^ (static_cast<u64>(x) + 0x9E3779B97F4A7C15ull));
+    ret = mix(ret ^ (static_cast<u64>(y) + 0x3C6EF372FE94F82Aull));
+
+    return ret;
+}
+
 struct pixel_integrator : task_integrator<> {
+    /// Samples between checks of the stop token, checking once per tile is too coarse at thousands of samples
+    static constexpr usize stop_check_interval = 64;
+
     pixel_integrator(std::shared_ptr<camera> camera, std::shared_ptr<scene> scene, task_generator_type const& generator = {})
         : task_integrator<>(std::move(camera), std::move(scene), generator) {}
 
 protected:
-    virtual constexpr auto kernel(vec2 xy, default_rng& gen) noexcept -> color = 0;
+    /// @param differentials Span the share of the pixel that one sample stands for, see <code>intersect_camera_ray</code>
+    /// @param aovs Where to record the first hit, <code>nullptr</code> if no AOVs were requested
+    virtual constexpr auto kernel(ray const& camera_ray, ray_differentials const& differentials, default_rng& gen, aov_sample* aovs) noexcept -> color = 0;
+
+    /// Intersects a camera ray, texture lookups at the hit pick their level of detail from <code>differentials</code>
+    constexpr auto intersect_camera_ray(ray const& camera_ray, ray_differentials const& differentials) const -> std::optional<intersection> {
+        std::optional<intersection> ret = m_scene->intersect(camera_ray);
+        if (ret) {
+            ret->differentials = &differentials;
+        }
 
-    constexpr void task_processor(task_payload_type payload, image_like& out, integration_settings opts, default_rng& gen) noexcept final override {
+        return ret;
+    }
+
+    /// Call this on every intersection found by a kernel, only the first one will be recorded.
+    constexpr void record_first_hit(aov_sample* aovs, intersection const& isect) const {
+        if (aovs == nullptr || aovs->hit) {
+            return;
+        }
+
+        aovs->record(isect, VARIANT_CALL(m_scene->material(isect.material_index), albedo_at, isect));
+    }
+
+    constexpr void task_processor(task_payload_type payload, image_like& out, integration_settings opts, u64 seed, std::stop_token const& stop) noexcept final override {
         stf::random::erand48_distribution<real> dist{};
 
         vec2 dims(out.width(), out.height());
 
+        // with n samples per pixel each one covers about 1/sqrt(n) of it, textures would be blurred if looked up over the
+        // whole pixel every time
+        const real footprint = std::max(real(0.125), 1 / std::sqrt(static_cast<real>(std::max<usize>(opts.samples, 1))));
+
         usize upto_row = std::min(payload.xy_start.second + payload.span.second, out.height());
         usize upto_col = std::min(payload.xy_start.first + payload.span.first, out.width());
 
+        if (payload.xy_start.first >= upto_col || payload.xy_start.second >= upto_row) {
+            return;
+        }
+
+        const usize tile_width = upto_col - payload.xy_start.first;
+        const usize tile_height = upto_row - payload.xy_start.second;
+
+        // handed to the image as a whole once done, see image_like::set_tile
+        std::vector<color> tile(tile_width * tile_height);
+
+        aov_image_like* aov_image = out.as_aov_image();
+        aov_tile aov_out{};
+        if (aov_image != nullptr) {
+            aov_out.create(*aov_image, tile_width, tile_height);
+        }
+
+        const bool record_aovs = aov_out.any();
+
         for (usize row = payload.xy_start.second; row < upto_row; row++) {
             for (usize col = payload.xy_start.first; col < upto_col; col++) {
+                default_rng gen{pixel_seed(seed, col, row)};
+
                 isize flipped_row = static_cast<isize>(out.height() - row) - 1;
                 vec2 cr_start = vec2(col, flipped_row) - (dims / 2);
 
                 color sum{};
+                aov_accumulator aovs{};
 
                 for (usize i = 0; i < opts.samples; i++) {
+                    // a partially sampled tile would be too dark, leave it alone instead
+                    if (i % stop_check_interval == 0 && stop.stop_requested()) {
+                        return;
+                    }
+
                     vec2 sample = vec2(dist(gen), dist(gen));
 
-                    sum = sum + kernel(cr_start + sample, gen);
+                    auto [camera_ray, differentials] = m_camera->generate_ray_differential(cr_start + sample, gen);
+                    differentials.scale(camera_ray, footprint);
+
+                    if (!record_aovs) {
+                        sum = sum + kernel(camera_ray, differentials, gen, nullptr);
+                        continue;
+                    }
+
+                    aov_sample first_hit{};
+                    sum = sum + kernel(camera_ray, differentials, gen, &first_hit);
+                    aovs.add(first_hit);
                 }
 
-                out.set(col, row, sum / static_cast<real>(opts.samples));
+                tile[(row - payload.xy_start.second) * tile_width + (col - payload.xy_start.first)] = sum / static_cast<real>(opts.samples);
+
+                if (record_aovs) {
+                    aovs.write(aov_out, col - payload.xy_start.first, row - payload.xy_start.second);
+                }
             }
         }
+
+        out.set_tile(payload.xy_start.first, payload.xy_start.second, tile_width, tile_height, tile);
+
+        if (record_aovs) {
+            aov_out.submit(*aov_image, payload.xy_start.first, payload.xy_start.second);
+        }
     }
 };
 
@@ -6,11 +6,6 @@
 
 namespace trc::detail {
 
-struct default_task {
-    std::pair<usize, usize> xy_start;
-    std::pair<usize, usize> span;
-};
-
 struct default_task_generator {
     using payload_type = default_task;
 
@@ -25,9 +20,11 @@ struct default_task_generator {
         , m_x_tasks(other.m_x_tasks)
         , m_y_tasks(other.m_y_tasks) {}
 
-    constexpr void set_image(image_like& image) {
-        m_x_tasks = image.width() / m_chunk_size.first + (image.width() % m_chunk_size.first != 0);
-        m_y_tasks = image.height() / m_chunk_size.second + (image.height() % m_chunk_size.second != 0);
+    constexpr void set_image(image_like& image) { set_dimensions(image.width(), image.height()); }
+
+    constexpr void set_dimensions(usize width, usize height) {
+        m_x_tasks = width / m_chunk_size.first + (width % m_chunk_size.first != 0);
+        m_y_tasks = height / m_chunk_size.second + (height % m_chunk_size.second != 0);
     }
 
     constexpr auto n_tasks() const -> usize {
@@ -58,7 +55,7 @@ struct default_task_generator {
     }
 
 private:
-    std::pair<usize, usize> m_chunk_size{32, 32};
+    std::pair<usize, usize> m_chunk_size{default_tile_extent, default_tile_extent};
 
     image_view m_image{};
     usize m_x_tasks = 0;
@@ -81,12 +78,22 @@ struct c4d_task_generator {
         , m_x_tasks(other.m_x_tasks)
         , m_y_tasks(other.m_y_tasks) {}
 
-    constexpr void set_image(image_like& image) {
-        m_x_tasks = image.width() / m_chunk_size.first + (image.width() % m_chunk_size.first != 0);
-        m_y_tasks = image.height() / m_chunk_size.second + (image.height() % m_chunk_size.second != 0);
+    constexpr void set_image(image_like& image) { set_dimensions(image.width(), image.height()); }
+
+    constexpr void set_dimensions(usize width, usize height) {
+        m_x_tasks = width / m_chunk_size.first + (width % m_chunk_size.first != 0);
+        m_y_tasks = height / m_chunk_size.second + (height % m_chunk_size.second != 0);
     }
 
-    constexpr void reset() {}
+    void reset() {
+        std::unique_lock lock{m_task_gen_mutex};
+
+        m_odd_direction_change = false;
+        m_step_counter = 0;
+        m_steps = 1;
+        m_direction = direction::north;
+        m_next_offset = {0, 0};
+    }
 
     auto next_task() -> std::optional<payload_type> {
         isize half_x = m_x_tasks / 2;
@@ -141,7 +148,7 @@ struct c4d_task_generator {
     }
 
 private:
-    std::pair<usize, usize> m_chunk_size{32, 32};
+    std::pair<usize, usize> m_chunk_size{default_tile_extent, default_tile_extent};
 
     image_view m_image{};
     isize m_x_tasks = 0;
@@ -185,8 +192,15 @@ struct task_integrator : integrator {
         : integrator(camera, scene)
         , m_task_generator(generator) {}
 
-    constexpr void integrate(image_like& out, integration_settings opts, default_rng& gen) noexcept final override {
+    constexpr void integrate(image_like& out, integration_settings opts, default_rng& gen, std::stop_token const& stop = {}) noexcept final override {
+        // the scene might have been edited since this integrator was created
+        m_scene->update_light_table();
+
         m_task_generator.set_image(out);
+        m_task_generator.reset();
+
+        // every pixel derives its own generator from this, see pixel_seed
+        const u64 seed = gen();
 
         usize n_threads;
 
@@ -198,14 +212,21 @@ struct task_integrator : integrator {
 #else
             n_threads = 1;
 #endif
+
+            if (opts.threads != 0) {
+                n_threads = opts.threads;
+            }
         }
 
-        auto consume_task = [this, opts, &gen, &out] constexpr {
+        auto consume_task = [this, opts, seed, &out, &stop] constexpr {
+            if (stop.stop_requested())
+                return false;
+
             auto task_opt = m_task_generator.next_task();
             if (!task_opt)
                 return false;
 
-            task_processor(*task_opt, out, opts, gen);
+            task_processor(*task_opt, out, opts, seed, stop);
             return true;
         };
 
@@ -221,9 +242,7 @@ struct task_integrator : integrator {
         stf::wait_group wg{};
         std::vector<std::thread> workers{};
 
-        m_task_generator.reset();
-
-        auto worker = [this, consume_task, &wg, &out, opts](usize thread_id, usize stride, default_rng gen) {
+        auto worker = [consume_task, &wg] {
             stf::scope::scope_exit wg_guard{[&wg] { wg.done(); }};
 
             for (;;) {
@@ -234,11 +253,7 @@ struct task_integrator : integrator {
 
         for (usize i = 0; i < n_threads; i++) {
             wg.add(1);
-
-            default_rng thread_rng = gen;
-            gen.jump_128();
-
-            workers.emplace_back(worker, i, n_threads, thread_rng);
+            workers.emplace_back(worker);
         }
 
         // this is not entirely necessary
@@ -250,8 +265,19 @@ struct task_integrator : integrator {
         }
     }
 
+    constexpr auto integrate_tile(image_like& out, integration_settings opts, u64 seed, default_task tile) noexcept -> bool final override {
+        if constexpr (std::is_same_v<task_payload_type, default_task>) {
+            task_processor(tile, out, opts, seed, {});
+            return true;
+        } else {
+            return false;
+        }
+    }
+
 protected:
-    virtual constexpr void task_processor(task_payload_type payload, image_like& out, integration_settings opts, default_rng& gen) noexcept = 0;
+    /// @param seed The same for all tasks of a frame
+    /// @param stop The one given to <code>integrate</code>, long tasks should check it every now and then
+    virtual constexpr void task_processor(task_payload_type payload, image_like& out, integration_settings opts, u64 seed, std::stop_token const& stop) noexcept = 0;
 
 private:
     task_generator_type m_task_generator;
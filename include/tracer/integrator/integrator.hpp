@@ -9,26 +9,56 @@
 
 #include <chrono>
 #include <memory>
+#include <stop_token>
+#include <utility>
 
 namespace trc {
 
+namespace detail {
+
+struct default_task {
+    std::pair<usize, usize> xy_start;
+    std::pair<usize, usize> span;
+};
+
+}// namespace detail
+
 struct integration_settings {
     usize samples = 0;
     std::chrono::seconds sample_for = std::chrono::years(1);
+
+    /// The number of worker threads, 0 picks a default depending on the build type and the machine
+    usize threads = 0;
 };
 
 struct integrator {
     integrator(std::shared_ptr<camera> camera, std::shared_ptr<scene> scene)
         : m_camera(std::move(camera))
-        , m_scene(std::move(scene)) {}
+        , m_scene(std::move(scene)) {
+        // integrate_tile runs on several threads at once, the light table has to be current before the first tile
+        if (m_scene) {
+            m_scene->update_light_table();
+        }
+    }
 
     virtual ~integrator() noexcept = default;
 
-    virtual constexpr void integrate(image_like& out, integration_settings opts, default_rng& gen) noexcept = 0;
+    /// @param stop Checked between tiles and between rounds of samples. Once a stop is requested, this returns within
+    /// roughly one tile's worth of work and the tiles it did not finish are left untouched.
+    virtual constexpr void integrate(image_like& out, integration_settings opts, default_rng& gen, std::stop_token const& stop = {}) noexcept = 0;
+
+    /// Renders a single tile of <code>out</code> on the calling thread, <code>out</code> must report the dimensions of
+    /// the whole frame.\n
+    /// Integrators that seed per pixel produce the same pixels as <code>integrate</code> would have when given the same
+    /// <code>seed</code>, regardless of how the frame was split up.
+    /// @return false if this integrator does not support rendering tiles
+    virtual constexpr auto integrate_tile(image_like& out, integration_settings opts, u64 seed, detail::default_task tile) noexcept -> bool {
+        return false;
+    }
 
 protected:
     std::shared_ptr<camera> m_camera{nullptr};
     std::shared_ptr<scene> m_scene{nullptr};
 };
 
-}
+}// namespace trc
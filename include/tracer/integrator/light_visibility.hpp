@@ -9,23 +9,26 @@ struct light_visibility_checker : detail::pixel_integrator {
         : pixel_integrator(std::move(camera), std::move(scene)) {}
 
 protected:
-    virtual constexpr auto kernel(vec2 xy, default_rng& gen) noexcept -> color final override {
-        ray ray = m_camera->generate_ray(xy, gen);
-
+    virtual constexpr auto kernel(ray const& camera_ray, ray_differentials const& differentials, default_rng& gen, aov_sample* aovs) noexcept -> color final override {
         intersection isect;
-        if (std::optional<intersection> isect_res = m_scene->intersect(ray); !isect_res) {
+        if (std::optional<intersection> isect_res = intersect_camera_ray(camera_ray, differentials); !isect_res) {
             return color{0, 0, 0};
         } else {
             isect = *isect_res;
         }
 
-        bound_shape picked_shape = m_scene->pick_light(gen);
+        record_first_hit(aovs, isect);
+
+        std::optional<light_pick> pick = m_scene->pick_light(gen, isect.isection_point, isect.get_global_normal());
+        if (!pick) {
+            return color(0);
+        }
 
-        intersection sample = VARIANT_CALL(picked_shape, sample_surface, gen);
+        intersection sample = VARIANT_CALL(*pick->shape, sample_surface, gen);
 
         bool hit = m_scene->visibility_check(isect.isection_point + isect.normal * 0.0001, sample.isection_point + sample.normal * 0.0001);
 
-        return hit ? color(VARIANT_CALL(picked_shape, surface_area)) : color(0);
+        return hit ? color(VARIANT_CALL(*pick->shape, surface_area) / pick->pdf) : color(0);
     }
 };
 
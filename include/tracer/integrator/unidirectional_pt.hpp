@@ -9,8 +9,8 @@ struct unidirectional_pt : detail::pixel_integrator {
         : pixel_integrator(std::move(camera), std::move(scene)) {}
 
 protected:
-    virtual auto kernel(vec2 xy, default_rng& gen) noexcept -> color final override {
-        ray ray = m_camera->generate_ray(xy, gen);
+    virtual auto kernel(ray const& camera_ray, ray_differentials const& differentials, default_rng& gen, aov_sample* aovs) noexcept -> color final override {
+        ray ray = camera_ray;
 
         constexpr usize depth_threshold = 3;
         constexpr real base_rr_prob = 0.05;
@@ -19,11 +19,12 @@ protected:
         color light{};
 
         for (usize depth = 0;; depth++) {
-            auto isect_res = m_scene->intersect(ray);
+            auto isect_res = depth == 0 ? intersect_camera_ray(ray, differentials) : m_scene->intersect(ray);
             if (!isect_res)
                 break;
 
             intersection isect = *isect_res;
+            record_first_hit(aovs, isect);
 
             auto interaction = VARIANT_CALL(m_scene->material(isect.material_index), sample, isect, gen);
             auto const& [wi, wi_pdf, albedo, emittance, _] = interaction;
@@ -54,6 +54,47 @@ struct intersection {
         };
     }
 
+    /// How far <code>uv</code> changes from one pixel to the next along x and y, zero for both unless
+    /// <code>differentials</code> is set. The offset rays are intersected with the tangent plane and the change of the
+    /// hit point is projected onto <code>dpduv</code>; only texture lookups need this, so it is not done up front.
+    constexpr auto uv_differentials() const -> std::pair<vec2, vec2> {
+        if (differentials == nullptr) {
+            return {};
+        }
+
+        const real plane_distance = dot(normal, isection_point);
+        const real x_cosine = dot(normal, differentials->x_direction);
+        const real y_cosine = dot(normal, differentials->y_direction);
+
+        // an offset ray running along the plane has no meaningful hit
+        if (std::abs(x_cosine) < epsilon || std::abs(y_cosine) < epsilon) {
+            return {};
+        }
+
+        const vec3 dpdx = differentials->x_origin + differentials->x_direction * ((plane_distance - dot(normal, differentials->x_origin)) / x_cosine) - isection_point;
+        const vec3 dpdy = differentials->y_origin + differentials->y_direction * ((plane_distance - dot(normal, differentials->y_origin)) / y_cosine) - isection_point;
+
+        // least squares solution of dpduv * duv = dp, dpduv is 3x2
+        auto const& [dpdu, dpdv] = dpduv;
+
+        const real uu = dot(dpdu, dpdu);
+        const real uv = dot(dpdu, dpdv);
+        const real vv = dot(dpdv, dpdv);
+        const real determinant = uu * vv - uv * uv;
+
+        if (std::abs(determinant) < epsilon * uu * vv) {
+            return {};
+        }
+
+        auto solve = [&](vec3 dp) -> vec2 {
+            const real u_projection = dot(dpdu, dp);
+            const real v_projection = dot(dpdv, dp);
+            return vec2{vv * u_projection - uv * v_projection, uu * v_projection - uv * u_projection} / determinant;
+        };
+
+        return {solve(dpdx), solve(dpdy)};
+    }
+
     constexpr auto get_global_wo() const -> vec3 { return wo; }
     constexpr auto get_local_wo() const -> vec3 { return vector_to_refl_space(wo); }
 
@@ -81,10 +122,16 @@ struct intersection {
     vec3 isection_point;             // global
     vec2 uv;                         // parametric
     std::pair<vec3, vec3> dpduv;     // global
+    /// Set by integrators on the first hit of camera rays, see <code>uv_differentials</code>
+    ray_differentials const* differentials = nullptr;
     mutable vec3 normal;             // global
     mutable std::pair<vec3, vec3> st;// global
 
     u32 material_index;
+    /// Index of the intersected shape, see <code>scene::intersect</code>
+    u32 shape_index = 0;
+    /// Index of the intersected primitive within the shape (e.g. the triangle of a mesh), 0 for simple shapes
+    u32 primitive_index = 0;
     mutable bool reflection_basis_computed = false;
 
 private:
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace trc::io::detail {
+
+/// A file descriptor that is closed on destruction.\n
+/// Reads and writes are positional so that several threads can write disjoint parts of a file at the same time.
+struct file {
+    file() = default;
+
+    explicit file(int fd)
+        : m_fd(fd) {}
+
+    file(file const&) = delete;
+    auto operator=(file const&) -> file& = delete;
+
+    file(file&& other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1)) {}
+
+    auto operator=(file&& other) noexcept -> file& {
+        release();
+        m_fd = std::exchange(other.m_fd, -1);
+        return *this;
+    }
+
+    ~file() { release(); }
+
+    /// Creates or truncates <code>path</code> for reading and writing
+    static auto create(std::string const& path) -> stf::expected<file, std::string> {
+        file ret{::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+        if (!ret) {
+            return stf::unexpected{errno_string(fmt::format("create \"{}\"", path))};
+        }
+
+        return ret;
+    }
+
+    /// Creates a file for scratch space on the file system <code>path</code> is on and removes it again right away, it
+    /// lives on while it is open or mapped
+    static auto create_anonymous(std::string const& path) -> stf::expected<file, std::string> {
+        auto ret = create(path);
+
+        if (ret && ::unlink(path.c_str()) != 0) {
+            return stf::unexpected{errno_string(fmt::format("unlink \"{}\"", path))};
+        }
+
+        return ret;
+    }
+
+    static auto open(std::string const& path) -> stf::expected<file, std::string> {
+        file ret{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (!ret) {
+            return stf::unexpected{errno_string(fmt::format("open \"{}\"", path))};
+        }
+
+        return ret;
+    }
+
+    auto write_at(std::span<const std::byte> data, u64 offset) -> bool {
+        while (!data.empty()) {
+            isize res = ::pwrite(m_fd, data.data(), data.size(), static_cast<off_t>(offset));
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (res <= 0) {
+                return false;
+            }
+
+            data = data.subspan(static_cast<usize>(res));
+            offset += static_cast<u64>(res);
+        }
+
+        return true;
+    }
+
+    /// @return false on errors and if the file ends before <code>buffer</code> is filled
+    auto read_at(std::span<std::byte> buffer, u64 offset) const -> bool {
+        while (!buffer.empty()) {
+            isize res = ::pread(m_fd, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (res <= 0) {
+                return false;
+            }
+
+            buffer = buffer.subspan(static_cast<usize>(res));
+            offset += static_cast<u64>(res);
+        }
+
+        return true;
+    }
+
+    auto size() const -> std::optional<u64> {
+        struct stat info {};
+        if (::fstat(m_fd, &info) != 0) {
+            return std::nullopt;
+        }
+
+        return static_cast<u64>(info.st_size);
+    }
+
+    /// Parts of the file that were never written read as zeros
+    auto resize(u64 size) -> bool { return ::ftruncate(m_fd, static_cast<off_t>(size)) == 0; }
+
+    /// Grows the file to at least <code>size</code> bytes and reserves the disk space for them, writes through a mapping
+    /// of the file cannot run out of space afterwards
+    auto allocate(u64 size) -> bool { return size == 0 || ::posix_fallocate(m_fd, 0, static_cast<off_t>(size)) == 0; }
+
+    /// Closing can report write errors that were deferred by the OS, e.g. on network file systems
+    auto close() -> stf::expected<void, std::string> {
+        if (m_fd < 0) {
+            return {};
+        }
+
+        int res = ::close(std::exchange(m_fd, -1));
+        if (res != 0 && errno != EINTR) {
+            return stf::unexpected{errno_string("close")};
+        }
+
+        return {};
+    }
+
+    explicit operator bool() const { return m_fd >= 0; }
+
+    auto descriptor() const -> int { return m_fd; }
+
+private:
+    int m_fd = -1;
+
+    void release() {
+        if (m_fd >= 0) {
+            ::close(std::exchange(m_fd, -1));
+        }
+    }
+
+    static auto errno_string(std::string_view what) -> std::string {
+        return fmt::format("{} failed: {}", what, std::strerror(errno));
+    }
+};
+
+}// namespace trc::io::detail
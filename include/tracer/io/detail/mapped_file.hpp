@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+#include <tracer/io/detail/file.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace trc::io::detail {
+
+/// A memory mapping of a whole file, unmapped on destruction. Read-only unless it is made through <code>map</code>.\n
+/// Pages are read in by the kernel as they are touched, parsers can work on the contents directly without copying them
+/// into buffers first.
+struct mapped_file {
+    mapped_file() = default;
+
+    mapped_file(mapped_file const&) = delete;
+    auto operator=(mapped_file const&) -> mapped_file& = delete;
+
+    mapped_file(mapped_file&& other) noexcept
+        : m_data(std::exchange(other.m_data, nullptr))
+        , m_size(std::exchange(other.m_size, 0)) {}
+
+    auto operator=(mapped_file&& other) noexcept -> mapped_file& {
+        release();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        return *this;
+    }
+
+    ~mapped_file() { release(); }
+
+    /// Maps <code>path</code> with the access pattern hinted as sequential, empty files map to an empty span
+    static auto open(std::string const& path) -> stf::expected<mapped_file, std::string> {
+        auto file_res = file::open(path);
+        if (!file_res) {
+            return stf::unexpected{file_res.error()};
+        }
+
+        auto size = file_res->size();
+        if (!size) {
+            return stf::unexpected{fmt::format("could not get the size of \"{}\"", path)};
+        }
+
+        mapped_file ret{};
+        if (*size == 0) {
+            return ret;
+        }
+
+        // the mapping stays valid once the descriptor is closed
+        void* data = ::mmap(nullptr, *size, PROT_READ, MAP_PRIVATE, file_res->descriptor(), 0);
+        if (data == MAP_FAILED) {
+            return stf::unexpected{fmt::format("mmap \"{}\" failed: {}", path, std::strerror(errno))};
+        }
+
+        ret.m_data = data;
+        ret.m_size = static_cast<usize>(*size);
+
+        ret.advise(MADV_SEQUENTIAL);
+
+        return ret;
+    }
+
+    /// Maps the first <code>size</code> bytes of <code>file</code> for reading and writing, the file has to be at least
+    /// that large and open for writing. Writes go to the file, the kernel writes them back as it sees fit and evicts
+    /// pages like it does those of a read-only mapping, so mappings larger than the memory of the machine work too.
+    static auto map(file const& file, usize size) -> stf::expected<mapped_file, std::string> {
+        mapped_file ret{};
+        if (size == 0) {
+            return ret;
+        }
+
+        void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file.descriptor(), 0);
+        if (data == MAP_FAILED) {
+            return stf::unexpected{fmt::format("mmap failed: {}", std::strerror(errno))};
+        }
+
+        ret.m_data = data;
+        ret.m_size = size;
+
+        return ret;
+    }
+
+    auto bytes() const -> std::span<const std::byte> { return {static_cast<const std::byte*>(m_data), m_size}; }
+
+    /// Only for mappings made through <code>map</code>
+    auto mutable_bytes() const -> std::span<std::byte> { return {static_cast<std::byte*>(m_data), m_size}; }
+    auto chars() const -> std::string_view { return {static_cast<const char*>(m_data), m_size}; }
+
+    auto size() const -> usize { return m_size; }
+
+    /// A hint to the kernel on how the mapping will be accessed, see <code>madvise(2)</code>, failures are ignored
+    void advise(int advice) const {
+        if (m_data != nullptr) {
+            ::madvise(m_data, m_size, advice);
+        }
+    }
+
+    /// Hints about the pages holding the bytes in [offset, offset + size).\n
+    /// With <code>inward</code> only pages lying completely within the range are affected, for advice like
+    /// <code>MADV_DONTNEED</code> that must not reach the neighbours of the range, otherwise every page the range touches.
+    void advise(int advice, usize offset, usize size, bool inward = false) const {
+        const usize page = page_size();
+
+        offset = std::min(offset, m_size);
+        const usize end = std::min(m_size, offset + size);
+
+        const usize first = inward ? (offset + page - 1) / page * page : offset / page * page;
+        const usize last = inward ? end / page * page : (end + page - 1) / page * page;
+
+        if (m_data == nullptr || first >= last) {
+            return;
+        }
+
+        ::madvise(static_cast<std::byte*>(m_data) + first, last - first, advice);
+    }
+
+    static auto page_size() -> usize {
+        static const usize size = static_cast<usize>(::sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+private:
+    void* m_data = nullptr;
+    usize m_size = 0;
+
+    void release() {
+        if (m_data != nullptr) {
+            ::munmap(std::exchange(m_data, nullptr), std::exchange(m_size, 0));
+        }
+    }
+};
+
+}// namespace trc::io::detail
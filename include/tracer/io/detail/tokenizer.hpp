@@ -0,0 +1,97 @@
+#pragma once
+
+#include <tracer/common.hpp>
+
+#include <charconv>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace trc::io::detail {
+
+/// Splits the contents of an ASCII file into whitespace separated tokens without copying them
+struct tokenizer {
+    std::string_view data;
+    usize position = 0;
+
+    constexpr auto next_token() -> std::optional<std::string_view> {
+        while (position < data.size() && is_space(data[position])) {
+            position++;
+        }
+
+        if (position == data.size()) {
+            return std::nullopt;
+        }
+
+        const usize begin = position;
+        while (position < data.size() && !is_space(data[position])) {
+            position++;
+        }
+
+        return data.substr(begin, position - begin);
+    }
+
+    template<typename T>
+    constexpr auto next(T& out) -> bool {
+        auto token = next_token();
+        return token && std::from_chars(token->data(), token->data() + token->size(), out).ec == std::errc{};
+    }
+
+    /// @return false if the next token is not <code>expected</code>
+    constexpr auto expect(std::string_view expected) -> bool { return next_token() == expected; }
+
+    constexpr auto skip_tokens(usize count) -> bool {
+        for (usize i = 0; i < count; i++) {
+            if (!next_token()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /// Skips to the start of the next line, for free-form text like names
+    constexpr void skip_line() {
+        const usize end = data.find('\n', position);
+        position = end == std::string_view::npos ? data.size() : end + 1;
+    }
+
+    static constexpr auto is_space(char c) -> bool { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+};
+
+/// The position after the <code>n</code>th newline from <code>position</code> or the end of <code>data</code>
+constexpr auto skip_lines(std::string_view data, usize position, usize n) -> usize {
+    for (usize i = 0; i < n; i++) {
+        position = data.find('\n', position);
+        if (position == std::string_view::npos) {
+            return data.size();
+        }
+
+        position++;
+    }
+
+    return position;
+}
+
+/// Splits <code>data</code> into at most <code>n_chunks</code> pieces of similar size that each end after a newline
+inline auto split_at_lines(std::string_view data, usize n_chunks) -> std::vector<std::string_view> {
+    std::vector<std::string_view> ret{};
+    ret.reserve(n_chunks);
+
+    usize begin = 0;
+    for (usize i = 1; i <= n_chunks && begin < data.size(); i++) {
+        const usize end = i == n_chunks ? data.size() : std::max(skip_lines(data, data.size() * i / n_chunks, 1), begin);
+
+        if (end != begin) {
+            ret.emplace_back(data.substr(begin, end - begin));
+        }
+
+        begin = end;
+    }
+
+    return ret;
+}
+
+}// namespace trc::io::detail
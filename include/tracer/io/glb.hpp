@@ -0,0 +1,502 @@
+#pragma once
+
+#include <tracer/affine_transform.hpp>
+#include <tracer/common.hpp>
+#include <tracer/io/detail/mapped_file.hpp>
+#include <tracer/io/json.hpp>
+
+#include <stuff/bit.hpp>
+#include <stuff/core.hpp>
+#include <stuff/expected.hpp>
+
+#include <fmt/format.h>
+
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace trc::io::glb {
+
+/// The elements of an accessor where they are in the mapped file, nothing is copied until they are read.\n
+/// Elements are read with memcpy since buffer views may interleave them with other attributes.
+template<typename T>
+struct accessor_view {
+    const std::byte* data = nullptr;
+    usize count = 0;
+    usize stride = sizeof(T);
+
+    auto operator[](usize i) const -> T {
+        T ret;
+        std::memcpy(&ret, data + i * stride, sizeof(T));
+
+        if constexpr (std::endian::native != std::endian::little) {
+            if constexpr (std::is_arithmetic_v<T>) {
+                ret = stf::bit::convert_endian(ret, std::endian::little, std::endian::native);
+            } else {
+                for (auto& component : ret) {
+                    component = stf::bit::convert_endian(component, std::endian::little, std::endian::native);
+                }
+            }
+        }
+
+        return ret;
+    }
+
+    auto size() const -> usize { return count; }
+};
+
+/// The triangles of one material of a mesh
+struct primitive {
+    accessor_view<std::array<float, 3>> positions;
+
+    /// Primitives without indices use their vertices in order
+    std::variant<std::monostate, accessor_view<u8>, accessor_view<u16>, accessor_view<u32>> indices;
+};
+
+struct mesh {
+    std::string name;
+    std::vector<primitive> primitives;
+};
+
+/// A node of the default scene that refers to a mesh, with the transforms of all its ancestors applied
+struct instance {
+    usize mesh;
+    affine_transform transform;
+};
+
+/// The accessors of the meshes point into <code>file</code> and stay valid for as long as the document does
+struct document {
+    io::detail::mapped_file file;
+
+    std::vector<mesh> meshes;
+    std::vector<instance> instances;
+};
+
+namespace detail {
+
+inline constexpr u32 magic = 0x46546C67;// "glTF"
+inline constexpr u32 json_chunk = 0x4E4F534A;
+inline constexpr u32 bin_chunk = 0x004E4942;
+
+inline constexpr u32 mode_triangles = 4;
+
+inline constexpr u32 component_u8 = 5121;
+inline constexpr u32 component_u16 = 5123;
+inline constexpr u32 component_u32 = 5125;
+inline constexpr u32 component_float = 5126;
+
+inline auto read_u32(std::span<const std::byte> data, usize offset) -> u32 {
+    u32 ret;
+    std::memcpy(&ret, data.data() + offset, sizeof(ret));
+    return stf::bit::convert_endian(ret, std::endian::little, std::endian::native);
+}
+
+/// @param what Names the value in errors
+inline auto to_index(json::value const& value, std::string_view what) -> stf::expected<usize, std::string> {
+    std::optional<real> number = value.number();
+    if (!number || *number < 0 || *number != std::floor(*number) || *number > static_cast<real>(std::numeric_limits<u32>::max())) {
+        return stf::unexpected{fmt::format("\"{}\" is not an index", what)};
+    }
+
+    return static_cast<usize>(*number);
+}
+
+/// @return An integer member that is not negative, <code>fallback</code> if it is missing
+inline auto get_index(json::value const& object, std::string_view key, std::optional<usize> fallback = std::nullopt) -> stf::expected<usize, std::string> {
+    json::value const* member = object.find(key);
+    if (member == nullptr) {
+        if (fallback) {
+            return *fallback;
+        }
+
+        return stf::unexpected{fmt::format("missing \"{}\"", key)};
+    }
+
+    return to_index(*member, key);
+}
+
+/// The elements of an array member, none if it is missing
+inline auto get_elements(json::value const& object, std::string_view key) -> std::span<const json::value> {
+    json::value const* member = object.find(key);
+    return member != nullptr ? member->elements() : std::span<const json::value>{};
+}
+
+/// @return The <code>index</code>th element of the array member <code>key</code> of the document
+inline auto get_element(json::value const& root, std::string_view key, usize index) -> stf::expected<json::value const*, std::string> {
+    json::value const* array = root.find(key);
+    if (array == nullptr || index >= array->elements().size()) {
+        return stf::unexpected{fmt::format("there is no \"{}\" {}", key, index)};
+    }
+
+    return &array->elements()[index];
+}
+
+/// Reads a fixed number of numbers from an array member, <code>fallback</code> if it is missing
+template<usize N>
+inline auto get_numbers(json::value const& object, std::string_view key, std::array<real, N> fallback) -> stf::expected<std::array<real, N>, std::string> {
+    json::value const* member = object.find(key);
+    if (member == nullptr) {
+        return fallback;
+    }
+
+    std::span<const json::value> elements = member->elements();
+    if (elements.size() != N) {
+        return stf::unexpected{fmt::format("\"{}\" needs {} numbers", key, N)};
+    }
+
+    std::array<real, N> ret;
+    for (usize i = 0; i < N; i++) {
+        std::optional<real> number = elements[i].number();
+        if (!number) {
+            return stf::unexpected{fmt::format("\"{}\" needs {} numbers", key, N)};
+        }
+
+        ret[i] = *number;
+    }
+
+    return ret;
+}
+
+struct accessor_info {
+    const std::byte* data;
+    usize count;
+    usize stride;
+    u32 component_type;
+};
+
+/// Resolves an accessor to where its elements are in the binary chunk, all ranges are checked against the chunk.
+/// Accessors without a buffer view (all zeros) and sparse accessors are not supported.
+inline auto get_accessor(json::value const& root, std::span<const std::byte> binary, usize index, std::string_view type) -> stf::expected<accessor_info, std::string> {
+    json::value const& accessor = *TRYX(get_element(root, "accessors", index));
+
+    if (accessor.find("sparse") != nullptr) {
+        return stf::unexpected{std::string("sparse accessors are not supported")};
+    }
+
+    if (accessor.find("type") == nullptr || accessor.find("type")->string() != type) {
+        return stf::unexpected{fmt::format("accessor {} is not a {}", index, type)};
+    }
+
+    json::value const& view = *TRYX(get_element(root, "bufferViews", TRYX(get_index(accessor, "bufferView"))));
+
+    // the binary chunk is the first buffer, other buffers live in separate files
+    json::value const& buffer = *TRYX(get_element(root, "buffers", TRYX(get_index(view, "buffer"))));
+    if (TRYX(get_index(view, "buffer")) != 0 || buffer.find("uri") != nullptr) {
+        return stf::unexpected{std::string("external buffers are not supported")};
+    }
+
+    const usize view_offset = TRYX(get_index(view, "byteOffset", 0));
+    const usize view_length = TRYX(get_index(view, "byteLength"));
+
+    if (view_offset > binary.size() || view_length > binary.size() - view_offset) {
+        return stf::unexpected{fmt::format("buffer view of accessor {} is out of bounds", index)};
+    }
+
+    accessor_info ret{
+      .data = nullptr,
+      .count = TRYX(get_index(accessor, "count")),
+      .stride = 0,
+      .component_type = static_cast<u32>(TRYX(get_index(accessor, "componentType"))),
+    };
+
+    usize component_size;
+    switch (ret.component_type) {
+        case component_u8: component_size = 1; break;
+        case component_u16: component_size = 2; break;
+        case component_u32: [[fallthrough]];
+        case component_float: component_size = 4; break;
+        default: return stf::unexpected{fmt::format("accessor {} has an unsupported component type", index)};
+    }
+
+    const usize element_size = component_size * (type == "VEC3" ? 3 : 1);
+    ret.stride = TRYX(get_index(view, "byteStride", element_size));
+
+    // strides are limited to 252 bytes by the specification
+    if (ret.stride < element_size || ret.stride > 252) {
+        return stf::unexpected{fmt::format("accessor {} has an invalid stride", index)};
+    }
+
+    const usize offset = TRYX(get_index(accessor, "byteOffset", 0));
+
+    // the last element only needs room for itself, not for a whole stride
+    if (ret.count != 0 && (offset > view_length || view_length - offset < element_size || (ret.count - 1) * ret.stride > view_length - offset - element_size)) {
+        return stf::unexpected{fmt::format("accessor {} is out of bounds", index)};
+    }
+
+    ret.data = binary.data() + view_offset + offset;
+
+    return ret;
+}
+
+inline auto read_primitive(json::value const& root, std::span<const std::byte> binary, json::value const& primitive) -> stf::expected<std::optional<glb::primitive>, std::string> {
+    // points and lines have no surface, strips and fans are rare enough to not be worth it
+    if (TRYX(get_index(primitive, "mode", mode_triangles)) != mode_triangles) {
+        return std::nullopt;
+    }
+
+    json::value const* attributes = primitive.find("attributes");
+    if (attributes == nullptr) {
+        return stf::unexpected{std::string("a primitive has no attributes")};
+    }
+
+    glb::primitive ret{};
+
+    const accessor_info positions = TRYX(get_accessor(root, binary, TRYX(get_index(*attributes, "POSITION")), "VEC3"));
+    if (positions.component_type != component_float) {
+        return stf::unexpected{std::string("positions have to be floats")};
+    }
+
+    ret.positions = {positions.data, positions.count, positions.stride};
+
+    if (primitive.find("indices") == nullptr) {
+        return ret;
+    }
+
+    const accessor_info indices = TRYX(get_accessor(root, binary, TRYX(get_index(primitive, "indices")), "SCALAR"));
+
+    switch (indices.component_type) {
+        case component_u8: ret.indices = accessor_view<u8>{indices.data, indices.count, indices.stride}; break;
+        case component_u16: ret.indices = accessor_view<u16>{indices.data, indices.count, indices.stride}; break;
+        case component_u32: ret.indices = accessor_view<u32>{indices.data, indices.count, indices.stride}; break;
+        default: return stf::unexpected{std::string("indices have to be unsigned integers")};
+    }
+
+    return ret;
+}
+
+/// The transform of a node relative to its parent, either a matrix or a translation, rotation and scale
+inline auto node_transform(json::value const& node) -> stf::expected<affine_transform, std::string> {
+    if (node.find("matrix") != nullptr) {
+        return affine_transform::from_columns(TRYX(get_numbers<16>(node, "matrix", {})));
+    }
+
+    const auto translation = TRYX(get_numbers<3>(node, "translation", {0, 0, 0}));
+    const auto rotation = TRYX(get_numbers<4>(node, "rotation", {0, 0, 0, 1}));
+    const auto scale = TRYX(get_numbers<3>(node, "scale", {1, 1, 1}));
+
+    return affine_transform::translate(vec3{translation[0], translation[1], translation[2]}) *
+           affine_transform::rotate(vec4{rotation[0], rotation[1], rotation[2], rotation[3]}) *
+           affine_transform::scale(vec3{scale[0], scale[1], scale[2]});
+}
+
+/// Walks the node trees of the default scene and emits an instance for every node with a mesh.\n
+/// Nodes with singular transforms are dropped, exporters hide nodes by scaling them to zero.
+inline auto gather_instances(json::value const& root, usize n_meshes) -> stf::expected<std::vector<instance>, std::string> {
+    const usize n_nodes = get_elements(root, "nodes").size();
+
+    std::vector<usize> roots{};
+
+    if (root.find("scenes") != nullptr) {
+        json::value const& scene = *TRYX(get_element(root, "scenes", TRYX(get_index(root, "scene", 0))));
+
+        for (json::value const& node : get_elements(scene, "nodes")) {
+            roots.push_back(TRYX(to_index(node, "nodes")));
+        }
+    } else {
+        // without scenes, every node that is not a child is a root
+        std::vector<bool> is_child(n_nodes, false);
+        for (usize i = 0; i < n_nodes; i++) {
+            json::value const& node = *TRYX(get_element(root, "nodes", i));
+            for (json::value const& child : get_elements(node, "children")) {
+                const usize child_index = TRYX(to_index(child, "children"));
+                if (child_index < n_nodes) {
+                    is_child[child_index] = true;
+                }
+            }
+        }
+
+        for (usize i = 0; i < n_nodes; i++) {
+            if (!is_child[i]) {
+                roots.push_back(i);
+            }
+        }
+    }
+
+    std::vector<instance> ret{};
+    std::vector<bool> visited(n_nodes, false);
+    std::vector<std::pair<usize, affine_transform>> stack{};
+
+    for (usize root_index : roots) {
+        stack.emplace_back(root_index, affine_transform::identity());
+    }
+
+    while (!stack.empty()) {
+        auto [index, parent] = stack.back();
+        stack.pop_back();
+
+        json::value const& node = *TRYX(get_element(root, "nodes", index));
+
+        // nodes can only have one parent, which also rules out cycles
+        if (visited[index]) {
+            return stf::unexpected{fmt::format("node {} appears more than once", index)};
+        }
+        visited[index] = true;
+
+        const affine_transform transform = parent * TRYX(node_transform(node));
+
+        if (node.find("mesh") != nullptr) {
+            const usize mesh = TRYX(get_index(node, "mesh"));
+            if (mesh >= n_meshes) {
+                return stf::unexpected{fmt::format("node {} refers to a mesh that does not exist", index)};
+            }
+
+            if (transform.inverse()) {
+                ret.push_back({mesh, transform});
+            }
+        }
+
+        for (json::value const& child : get_elements(node, "children")) {
+            stack.emplace_back(TRYX(to_index(child, "children")), transform);
+        }
+    }
+
+    return ret;
+}
+
+}// namespace detail
+
+/// Appends the triangles of a primitive whose vertices start at <code>first_vertex</code> within a mesh, indices are
+/// checked against the number of vertices.
+template<std::unsigned_integral IndexType>
+inline auto append_triangles(primitive const& primitive, usize first_vertex, std::vector<std::array<IndexType, 3>>& out) -> stf::expected<void, std::string> {
+    const usize n_vertices = primitive.positions.size();
+
+    if (first_vertex + n_vertices > static_cast<usize>(std::numeric_limits<IndexType>::max())) {
+        return stf::unexpected{std::string("too many vertices for the index type")};
+    }
+
+    // the visitor is only dispatched once, not once per index
+    return std::visit(
+      [&]<typename View>(View const& view) -> stf::expected<void, std::string> {
+          if constexpr (std::is_same_v<View, std::monostate>) {
+              for (usize i = 0; i + 2 < n_vertices; i += 3) {
+                  out.push_back({static_cast<IndexType>(first_vertex + i), static_cast<IndexType>(first_vertex + i + 1), static_cast<IndexType>(first_vertex + i + 2)});
+              }
+          } else {
+              out.reserve(out.size() + view.size() / 3);
+
+              for (usize i = 0; i + 2 < view.size(); i += 3) {
+                  std::array<IndexType, 3> triangle;
+
+                  for (usize corner = 0; corner < 3; corner++) {
+                      const usize index = view[i + corner];
+                      if (index >= n_vertices) {
+                          return stf::unexpected{std::string("an index refers to a vertex that does not exist")};
+                      }
+
+                      triangle[corner] = static_cast<IndexType>(first_vertex + index);
+                  }
+
+                  out.push_back(triangle);
+              }
+          }
+
+          return {};
+      },
+      primitive.indices);
+}
+
+/// Reads the meshes of a binary glTF file and the instances of them the nodes of its default scene place.\n
+/// The file is memory mapped, only the JSON chunk is parsed, vertex and index data stays where it is until it is read
+/// through the accessors.
+inline auto read_document(std::string const& path) -> stf::expected<document, std::string> {
+    auto with_path = [&path](std::string_view error) { return stf::unexpected{fmt::format("\"{}\": {}", path, error)}; };
+
+    auto file_res = io::detail::mapped_file::open(path);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    std::span<const std::byte> data = file_res->bytes();
+
+    if (data.size() < 20 || detail::read_u32(data, 0) != detail::magic) {
+        return with_path("not a binary glTF file");
+    }
+
+    if (detail::read_u32(data, 4) != 2) {
+        return with_path("only version 2 is supported");
+    }
+
+    if (detail::read_u32(data, 8) > data.size()) {
+        return with_path("the file is truncated");
+    }
+
+    data = data.first(detail::read_u32(data, 8));
+
+    std::string_view json_data{};
+    std::span<const std::byte> binary{};
+
+    for (usize offset = 12; offset + 8 <= data.size();) {
+        const usize length = detail::read_u32(data, offset);
+        const u32 type = detail::read_u32(data, offset + 4);
+
+        if (length > data.size() - offset - 8) {
+            return with_path("a chunk is truncated");
+        }
+
+        std::span<const std::byte> contents = data.subspan(offset + 8, length);
+
+        // the JSON chunk comes first and there is at most one binary chunk, unknown chunks are skipped
+        if (offset == 12 && type != detail::json_chunk) {
+            return with_path("the first chunk is not JSON");
+        }
+
+        if (type == detail::json_chunk && offset == 12) {
+            json_data = {reinterpret_cast<const char*>(contents.data()), contents.size()};
+        } else if (type == detail::bin_chunk && binary.empty()) {
+            binary = contents;
+        }
+
+        offset += 8 + length;
+    }
+
+    auto root_res = json::parse(json_data);
+    if (!root_res) {
+        return with_path(root_res.error());
+    }
+
+    json::value const& root = *root_res;
+
+    document ret{};
+
+    for (json::value const& mesh : detail::get_elements(root, "meshes")) {
+        glb::mesh& out = ret.meshes.emplace_back();
+
+        if (mesh.find("name") != nullptr && mesh.find("name")->string()) {
+            out.name = *mesh.find("name")->string();
+        }
+
+        for (json::value const& primitive : detail::get_elements(mesh, "primitives")) {
+            auto res = detail::read_primitive(root, binary, primitive);
+            if (!res) {
+                return with_path(fmt::format("mesh {}: {}", ret.meshes.size() - 1, res.error()));
+            }
+
+            if (*res) {
+                out.primitives.emplace_back(**res);
+            }
+        }
+    }
+
+    auto instances_res = detail::gather_instances(root, ret.meshes.size());
+    if (!instances_res) {
+        return with_path(instances_res.error());
+    }
+
+    ret.instances = std::move(*instances_res);
+
+    // the views point into the mapping, which does not move with the mapped_file
+    ret.file = std::move(*file_res);
+
+    return ret;
+}
+
+}// namespace trc::io::glb
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+
+#include <fmt/format.h>
+
+#include <charconv>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace trc::io::json {
+
+/// A parsed JSON document.\n
+/// Objects keep their members in the order of the file and are searched linearly, the documents this is used for
+/// (glTF headers, scene descriptions) have objects with a handful of members.
+struct value {
+    using array = std::vector<value>;
+    using object = std::vector<std::pair<std::string, value>>;
+
+    std::variant<std::nullptr_t, bool, real, std::string, array, object> data = nullptr;
+
+    template<typename T>
+    auto get() const -> T const* { return std::get_if<T>(&data); }
+
+    /// @return The member called <code>key</code>, nullptr if there is none or if this is not an object
+    auto find(std::string_view key) const -> value const* {
+        object const* members = get<object>();
+        if (members == nullptr) {
+            return nullptr;
+        }
+
+        for (auto const& [name, member] : *members) {
+            if (name == key) {
+                return &member;
+            }
+        }
+
+        return nullptr;
+    }
+
+    auto number() const -> std::optional<real> { return get<real>() != nullptr ? std::optional(*get<real>()) : std::nullopt; }
+
+    auto string() const -> std::optional<std::string_view> { return get<std::string>() != nullptr ? std::optional<std::string_view>(*get<std::string>()) : std::nullopt; }
+
+    /// Empty for anything but arrays
+    auto elements() const -> std::span<const value> { return get<array>() != nullptr ? std::span<const value>(*get<array>()) : std::span<const value>{}; }
+};
+
+namespace detail {
+
+/// Documents nested deeper than this are rejected instead of running out of stack
+inline constexpr usize max_depth = 256;
+
+struct parser {
+    std::string_view data;
+    usize position = 0;
+
+    auto parse_value(usize depth) -> stf::expected<value, std::string> {
+        if (depth > max_depth) {
+            return error("too deeply nested");
+        }
+
+        skip_whitespace();
+
+        if (position == data.size()) {
+            return error("unexpected end of input");
+        }
+
+        switch (data[position]) {
+            case '{': return parse_object(depth);
+            case '[': return parse_array(depth);
+            case '"': {
+                auto res = parse_string();
+                if (!res) {
+                    return stf::unexpected{res.error()};
+                }
+
+                return value{std::move(*res)};
+            }
+            case 't': return parse_literal("true", value{true});
+            case 'f': return parse_literal("false", value{false});
+            case 'n': return parse_literal("null", value{nullptr});
+            default: return parse_number();
+        }
+    }
+
+    void skip_whitespace() {
+        while (position < data.size() && (data[position] == ' ' || data[position] == '\t' || data[position] == '\n' || data[position] == '\r')) {
+            position++;
+        }
+    }
+
+    auto error(std::string_view what) const -> stf::unexpected<std::string> {
+        return stf::unexpected{fmt::format("{} at offset {}", what, position)};
+    }
+
+private:
+    auto consume(char c) -> bool {
+        skip_whitespace();
+
+        if (position < data.size() && data[position] == c) {
+            position++;
+            return true;
+        }
+
+        return false;
+    }
+
+    auto parse_literal(std::string_view literal, value ret) -> stf::expected<value, std::string> {
+        if (!data.substr(position).starts_with(literal)) {
+            return error("invalid literal");
+        }
+
+        position += literal.size();
+        return ret;
+    }
+
+    auto parse_number() -> stf::expected<value, std::string> {
+        // from_chars would also take "inf", "nan" and leading zeros, none of which are JSON
+        const usize begin = position;
+
+        if (position < data.size() && data[position] == '-') {
+            position++;
+        }
+
+        if (position == data.size() || data[position] < '0' || data[position] > '9') {
+            return error("invalid value");
+        }
+
+        if (data[position] == '0' && position + 1 < data.size() && data[position + 1] >= '0' && data[position + 1] <= '9') {
+            return error("leading zeros are not allowed");
+        }
+
+        real ret;
+        auto [end, error_code] = std::from_chars(data.data() + begin, data.data() + data.size(), ret);
+        if (error_code != std::errc{}) {
+            return error("invalid number");
+        }
+
+        position = static_cast<usize>(end - data.data());
+        return value{ret};
+    }
+
+    auto parse_hex_quad() -> std::optional<u32> {
+        if (data.size() - position < 4) {
+            return std::nullopt;
+        }
+
+        u32 ret;
+        auto [end, error_code] = std::from_chars(data.data() + position, data.data() + position + 4, ret, 16);
+        if (error_code != std::errc{} || end != data.data() + position + 4) {
+            return std::nullopt;
+        }
+
+        position += 4;
+        return ret;
+    }
+
+    static void append_utf8(std::string& out, u32 code_point) {
+        if (code_point < 0x80) {
+            out += static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            out += static_cast<char>(0xC0 | (code_point >> 6));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else if (code_point < 0x10000) {
+            out += static_cast<char>(0xE0 | (code_point >> 12));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code_point >> 18));
+            out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    auto parse_string() -> stf::expected<std::string, std::string> {
+        // the opening quote
+        position++;
+
+        std::string ret{};
+
+        for (;;) {
+            // runs without escapes are appended at once
+            const usize run_begin = position;
+            while (position < data.size() && data[position] != '"' && data[position] != '\\' && static_cast<unsigned char>(data[position]) >= 0x20) {
+                position++;
+            }
+
+            ret.append(data.substr(run_begin, position - run_begin));
+
+            if (position == data.size()) {
+                return error("unterminated string");
+            }
+
+            const char c = data[position++];
+
+            if (c == '"') {
+                return ret;
+            }
+
+            if (c != '\\') {
+                return error("control character in string");
+            }
+
+            if (position == data.size()) {
+                return error("unterminated string");
+            }
+
+            switch (const char escaped = data[position++]; escaped) {
+                case '"': ret += '"'; break;
+                case '\\': ret += '\\'; break;
+                case '/': ret += '/'; break;
+                case 'b': ret += '\b'; break;
+                case 'f': ret += '\f'; break;
+                case 'n': ret += '\n'; break;
+                case 'r': ret += '\r'; break;
+                case 't': ret += '\t'; break;
+                case 'u': {
+                    std::optional<u32> code_point = parse_hex_quad();
+                    if (!code_point) {
+                        return error("invalid unicode escape");
+                    }
+
+                    // characters outside the basic plane are escaped as utf-16 surrogate pairs
+                    if (*code_point >= 0xD800 && *code_point < 0xDC00 && data.substr(position).starts_with("\\u")) {
+                        position += 2;
+
+                        std::optional<u32> low = parse_hex_quad();
+                        if (!low || *low < 0xDC00 || *low >= 0xE000) {
+                            return error("invalid surrogate pair");
+                        }
+
+                        *code_point = 0x10000 + ((*code_point - 0xD800) << 10) + (*low - 0xDC00);
+                    }
+
+                    append_utf8(ret, *code_point);
+                    break;
+                }
+                default: return error("invalid escape");
+            }
+        }
+    }
+
+    auto parse_array(usize depth) -> stf::expected<value, std::string> {
+        // the opening bracket
+        position++;
+
+        value::array ret{};
+
+        if (consume(']')) {
+            return value{std::move(ret)};
+        }
+
+        do {
+            auto element = parse_value(depth + 1);
+            if (!element) {
+                return stf::unexpected{element.error()};
+            }
+
+            ret.emplace_back(std::move(*element));
+        } while (consume(','));
+
+        if (!consume(']')) {
+            return error("expected ',' or ']'");
+        }
+
+        return value{std::move(ret)};
+    }
+
+    auto parse_object(usize depth) -> stf::expected<value, std::string> {
+        // the opening brace
+        position++;
+
+        value::object ret{};
+
+        if (consume('}')) {
+            return value{std::move(ret)};
+        }
+
+        do {
+            skip_whitespace();
+            if (position == data.size() || data[position] != '"') {
+                return error("expected a member name");
+            }
+
+            auto name = parse_string();
+            if (!name) {
+                return stf::unexpected{name.error()};
+            }
+
+            if (!consume(':')) {
+                return error("expected ':'");
+            }
+
+            auto member = parse_value(depth + 1);
+            if (!member) {
+                return stf::unexpected{member.error()};
+            }
+
+            ret.emplace_back(std::move(*name), std::move(*member));
+        } while (consume(','));
+
+        if (!consume('}')) {
+            return error("expected ',' or '}'");
+        }
+
+        return value{std::move(ret)};
+    }
+};
+
+}// namespace detail
+
+/// Parses a whole document, anything but whitespace after the top level value is an error
+inline auto parse(std::string_view data) -> stf::expected<value, std::string> {
+    detail::parser parser{.data = data};
+
+    auto ret = parser.parse_value(0);
+    if (!ret) {
+        return ret;
+    }
+
+    parser.skip_whitespace();
+    if (parser.position != data.size()) {
+        return parser.error("trailing characters");
+    }
+
+    return ret;
+}
+
+}// namespace trc::io::json
@@ -0,0 +1,749 @@
+#pragma once
+
+#include <tracer/bvh/tree.hpp>
+#include <tracer/common.hpp>
+#include <tracer/detail/hash.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/io/detail/file.hpp>
+#include <tracer/io/detail/mapped_file.hpp>
+#include <tracer/shape/mesh.hpp>
+
+#include <stuff/expected.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace trc::io::mesh_cache {
+
+namespace detail {
+
+inline constexpr std::array<char, 8> magic{'t', 'r', 'c', 'm', 'e', 's', 'h', '\0'};
+/// Bump this whenever the layout of the file or the way meshes are built changes
+inline constexpr u32 version = 3;
+
+/// Arrays start at multiples of this within the file
+inline constexpr usize alignment = 64;
+
+/// Arrays are written through a buffer of this many bytes
+inline constexpr usize write_chunk_size = usize(1) << 16;
+
+/// Files modified this recently may still change without their modification time changing, timestamps are as coarse as
+/// two seconds on some file systems
+inline constexpr std::chrono::seconds racy_window{2};
+
+/// The number of consecutive triangles forming a cluster, see <code>header</code>
+inline constexpr u64 cluster_size = 4096;
+
+/// Followed by the vertices, the triangles, the nodes of the tree, the cluster table and the running sums of the triangle
+/// areas, each an array of records at the given offset.\n
+/// All references between the arrays are indices, nothing needs to be fixed up after reading them back.\n
+/// Triangles are in the order the tree left them in, so that every subtree is a contiguous run of them, and vertices are
+/// in the order the triangles first use them. Runs of <code>cluster_size</code> triangles form clusters, the cluster
+/// table holds the index of the first vertex first used by each cluster and the number of vertices at its end, a
+/// cluster and the vertices it introduces lie on a few pages of the file each. Rendering straight from the file relies
+/// on this (see <code>shapes::mapped_mesh</code>).
+struct header {
+    std::array<char, 8> magic;
+    u32 version;
+    /// Caches are machine-local, the byte order is only checked
+    u32 byte_order_mark;
+    u32 index_size;
+    u32 real_size;
+
+    u64 key;
+
+    u64 n_vertices;
+    u64 n_triangles;
+    u64 n_nodes;
+    u64 depth;
+
+    u64 vertices_offset;
+    u64 triangles_offset;
+    u64 nodes_offset;
+
+    u64 cluster_size;
+    u64 n_clusters;
+    u64 clusters_offset;
+
+    u64 areas_offset;
+
+    std::array<real, 3> bounds_min;
+    std::array<real, 3> bounds_max;
+    std::array<real, 3> center;
+    real surface_area;
+};
+
+using vertex_record = std::array<real, 3>;
+
+/// The fourth index pads the record to a multiple of 8 bytes
+template<std::unsigned_integral IndexType>
+struct triangle_record {
+    std::array<real, 3> normal;
+    std::array<IndexType, 4> vertex_indices;
+};
+
+constexpr auto to_array(vec3 const& vec) -> std::array<real, 3> { return {vec[0], vec[1], vec[2]}; }
+
+constexpr auto to_vec3(std::array<real, 3> const& array) -> vec3 { return {array[0], array[1], array[2]}; }
+
+constexpr auto align_up(u64 offset) -> u64 { return (offset + alignment - 1) / alignment * alignment; }
+
+template<std::unsigned_integral IndexType>
+constexpr auto expected_header(u64 key) -> header {
+    return {
+      .magic = magic,
+      .version = version,
+      .byte_order_mark = 0x01020304,
+      .index_size = sizeof(IndexType),
+      .real_size = sizeof(real),
+      .key = key,
+      .cluster_size = cluster_size,
+    };
+}
+
+/// Whether <code>read</code> heads a cache written for <code>key</code> by this version, for this index type and machine
+template<std::unsigned_integral IndexType>
+constexpr auto header_matches(header const& read, u64 key) -> bool {
+    const header expected = expected_header<IndexType>(key);
+
+    return read.magic == expected.magic && read.version == expected.version && read.byte_order_mark == expected.byte_order_mark &&
+           read.index_size == expected.index_size && read.real_size == expected.real_size && read.key == expected.key &&
+           read.cluster_size == expected.cluster_size;
+}
+
+/// The tree is complete, its node count follows from its depth and the children of node i are at 2i + 1 and 2i + 2
+/// (see <code>construct_bvh_nodes</code>)
+constexpr auto tree_matches(header const& read) -> bool {
+    return read.depth < 64 && read.n_nodes == (u64(1) << read.depth) - 1;
+}
+
+/// @return The records of an array if it lies within <code>data</code>
+template<typename Record>
+auto get_records(std::span<const std::byte> data, u64 offset, u64 count) -> std::optional<std::span<const std::byte>> {
+    if (offset > data.size() || count > (data.size() - offset) / sizeof(Record)) {
+        return std::nullopt;
+    }
+
+    return data.subspan(static_cast<usize>(offset), static_cast<usize>(count) * sizeof(Record));
+}
+
+/// Writes the records <code>record(i)</code> for i in [0, <code>count</code>) to <code>file</code> at <code>offset</code>,
+/// a chunk at a time
+template<typename Record, typename Fn>
+auto write_records(io::detail::file& file, u64 offset, usize count, Fn&& record) -> bool {
+    constexpr usize records_per_chunk = std::max<usize>(write_chunk_size / sizeof(Record), 1);
+
+    std::vector<std::byte> chunk(std::min(count, records_per_chunk) * sizeof(Record));
+
+    for (usize begin = 0; begin < count; begin += records_per_chunk) {
+        const usize end = std::min(begin + records_per_chunk, count);
+
+        for (usize i = begin; i < end; i++) {
+            const Record value = std::invoke(record, i);
+            std::memcpy(chunk.data() + (i - begin) * sizeof(Record), &value, sizeof(Record));
+        }
+
+        if (!file.write_at(std::span<const std::byte>(chunk).first((end - begin) * sizeof(Record)), offset + begin * sizeof(Record))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// A name next to <code>path</code> that no other thread or process uses at the same time
+inline auto temporary_path(std::string const& path, std::string_view suffix = {}) -> std::string {
+    // meshes loaded on several threads can share a key, so can processes
+    return fmt::format("{}.{}.{:x}{}.tmp", path, ::getpid(), std::hash<std::thread::id>{}(std::this_thread::get_id()), suffix);
+}
+
+/// Writes a file through <code>fn(io::detail::file&) -> bool</code> under a temporary name first and renames it to
+/// <code>path</code> afterwards, concurrent loads never see a partial file
+template<typename Fn>
+auto write_atomically(std::string const& path, Fn&& fn) -> stf::expected<void, std::string> {
+    const std::string temporary = temporary_path(path);
+
+    auto file_res = io::detail::file::create(temporary);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    if (!std::invoke(fn, *file_res)) {
+        std::error_code ec;
+        std::filesystem::remove(temporary, ec);
+        return stf::unexpected{fmt::format("could not write \"{}\"", temporary)};
+    }
+
+    if (auto res = file_res->close(); !res) {
+        std::error_code ec;
+        std::filesystem::remove(temporary, ec);
+        return res;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        std::filesystem::remove(temporary, ec);
+        return stf::unexpected{fmt::format("could not rename \"{}\": {}", temporary, ec.message())};
+    }
+
+    return {};
+}
+
+/// Renumbers the vertices in the order the triangles first use them, the ones no triangle uses go last
+/// @param indices <code>indices(i)</code> are the vertex indices of triangle i
+/// @param new_index, old_index Filled with the new index of every vertex and the old index of every new one
+/// @return The cluster table, see <code>header</code>
+template<std::unsigned_integral IndexType, typename IndicesFn>
+auto renumber_vertices(usize n_triangles, IndicesFn&& indices, std::span<IndexType> new_index, std::span<IndexType> old_index) -> std::vector<u64> {
+    constexpr IndexType unused = static_cast<IndexType>(-1);
+    std::ranges::fill(new_index, unused);
+
+    std::vector<u64> cluster_vertices{};
+    cluster_vertices.reserve((n_triangles + cluster_size - 1) / cluster_size + 1);
+
+    usize n_renumbered = 0;
+    for (usize i = 0; i < n_triangles; i++) {
+        if (i % cluster_size == 0) {
+            cluster_vertices.push_back(n_renumbered);
+        }
+
+        for (IndexType index : std::invoke(indices, i)) {
+            if (new_index[index] == unused) {
+                new_index[index] = static_cast<IndexType>(n_renumbered++);
+            }
+        }
+    }
+
+    cluster_vertices.push_back(n_renumbered);
+
+    for (IndexType& index : new_index) {
+        if (index == unused) {
+            index = static_cast<IndexType>(n_renumbered++);
+        }
+    }
+
+    for (usize i = 0; i < new_index.size(); i++) {
+        old_index[new_index[i]] = static_cast<IndexType>(i);
+    }
+
+    return cluster_vertices;
+}
+
+/// Lays the arrays out after <code>header</code>, which has everything but the offsets filled in already, and writes
+/// them and the header to <code>file</code>. The records are <code>vertex(i)</code>, <code>triangle(i)</code>,
+/// <code>node(i)</code> and <code>area_sum(i)</code>.
+template<std::unsigned_integral IndexType, typename VertexFn, typename TriangleFn, typename NodeFn, typename AreaSumFn>
+auto write_mesh(io::detail::file& file, header& header, std::span<const u64> cluster_vertices, VertexFn&& vertex, TriangleFn&& triangle, NodeFn&& node, AreaSumFn&& area_sum) -> bool {
+    header.n_clusters = cluster_vertices.size() - 1;
+    header.vertices_offset = align_up(sizeof(header));
+    header.triangles_offset = align_up(header.vertices_offset + header.n_vertices * sizeof(vertex_record));
+    header.nodes_offset = align_up(header.triangles_offset + header.n_triangles * sizeof(triangle_record<IndexType>));
+    header.clusters_offset = align_up(header.nodes_offset + header.n_nodes * sizeof(bvh_node_record));
+    header.areas_offset = align_up(header.clusters_offset + cluster_vertices.size_bytes());
+
+    // the arrays are written one after the other, the gaps between them are never written and read as zeros
+    return file.write_at(std::as_bytes(std::span(&header, 1)), 0) &&
+           write_records<vertex_record>(file, header.vertices_offset, header.n_vertices, std::forward<VertexFn>(vertex)) &&
+           write_records<triangle_record<IndexType>>(file, header.triangles_offset, header.n_triangles, std::forward<TriangleFn>(triangle)) &&
+           write_records<bvh_node_record>(file, header.nodes_offset, header.n_nodes, std::forward<NodeFn>(node)) &&
+           file.write_at(std::as_bytes(cluster_vertices), header.clusters_offset) &&
+           write_records<real>(file, header.areas_offset, header.n_triangles, std::forward<AreaSumFn>(area_sum));
+}
+
+/// An array of records in a scratch file, which is removed as soon as it is created. Records are appended through a
+/// buffer, the array is worked on through a mapping of the file afterwards.
+template<typename Record>
+struct scratch_array {
+    static auto create(std::string const& path) -> stf::expected<scratch_array, std::string> {
+        auto file_res = io::detail::file::create_anonymous(path);
+        if (!file_res) {
+            return stf::unexpected{file_res.error()};
+        }
+
+        scratch_array ret{};
+        ret.m_file = std::move(*file_res);
+
+        return ret;
+    }
+
+    void push_back(Record const& record) {
+        std::span<const std::byte> bytes = std::as_bytes(std::span(&record, 1));
+        m_buffer.insert(m_buffer.end(), bytes.begin(), bytes.end());
+        m_size++;
+
+        if (m_buffer.size() >= write_chunk_size) {
+            flush();
+        }
+    }
+
+    /// Grows the array to <code>size</code> records, for arrays that are only filled in through <code>map</code>
+    auto resize(usize size) -> bool {
+        flush();
+        m_size = size;
+        m_failed |= !m_file.allocate(size * sizeof(Record));
+
+        return !m_failed;
+    }
+
+    /// Forgets the records appended so far
+    void clear() {
+        m_buffer.clear();
+        m_written = 0;
+        m_size = 0;
+    }
+
+    auto size() const -> usize { return m_size; }
+
+    /// @return An error if any write to the file failed
+    auto map() -> stf::expected<std::span<Record>, std::string> {
+        flush();
+
+        if (m_failed) {
+            return stf::unexpected{std::string("could not write to a scratch file")};
+        }
+
+        auto mapping_res = io::detail::mapped_file::map(m_file, m_size * sizeof(Record));
+        if (!mapping_res) {
+            return stf::unexpected{mapping_res.error()};
+        }
+
+        m_mapping = std::move(*mapping_res);
+
+        return std::span<Record>(reinterpret_cast<Record*>(m_mapping.mutable_bytes().data()), m_size);
+    }
+
+private:
+    io::detail::file m_file{};
+    io::detail::mapped_file m_mapping{};
+
+    std::vector<std::byte> m_buffer{};
+    u64 m_written = 0;
+    usize m_size = 0;
+    bool m_failed = false;
+
+    void flush() {
+        m_failed |= !m_file.write_at(m_buffer, m_written);
+        m_written += m_buffer.size();
+        m_buffer.clear();
+    }
+};
+
+/// Converts records to the in-memory type in parallel, element by element since the in-memory types are not required
+/// to be trivially copyable
+template<typename Record, typename T, typename Fn>
+void convert_records(std::span<const std::byte> records, std::vector<T>& out, Fn&& convert) {
+    out.resize(records.size() / sizeof(Record));
+
+    trc::detail::parallel_for(out.size(), 0, [&](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            Record record;
+            std::memcpy(&record, records.data() + i * sizeof(Record), sizeof(Record));
+            out[i] = std::invoke(convert, record);
+        }
+    });
+}
+
+}// namespace detail
+
+/// Where caches go: <code>$TRACER_CACHE_DIR</code>, <code>$XDG_CACHE_HOME/tracer</code> or
+/// <code>$HOME/.cache/tracer</code>, the first one that is set. An empty <code>TRACER_CACHE_DIR</code> disables caching.
+inline auto default_directory() -> std::optional<std::filesystem::path> {
+    if (const char* dir = std::getenv("TRACER_CACHE_DIR"); dir != nullptr) {
+        return *dir == '\0' ? std::nullopt : std::optional<std::filesystem::path>(dir);
+    }
+
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir != nullptr && *dir != '\0') {
+        return std::filesystem::path(dir) / "tracer";
+    }
+
+    if (const char* dir = std::getenv("HOME"); dir != nullptr && *dir != '\0') {
+        return std::filesystem::path(dir) / ".cache" / "tracer";
+    }
+
+    return std::nullopt;
+}
+
+/// A key for the mesh built from the file at <code>path</code> with the parameters in <code>parameters</code>.\n
+/// The file is identified by its canonical path, size and modification time, looking for a cache does not read it.
+/// Its contents are only hashed if it was modified within <code>detail::racy_window</code>, a later write within the
+/// same timestamp would go unnoticed otherwise.
+inline auto source_key(std::string const& path, std::span<const std::byte> parameters) -> stf::expected<u64, std::string> {
+    std::error_code ec;
+
+    const std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+    const u64 size = ec ? 0 : std::filesystem::file_size(canonical, ec);
+    const std::filesystem::file_time_type modified = ec ? std::filesystem::file_time_type{} : std::filesystem::last_write_time(canonical, ec);
+
+    if (ec) {
+        return stf::unexpected{fmt::format("could not stat \"{}\": {}", path, ec.message())};
+    }
+
+    const std::array<u64, 3> identity{detail::version, size, static_cast<u64>(modified.time_since_epoch().count())};
+
+    u64 key = trc::detail::hash_bytes(std::as_bytes(std::span(canonical.native())));
+    key = trc::detail::hash_bytes(std::as_bytes(std::span(identity)), key);
+
+    if (std::filesystem::file_time_type::clock::now() - modified < detail::racy_window) {
+        auto file_res = io::detail::mapped_file::open(canonical.string());
+        if (!file_res) {
+            return stf::unexpected{file_res.error()};
+        }
+
+        key = trc::detail::hash_bytes(file_res->bytes(), key);
+    }
+
+    return trc::detail::hash_bytes(parameters, key);
+}
+
+/// Reads back a mesh stored with <code>store</code>.\n
+/// The file is memory mapped and its arrays are copied into the mesh as they are, the tree is not rebuilt.
+/// @return nullopt if there is no cache for <code>key</code> at <code>path</code> or if it was written by a different
+/// version or for a different index type
+template<std::unsigned_integral IndexType>
+auto load(std::string const& path, u64 key, u32 mat_idx) -> std::optional<shapes::mesh<IndexType>> {
+    using triangle_type = typename shapes::mesh<IndexType>::triangle_type;
+    using node_type = typename shapes::mesh<IndexType>::node_type;
+
+    auto file_res = io::detail::mapped_file::open(path);
+    if (!file_res || file_res->size() < sizeof(detail::header)) {
+        return std::nullopt;
+    }
+
+    std::span<const std::byte> data = file_res->bytes();
+
+    detail::header header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if (!detail::header_matches<IndexType>(header, key) || !detail::tree_matches(header)) {
+        return std::nullopt;
+    }
+
+    auto vertex_records = TRYX(detail::get_records<detail::vertex_record>(data, header.vertices_offset, header.n_vertices));
+    auto triangle_records = TRYX(detail::get_records<detail::triangle_record<IndexType>>(data, header.triangles_offset, header.n_triangles));
+    auto node_records = TRYX(detail::get_records<bvh_node_record>(data, header.nodes_offset, header.n_nodes));
+
+    shapes::constructed_mesh<IndexType> constructed{
+      .depth = static_cast<usize>(header.depth),
+      .bounds = {detail::to_vec3(header.bounds_min), detail::to_vec3(header.bounds_max)},
+      .center = detail::to_vec3(header.center),
+      .surface_area = header.surface_area,
+    };
+
+    detail::convert_records<detail::vertex_record>(vertex_records, constructed.vertices, detail::to_vec3);
+
+    detail::convert_records<detail::triangle_record<IndexType>>(triangle_records, constructed.triangles, [](detail::triangle_record<IndexType> const& record) {
+        return triangle_type{
+          .vertex_indices{record.vertex_indices[0], record.vertex_indices[1], record.vertex_indices[2]},
+          .normal = detail::to_vec3(record.normal),
+        };
+    });
+
+    detail::convert_records<bvh_node_record>(node_records, constructed.nodes, node_type::from_record);
+
+    // a cache that passed the checks above but refers to things that do not exist has been tampered with
+    for (usize i = 0; i < header.n_nodes; i++) {
+        bvh_node_record record;
+        std::memcpy(&record, node_records.data() + i * sizeof(record), sizeof(record));
+
+        if (record.shape_extents[0] > record.shape_extents[1] || record.shape_extents[1] > header.n_triangles) {
+            return std::nullopt;
+        }
+
+        // traversal descends into the children of every node that is not a leaf
+        if (record.is_leaf == 0 && i * 2 + 2 >= header.n_nodes) {
+            return std::nullopt;
+        }
+    }
+
+    for (triangle_type const& tri : constructed.triangles) {
+        for (IndexType index : tri.vertex_indices) {
+            if (index >= constructed.vertices.size()) {
+                return std::nullopt;
+            }
+        }
+    }
+
+    return shapes::mesh<IndexType>(mat_idx, std::move(constructed));
+}
+
+/// Writes a constructed mesh so that <code>load</code> can read it back, array by array without building the file in
+/// memory.\n
+/// The file is written under a temporary name first and then renamed, concurrent loads never see a partial cache.\n
+/// Safe to call from several threads at once.
+template<std::unsigned_integral IndexType>
+auto store(std::string const& path, u64 key, shapes::mesh<IndexType> const& mesh) -> stf::expected<void, std::string> {
+    using triangle_type = typename shapes::mesh<IndexType>::triangle_type;
+
+    std::span<const vec3> vertices = mesh.vertices();
+    std::span<const triangle_type> triangles = mesh.triangles();
+    std::span<const real> area_sums = mesh.area_cdf();
+    auto nodes = mesh.nodes();
+
+    detail::header header = detail::expected_header<IndexType>(key);
+    header.n_vertices = vertices.size();
+    header.n_triangles = triangles.size();
+    header.n_nodes = nodes.size();
+    header.depth = mesh.depth();
+    header.bounds_min = detail::to_array(mesh.bounds().first);
+    header.bounds_max = detail::to_array(mesh.bounds().second);
+    header.center = detail::to_array(triangles.empty() ? vec3{} : mesh.center());
+    header.surface_area = mesh.surface_area();
+
+    std::vector<IndexType> new_index(vertices.size());
+    std::vector<IndexType> old_index(vertices.size());
+    const std::vector<u64> cluster_vertices = detail::renumber_vertices<IndexType>(triangles.size(), [&](usize i) { return triangles[i].vertex_indices; }, new_index, old_index);
+
+    return detail::write_atomically(path, [&](io::detail::file& file) {
+        return detail::write_mesh<IndexType>(
+          file, header, cluster_vertices,//
+          [&](usize i) { return detail::to_array(vertices[old_index[i]]); },
+          [&](usize i) {
+              auto const& indices = triangles[i].vertex_indices;
+              return detail::triangle_record<IndexType>{
+                .normal = detail::to_array(triangles[i].normal),
+                .vertex_indices{new_index[indices[0]], new_index[indices[1]], new_index[indices[2]], 0},
+              };
+          },
+          [&](usize i) { return nodes[i].to_record(); },
+          [&](usize i) { return area_sums[i]; });
+    });
+}
+
+/// Writes the cache of a mesh that is streamed in from its source file, for meshes that do not fit into memory.\n
+/// Everything pushed goes to scratch files next to the cache, which are removed as soon as they are created, and is
+/// worked on through mappings of them. The cache is the one <code>store</code> writes for a <code>shapes::mesh</code>
+/// made of the same vertices and triangles, transformed with <code>transform</code> and constructed with
+/// <code>finish_construction</code>.
+template<std::unsigned_integral IndexType>
+struct builder {
+    /// @param path Where the cache goes
+    static auto create(std::string const& path, mat4x4 const& transform) -> stf::expected<builder, std::string> {
+        auto raw_vertices_res = detail::scratch_array<detail::vertex_record>::create(detail::temporary_path(path, ".raw"));
+        if (!raw_vertices_res) {
+            return stf::unexpected{raw_vertices_res.error()};
+        }
+
+        auto vertices_res = detail::scratch_array<detail::vertex_record>::create(detail::temporary_path(path, ".vertices"));
+        if (!vertices_res) {
+            return stf::unexpected{vertices_res.error()};
+        }
+
+        auto triangles_res = detail::scratch_array<std::array<IndexType, 3>>::create(detail::temporary_path(path, ".triangles"));
+        if (!triangles_res) {
+            return stf::unexpected{triangles_res.error()};
+        }
+
+        builder ret{};
+        ret.m_path = path;
+        ret.m_transform = transform;
+        ret.m_raw_vertices = std::move(*raw_vertices_res);
+        ret.m_vertices = std::move(*vertices_res);
+        ret.m_triangles = std::move(*triangles_res);
+
+        return ret;
+    }
+
+    /// Adds vertices, triangles refer to them by the order they were pushed in
+    void push_vertices(std::span<const vec3> vertices) {
+        for (vec3 const& vert : vertices) {
+            // the same way mesh::transform does it
+            vec4 temp(vert, 1);
+            temp = m_transform * temp;
+            const vec3 transformed = vec3(temp) / temp[3];
+
+            m_bounds.bump(transformed);
+
+            m_raw_vertices.push_back(detail::to_array(vert));
+            m_vertices.push_back(detail::to_array(transformed));
+        }
+    }
+
+    void push_triangles(std::span<const std::array<IndexType, 3>> triangles) {
+        for (std::array<IndexType, 3> const& indices : triangles) {
+            m_triangles.push_back(indices);
+        }
+    }
+
+    /// Adds triangles that do not share vertices, like the ones of STL files. Their vertices are not welded.
+    void push_triangles(std::span<const std::array<vec3, 3>> triangles) {
+        for (std::array<vec3, 3> const& vertices : triangles) {
+            const auto first = static_cast<IndexType>(m_vertices.size());
+
+            push_vertices(vertices);
+            m_triangles.push_back({first, static_cast<IndexType>(first + 1), static_cast<IndexType>(first + 2)});
+        }
+    }
+
+    /// Forgets everything pushed so far
+    void clear() {
+        m_raw_vertices.clear();
+        m_vertices.clear();
+        m_triangles.clear();
+        m_bounds = {};
+    }
+
+    /// Builds the tree and writes the cache, see <code>store</code>
+    /// @param depth See <code>mesh::finish_construction</code>
+    auto finish(u64 key, usize depth = 12) -> stf::expected<void, std::string> {
+        const usize n_vertices = m_vertices.size();
+        const usize n_triangles = m_triangles.size();
+
+        if (n_triangles == 0) {
+            return stf::unexpected{std::string("the mesh has no triangles")};
+        }
+
+        if (n_vertices > static_cast<usize>(std::numeric_limits<IndexType>::max())) {
+            return stf::unexpected{std::string("too many vertices for the index type")};
+        }
+
+        std::span<const detail::vertex_record> raw_vertices = TRYX(m_raw_vertices.map());
+        std::span<const detail::vertex_record> vertices = TRYX(m_vertices.map());
+        std::span<const std::array<IndexType, 3>> triangles = TRYX(m_triangles.map());
+
+        auto tree_triangles_res = detail::scratch_array<tree_triangle>::create(detail::temporary_path(m_path, ".tree"));
+        if (!tree_triangles_res || !tree_triangles_res->resize(n_triangles)) {
+            return stf::unexpected{tree_triangles_res ? std::string("could not allocate a scratch file") : tree_triangles_res.error()};
+        }
+
+        std::span<tree_triangle> tree_triangles = TRYX(tree_triangles_res->map());
+
+        // the same way mesh::push_triangle, mesh::transform and mesh::finish_construction do it, in the same order
+        vec3 center_sum{};
+        real surface_area = 0;
+
+        for (usize i = 0; i < n_triangles; i++) {
+            std::array<IndexType, 3> const& indices = triangles[i];
+            if (std::ranges::any_of(indices, [n_vertices](IndexType index) { return index >= n_vertices; })) {
+                return stf::unexpected{std::string("a triangle refers to a vertex that does not exist")};
+            }
+
+            const vec3 raw_0 = detail::to_vec3(raw_vertices[indices[0]]);
+            vec4 normal(normalize(cross(detail::to_vec3(raw_vertices[indices[1]]) - raw_0, detail::to_vec3(raw_vertices[indices[2]]) - raw_0)), 0);
+            normal = m_transform * normal;
+
+            const vec3 vert_0 = detail::to_vec3(vertices[indices[0]]);
+            const vec3 vert_1 = detail::to_vec3(vertices[indices[1]]);
+            const vec3 vert_2 = detail::to_vec3(vertices[indices[2]]);
+            vec3 edge_0 = vert_1 - vert_0;
+            vec3 edge_1 = vert_2 - vert_0;
+
+            const vec3 center = (vert_0 + vert_1 + vert_2) / 3;
+            const real area = abs(cross(edge_0, edge_1)) / 2;
+
+            center_sum = center_sum + center;
+            surface_area += area;
+
+            bounding_box bounds{};
+            bounds.bump(vert_0);
+            bounds.bump(vert_1);
+            bounds.bump(vert_2);
+
+            tree_triangles[i] = {
+              .triangle{
+                .normal = detail::to_array(normalize(vec3(normal))),
+                .vertex_indices{indices[0], indices[1], indices[2], 0},
+              },
+              .center = detail::to_array(center),
+              .bounds_min = detail::to_array(bounds.bounds.first),
+              .bounds_max = detail::to_array(bounds.bounds.second),
+              .area_sum = area,
+            };
+        }
+
+        auto [nodes, n_layers] = construct_bvh_nodes(
+          tree_triangles, depth,//
+          [](tree_triangle const& tri) { return detail::to_vec3(tri.center); },
+          [](tree_triangle const& tri) { return std::pair{detail::to_vec3(tri.bounds_min), detail::to_vec3(tri.bounds_max)}; });
+
+        real area_sum = 0;
+        for (tree_triangle& tri : tree_triangles) {
+            area_sum += tri.area_sum;
+            tri.area_sum = area_sum;
+        }
+
+        auto new_index_res = detail::scratch_array<IndexType>::create(detail::temporary_path(m_path, ".new"));
+        auto old_index_res = detail::scratch_array<IndexType>::create(detail::temporary_path(m_path, ".old"));
+        if (!new_index_res || !old_index_res || !new_index_res->resize(n_vertices) || !old_index_res->resize(n_vertices)) {
+            return stf::unexpected{std::string("could not allocate a scratch file")};
+        }
+
+        std::span<IndexType> new_index = TRYX(new_index_res->map());
+        std::span<IndexType> old_index = TRYX(old_index_res->map());
+
+        const std::vector<u64> cluster_vertices = detail::renumber_vertices<IndexType>(
+          n_triangles, [&](usize i) {
+              auto const& indices = tree_triangles[i].triangle.vertex_indices;
+              return std::array<IndexType, 3>{indices[0], indices[1], indices[2]};
+          },
+          new_index, old_index);
+
+        detail::header header = detail::expected_header<IndexType>(key);
+        header.n_vertices = n_vertices;
+        header.n_triangles = n_triangles;
+        header.n_nodes = nodes.size();
+        header.depth = n_layers;
+        header.bounds_min = detail::to_array(m_bounds.bounds.first);
+        header.bounds_max = detail::to_array(m_bounds.bounds.second);
+        header.center = detail::to_array(center_sum / static_cast<real>(n_triangles));
+        header.surface_area = surface_area;
+
+        return detail::write_atomically(m_path, [&](io::detail::file& file) {
+            return detail::write_mesh<IndexType>(
+              file, header, cluster_vertices,//
+              [&](usize i) { return vertices[old_index[i]]; },
+              [&](usize i) {
+                  detail::triangle_record<IndexType> ret = tree_triangles[i].triangle;
+                  for (usize j = 0; j < 3; j++) {
+                      ret.vertex_indices[j] = new_index[ret.vertex_indices[j]];
+                  }
+
+                  return ret;
+              },
+              [&](usize i) { return nodes[i].to_record(); },
+              [&](usize i) { return tree_triangles[i].area_sum; });
+        });
+    }
+
+private:
+    /// A triangle with what the tree is built from
+    struct tree_triangle {
+        detail::triangle_record<IndexType> triangle;
+        std::array<real, 3> center;
+        std::array<real, 3> bounds_min;
+        std::array<real, 3> bounds_max;
+        /// The area of the triangle until the tree is built, the running sum of the areas in tree order afterwards
+        real area_sum;
+    };
+
+    std::string m_path{};
+    mat4x4 m_transform{};
+
+    /// Untransformed, the normals of the triangles are computed from these before they are transformed
+    detail::scratch_array<detail::vertex_record> m_raw_vertices{};
+    detail::scratch_array<detail::vertex_record> m_vertices{};
+    detail::scratch_array<std::array<IndexType, 3>> m_triangles{};
+
+    bounding_box m_bounds{};
+};
+
+}// namespace trc::io::mesh_cache
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/io/detail/mapped_file.hpp>
+#include <tracer/io/detail/tokenizer.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <concepts>
+#include <limits>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace trc::io::obj {
+
+/// The faces following an <code>o</code> or a <code>g</code> statement, faces before the first one form a group with
+/// an empty name. Groups that are opened more than once are merged.
+template<std::unsigned_integral IndexType = u32>
+struct group {
+    std::string name;
+    /// Indices into <code>mesh_data::positions</code>
+    std::vector<std::array<IndexType, 3>> triangles;
+};
+
+template<std::unsigned_integral IndexType = u32>
+struct mesh_data {
+    std::vector<vec3> positions;
+    std::vector<group<IndexType>> groups;
+};
+
+namespace detail {
+
+/// Files smaller than this are parsed before threads would have started
+inline constexpr usize parallel_threshold = usize(1) << 20;
+
+/// A run of lines parsed by one thread
+template<std::unsigned_integral IndexType>
+struct chunk {
+    std::string_view data;
+
+    /// The number of positions in the chunks before this one and in this one
+    usize first_position = 0;
+    usize n_positions = 0;
+
+    std::vector<std::array<IndexType, 3>> triangles{};
+    /// The names of the groups started within the chunk and the first of their triangles
+    std::vector<std::pair<std::string_view, usize>> groups{};
+
+    stf::expected<void, std::string_view> result{};
+};
+
+/// Calls <code>fn(keyword, tokenizer)</code> for each line that is not empty, the tokenizer is at the rest of the line
+template<typename Fn>
+constexpr void for_each_line(std::string_view data, Fn&& fn) {
+    for (usize position = 0; position < data.size();) {
+        const usize end = io::detail::skip_lines(data, position, 1);
+
+        io::detail::tokenizer tokenizer{.data = data.substr(position, end - position)};
+        position = end;
+
+        if (auto keyword = tokenizer.next_token(); keyword) {
+            std::invoke(fn, *keyword, tokenizer);
+        }
+    }
+}
+
+constexpr auto count_positions(std::string_view data) -> usize {
+    usize ret = 0;
+    for_each_line(data, [&ret](std::string_view keyword, io::detail::tokenizer const&) { ret += keyword == "v"; });
+    return ret;
+}
+
+/// The rest of the line after the keyword, without surrounding whitespace
+constexpr auto rest_of_line(io::detail::tokenizer const& tokenizer) -> std::string_view {
+    std::string_view ret = tokenizer.data.substr(tokenizer.position);
+
+    while (!ret.empty() && io::detail::tokenizer::is_space(ret.front())) {
+        ret.remove_prefix(1);
+    }
+
+    while (!ret.empty() && io::detail::tokenizer::is_space(ret.back())) {
+        ret.remove_suffix(1);
+    }
+
+    return ret;
+}
+
+/// Parses the positions straight into their place in <code>positions</code> and the faces of a chunk.\n
+/// Texture coordinates, normals, materials and smoothing groups are skipped, meshes only store positions. Faces refer
+/// to positions only through the first number of each corner.
+template<std::unsigned_integral IndexType>
+inline auto parse_chunk(chunk<IndexType>& chunk, usize n_positions, std::span<vec3> positions) -> stf::expected<void, std::string_view> {
+    usize position_index = chunk.first_position;
+
+    // reused across faces, only polygons with more corners than any before allocate
+    std::vector<IndexType> corners{};
+
+    stf::expected<void, std::string_view> ret{};
+
+    for_each_line(chunk.data, [&](std::string_view keyword, io::detail::tokenizer& tokenizer) {
+        if (!ret) {
+            return;
+        }
+
+        if (keyword == "v") {
+            vec3& vertex = positions[position_index++];
+            if (!tokenizer.next(vertex[0]) || !tokenizer.next(vertex[1]) || !tokenizer.next(vertex[2])) {
+                ret = stf::unexpected{"malformed vertex"};
+            }
+        } else if (keyword == "f") {
+            corners.clear();
+
+            while (auto token = tokenizer.next_token()) {
+                // corners are v, v/vt, v//vn or v/vt/vn
+                i64 index;
+                auto [end, error] = std::from_chars(token->data(), token->data() + token->size(), index);
+
+                if (error != std::errc{} || (end != token->data() + token->size() && *end != '/')) {
+                    ret = stf::unexpected{"malformed face"};
+                    return;
+                }
+
+                // negative indices count back from the last position before the face
+                const i64 resolved = index > 0 ? index - 1 : static_cast<i64>(position_index) + index;
+
+                if (index == 0 || resolved < 0 || resolved >= static_cast<i64>(n_positions)) {
+                    ret = stf::unexpected{"a face refers to a vertex that does not exist"};
+                    return;
+                }
+
+                corners.push_back(static_cast<IndexType>(resolved));
+            }
+
+            if (corners.size() < 3) {
+                ret = stf::unexpected{"faces need at least 3 corners"};
+                return;
+            }
+
+            // polygons are assumed to be convex and split into fans
+            for (usize i = 1; i + 1 < corners.size(); i++) {
+                chunk.triangles.push_back({corners[0], corners[i], corners[i + 1]});
+            }
+        } else if (keyword == "o" || keyword == "g") {
+            chunk.groups.emplace_back(rest_of_line(tokenizer), chunk.triangles.size());
+        }
+    });
+
+    return ret;
+}
+
+/// Moves the triangles of all chunks into groups, in the order of the file
+template<std::unsigned_integral IndexType>
+inline auto gather_groups(std::span<chunk<IndexType>> chunks) -> std::vector<group<IndexType>> {
+    std::vector<group<IndexType>> ret{};
+    std::map<std::string_view, usize> indices{};
+
+    auto group_index = [&](std::string_view name) {
+        auto [it, inserted] = indices.try_emplace(name, ret.size());
+        if (inserted) {
+            ret.push_back({std::string(name), {}});
+        }
+
+        return it->second;
+    };
+
+    usize current = group_index("");
+
+    for (chunk<IndexType>& chunk : chunks) {
+        usize copied = 0;
+
+        auto copy_until = [&](usize end) {
+            auto& triangles = ret[current].triangles;
+            triangles.insert(triangles.end(), chunk.triangles.begin() + static_cast<isize>(copied), chunk.triangles.begin() + static_cast<isize>(end));
+            copied = end;
+        };
+
+        for (auto const& [name, first_triangle] : chunk.groups) {
+            copy_until(first_triangle);
+            current = group_index(name);
+        }
+
+        copy_until(chunk.triangles.size());
+        chunk.triangles = {};
+    }
+
+    std::erase_if(ret, [](group<IndexType> const& group) { return group.triangles.empty(); });
+
+    return ret;
+}
+
+}// namespace detail
+
+/// Reads the positions and the faces of a Wavefront OBJ file, polygons are split into triangle fans.\n
+/// The file is memory mapped and split at newlines into one chunk per thread. A pre-pass counts the positions of each
+/// chunk so that negative indices can be resolved and positions can be parsed straight into their place.
+/// @param n_threads 0 means <code>trc::detail::default_thread_count()</code>
+template<std::unsigned_integral IndexType = u32>
+inline auto read_mesh(std::string const& path, usize n_threads = 0) -> stf::expected<mesh_data<IndexType>, std::string> {
+    auto file_res = io::detail::mapped_file::open(path);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    auto with_path = [&path](std::string_view error) { return stf::unexpected{fmt::format("\"{}\": {}", path, error)}; };
+
+    if (n_threads == 0) {
+        n_threads = trc::detail::default_thread_count();
+    }
+
+    if (file_res->size() < detail::parallel_threshold) {
+        n_threads = 1;
+    }
+
+    std::vector<detail::chunk<IndexType>> chunks{};
+    for (std::string_view piece : io::detail::split_at_lines(file_res->chars(), n_threads)) {
+        chunks.push_back({.data = piece});
+    }
+
+    trc::detail::parallel_for(chunks.size(), n_threads, [&chunks](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            chunks[i].n_positions = detail::count_positions(chunks[i].data);
+        }
+    });
+
+    usize n_positions = 0;
+    for (detail::chunk<IndexType>& chunk : chunks) {
+        chunk.first_position = n_positions;
+        n_positions += chunk.n_positions;
+    }
+
+    if (n_positions > static_cast<usize>(std::numeric_limits<IndexType>::max())) {
+        return with_path("too many vertices for the index type");
+    }
+
+    mesh_data<IndexType> ret{};
+    ret.positions.resize(n_positions);
+
+    trc::detail::parallel_for(chunks.size(), n_threads, [&](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            chunks[i].result = detail::parse_chunk(chunks[i], n_positions, ret.positions);
+        }
+    });
+
+    for (detail::chunk<IndexType> const& chunk : chunks) {
+        if (!chunk.result) {
+            return with_path(chunk.result.error());
+        }
+    }
+
+    ret.groups = detail::gather_groups<IndexType>(chunks);
+
+    return ret;
+}
+
+}// namespace trc::io::obj
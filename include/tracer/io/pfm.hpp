@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stuff/bit.hpp>
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+#include <tracer/image.hpp>
+#include <tracer/io/detail/file.hpp>
+
+#include <fmt/format.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace trc::io::pfm {
+
+/// Writes an image into a Portable Float Map (RGB, 32-bit floats in native byte order) as pixels arrive.\n
+/// The file is sized up front and every tile is written in place, so nothing image-sized is held in memory and tiles
+/// may arrive from several threads at once. Pixels that are never written stay black.\n
+/// Write-only, <code>get</code> returns black. Errors are collected and reported by <code>finish</code>.
+struct writer final : image_like {
+    static auto create(std::string const& path, usize width, usize height) -> stf::expected<writer, std::string> {
+        auto file_res = detail::file::create(path);
+        if (!file_res) {
+            return stf::unexpected{file_res.error()};
+        }
+
+        writer ret{};
+        ret.m_file = std::move(*file_res);
+        ret.m_width = width;
+        ret.m_height = height;
+
+        // a negative scale marks little-endian data
+        std::string header = fmt::format("PF\n{} {}\n{}\n", width, height, std::endian::native == std::endian::little ? "-1.0" : "1.0");
+        ret.m_data_offset = header.size();
+
+        if (!ret.m_file.write_at(std::as_bytes(std::span(header)), 0) || !ret.m_file.resize(ret.m_data_offset + width * height * 3 * sizeof(float))) {
+            return stf::unexpected{fmt::format("could not write to \"{}\"", path)};
+        }
+
+        return ret;
+    }
+
+    writer(writer&& other) noexcept
+        : m_file(std::move(other.m_file))
+        , m_width(other.m_width)
+        , m_height(other.m_height)
+        , m_data_offset(other.m_data_offset)
+        , m_failed(other.m_failed.load(std::memory_order::relaxed)) {}
+
+    ~writer() override = default;
+
+    auto width() const -> usize override { return m_width; }
+    auto height() const -> usize override { return m_height; }
+
+    void set(usize x, usize y, color c) override { set_tile(x, y, 1, 1, std::span(&c, 1)); }
+
+    auto get(usize, usize) const -> color override { return {}; }
+
+    void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        std::vector<float> row(tile_width * 3);
+
+        for (usize i = 0; i < tile_height; i++) {
+            for (usize j = 0; j < tile_width * 3; j++) {
+                row[j] = static_cast<float>(pixels[i * tile_width + j / 3][j % 3]);
+            }
+
+            // rows are stored bottom to top
+            const u64 offset = m_data_offset + ((m_height - 1 - (y + i)) * m_width + x) * 3 * sizeof(float);
+
+            if (!m_file.write_at(std::as_bytes(std::span(row)), offset)) {
+                m_failed.store(true, std::memory_order::relaxed);
+            }
+        }
+    }
+
+    /// Closes the file, reports whether any write failed
+    auto finish() -> stf::expected<void, std::string> {
+        auto res = m_file.close();
+
+        if (m_failed.load(std::memory_order::relaxed)) {
+            return stf::unexpected{std::string("could not write all pixels")};
+        }
+
+        return res;
+    }
+
+private:
+    writer() = default;
+
+    detail::file m_file{};
+    usize m_width = 0;
+    usize m_height = 0;
+    u64 m_data_offset = 0;
+    std::atomic_bool m_failed = false;
+};
+
+/// Reads RGB (<code>PF</code>) and greyscale (<code>Pf</code>) float maps in either byte order
+inline auto read(std::string const& path) -> stf::expected<image, std::string> {
+    auto file_res = detail::file::open(path);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    detail::file& file = *file_res;
+
+    std::vector<char> contents(file.size().value_or(0));
+    if (!file.read_at(std::as_writable_bytes(std::span(contents)), 0)) {
+        return stf::unexpected{fmt::format("could not read \"{}\"", path)};
+    }
+
+    auto bad_file = [&] { return stf::unexpected{fmt::format("\"{}\" is not a PFM file", path)}; };
+
+    // "PF" or "Pf", then width, height and scale separated by whitespace and a single whitespace before the data
+    usize cursor = 0;
+
+    auto skip_whitespace = [&] {
+        while (cursor < contents.size() && std::isspace(static_cast<unsigned char>(contents[cursor]))) {
+            cursor++;
+        }
+    };
+
+    auto next_token = [&]() -> std::string_view {
+        skip_whitespace();
+
+        usize begin = cursor;
+        while (cursor < contents.size() && !std::isspace(static_cast<unsigned char>(contents[cursor]))) {
+            cursor++;
+        }
+
+        return {contents.data() + begin, cursor - begin};
+    };
+
+    std::string_view magic = next_token();
+    if (magic != "PF" && magic != "Pf") {
+        return bad_file();
+    }
+
+    const usize n_channels = magic == "PF" ? 3 : 1;
+
+    auto parse_token = [&]<typename T>(T& out) -> bool {
+        std::string_view token = next_token();
+        return std::from_chars(token.data(), token.data() + token.size(), out).ec == std::errc{};
+    };
+
+    usize width = 0;
+    usize height = 0;
+    double scale = 0;
+
+    if (!parse_token(width) || !parse_token(height) || !parse_token(scale) || scale == 0) {
+        return bad_file();
+    }
+
+    cursor++;
+
+    const std::endian data_endian = scale < 0 ? std::endian::little : std::endian::big;
+
+    if (cursor > contents.size() || (contents.size() - cursor) / (n_channels * sizeof(float)) < width * height) {
+        return stf::unexpected{fmt::format("\"{}\" is truncated", path)};
+    }
+
+    image ret(width, height);
+
+    for (usize y = 0; y < height; y++) {
+        for (usize x = 0; x < width; x++) {
+            color c{};
+
+            for (usize i = 0; i < n_channels; i++) {
+                std::array<char, sizeof(float)> bytes{};
+                std::copy_n(contents.data() + cursor, sizeof(float), bytes.data());
+                cursor += sizeof(float);
+
+                c[i] = static_cast<real>(stf::bit::convert_endian(std::bit_cast<float>(bytes), data_endian, std::endian::native));
+            }
+
+            if (n_channels == 1) {
+                c = color(c[0]);
+            }
+
+            // rows are stored bottom to top
+            ret.at(x, height - 1 - y) = c;
+        }
+    }
+
+    return ret;
+}
+
+}// namespace trc::io::pfm
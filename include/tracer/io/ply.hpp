@@ -1,23 +1,38 @@
 #pragma once
 
+#include <stuff/bit.hpp>
 #include <stuff/expected.hpp>
 
 #include <tracer/common.hpp>
+#include <tracer/detail/fast_math.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/io/detail/mapped_file.hpp>
+#include <tracer/io/detail/tokenizer.hpp>
 
 #include <range/v3/range.hpp>
-#include <range/v3/range/conversion.hpp>
 #include <range/v3/view/getlines.hpp>
-#include <range/v3/view/join.hpp>
-#include <range/v3/view/split.hpp>
-#include <range/v3/view/take_while.hpp>
-#include <range/v3/view/transform.hpp>
 
+#include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <bit>
 #include <charconv>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <utility>
 
 namespace trc::io::ply {
 
+enum class format {
+    ascii,
+    binary_little_endian,
+    binary_big_endian,
+};
+
 enum class primitive_type {
     s8,
     u8,
@@ -32,10 +47,6 @@ enum class primitive_type {
 using list_type = std::pair<primitive_type, primitive_type>;
 using data_type = std::variant<primitive_type, list_type>;
 
-using primitive = std::variant<i8, u8, i16, u16, i32, u32, float, double>;
-using list = std::vector<primitive>;
-using data = std::variant<primitive, list>;
-
 struct property {
     std::string name;
     data_type data_type;
@@ -48,8 +59,12 @@ struct element {
 };
 
 struct header {
+    ply::format format = ply::format::ascii;
     std::vector<std::string> comments {};
     std::vector<element> elements {};
+
+    /// Where the data of the first element starts, in bytes from the start of the file
+    usize data_offset = 0;
 };
 
 namespace detail {
@@ -63,10 +78,6 @@ using comment_line = std::string;
 
 using line = std::variant<empty_line, magic_line, format_line, element_line, property_line, comment_line>;
 
-constexpr auto tokenize(std::string_view line) -> std::vector<std::string> {
-    return line | ranges::views::split(' ') | ranges::to<std::vector<std::string>>;
-};
-
 constexpr auto parse_primitive_type(std::string_view str) -> std::optional<primitive_type> {
     if (str == "char") {
         return primitive_type::s8;
@@ -89,40 +100,6 @@ constexpr auto parse_primitive_type(std::string_view str) -> std::optional<primi
     return std::nullopt;
 };
 
-constexpr auto parse_primitive(primitive_type expected_type, std::string_view token) -> std::optional<primitive> {
-    primitive ret;
-
-    auto parse_and_assign = [&ret, token]<typename T>() -> bool {
-        T v;
-        if (auto res = std::from_chars(token.data(), token.data() + token.size(), v); res.ec != std::errc()) {
-            return false;
-        }
-
-        ret = v;
-        return true;
-    };
-
-    bool res;
-
-    switch (expected_type) {
-        case primitive_type::s8: res = parse_and_assign.operator()<i8>(); break;
-        case primitive_type::u8: res = parse_and_assign.operator()<u8>(); break;
-        case primitive_type::s16: res = parse_and_assign.operator()<i16>(); break;
-        case primitive_type::u16: res = parse_and_assign.operator()<u16>(); break;
-        case primitive_type::s32: res = parse_and_assign.operator()<i32>(); break;
-        case primitive_type::u32: res = parse_and_assign.operator()<u32>(); break;
-        case primitive_type::f32: res = parse_and_assign.operator()<float>(); break;
-        case primitive_type::f64: res = parse_and_assign.operator()<double>(); break;
-        default: std::unreachable();
-    }
-
-    if (!res) {
-        return std::nullopt;
-    }
-
-    return ret;
-}
-
 constexpr auto parse_line(std::string_view str) -> stf::expected<line, std::string_view> {
     if (str.empty()) {
         return empty_line{};
@@ -137,7 +114,10 @@ constexpr auto parse_line(std::string_view str) -> stf::expected<line, std::stri
         return magic_line{};
     }
 
-    std::vector<std::string> tokens = tokenize(str);
+    std::vector<std::string_view> tokens{};
+    for (io::detail::tokenizer tokenizer{.data = str}; auto token = tokenizer.next_token();) {
+        tokens.push_back(*token);
+    }
 
     if (tokens.empty()) {
         return empty_line{};
@@ -164,7 +144,7 @@ constexpr auto parse_line(std::string_view str) -> stf::expected<line, std::stri
             return stf::unexpected{"expected exactly 3 tokens for an element line"};
         }
 
-        ret.first = std::move(tokens[1]);
+        ret.first = tokens[1];
 
         if (auto res = std::from_chars(tokens[2].data(), tokens[2].data() + tokens[2].size(), ret.second); res.ec != std::errc()) {
             return stf::unexpected{"bad element count"};
@@ -216,24 +196,10 @@ constexpr auto parse_line(std::string_view str) -> stf::expected<line, std::stri
 
 }// namespace detail
 
-constexpr auto read_header(std::basic_istream<char>& range) -> stf::expected<header, std::string_view> {
-    namespace views = ranges::views;
-
-    auto lines = ranges::getlines(range, '\n');
-    auto lines_it = lines.begin();
-    auto lines_end = lines.end();
-
-    std::vector<detail::line> header_lines;
-
-    for (; lines_it != lines_end; lines_it++) {
-        std::string cur_line = *lines_it;
-        if (cur_line == "end_header") {
-            break;
-        }
-
-        header_lines.emplace_back(TRYX(detail::parse_line(cur_line)));
-    }
+namespace detail {
 
+/// Builds the header out of its lines, the ones before <code>end_header</code>
+constexpr auto assemble_header(std::vector<line> const& header_lines) -> stf::expected<header, std::string_view> {
     if (header_lines.size() < 2) {
         return stf::unexpected{"expected at least 2 lines in the header"};
     }
@@ -246,7 +212,17 @@ constexpr auto read_header(std::basic_istream<char>& range) -> stf::expected<hea
         return stf::unexpected{"second line should be the format line"};
     }
 
-    if (auto line = get<detail::format_line>(header_lines[1]); line.first != "ascii" || line.second.first != 1 || line.second.second != 0) {
+    format file_format;
+
+    if (auto line = get<detail::format_line>(header_lines[1]); line.second.first != 1 || line.second.second != 0) {
+        return stf::unexpected{"unsupported PLY version"};
+    } else if (line.first == "ascii") {
+        file_format = format::ascii;
+    } else if (line.first == "binary_little_endian") {
+        file_format = format::binary_little_endian;
+    } else if (line.first == "binary_big_endian") {
+        file_format = format::binary_big_endian;
+    } else {
         return stf::unexpected{"unsupported PLY format"};
     }
 
@@ -306,73 +282,864 @@ constexpr auto read_header(std::basic_istream<char>& range) -> stf::expected<hea
     }
 
     return header {
+      .format = file_format,
       .comments = std::move(comments),
       .elements = std::move(elements),
     };
 }
 
-template<typename Fn>
-constexpr auto read_element(element description, std::basic_istream<char>& range, Fn&& fn) -> stf::expected<void, std::string_view> {
+}// namespace detail
+
+constexpr auto read_header(std::basic_istream<char>& range) -> stf::expected<header, std::string_view> {
+    namespace views = ranges::views;
+
     auto lines = ranges::getlines(range, '\n');
     auto lines_it = lines.begin();
     auto lines_end = lines.end();
 
+    std::vector<detail::line> header_lines;
+    usize data_offset = 0;
+
+    for (; lines_it != lines_end; lines_it++) {
+        std::string cur_line = *lines_it;
+        data_offset += cur_line.size() + 1;
+
+        if (cur_line == "end_header") {
+            break;
+        }
+
+        header_lines.emplace_back(TRYX(detail::parse_line(cur_line)));
+    }
+
+    header ret = TRYX(detail::assemble_header(header_lines));
+    ret.data_offset = data_offset;
+
+    return ret;
+}
+
+/// Reads the header at the start of <code>contents</code>, e.g. a mapped file, the element data starts at
+/// <code>header::data_offset</code>
+constexpr auto read_header(std::string_view contents) -> stf::expected<header, std::string_view> {
+    std::vector<detail::line> header_lines;
+    usize data_offset = 0;
+
+    for (;;) {
+        usize line_end = contents.find('\n', data_offset);
+        if (line_end == std::string_view::npos) {
+            return stf::unexpected{"unexpected EOF in the header"};
+        }
+
+        std::string_view cur_line = contents.substr(data_offset, line_end - data_offset);
+        data_offset = line_end + 1;
+
+        if (cur_line.ends_with('\r')) {
+            cur_line.remove_suffix(1);
+        }
+
+        if (cur_line == "end_header") {
+            break;
+        }
+
+        header_lines.emplace_back(TRYX(detail::parse_line(cur_line)));
+    }
+
+    header ret = TRYX(detail::assemble_header(header_lines));
+    ret.data_offset = data_offset;
+
+    return ret;
+}
+
+/// Vertex positions and triangles of a mesh, ready to be pushed into a <code>shapes::mesh</code>
+template<std::unsigned_integral IndexType = u32>
+struct mesh_data {
+    std::vector<vec3> vertices{};
+    std::vector<std::array<IndexType, 3>> triangles{};
+};
+
+namespace detail {
+
+constexpr auto primitive_size(primitive_type type) -> usize {
+    switch (type) {
+        case primitive_type::s8:
+        case primitive_type::u8: return 1;
+        case primitive_type::s16:
+        case primitive_type::u16: return 2;
+        case primitive_type::s32:
+        case primitive_type::u32:
+        case primitive_type::f32: return 4;
+        case primitive_type::f64: return 8;
+    }
+
+    std::unreachable();
+}
+
+/// Loads a value stored as <code>type</code> in the given byte order from unaligned memory
+template<typename T>
+inline auto load_binary(primitive_type type, const std::byte* ptr, std::endian endian) -> T {
+    auto load = [&]<typename U>() -> T {
+        U v;
+        std::memcpy(&v, ptr, sizeof(U));
+        return static_cast<T>(stf::bit::convert_endian(v, endian, std::endian::native));
+    };
+
+    switch (type) {
+        case primitive_type::s8: return load.template operator()<i8>();
+        case primitive_type::u8: return load.template operator()<u8>();
+        case primitive_type::s16: return load.template operator()<i16>();
+        case primitive_type::u16: return load.template operator()<u16>();
+        case primitive_type::s32: return load.template operator()<i32>();
+        case primitive_type::u32: return load.template operator()<u32>();
+        case primitive_type::f32: return load.template operator()<float>();
+        case primitive_type::f64: return load.template operator()<double>();
+    }
+
+    std::unreachable();
+}
+
+/// Loads a count or an index, nothing if it is negative or not a whole number within the range of <code>u64</code>,
+/// where converting it would be undefined
+inline auto load_unsigned(primitive_type type, const std::byte* ptr, std::endian endian) -> std::optional<u64> {
+    if (type == primitive_type::f32 || type == primitive_type::f64) {
+        const double value = load_binary<double>(type, ptr, endian);
+
+        // NaNs are told apart by their bits, comparisons with them are not reliable under -ffast-math
+        if (!trc::detail::is_finite(value) || value < 0 || value >= 0x1p64 || value != std::floor(value)) {
+            return std::nullopt;
+        }
+
+        return static_cast<u64>(value);
+    }
+
+    const i64 value = load_binary<i64>(type, ptr, endian);
+    if (value < 0) {
+        return std::nullopt;
+    }
+
+    return static_cast<u64>(value);
+}
+
+/// The size of every instance of <code>description</code>, nothing if it has list properties
+constexpr auto fixed_element_size(element const& description) -> std::optional<usize> {
+    usize ret = 0;
+
+    for (property const& prop : description.properties) {
+        if (!std::holds_alternative<primitive_type>(prop.data_type)) {
+            return std::nullopt;
+        }
+
+        ret += primitive_size(std::get<primitive_type>(prop.data_type));
+    }
+
+    return ret;
+}
+
+/// Finds the offsets of the properties of the binary element at the start of <code>data</code>, lists are located
+/// by their count.
+/// @return The size of the element, nothing if it does not fit into <code>data</code> or has an invalid list count
+inline auto locate_properties(element const& description, std::span<const std::byte> data, std::endian endian, std::span<usize> offsets) -> std::optional<usize> {
+    usize offset = 0;
+
+    for (usize i = 0; i < description.properties.size(); i++) {
+        offsets[i] = offset;
+
+        if (auto const* type = std::get_if<primitive_type>(&description.properties[i].data_type); type != nullptr) {
+            offset += primitive_size(*type);
+        } else {
+            auto [count_type, value_type] = std::get<list_type>(description.properties[i].data_type);
+
+            if (data.size() < offset + primitive_size(count_type)) {
+                return std::nullopt;
+            }
+
+            const std::optional<u64> count = load_unsigned(count_type, data.data() + offset, endian);
+            if (!count || *count > data.size()) {
+                return std::nullopt;
+            }
+
+            offset += primitive_size(count_type) + static_cast<usize>(*count) * primitive_size(value_type);
+        }
+
+        if (offset > data.size()) {
+            return std::nullopt;
+        }
+    }
+
+    return offset;
+}
+
+/// Calls <code>fn(std::span<const std::byte>)</code> with every instance of <code>description</code> in turn and
+/// advances <code>data</code> past them
+template<typename Fn>
+inline auto for_each_binary_element(element const& description, std::span<const std::byte>& data, std::endian endian, Fn&& fn) -> stf::expected<void, std::string_view> {
+    if (auto size = fixed_element_size(description); size) {
+        if (*size != 0 && data.size() / *size < description.count) {
+            return stf::unexpected{"unexpected EOF"};
+        }
+
+        for (usize i = 0; i < description.count; i++) {
+            std::invoke(fn, data.subspan(i * *size, *size));
+        }
+
+        data = data.subspan(description.count * *size);
+        return {};
+    }
+
+    std::vector<usize> offsets(description.properties.size());
+
     for (usize i = 0; i < description.count; i++) {
-        if (lines_it == lines_end) {
-            return stf::unexpected { "unexpected EOF" };
+        auto size = locate_properties(description, data, endian, offsets);
+        if (!size) {
+            return stf::unexpected{"unexpected EOF or an invalid list count"};
+        }
+
+        std::invoke(fn, data.subspan(0, *size));
+        data = data.subspan(*size);
+    }
+
+    return {};
+}
+
+constexpr auto find_property(element const& description, std::string_view name) -> std::optional<usize> {
+    for (usize i = 0; i < description.properties.size(); i++) {
+        if (description.properties[i].name == name) {
+            return i;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/// Adds the triangles of a convex polygon as a fan around its first vertex
+/// @return false if the polygon refers to a vertex past <code>n_vertices</code>
+template<std::unsigned_integral IndexType, typename IndexFn>
+constexpr auto push_polygon(usize n_corners, IndexFn&& index_at, usize n_vertices, std::vector<std::array<IndexType, 3>>& triangles) -> bool {
+    if (n_corners < 3) {
+        return true;
+    }
+
+    const u64 first = index_at(0);
+    u64 previous = index_at(1);
+
+    if (first >= n_vertices || previous >= n_vertices) {
+        return false;
+    }
+
+    for (usize i = 2; i < n_corners; i++) {
+        const u64 current = index_at(i);
+        if (current >= n_vertices) {
+            return false;
         }
 
-        std::string line = *lines_it++;
-        std::vector<std::string> tokens = detail::tokenize(line);
-        std::span<std::string> tokens_span { tokens };
+        triangles.push_back({static_cast<IndexType>(first), static_cast<IndexType>(previous), static_cast<IndexType>(current)});
+        previous = current;
+    }
+
+    return true;
+}
 
-        std::vector<data> arguments {};
+inline auto read_binary_vertices(element const& description, std::span<const std::byte>& data, std::endian endian, std::vector<vec3>& vertices) -> stf::expected<void, std::string_view> {
+    std::array<usize, 3> coordinates{};
+    std::array<primitive_type, 3> types{};
 
-        for (property prop : description.properties) {
-            if (tokens_span.empty()) {
-                return stf::unexpected { "ran out of tokens before reading all of the properties" };
+    for (usize i = 0; i < 3; i++) {
+        auto index = find_property(description, std::array{"x", "y", "z"}[i]);
+        if (!index || !std::holds_alternative<primitive_type>(description.properties[*index].data_type)) {
+            return stf::unexpected{"vertices need scalar x, y and z properties"};
+        }
+
+        coordinates[i] = *index;
+        types[i] = std::get<primitive_type>(description.properties[*index].data_type);
+    }
+
+    vertices.reserve(vertices.size() + description.count);
+
+    // the common layout of three consecutive floats first, without going through the per-type dispatch
+    if (auto size = fixed_element_size(description); size && types == std::array{primitive_type::f32, primitive_type::f32, primitive_type::f32} && coordinates[1] == coordinates[0] + 1 && coordinates[2] == coordinates[0] + 2) {
+        usize x_offset = 0;
+        for (usize i = 0; i < coordinates[0]; i++) {
+            x_offset += primitive_size(std::get<primitive_type>(description.properties[i].data_type));
+        }
+
+        if (data.size() / *size < description.count) {
+            return stf::unexpected{"unexpected EOF"};
+        }
+
+        const std::byte* ptr = data.data() + x_offset;
+
+        for (usize i = 0; i < description.count; i++, ptr += *size) {
+            std::array<float, 3> position;
+            std::memcpy(position.data(), ptr, sizeof(position));
+
+            vertices.emplace_back(
+              stf::bit::convert_endian(position[0], endian, std::endian::native),
+              stf::bit::convert_endian(position[1], endian, std::endian::native),
+              stf::bit::convert_endian(position[2], endian, std::endian::native));
+        }
+
+        data = data.subspan(description.count * *size);
+        return {};
+    }
+
+    std::vector<usize> offsets(description.properties.size());
+
+    return for_each_binary_element(description, data, endian, [&](std::span<const std::byte> instance) {
+        locate_properties(description, instance, endian, offsets);
+
+        vec3& vertex = vertices.emplace_back();
+        for (usize i = 0; i < 3; i++) {
+            vertex[i] = load_binary<real>(types[i], instance.data() + offsets[coordinates[i]], endian);
+        }
+    });
+}
+
+template<std::unsigned_integral IndexType>
+inline auto read_binary_faces(element const& description, std::span<const std::byte>& data, std::endian endian, usize n_vertices, std::vector<std::array<IndexType, 3>>& triangles) -> stf::expected<void, std::string_view> {
+    auto list_index = find_property(description, "vertex_indices");
+    if (!list_index) {
+        list_index = find_property(description, "vertex_index");
+    }
+
+    if (!list_index || !std::holds_alternative<list_type>(description.properties[*list_index].data_type)) {
+        return stf::unexpected{"faces need a vertex_indices list"};
+    }
+
+    auto [count_type, index_type] = std::get<list_type>(description.properties[*list_index].data_type);
+
+    // most files store triangles and nothing else
+    triangles.reserve(triangles.size() + description.count);
+
+    // the common layout of a uchar count followed by 32-bit indices, without going through the per-type dispatch
+    if (description.properties.size() == 1 && count_type == primitive_type::u8 && (index_type == primitive_type::s32 || index_type == primitive_type::u32)) {
+        const std::byte* ptr = data.data();
+        const std::byte* end = data.data() + data.size();
+
+        for (usize i = 0; i < description.count; i++) {
+            if (ptr == end) {
+                return stf::unexpected{"unexpected EOF"};
             }
 
-            if (std::holds_alternative<primitive_type>(prop.data_type)) {
-                if (auto res = detail::parse_primitive(std::get<primitive_type>(prop.data_type), tokens_span.front()); res) {
-                    arguments.emplace_back(*res);
-                } else {
-                    return stf::unexpected { "could not read a property" };
-                }
-                tokens_span = tokens_span.subspan(1);
-            } else {
-                auto [size_type, value_type] = std::get<std::pair<primitive_type, primitive_type>>(prop.data_type);
+            const usize n_corners = static_cast<usize>(*ptr++);
+            if (static_cast<usize>(end - ptr) / sizeof(u32) < n_corners) {
+                return stf::unexpected{"unexpected EOF"};
+            }
 
-                usize sz;
+            auto index_at = [ptr, endian](usize j) -> u64 {
+                u32 index;
+                std::memcpy(&index, ptr + j * sizeof(u32), sizeof(u32));
+                return stf::bit::convert_endian(index, endian, std::endian::native);
+            };
+
+            if (!push_polygon(n_corners, index_at, n_vertices, triangles)) {
+                return stf::unexpected{"a face refers to a vertex that does not exist"};
+            }
+
+            ptr += n_corners * sizeof(u32);
+        }
+
+        data = data.subspan(static_cast<usize>(ptr - data.data()));
+        return {};
+    }
 
-                // force a primitive type of u32 for sizes?
-                if (auto res = detail::parse_primitive(size_type, tokens_span.front()); res) {
-                    std::visit([&sz](auto v) { sz = static_cast<usize>(v); }, *res);
-                } else {
-                    return stf::unexpected { "could not read a property index type" };
+    std::vector<usize> offsets(description.properties.size());
+    bool bad_index = false;
+
+    auto res = for_each_binary_element(description, data, endian, [&](std::span<const std::byte> instance) {
+        locate_properties(description, instance, endian, offsets);
+
+        const std::byte* list = instance.data() + offsets[*list_index];
+        // for_each_binary_element has checked the count already
+        const usize n_corners = static_cast<usize>(*load_unsigned(count_type, list, endian));
+        const std::byte* indices = list + primitive_size(count_type);
+
+        // invalid indices refer to no vertex
+        auto index_at = [&](usize j) -> u64 {
+            return load_unsigned(index_type, indices + j * primitive_size(index_type), endian).value_or(std::numeric_limits<u64>::max());
+        };
+
+        bad_index |= !push_polygon(n_corners, index_at, n_vertices, triangles);
+    });
+
+    if (!res) {
+        return res;
+    }
+
+    if (bad_index) {
+        return stf::unexpected{"a face refers to a vertex that does not exist"};
+    }
+
+    return {};
+}
+
+template<std::unsigned_integral IndexType>
+inline auto read_binary_mesh(header const& header, std::span<const std::byte> data, mesh_data<IndexType>& out) -> stf::expected<void, std::string_view> {
+    const std::endian endian = header.format == format::binary_little_endian ? std::endian::little : std::endian::big;
+
+    usize n_vertices = 0;
+    for (element const& description : header.elements) {
+        if (description.name == "vertex") {
+            n_vertices = description.count;
+        }
+    }
+
+    for (element const& description : header.elements) {
+        if (description.name == "vertex") {
+            TRYX(read_binary_vertices(description, data, endian, out.vertices));
+        } else if (description.name == "face") {
+            TRYX(read_binary_faces(description, data, endian, n_vertices, out.triangles));
+        } else {
+            TRYX(for_each_binary_element(description, data, endian, [](std::span<const std::byte>) {}));
+        }
+    }
+
+    return {};
+}
+
+using ascii_cursor = io::detail::tokenizer;
+
+/// Rounds through <code>float</code> for <code>f32</code> properties so that ASCII and binary files agree
+constexpr auto next_coordinate(ascii_cursor& cursor, primitive_type type, real& out) -> bool {
+    if (type != primitive_type::f32) {
+        return cursor.next(out);
+    }
+
+    float value;
+    if (!cursor.next(value)) {
+        return false;
+    }
+
+    out = static_cast<real>(value);
+    return true;
+}
+
+/// Skips a property without parsing it unless it is the count of a list
+constexpr auto skip_property(ascii_cursor& cursor, data_type const& type) -> bool {
+    if (std::holds_alternative<primitive_type>(type)) {
+        return cursor.next_token().has_value();
+    }
+
+    u64 count;
+    return cursor.next(count) && cursor.skip_tokens(count);
+}
+
+/// Parses <code>vertices.size()</code> vertices
+inline auto parse_ascii_vertices(element const& description, ascii_cursor& cursor, std::span<vec3> vertices) -> stf::expected<void, std::string_view> {
+    // the coordinate each property is, 3 for the ones that are not
+    std::vector<usize> roles(description.properties.size(), 3);
+
+    for (usize i = 0; i < 3; i++) {
+        auto index = find_property(description, std::array{"x", "y", "z"}[i]);
+        if (!index || !std::holds_alternative<primitive_type>(description.properties[*index].data_type)) {
+            return stf::unexpected{"vertices need scalar x, y and z properties"};
+        }
+
+        roles[*index] = i;
+    }
+
+    for (vec3& vertex : vertices) {
+        for (usize i = 0; i < roles.size(); i++) {
+            if (roles[i] == 3) {
+                if (!skip_property(cursor, description.properties[i].data_type)) {
+                    return stf::unexpected{"could not read a property"};
                 }
-                tokens_span = tokens_span.subspan(1);
+            } else if (!next_coordinate(cursor, std::get<primitive_type>(description.properties[i].data_type), vertex[roles[i]])) {
+                return stf::unexpected{"could not read a vertex coordinate"};
+            }
+        }
+    }
+
+    return {};
+}
+
+/// Parses <code>count</code> faces and appends their triangles
+template<std::unsigned_integral IndexType>
+inline auto parse_ascii_faces(element const& description, ascii_cursor& cursor, usize count, usize n_vertices, std::vector<std::array<IndexType, 3>>& triangles) -> stf::expected<void, std::string_view> {
+    auto list_index = find_property(description, "vertex_indices");
+    if (!list_index) {
+        list_index = find_property(description, "vertex_index");
+    }
+
+    if (!list_index || !std::holds_alternative<list_type>(description.properties[*list_index].data_type)) {
+        return stf::unexpected{"faces need a vertex_indices list"};
+    }
+
+    // reused across faces, only polygons with more corners than any before allocate
+    std::vector<u64> corners(8);
 
-                if (tokens_span.size() < sz) {
-                    return stf::unexpected { "not enough elements in list" };
+    for (usize face = 0; face < count; face++) {
+        for (usize i = 0; i < description.properties.size(); i++) {
+            if (i != *list_index) {
+                if (!skip_property(cursor, description.properties[i].data_type)) {
+                    return stf::unexpected{"could not read a property"};
                 }
 
-                list arg {};
+                continue;
+            }
 
-                for (usize j = 0; j < sz; j++) {
-                    if (auto res = detail::parse_primitive(value_type, tokens_span.front()); res) {
-                        arg.emplace_back(*res); // FIXME: 6-deep indentation
-                    } else {
-                        return stf::unexpected { "could not read a list element" };
-                    }
-                    tokens_span = tokens_span.subspan(1);
+            u64 n_corners;
+            if (!cursor.next(n_corners) || n_corners > cursor.data.size()) {
+                return stf::unexpected{"could not read a face"};
+            }
+
+            if (n_corners > corners.size()) {
+                corners.resize(n_corners);
+            }
+
+            for (usize j = 0; j < n_corners; j++) {
+                if (!cursor.next(corners[j])) {
+                    return stf::unexpected{"could not read a face"};
                 }
+            }
+
+            if (!push_polygon(n_corners, [&corners](usize j) { return corners[j]; }, n_vertices, triangles)) {
+                return stf::unexpected{"a face refers to a vertex that does not exist"};
+            }
+        }
+    }
+
+    return {};
+}
+
+/// The number of vertices face indices refer to
+constexpr auto vertex_count(header const& header) -> usize {
+    usize ret = 0;
+    for (element const& description : header.elements) {
+        if (description.name == "vertex") {
+            ret = description.count;
+        }
+    }
+
+    return ret;
+}
+
+constexpr auto skip_ascii_element(element const& description, ascii_cursor& cursor, usize count) -> bool {
+    for (usize i = 0; i < count; i++) {
+        for (property const& prop : description.properties) {
+            if (!skip_property(cursor, prop.data_type)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+template<std::unsigned_integral IndexType>
+inline auto read_ascii_mesh_serial(header const& header, std::string_view data, mesh_data<IndexType>& out) -> stf::expected<void, std::string_view> {
+    ascii_cursor cursor{.data = data};
+
+    const usize n_vertices = vertex_count(header);
+
+    for (element const& description : header.elements) {
+        if (description.name == "vertex") {
+            const usize first = out.vertices.size();
+            out.vertices.resize(first + description.count);
+
+            TRYX(parse_ascii_vertices(description, cursor, std::span(out.vertices).subspan(first)));
+        } else if (description.name == "face") {
+            // most files store triangles and nothing else
+            out.triangles.reserve(out.triangles.size() + description.count);
+
+            TRYX(parse_ascii_faces(description, cursor, description.count, n_vertices, out.triangles));
+        } else if (!skip_ascii_element(description, cursor, description.count)) {
+            return stf::unexpected{"unexpected EOF"};
+        }
+    }
+
+    return {};
+}
+
+/// Bodies smaller than this are parsed before threads would have started
+inline constexpr usize parallel_ascii_threshold = usize(1) << 20;
+
+/// A run of lines of the body parsed by one thread
+template<std::unsigned_integral IndexType>
+struct ascii_chunk {
+    std::string_view data;
+    usize first_line = 0;
+    usize n_lines = 0;
+
+    std::vector<std::array<IndexType, 3>> triangles{};
+    stf::expected<void, std::string_view> result{};
+};
+
+/// Parses the lines of <code>chunk</code>, vertices are written to their final place in <code>out</code>, triangles are
+/// kept in the chunk as the number of triangles before them is not known yet
+template<std::unsigned_integral IndexType>
+inline auto parse_ascii_chunk(header const& header, std::span<const usize> first_vertices, usize n_vertices, ascii_chunk<IndexType>& chunk, mesh_data<IndexType>& out) -> stf::expected<void, std::string_view> {
+    usize element_begin = 0;
+    usize position = 0;
+
+    for (usize i = 0; i < header.elements.size(); i++) {
+        element const& description = header.elements[i];
+
+        const usize element_end = element_begin + description.count;
+        const usize begin = std::max(element_begin, chunk.first_line);
+        const usize end = std::min(element_end, chunk.first_line + chunk.n_lines);
+
+        element_begin = element_end;
+
+        if (begin >= end) {
+            continue;
+        }
 
-                arguments.emplace_back(std::move(arg));
+        const usize count = end - begin;
+        const usize segment_end = io::detail::skip_lines(chunk.data, position, count);
+
+        ascii_cursor cursor{.data = chunk.data.substr(position, segment_end - position)};
+        position = segment_end;
+
+        if (description.name == "vertex") {
+            const usize first = first_vertices[i] + begin - (element_end - description.count);
+            TRYX(parse_ascii_vertices(description, cursor, std::span(out.vertices).subspan(first, count)));
+        } else if (description.name == "face") {
+            chunk.triangles.reserve(chunk.triangles.size() + count);
+            TRYX(parse_ascii_faces(description, cursor, count, n_vertices, chunk.triangles));
+        } else if (!skip_ascii_element(description, cursor, count)) {
+            return stf::unexpected{"unexpected EOF"};
+        }
+
+        if (cursor.next_token()) {
+            return stf::unexpected{"an element spans more than one line"};
+        }
+    }
+
+    return {};
+}
+
+/// Parses bodies that store one element per line, as every exporter does, in chunks on <code>n_threads</code> threads.\n
+/// A pre-pass counts the lines of each chunk, which gives the element each chunk starts in and where its vertices go.
+/// Triangles are gathered per chunk and copied behind the ones of the chunks before them.
+/// @return <code>std::nullopt</code> if the body does not have one line per element
+template<std::unsigned_integral IndexType>
+inline auto read_ascii_mesh_parallel(header const& header, std::string_view data, usize n_threads, mesh_data<IndexType>& out) -> std::optional<stf::expected<void, std::string_view>> {
+    while (!data.empty() && ascii_cursor::is_space(data.back())) {
+        data.remove_suffix(1);
+    }
+
+    std::vector<ascii_chunk<IndexType>> chunks{};
+    for (std::string_view piece : io::detail::split_at_lines(data, n_threads)) {
+        chunks.push_back({.data = piece});
+    }
+
+    trc::detail::parallel_for(chunks.size(), n_threads, [&chunks](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            ascii_chunk<IndexType>& chunk = chunks[i];
+            chunk.n_lines = static_cast<usize>(std::ranges::count(chunk.data, '\n')) + (chunk.data.back() != '\n');
+        }
+    });
+
+    usize n_lines = 0;
+    for (ascii_chunk<IndexType>& chunk : chunks) {
+        chunk.first_line = n_lines;
+        n_lines += chunk.n_lines;
+    }
+
+    usize n_elements = 0;
+    std::vector<usize> first_vertices(header.elements.size());
+
+    for (usize i = 0; i < header.elements.size(); i++) {
+        first_vertices[i] = out.vertices.size();
+        if (header.elements[i].name == "vertex") {
+            out.vertices.resize(out.vertices.size() + header.elements[i].count);
+        }
+
+        n_elements += header.elements[i].count;
+    }
+
+    if (n_lines != n_elements) {
+        out.vertices.resize(first_vertices.empty() ? out.vertices.size() : first_vertices.front());
+        return std::nullopt;
+    }
+
+    const usize n_vertices = vertex_count(header);
+
+    trc::detail::parallel_for(chunks.size(), n_threads, [&](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            chunks[i].result = parse_ascii_chunk(header, first_vertices, n_vertices, chunks[i], out);
+        }
+    });
+
+    std::vector<usize> triangle_offsets(chunks.size());
+    usize n_triangles = out.triangles.size();
+
+    for (usize i = 0; i < chunks.size(); i++) {
+        TRYX(chunks[i].result);
+
+        triangle_offsets[i] = n_triangles;
+        n_triangles += chunks[i].triangles.size();
+    }
+
+    out.triangles.resize(n_triangles);
+
+    trc::detail::parallel_for(chunks.size(), n_threads, [&](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            std::ranges::copy(chunks[i].triangles, out.triangles.begin() + static_cast<isize>(triangle_offsets[i]));
+            chunks[i].triangles = {};
+        }
+    });
+
+    return stf::expected<void, std::string_view>{};
+}
+
+/// @param n_threads 0 means <code>trc::detail::default_thread_count()</code>
+template<std::unsigned_integral IndexType>
+inline auto read_ascii_mesh(header const& header, std::string_view data, usize n_threads, mesh_data<IndexType>& out) -> stf::expected<void, std::string_view> {
+    if (n_threads == 0) {
+        n_threads = trc::detail::default_thread_count();
+    }
+
+    if (n_threads > 1 && data.size() >= parallel_ascii_threshold) {
+        if (auto res = read_ascii_mesh_parallel(header, data, n_threads, out)) {
+            return *res;
+        }
+
+        spdlog::debug("the body of the PLY file does not have one element per line, parsing it on one thread");
+    }
+
+    return read_ascii_mesh_serial(header, data, out);
+}
+
+/// The number of elements <code>read_mesh_chunked</code> hands over at a time
+inline constexpr usize chunk_elements = usize(1) << 16;
+
+template<std::unsigned_integral IndexType, typename VerticesFn, typename TrianglesFn>
+inline auto read_binary_mesh_chunked(header const& header, std::span<const std::byte> data, VerticesFn&& vertices_fn, TrianglesFn&& triangles_fn) -> stf::expected<void, std::string_view> {
+    const std::endian endian = header.format == format::binary_little_endian ? std::endian::little : std::endian::big;
+    const usize n_vertices = vertex_count(header);
+
+    std::vector<vec3> vertices{};
+    std::vector<std::array<IndexType, 3>> triangles{};
+
+    for (element const& description : header.elements) {
+        // the readers take the number of instances to read from the description
+        element chunk = description;
+
+        for (usize done = 0; done < description.count; done += chunk.count) {
+            chunk.count = std::min(chunk_elements, description.count - done);
+
+            if (description.name == "vertex") {
+                vertices.clear();
+                TRYX(read_binary_vertices(chunk, data, endian, vertices));
+                std::invoke(vertices_fn, std::span<const vec3>(vertices));
+            } else if (description.name == "face") {
+                triangles.clear();
+                TRYX(read_binary_faces(chunk, data, endian, n_vertices, triangles));
+                std::invoke(triangles_fn, std::span<const std::array<IndexType, 3>>(triangles));
+            } else {
+                TRYX(for_each_binary_element(chunk, data, endian, [](std::span<const std::byte>) {}));
             }
         }
+    }
+
+    return {};
+}
+
+template<std::unsigned_integral IndexType, typename VerticesFn, typename TrianglesFn>
+inline auto read_ascii_mesh_chunked(header const& header, std::string_view data, VerticesFn&& vertices_fn, TrianglesFn&& triangles_fn) -> stf::expected<void, std::string_view> {
+    ascii_cursor cursor{.data = data};
+    const usize n_vertices = vertex_count(header);
+
+    std::vector<vec3> vertices{};
+    std::vector<std::array<IndexType, 3>> triangles{};
+
+    for (element const& description : header.elements) {
+        if (description.name != "vertex" && description.name != "face") {
+            if (!skip_ascii_element(description, cursor, description.count)) {
+                return stf::unexpected{"unexpected EOF"};
+            }
+
+            continue;
+        }
+
+        for (usize done = 0; done < description.count;) {
+            const usize count = std::min(chunk_elements, description.count - done);
+            done += count;
+
+            if (description.name == "vertex") {
+                vertices.resize(count);
+                TRYX(parse_ascii_vertices(description, cursor, vertices));
+                std::invoke(vertices_fn, std::span<const vec3>(vertices));
+            } else {
+                triangles.clear();
+                TRYX(parse_ascii_faces(description, cursor, count, n_vertices, triangles));
+                std::invoke(triangles_fn, std::span<const std::array<IndexType, 3>>(triangles));
+            }
+        }
+    }
+
+    return {};
+}
+
+/// Maps a PLY file and reads its header
+/// @return An error if the file cannot be read or if its vertices cannot be indexed with <code>IndexType</code>
+template<std::unsigned_integral IndexType>
+inline auto open_mesh(std::string const& path) -> stf::expected<std::pair<io::detail::mapped_file, header>, std::string> {
+    auto file_res = io::detail::mapped_file::open(path);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
 
-        std::invoke(std::forward<Fn>(fn), std::move(arguments));
+    auto header_res = read_header(file_res->chars());
+    if (!header_res) {
+        return stf::unexpected{fmt::format("\"{}\": {}", path, header_res.error())};
+    }
+
+    if (vertex_count(*header_res) > static_cast<usize>(std::numeric_limits<IndexType>::max())) {
+        return stf::unexpected{fmt::format("\"{}\": too many vertices for the index type", path)};
+    }
+
+    return std::pair{std::move(*file_res), std::move(*header_res)};
+}
+
+}// namespace detail
+
+/// Reads the positions of the <code>vertex</code> element and the <code>face</code> element of a PLY file, polygons
+/// are split into triangle fans.\n
+/// Files are parsed straight out of a memory mapping into the preallocated arrays, nothing is allocated per element.
+/// Binary files in common layouts (float coordinates, uchar counts and int indices) skip the per-type dispatch, large
+/// ASCII files are parsed in chunks on several threads.
+/// @param n_threads The number of threads parsing ASCII files, 0 means <code>trc::detail::default_thread_count()</code>
+template<std::unsigned_integral IndexType = u32>
+inline auto read_mesh(std::string const& path, usize n_threads = 0) -> stf::expected<mesh_data<IndexType>, std::string> {
+    auto open_res = detail::open_mesh<IndexType>(path);
+    if (!open_res) {
+        return stf::unexpected{open_res.error()};
+    }
+
+    auto const& [file, header] = *open_res;
+
+    mesh_data<IndexType> ret{};
+
+    auto res = header.format == format::ascii
+                 ? detail::read_ascii_mesh(header, file.chars().substr(header.data_offset), n_threads, ret)
+                 : detail::read_binary_mesh(header, file.bytes().subspan(header.data_offset), ret);
+
+    if (!res) {
+        return stf::unexpected{fmt::format("\"{}\": {}", path, res.error())};
+    }
+
+    return ret;
+}
+
+/// Reads a PLY file like <code>read_mesh</code>, but hands the vertices and the triangles to
+/// <code>vertices_fn(std::span<const vec3>)</code> and <code>triangles_fn(std::span<const std::array<IndexType, 3>>)</code>
+/// a chunk at a time instead of collecting them, for meshes that do not fit into memory. Chunks are handed over in file
+/// order, ASCII files are parsed on the calling thread.
+template<std::unsigned_integral IndexType = u32, typename VerticesFn, typename TrianglesFn>
+inline auto read_mesh_chunked(std::string const& path, VerticesFn&& vertices_fn, TrianglesFn&& triangles_fn) -> stf::expected<void, std::string> {
+    auto open_res = detail::open_mesh<IndexType>(path);
+    if (!open_res) {
+        return stf::unexpected{open_res.error()};
+    }
+
+    auto const& [file, header] = *open_res;
+
+    auto res = header.format == format::ascii
+                 ? detail::read_ascii_mesh_chunked<IndexType>(header, file.chars().substr(header.data_offset), vertices_fn, triangles_fn)
+                 : detail::read_binary_mesh_chunked<IndexType>(header, file.bytes().subspan(header.data_offset), vertices_fn, triangles_fn);
+
+    if (!res) {
+        return stf::unexpected{fmt::format("\"{}\": {}", path, res.error())};
     }
 
     return {};
@@ -1,12 +1,23 @@
 #pragma once
 
 #include <tracer/common.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/io/detail/mapped_file.hpp>
+#include <tracer/io/detail/tokenizer.hpp>
 
 #include <stuff/bit.hpp>
 #include <stuff/core.hpp>
 #include <stuff/expected.hpp>
 
+#include <fmt/format.h>
+
+#include <cstring>
+#include <functional>
 #include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace trc::io::stl {
 
@@ -15,87 +26,265 @@ struct triangle {
     std::array<stf::blas::vector<float, 3>, 3> vertices;
 };
 
-template<typename It>
-struct binary_stream {
-    constexpr binary_stream(It it, It end)
-        : m_it(it)
-        , m_end(end) {
-        discard_bytes(80);
-        discard_bytes(4);
+namespace detail {
+
+inline constexpr usize header_size = 84;
+inline constexpr usize record_size = 50;
+
+/// Records are decoded on several threads from this many on
+inline constexpr usize parallel_record_threshold = usize(1) << 16;
+
+inline auto triangle_count(std::span<const std::byte> data) -> u32 {
+    u32 count;
+    std::memcpy(&count, data.data() + 80, sizeof(count));
+    return stf::bit::convert_endian(count, std::endian::little, std::endian::native);
+}
+
+/// Binary files whose header starts with "solid" exist, the size matching the triangle count tells them apart
+inline auto is_ascii(std::span<const std::byte> data) -> bool {
+    if (data.size() >= header_size && data.size() == header_size + usize(triangle_count(data)) * record_size) {
+        return false;
+    }
+
+    io::detail::tokenizer tokenizer{.data = {reinterpret_cast<const char*>(data.data()), data.size()}};
+    return tokenizer.next_token() == "solid";
+}
+
+inline auto decode_record(const std::byte* record) -> triangle {
+    // the normal and the vertices are 12 consecutive floats, copied in one go
+    std::array<float, 12> values;
+    std::memcpy(values.data(), record, sizeof(values));
+
+    if constexpr (std::endian::native != std::endian::little) {
+        for (float& value : values) {
+            value = stf::bit::convert_endian(value, std::endian::little, std::endian::native);
+        }
+    }
+
+    triangle ret{};
+    for (usize i = 0; i < 3; i++) {
+        ret.normal[i] = values[i];
+        ret.vertices[0][i] = values[3 + i];
+        ret.vertices[1][i] = values[6 + i];
+        ret.vertices[2][i] = values[9 + i];
+    }
+
+    return ret;
+}
+
+/// @return The number of triangles of a binary file, if there is room for them
+inline auto binary_triangle_count(std::span<const std::byte> data) -> stf::expected<usize, std::string> {
+    if (data.size() < header_size) {
+        return stf::unexpected{std::string("the header is cut short")};
+    }
+
+    const usize count = triangle_count(data);
+
+    if (data.size() < header_size + count * record_size) {
+        return stf::unexpected{fmt::format("the header announces {} triangles but there is only room for {}", count, (data.size() - header_size) / record_size)};
     }
 
-    constexpr auto next() -> std::optional<triangle> {
-        triangle ret{};
+    return count;
+}
 
-        if (
-          !read_primitives<float>({ret.normal.data(), 3}) ||
-          !read_primitives<float>({ret.vertices[0].data(), 3}) ||
-          !read_primitives<float>({ret.vertices[1].data(), 3}) ||
-          !read_primitives<float>({ret.vertices[2].data(), 3})) {
-            return std::nullopt;
+/// Hands the triangles of a binary file to <code>fn(triangle const&)</code> one by one
+template<typename Fn>
+inline auto for_each_binary(std::span<const std::byte> data, Fn&& fn) -> stf::expected<void, std::string> {
+    const usize count = TRYX(binary_triangle_count(data));
+
+    // some writers store extra bytes after records and their length in the attribute field, files without them may
+    // use the field for other things
+    const bool walk = data.size() != header_size + count * record_size;
+
+    usize offset = header_size;
+    for (usize i = 0; i < count; i++) {
+        if (offset > data.size() || data.size() - offset < record_size) {
+            return stf::unexpected{fmt::format("unexpected EOF after {} of {} triangles", i, count)};
         }
 
-        if (u16 attrib_size = TRYX(read_primitive<u16>()); !discard_bytes(attrib_size)) {
-            return std::nullopt;
+        std::invoke(fn, decode_record(data.data() + offset));
+
+        u16 attribute_size = 0;
+        if (walk) {
+            std::memcpy(&attribute_size, data.data() + offset + 48, sizeof(attribute_size));
         }
 
+        offset += record_size + stf::bit::convert_endian(attribute_size, std::endian::little, std::endian::native);
+    }
+
+    return {};
+}
+
+inline auto read_binary(std::span<const std::byte> data, usize n_threads) -> stf::expected<std::vector<triangle>, std::string> {
+    const usize count = TRYX(binary_triangle_count(data));
+
+    std::vector<triangle> ret{};
+
+    if (data.size() != header_size + count * record_size) {
+        ret.reserve(count);
+        TRYX(for_each_binary(data, [&ret](triangle const& tri) { ret.push_back(tri); }));
+
         return ret;
     }
 
-private:
-    It m_it;
-    It m_end;
-    constexpr auto discard_bytes(usize n) -> bool {
-        for (usize i = 0; i < n; i++) {
-            if (m_it == m_end) {
-                return false;
-            }
-            m_it++;
+    ret.resize(count);
+    const std::byte* records = data.data() + header_size;
+
+    trc::detail::parallel_for(count, count >= parallel_record_threshold ? n_threads : 1, [&](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            ret[i] = decode_record(records + i * record_size);
         }
+    });
 
-        return true;
-    }
+    return ret;
+}
+
+constexpr auto read_vector(io::detail::tokenizer& tokenizer, std::string_view keyword, stf::blas::vector<float, 3>& out) -> bool {
+    return tokenizer.expect(keyword) && tokenizer.next(out[0]) && tokenizer.next(out[1]) && tokenizer.next(out[2]);
+}
+
+/// Parses the <code>solid</code>s of an ASCII file, which may hold any number of them, and hands their facets to
+/// <code>fn(triangle const&)</code> one by one
+template<typename Fn>
+inline auto for_each_ascii(std::string_view data, Fn&& fn) -> stf::expected<void, std::string> {
+    io::detail::tokenizer tokenizer{.data = data};
+
+    usize n_facets = 0;
+
+    auto error = [&n_facets](std::string_view what) {
+        return stf::unexpected{fmt::format("{} in facet {}", what, n_facets + 1)};
+    };
+
+    // binary files with "solid" in their header tend to run into a record before a facet, but not always
+    bool in_solid = false;
+
+    while (auto token = tokenizer.next_token()) {
+        if (*token == "solid" || *token == "endsolid") {
+            in_solid = *token == "solid";
 
-    template<typename OIt>
-    constexpr auto read_bytes(OIt out, usize n) {
-        for (usize i = 0; i < n; i++) {
-            if (m_it == m_end) {
-                return false;
+            // names may contain spaces
+            tokenizer.skip_line();
+            continue;
+        }
+
+        if (*token != "facet") {
+            return error(fmt::format("unexpected \"{}\"", *token));
+        }
+
+        triangle tri{};
+
+        if (!read_vector(tokenizer, "normal", tri.normal)) {
+            return error("malformed normal");
+        }
+
+        if (!tokenizer.expect("outer") || !tokenizer.expect("loop")) {
+            return error("expected \"outer loop\"");
+        }
+
+        for (auto& vertex : tri.vertices) {
+            if (!read_vector(tokenizer, "vertex", vertex)) {
+                return error("malformed vertex");
             }
+        }
 
-            *out++ = *m_it++;
+        if (!tokenizer.expect("endloop") || !tokenizer.expect("endfacet")) {
+            return error("facets have to be triangles");
         }
 
-        return true;
+        std::invoke(fn, tri);
+        n_facets++;
     }
 
-    template<size_t Extent = std::dynamic_extent>
-    constexpr auto read_bytes(std::span<u8, Extent> out) -> bool {
-        return read_bytes(out.begin(), out.size());
+    if (in_solid) {
+        return stf::unexpected{std::string("missing \"endsolid\"")};
     }
 
-    template<typename T>
-    constexpr auto read_primitive() -> std::optional<T> {
-        std::array<u8, sizeof(T)> temp{};
-        if (!read_bytes({temp})) {
-            return std::nullopt;
-        }
+    return {};
+}
+
+inline auto read_ascii(std::string_view data) -> stf::expected<std::vector<triangle>, std::string> {
+    std::vector<triangle> ret{};
+    // a facet takes around 250 characters
+    ret.reserve(data.size() / 256);
+
+    TRYX(for_each_ascii(data, [&ret](triangle const& tri) { ret.push_back(tri); }));
+
+    return ret;
+}
 
-        return stf::bit::convert_endian(std::bit_cast<T>(temp), std::endian::little, std::endian::native);
+/// Tells binary and ASCII files apart, files that start with "solid" but do not parse as ASCII are read as binary ones
+/// as some binary writers put "solid" into the header
+inline auto read_triangles(std::span<const std::byte> data, usize n_threads) -> stf::expected<std::vector<triangle>, std::string> {
+    if (!is_ascii(data)) {
+        return read_binary(data, n_threads);
     }
 
-    template<typename T, size_t Extent = std::dynamic_extent>
-    constexpr auto read_primitives(std::span<T, Extent> out) -> bool {
-        for (T& elem: out) {
-            std::optional<T> temp = read_primitive<T>();
-            if (!temp) {
-                return false;
-            }
-            elem = *temp;
-        }
+    auto res = read_ascii({reinterpret_cast<const char*>(data.data()), data.size()});
+    if (res) {
+        return res;
+    }
+
+    // the error of the ASCII parse is the more telling one for files that are neither
+    auto binary_res = read_binary(data, n_threads);
+    return binary_res ? binary_res : res;
+}
 
-        return true;
+template<typename Fn, typename RestartFn>
+inline auto for_each_triangle(std::span<const std::byte> data, Fn&& fn, RestartFn&& restart) -> stf::expected<void, std::string> {
+    if (!is_ascii(data)) {
+        return for_each_binary(data, fn);
     }
-};
+
+    auto res = for_each_ascii({reinterpret_cast<const char*>(data.data()), data.size()}, fn);
+    if (res) {
+        return res;
+    }
+
+    std::invoke(restart);
+
+    auto binary_res = for_each_binary(data, fn);
+    return binary_res ? binary_res : res;
+}
+
+}// namespace detail
+
+/// Reads all triangles of a binary or ASCII STL file.\n
+/// The file is memory mapped, binary records are decoded straight out of the mapping after checking the size of the
+/// file against the triangle count in the header.
+/// @param n_threads The number of threads decoding large binary files, 0 means <code>trc::detail::default_thread_count()</code>
+inline auto read_triangles(std::string const& path, usize n_threads = 0) -> stf::expected<std::vector<triangle>, std::string> {
+    auto file_res = io::detail::mapped_file::open(path);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    auto res = detail::read_triangles(file_res->bytes(), n_threads);
+
+    if (!res) {
+        return stf::unexpected{fmt::format("\"{}\": {}", path, res.error())};
+    }
+
+    return res;
+}
+
+/// Reads the triangles of a binary or ASCII STL file like <code>read_triangles</code>, but hands them to
+/// <code>fn(triangle const&)</code> one by one instead of collecting them, for meshes that do not fit into memory.\n
+/// Files that start with "solid" but do not parse as ASCII are read again as binary ones, <code>restart()</code> is
+/// called before that and has to forget the triangles handed over so far.
+template<typename Fn, typename RestartFn>
+inline auto for_each_triangle(std::string const& path, Fn&& fn, RestartFn&& restart) -> stf::expected<void, std::string> {
+    auto file_res = io::detail::mapped_file::open(path);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    auto res = detail::for_each_triangle(file_res->bytes(), std::forward<Fn>(fn), std::forward<RestartFn>(restart));
+
+    if (!res) {
+        return stf::unexpected{fmt::format("\"{}\": {}", path, res.error())};
+    }
+
+    return res;
+}
 
 }// namespace trc::io::stl
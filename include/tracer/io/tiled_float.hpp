@@ -0,0 +1,404 @@
+#pragma once
+
+#include <stuff/bit.hpp>
+#include <stuff/expected.hpp>
+
+#include <tracer/aov.hpp>
+#include <tracer/common.hpp>
+#include <tracer/image.hpp>
+#include <tracer/io/detail/file.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace trc::io::tiled_float {
+
+// A simple HDR format for renders and their AOVs, written tile by tile as they finish.
+//
+// header:  "TFIM", u32 version, u32 width, u32 height, u32 n_layers, n_layers strings (u32 length and characters)
+// records: u32 layer, u32 x, u32 y, u32 width, u32 height, u32 encoding, u32 payload size, payload
+//
+// Records follow the header back to back until the end of the file, in whatever order tiles were finished. Every
+// layer has three channels, a payload holds all reds of the block row by row, then the greens, then the blues as
+// 32-bit floats. Encoded payloads are a sequence of packets of 32-bit words, the control word either introduces a
+// run (high bit set, the low bits count the copies of the next word) or the given number of literal words.
+// All numbers are little-endian, pixels no record covers are black.
+
+inline constexpr std::array<char, 4> magic{'T', 'F', 'I', 'M'};
+inline constexpr u32 version = 1;
+
+enum class encoding : u32 {
+    raw = 0,
+    rle = 1,
+};
+
+namespace detail {
+
+inline constexpr usize record_header_size = 7 * sizeof(u32);
+
+inline constexpr u32 run_bit = 0x80000000u;
+
+inline void put_u32(std::vector<std::byte>& out, u32 v) {
+    v = stf::bit::convert_endian(v, std::endian::native, std::endian::little);
+    auto bytes = std::bit_cast<std::array<std::byte, sizeof(u32)>>(v);
+    out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+inline auto get_u32(std::span<const std::byte> in, usize offset) -> u32 {
+    std::array<std::byte, sizeof(u32)> bytes{};
+    std::copy_n(in.data() + offset, sizeof(u32), bytes.data());
+    return stf::bit::convert_endian(std::bit_cast<u32>(bytes), std::endian::little, std::endian::native);
+}
+
+/// Appends the packets for <code>words</code> to <code>out</code>, runs shorter than 3 words are not worth a packet
+inline void rle_encode(std::span<const u32> words, std::vector<std::byte>& out) {
+    usize literal_begin = 0;
+
+    auto flush_literals = [&](usize end) {
+        if (end == literal_begin) {
+            return;
+        }
+
+        put_u32(out, static_cast<u32>(end - literal_begin));
+        for (usize i = literal_begin; i < end; i++) {
+            put_u32(out, words[i]);
+        }
+    };
+
+    for (usize i = 0; i < words.size();) {
+        usize run_end = i + 1;
+        while (run_end < words.size() && words[run_end] == words[i] && run_end - i < run_bit - 1) {
+            run_end++;
+        }
+
+        if (run_end - i < 3) {
+            i = run_end;
+            continue;
+        }
+
+        flush_literals(i);
+
+        put_u32(out, run_bit | static_cast<u32>(run_end - i));
+        put_u32(out, words[i]);
+
+        i = run_end;
+        literal_begin = i;
+    }
+
+    flush_literals(words.size());
+}
+
+/// @return false if the packets do not decode to exactly <code>words.size()</code> words
+inline auto rle_decode(std::span<const std::byte> in, std::span<u32> words) -> bool {
+    usize offset = 0;
+    usize n_written = 0;
+
+    while (offset + sizeof(u32) <= in.size()) {
+        u32 control = get_u32(in, offset);
+        offset += sizeof(u32);
+
+        const usize count = control & ~run_bit;
+        const usize n_words = (control & run_bit) != 0 ? 1 : count;
+
+        if (count > words.size() - n_written || n_words > (in.size() - offset) / sizeof(u32)) {
+            return false;
+        }
+
+        for (usize i = 0; i < count; i++) {
+            words[n_written + i] = get_u32(in, offset + ((control & run_bit) != 0 ? 0 : i * sizeof(u32)));
+        }
+
+        offset += n_words * sizeof(u32);
+        n_written += count;
+    }
+
+    return offset == in.size() && n_written == words.size();
+}
+
+}// namespace detail
+
+/// Streams a render and any number of additional layers (e.g. AOVs) to a file as blocks of pixels finish.\n
+/// Each block becomes a record appended at the end of the file, blocks may come from several threads at once and
+/// nothing image-sized is held in memory. <code>set_tile</code> writes to the first layer, layers named after an AOV
+/// (see <code>aov_name</code>) receive that AOV from integrators as tiles finish.\n
+/// Write-only, <code>get</code> returns black. Errors are collected and reported by <code>finish</code>.
+struct writer final : aov_image_like {
+    static auto create(std::string const& path, usize width, usize height, std::vector<std::string> layers = {"beauty"}, encoding payload_encoding = encoding::rle)
+      -> stf::expected<writer, std::string> {
+        if (layers.empty()) {
+            return stf::unexpected{std::string("an image needs at least one layer")};
+        }
+
+        auto file_res = io::detail::file::create(path);
+        if (!file_res) {
+            return stf::unexpected{file_res.error()};
+        }
+
+        std::vector<std::byte> header{};
+        header.insert(header.end(), reinterpret_cast<const std::byte*>(magic.data()), reinterpret_cast<const std::byte*>(magic.data()) + magic.size());
+        detail::put_u32(header, version);
+        detail::put_u32(header, static_cast<u32>(width));
+        detail::put_u32(header, static_cast<u32>(height));
+        detail::put_u32(header, static_cast<u32>(layers.size()));
+
+        for (std::string const& name: layers) {
+            detail::put_u32(header, static_cast<u32>(name.size()));
+            header.insert(header.end(), reinterpret_cast<const std::byte*>(name.data()), reinterpret_cast<const std::byte*>(name.data()) + name.size());
+        }
+
+        if (!file_res->write_at(header, 0)) {
+            return stf::unexpected{fmt::format("could not write to \"{}\"", path)};
+        }
+
+        writer ret{};
+        ret.m_file = std::move(*file_res);
+        ret.m_width = width;
+        ret.m_height = height;
+        ret.m_n_layers = layers.size();
+        ret.m_encoding = payload_encoding;
+        ret.m_end = header.size();
+
+        for (usize i = 1; i < n_aovs; i++) {
+            auto it = std::ranges::find(layers, aov_name(static_cast<aov>(i)));
+            ret.m_aov_layers[i] = it == layers.end() ? no_layer : static_cast<usize>(it - layers.begin());
+        }
+
+        return ret;
+    }
+
+    writer(writer&& other) noexcept
+        : m_file(std::move(other.m_file))
+        , m_width(other.m_width)
+        , m_height(other.m_height)
+        , m_n_layers(other.m_n_layers)
+        , m_encoding(other.m_encoding)
+        , m_aov_layers(other.m_aov_layers)
+        , m_end(other.m_end.load(std::memory_order::relaxed))
+        , m_failed(other.m_failed.load(std::memory_order::relaxed)) {}
+
+    ~writer() override = default;
+
+    auto width() const -> usize override { return m_width; }
+    auto height() const -> usize override { return m_height; }
+
+    auto n_layers() const -> usize { return m_n_layers; }
+
+    /// One record per call, prefer <code>set_tile</code>
+    void set(usize x, usize y, color c) override { set_tile(x, y, 1, 1, std::span(&c, 1)); }
+
+    auto get(usize, usize) const -> color override { return {}; }
+
+    void set_tile(usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        write_tile(0, x, y, tile_width, tile_height, pixels);
+    }
+
+    auto has_aov(aov channel) const -> bool override {
+        return channel == aov::beauty || m_aov_layers[static_cast<usize>(channel)] != no_layer;
+    }
+
+    void set_aov_tile(aov channel, usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) override {
+        if (has_aov(channel)) {
+            write_tile(channel == aov::beauty ? 0 : m_aov_layers[static_cast<usize>(channel)], x, y, tile_width, tile_height, pixels);
+        }
+    }
+
+    void write_tile(usize layer, usize x, usize y, usize tile_width, usize tile_height, std::span<const color> pixels) {
+        const usize n_pixels = tile_width * tile_height;
+
+        std::vector<u32> words(n_pixels * 3);
+        for (usize c = 0; c < 3; c++) {
+            for (usize i = 0; i < n_pixels; i++) {
+                words[c * n_pixels + i] = std::bit_cast<u32>(static_cast<float>(pixels[i][c]));
+            }
+        }
+
+        std::vector<std::byte> record{};
+        record.reserve(detail::record_header_size + words.size() * sizeof(u32));
+
+        for (usize v: {layer, x, y, tile_width, tile_height}) {
+            detail::put_u32(record, static_cast<u32>(v));
+        }
+
+        // the encoding and size are filled in below
+        record.resize(detail::record_header_size);
+
+        encoding payload_encoding = m_encoding;
+        if (payload_encoding == encoding::rle) {
+            detail::rle_encode(words, record);
+
+            // noise compresses poorly, fall back to raw if the packets do not save anything
+            if (record.size() - detail::record_header_size >= words.size() * sizeof(u32)) {
+                record.resize(detail::record_header_size);
+                payload_encoding = encoding::raw;
+            }
+        }
+
+        if (payload_encoding == encoding::raw) {
+            for (u32 word: words) {
+                detail::put_u32(record, word);
+            }
+        }
+
+        std::vector<std::byte> tail{};
+        detail::put_u32(tail, static_cast<u32>(payload_encoding));
+        detail::put_u32(tail, static_cast<u32>(record.size() - detail::record_header_size));
+        std::copy(tail.begin(), tail.end(), record.begin() + 5 * sizeof(u32));
+
+        const u64 offset = m_end.fetch_add(record.size(), std::memory_order::relaxed);
+        if (!m_file.write_at(record, offset)) {
+            m_failed.store(true, std::memory_order::relaxed);
+        }
+    }
+
+    /// Closes the file, reports whether any write failed
+    auto finish() -> stf::expected<void, std::string> {
+        auto res = m_file.close();
+
+        if (m_failed.load(std::memory_order::relaxed)) {
+            return stf::unexpected{std::string("could not write all tiles")};
+        }
+
+        return res;
+    }
+
+private:
+    static constexpr usize no_layer = static_cast<usize>(-1);
+
+    writer() = default;
+
+    io::detail::file m_file{};
+    usize m_width = 0;
+    usize m_height = 0;
+    usize m_n_layers = 0;
+    encoding m_encoding = encoding::rle;
+
+    /// The layer each AOV is written to, <code>no_layer</code> for the ones the file does not have
+    std::array<usize, n_aovs> m_aov_layers{};
+
+    /// Where the next record goes, reserved atomically so that concurrent writers never overlap
+    std::atomic<u64> m_end = 0;
+    std::atomic_bool m_failed = false;
+};
+
+struct contents {
+    std::vector<std::string> layer_names{};
+    std::vector<image> layers{};
+
+    auto width() const -> usize { return layers.front().width(); }
+    auto height() const -> usize { return layers.front().height(); }
+};
+
+inline auto read(std::string const& path) -> stf::expected<contents, std::string> {
+    auto file_res = io::detail::file::open(path);
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    std::vector<std::byte> data(file_res->size().value_or(0));
+    if (!file_res->read_at(data, 0)) {
+        return stf::unexpected{fmt::format("could not read \"{}\"", path)};
+    }
+
+    auto bad_file = [&] { return stf::unexpected{fmt::format("\"{}\" is not a tiled float image", path)}; };
+
+    std::span<const std::byte> in = data;
+    usize offset = 0;
+
+    auto next_u32 = [&]() -> std::optional<u32> {
+        if (in.size() - offset < sizeof(u32)) {
+            return std::nullopt;
+        }
+
+        offset += sizeof(u32);
+        return detail::get_u32(in, offset - sizeof(u32));
+    };
+
+    if (in.size() < magic.size() || !std::equal(magic.begin(), magic.end(), reinterpret_cast<const char*>(in.data()))) {
+        return bad_file();
+    }
+
+    offset = magic.size();
+
+    auto file_version = next_u32();
+    auto width = next_u32();
+    auto height = next_u32();
+    auto n_layers = next_u32();
+
+    if (!file_version || *file_version != version || !width || !height || !n_layers || *n_layers == 0) {
+        return bad_file();
+    }
+
+    contents ret{};
+
+    for (u32 i = 0; i < *n_layers; i++) {
+        auto length = next_u32();
+        if (!length || in.size() - offset < *length) {
+            return bad_file();
+        }
+
+        ret.layer_names.emplace_back(reinterpret_cast<const char*>(in.data() + offset), *length);
+        offset += *length;
+
+        ret.layers.emplace_back(*width, *height);
+        ret.layers.back().fill(color{});
+    }
+
+    std::vector<u32> words{};
+
+    // an interrupted render leaves a partial record at the end, everything before it is still good
+    while (in.size() - offset >= detail::record_header_size) {
+        u32 layer = *next_u32();
+        u32 x = *next_u32();
+        u32 y = *next_u32();
+        u32 tile_width = *next_u32();
+        u32 tile_height = *next_u32();
+        u32 payload_encoding = *next_u32();
+        u32 payload_size = *next_u32();
+
+        if (in.size() - offset < payload_size) {
+            break;
+        }
+
+        std::span<const std::byte> payload = in.subspan(offset, payload_size);
+        offset += payload_size;
+
+        if (layer >= *n_layers || x > *width || y > *height || tile_width > *width - x || tile_height > *height - y) {
+            return bad_file();
+        }
+
+        const usize n_pixels = static_cast<usize>(tile_width) * tile_height;
+        words.resize(n_pixels * 3);
+
+        if (payload_encoding == static_cast<u32>(encoding::raw)) {
+            if (payload_size != words.size() * sizeof(u32)) {
+                return bad_file();
+            }
+
+            for (usize i = 0; i < words.size(); i++) {
+                words[i] = detail::get_u32(payload, i * sizeof(u32));
+            }
+        } else if (payload_encoding != static_cast<u32>(encoding::rle) || !detail::rle_decode(payload, words)) {
+            return bad_file();
+        }
+
+        image& target = ret.layers[layer];
+        for (usize i = 0; i < n_pixels; i++) {
+            color& c = target.at(x + i % tile_width, y + i / tile_width);
+            for (usize channel = 0; channel < 3; channel++) {
+                c[channel] = static_cast<real>(std::bit_cast<float>(words[channel * n_pixels + i]));
+            }
+        }
+    }
+
+    return ret;
+}
+
+}// namespace trc::io::tiled_float
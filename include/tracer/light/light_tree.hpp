@@ -0,0 +1,350 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/shape/shapes.hpp>
+
+#include <span>
+#include <vector>
+
+namespace trc {
+
+/// Bounds a set of surface normals.\n
+/// Every material in the tracer emits from both faces of a surface, so cones bound lines rather than directions: a
+/// cone around <code>axis</code> also contains the directions around <code>-axis</code>. An opening angle of π/2
+/// therefore bounds every direction.
+struct normal_cone {
+    static constexpr real max_angle = std::numbers::pi_v<real> / 2;
+
+    vec3 axis{0, 0, 1};
+    real theta_o = max_angle;
+
+    static constexpr auto everything() -> normal_cone { return {}; }
+
+    static constexpr auto around(vec3 normal) -> normal_cone {
+        return {
+          .axis = normal,
+          .theta_o = 0,
+        };
+    }
+
+    constexpr auto bounds_everything() const -> bool { return theta_o >= max_angle; }
+
+    constexpr auto merge(normal_cone other) const -> normal_cone {
+        normal_cone a = *this;
+        normal_cone b = other;
+
+        if (a.bounds_everything() || b.bounds_everything()) {
+            return everything();
+        }
+
+        if (dot(a.axis, b.axis) < 0) {
+            b.axis = -b.axis;
+        }
+
+        if (b.theta_o > a.theta_o) {
+            std::swap(a, b);
+        }
+
+        real theta_d = std::acos(std::clamp<real>(dot(a.axis, b.axis), -1, 1));
+
+        if (theta_d + b.theta_o <= a.theta_o) {
+            return a;
+        }
+
+        real theta_o = (a.theta_o + theta_d + b.theta_o) / 2;
+        if (theta_o >= max_angle) {
+            return everything();
+        }
+
+        vec3 perpendicular = b.axis - a.axis * dot(a.axis, b.axis);
+        real perpendicular_length = abs(perpendicular);
+        if (perpendicular_length <= epsilon) {
+            return {.axis = a.axis, .theta_o = theta_o};
+        }
+
+        real theta_r = theta_o - a.theta_o;
+        vec3 axis = a.axis * std::cos(theta_r) + (perpendicular / perpendicular_length) * std::sin(theta_r);
+
+        return {
+          .axis = normalize(axis),
+          .theta_o = theta_o,
+        };
+    }
+};
+
+constexpr auto shape_normal_cone(bound_shape const& shape) -> normal_cone {
+    stf::multi_visitor visitor{
+      [](shapes::disc const& disc) { return normal_cone::around(disc.normal_at({})); },
+      [](shapes::triangle const& triangle) { return normal_cone::around(triangle.normal()); },
+      []<std::unsigned_integral IndexType>(shapes::mesh<IndexType> const& mesh) {
+          std::span<const shapes::pseudo_triangle<IndexType>> triangles = mesh.triangles();
+
+          if (triangles.empty()) {
+              return normal_cone::everything();
+          }
+
+          normal_cone ret = normal_cone::around(triangles.front().normal);
+          for (auto const& triangle: triangles.subspan(1)) {
+              ret = ret.merge(normal_cone::around(triangle.normal));
+
+              if (ret.bounds_everything()) {
+                  break;
+              }
+          }
+
+          return ret;
+      },
+      [](auto const&) { return normal_cone::everything(); },
+    };
+
+    return std::visit(visitor, shape);
+}
+
+/// A bounding volume hierarchy over emitters (Conty & Kulla 2018, simplified).\n
+/// Every node stores the bounds, the total power and the orientation bounds of the emitters beneath it, which is used
+/// to pick emitters proportional to a conservative estimate of the contribution they make to a given shading point.
+struct light_tree {
+    struct light_description {
+        bounding_box bounds;
+        normal_cone cone;
+        real power;
+    };
+
+    struct node {
+        bounding_box bounds;
+        normal_cone cone;
+        real power;
+
+        // leaves store the emitter index, interior nodes the index of their right child (the left child is the next node)
+        usize index;
+        bool is_leaf;
+    };
+
+    constexpr light_tree() = default;
+
+    constexpr void clear() {
+        m_nodes.clear();
+        m_paths.clear();
+    }
+
+    constexpr auto empty() const -> bool { return m_nodes.empty(); }
+
+    constexpr auto nodes() const -> std::span<const node> { return m_nodes; }
+
+    /// @param lights The description of the emitter at every index, as used in <code>pick</code> and <code>pdf</code>
+    constexpr void construct(std::span<const light_description> lights) {
+        clear();
+
+        if (lights.empty()) {
+            return;
+        }
+
+        std::vector<usize> indices(lights.size());
+        for (usize i = 0; i < indices.size(); i++) {
+            indices[i] = i;
+        }
+
+        m_paths.resize(lights.size());
+        m_nodes.reserve(lights.size() * 2 - 1);
+
+        construct_node(lights, indices, path{});
+    }
+
+    /// Picks an emitter for the shading point <code>at</code>. The normal at the point is optional but recommended.
+    /// @return
+    /// The index of the emitter and the probability of having picked it. Nothing if no emitter can contribute.
+    template<typename Gen>
+    constexpr auto pick(Gen& gen, vec3 at, std::optional<vec3> normal = std::nullopt) const -> std::optional<std::pair<usize, real>> {
+        if (m_nodes.empty()) {
+            return std::nullopt;
+        }
+
+        stf::random::erand48_distribution<real> dist{};
+
+        usize current = 0;
+        real pdf = 1;
+
+        while (!m_nodes[current].is_leaf) {
+            usize left = current + 1;
+            usize right = m_nodes[current].index;
+
+            real importance_left = importance(m_nodes[left], at, normal);
+            real importance_right = importance(m_nodes[right], at, normal);
+            real total = importance_left + importance_right;
+
+            if (total <= 0) {
+                return std::nullopt;
+            }
+
+            real prob_left = importance_left / total;
+
+            if (dist(gen) < prob_left) {
+                current = left;
+                pdf *= prob_left;
+            } else {
+                current = right;
+                pdf *= 1 - prob_left;
+            }
+        }
+
+        return std::pair{m_nodes[current].index, pdf};
+    }
+
+    /// The probability of <code>pick</code> returning the emitter at <code>index</code> for the given shading point
+    constexpr auto pdf(usize index, vec3 at, std::optional<vec3> normal = std::nullopt) const -> real {
+        if (index >= m_paths.size()) {
+            return 0;
+        }
+
+        path emitter_path = m_paths[index];
+
+        usize current = 0;
+        real pdf = 1;
+
+        for (usize depth = 0; depth < emitter_path.depth; depth++) {
+            usize left = current + 1;
+            usize right = m_nodes[current].index;
+
+            real importance_left = importance(m_nodes[left], at, normal);
+            real importance_right = importance(m_nodes[right], at, normal);
+            real total = importance_left + importance_right;
+
+            if (total <= 0) {
+                return 0;
+            }
+
+            if (((emitter_path.bits >> depth) & 1) == 0) {
+                current = left;
+                pdf *= importance_left / total;
+            } else {
+                current = right;
+                pdf *= importance_right / total;
+            }
+        }
+
+        return pdf;
+    }
+
+    static constexpr auto importance(node const& node, vec3 at, std::optional<vec3> normal) -> real {
+        if (node.power <= 0) {
+            return 0;
+        }
+
+        auto const& [min_corner, max_corner] = node.bounds.bounds;
+
+        vec3 center = (min_corner + max_corner) / 2;
+        real radius = abs(max_corner - min_corner) / 2;
+
+        vec3 to_point = at - center;
+        real distance_sq = dot(to_point, to_point);
+        real distance = std::sqrt(distance_sq);
+
+        // the point is within the bounding sphere, nothing can be said about the orientation
+        if (distance <= radius) {
+            return node.power / std::max(distance_sq, radius * radius / 4);
+        }
+
+        vec3 direction = to_point / distance;
+        real theta_u = std::asin(std::clamp<real>(radius / distance, 0, 1));
+
+        real cos_theta = std::abs(dot(node.cone.axis, direction));
+        real theta = std::acos(std::clamp<real>(cos_theta, 0, 1));
+        real theta_prime = std::max<real>(0, theta - node.cone.theta_o - theta_u);
+
+        if (theta_prime >= normal_cone::max_angle) {
+            return 0;
+        }
+
+        real ret = node.power * std::cos(theta_prime) / std::max(distance_sq, radius * radius / 4);
+
+        if (normal) {
+            real cos_theta_i = std::abs(dot(*normal, direction));
+            real theta_i = std::acos(std::clamp<real>(cos_theta_i, 0, 1));
+            real theta_i_prime = std::max<real>(0, theta_i - theta_u);
+
+            ret *= std::cos(theta_i_prime);
+        }
+
+        return ret;
+    }
+
+private:
+    struct path {
+        u64 bits = 0;
+        usize depth = 0;
+    };
+
+    std::vector<node> m_nodes{};
+    std::vector<path> m_paths{};
+
+    constexpr auto construct_node(std::span<const light_description> lights, std::span<usize> indices, path current_path) -> usize {
+        usize node_index = m_nodes.size();
+        m_nodes.emplace_back();
+
+        bounding_box bounds{};
+        bounding_box centroid_bounds{};
+        normal_cone cone = lights[indices.front()].cone;
+        real power = 0;
+
+        for (usize index: indices) {
+            light_description const& light = lights[index];
+
+            bounds.bump(light.bounds);
+            centroid_bounds.bump((light.bounds.bounds.first + light.bounds.bounds.second) / 2);
+            cone = cone.merge(light.cone);
+            power += light.power;
+        }
+
+        // the median split below keeps the depth at around log2(n), so 64 bits of path are plenty
+        if (indices.size() == 1 || current_path.depth >= 63) {
+            m_nodes[node_index] = node{
+              .bounds = bounds,
+              .cone = cone,
+              .power = power,
+              .index = indices.front(),
+              .is_leaf = true,
+            };
+
+            // in the (practically impossible) case of a too-deep tree, the extra emitters become unreachable
+            for (usize index: indices) {
+                m_paths[index] = current_path;
+            }
+
+            return node_index;
+        }
+
+        vec3 extents = centroid_bounds.bounds.second - centroid_bounds.bounds.first;
+        usize axis = extents[0] > extents[1] ? extents[0] > extents[2] ? 0 : 2 : extents[1] > extents[2] ? 1 : 2;
+
+        auto midpoint = indices.begin() + indices.size() / 2;
+        std::nth_element(indices.begin(), midpoint, indices.end(), [&](usize lhs, usize rhs) {
+            auto const& [lhs_min, lhs_max] = lights[lhs].bounds.bounds;
+            auto const& [rhs_min, rhs_max] = lights[rhs].bounds.bounds;
+            return (lhs_min[axis] + lhs_max[axis]) < (rhs_min[axis] + rhs_max[axis]);
+        });
+
+        usize split = static_cast<usize>(std::distance(indices.begin(), midpoint));
+
+        path left_path = current_path;
+        left_path.depth++;
+
+        path right_path = current_path;
+        right_path.bits |= u64(1) << current_path.depth;
+        right_path.depth++;
+
+        construct_node(lights, indices.subspan(0, split), left_path);
+        usize right_index = construct_node(lights, indices.subspan(split), right_path);
+
+        m_nodes[node_index] = node{
+          .bounds = bounds,
+          .cone = cone,
+          .power = power,
+          .index = right_index,
+          .is_leaf = false,
+        };
+
+        return node_index;
+    }
+};
+
+}// namespace trc
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <tracer/intersection.hpp>
-#include <tracer/texture.hpp>
+#include <tracer/texture_registry.hpp>
 
 #include <concepts>
 
@@ -21,7 +21,7 @@ concept material =//
 struct uv_albedo { color scale = vec3(1); };
 struct normal_albedo { color scale = vec3(1); };
 
-using albedo_source = std::variant<color, texture, uv_albedo, normal_albedo>;
+using albedo_source = std::variant<color, texture_handle, uv_albedo, normal_albedo>;
 
 constexpr auto sample_albedo_source(albedo_source const& source, intersection const& isection) -> color {
     vec2 uv = isection.uv;
@@ -29,7 +29,14 @@ constexpr auto sample_albedo_source(albedo_source const& source, intersection co
 
     stf::multi_visitor visitor{
       [](color c) -> color { return c; },
-      [uv](texture const& tex) -> color { return tex.sample(uv); },
+      [&isection](texture_handle tex) -> color {
+          if (!tex) {
+              return color{};
+          }
+
+          auto [duvdx, duvdy] = isection.uv_differentials();
+          return tex->sample(isection.uv, duvdx, duvdy);
+      },
       [uv](uv_albedo src) -> color { return color(uv, 0) * src.scale ; },
       [normal](normal_albedo src) -> color { return color(elem_abs(normal)) * src.scale; },
     };
@@ -37,6 +44,18 @@ constexpr auto sample_albedo_source(albedo_source const& source, intersection co
     return std::visit(visitor, source);
 }
 
+/// A representative (mean) value for an albedo source, used where a single color is needed to describe a whole surface
+constexpr auto average_albedo_source(albedo_source const& source) -> color {
+    stf::multi_visitor visitor{
+      [](color c) -> color { return c; },
+      [](texture_handle tex) -> color { return tex ? tex->average() : color{}; },
+      [](uv_albedo src) -> color { return color(0.5, 0.5, 0) * src.scale; },
+      [](normal_albedo src) -> color { return color(0.5) * src.scale; },
+    };
+
+    return std::visit(visitor, source);
+}
+
 struct material_base {
     constexpr material_base(albedo_source albedo, albedo_source emission = color(0)) noexcept
         : m_albedo(albedo)
@@ -45,7 +64,7 @@ struct material_base {
     constexpr auto is_light() const -> bool {
         stf::multi_visitor visitor{
           [](color c) { return vec3(0) != c; },
-          [](texture const& tex) { return !tex.empty(); },
+          [](texture_handle tex) { return tex && !tex->empty(); },
           [](uv_albedo) { return true; },
           [](normal_albedo) { return true; },
         };
@@ -53,6 +72,11 @@ struct material_base {
         return std::visit(visitor, m_emission);
     }
 
+    /// Mean emitted radiance over the surface, see <code>average_albedo_source</code>
+    constexpr auto average_emission() const -> color {
+        return average_albedo_source(m_emission);
+    }
+
     constexpr auto albedo_at(intersection const& isection) const -> color {
         return sample_albedo_source(m_albedo, isection);
     }
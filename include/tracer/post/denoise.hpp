@@ -0,0 +1,273 @@
+#pragma once
+
+#include <tracer/aov.hpp>
+#include <tracer/common.hpp>
+#include <tracer/detail/fast_math.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/image.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace trc {
+
+struct atrous_settings {
+    /// The filter footprint doubles every iteration, anything above 10 is clamped
+    usize iterations = 5;
+
+    // edge-stopping parameters, smaller values preserve more edges (and more noise)
+
+    /// Halved every iteration
+    real sigma_color = 1;
+    real sigma_normal = 0.3;
+    /// Relative to the depth of the center pixel
+    real sigma_depth = 0.05;
+
+    /// Filter irradiance instead of radiance so that texture detail is not blurred
+    bool demodulate_albedo = true;
+
+    /// 0 means one thread per core
+    usize threads = 0;
+};
+
+namespace detail {
+
+/// Single precision planar image with a zeroed border of <code>pad</code> pixels on all sides.
+struct padded_planes {
+    padded_planes(usize n_planes, usize width, usize height, usize pad)
+        : m_width(width)
+        , m_height(height)
+        , m_pad(pad)
+        , m_stride(width + 2 * pad)
+        , m_plane_size(m_stride * (height + 2 * pad))
+        , m_data(n_planes * m_plane_size, 0.f) {}
+
+    auto row(usize plane, usize y) -> float* { return m_data.data() + plane * m_plane_size + (y + m_pad) * m_stride + m_pad; }
+    auto row(usize plane, usize y) const -> const float* { return m_data.data() + plane * m_plane_size + (y + m_pad) * m_stride + m_pad; }
+
+    /// Like <code>row</code>, but the row index may lie within the border
+    auto row_offset(usize plane, usize y, isize dy) const -> const float* { return row(plane, y) + dy * static_cast<isize>(m_stride); }
+
+private:
+    usize m_width;
+    usize m_height;
+    usize m_pad;
+    usize m_stride;
+    usize m_plane_size;
+    std::vector<float> m_data;
+};
+
+/// Accumulates one of the 25 taps for a whole row.\n
+/// This is a separate function for the sake of the <code>__restrict</code> parameters, there are too many pointers
+/// involved for the vectoriser to version the loop with runtime alias checks.
+inline void atrous_accumulate_row(
+  const float* __restrict tap_r, const float* __restrict tap_g, const float* __restrict tap_b,
+  const float* __restrict tap_nx, const float* __restrict tap_ny, const float* __restrict tap_nz,
+  const float* __restrict tap_depth, const float* __restrict tap_valid,
+  const float* __restrict center_r, const float* __restrict center_g, const float* __restrict center_b,
+  const float* __restrict center_nx, const float* __restrict center_ny, const float* __restrict center_nz,
+  const float* __restrict center_depth, const float* __restrict depth_scales,
+  float* __restrict acc_r, float* __restrict acc_g, float* __restrict acc_b, float* __restrict acc_w,
+  usize width, float spatial_weight, float inv_sigma_color_sq, float inv_sigma_normal_sq
+) {
+    for (usize x = 0; x < width; x++) {
+        float d_r = tap_r[x] - center_r[x];
+        float d_g = tap_g[x] - center_g[x];
+        float d_b = tap_b[x] - center_b[x];
+        float d_nx = tap_nx[x] - center_nx[x];
+        float d_ny = tap_ny[x] - center_ny[x];
+        float d_nz = tap_nz[x] - center_nz[x];
+        float d_depth = std::abs(tap_depth[x] - center_depth[x]);
+
+        float exponent = (d_r * d_r + d_g * d_g + d_b * d_b) * inv_sigma_color_sq +
+                         (d_nx * d_nx + d_ny * d_ny + d_nz * d_nz) * inv_sigma_normal_sq +
+                         d_depth * depth_scales[x];
+
+        float weight = spatial_weight * tap_valid[x] * fast_exp_neg(-exponent);
+
+        acc_r[x] += weight * tap_r[x];
+        acc_g[x] += weight * tap_g[x];
+        acc_b[x] += weight * tap_b[x];
+        acc_w[x] += weight;
+    }
+}
+
+}// namespace detail
+
+/// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) guided by the first-hit albedo, normal and depth AOVs,
+/// all three must be enabled in <code>guides</code> and <code>out</code> must be as large as <code>beauty</code>;
+/// <code>out</code> is left untouched otherwise.\n
+/// The buffers are converted to padded single precision planes once so that the inner loops are contiguous,
+/// branch-free and vectorisable, rows are distributed among threads. <code>beauty</code> is read in full before the
+/// result is handed to <code>out</code> row by row through <code>set_tile</code>, so <code>out</code> may be a file
+/// writer or even <code>beauty</code> itself.
+inline void denoise_atrous(image const& beauty, aov_buffers const& guides, image_like& out, atrous_settings settings = {}) {
+    const usize width = beauty.width();
+    const usize height = beauty.height();
+
+    if (width == 0 || height == 0 || guides.width() != width || guides.height() != height || out.width() != width || out.height() != height) {
+        return;
+    }
+
+    if (!guides.enabled(aov::albedo) || !guides.enabled(aov::normal) || !guides.enabled(aov::depth)) {
+        return;
+    }
+
+    image const& albedo_guide = guides.channel(aov::albedo);
+    image const& normal_guide = guides.channel(aov::normal);
+    image const& depth_guide = guides.channel(aov::depth);
+
+    settings.iterations = std::min<usize>(settings.iterations, 10);
+
+    constexpr float kernel[5]{1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+    // keeps the squared differences in the edge-stopping exponents finite even at the narrowest color sigma, an infinite
+    // exponent would turn the weight into NaN
+    constexpr real max_radiance = 1e12;
+
+    enum plane : usize {
+        normal_x = 0,
+        normal_y,
+        normal_z,
+        depth,
+        valid,
+        modulation_r,
+        modulation_g,
+        modulation_b,
+        n_guide_planes,
+    };
+
+    const usize pad = 2 * (1uz << (std::max<usize>(settings.iterations, 1) - 1));
+
+    detail::padded_planes guide_planes(n_guide_planes, width, height, pad);
+    detail::padded_planes color_ping(3, width, height, pad);
+    detail::padded_planes color_pong(3, width, height, pad);
+
+    detail::parallel_for(height, settings.threads, [&](usize row_begin, usize row_end) {
+        for (usize y = row_begin; y < row_end; y++) {
+            for (usize x = 0; x < width; x++) {
+                vec3 normal = normal_guide.at(x, y);
+                real depth_value = depth_guide.at(x, y)[0];
+                color albedo = albedo_guide.at(x, y);
+                color radiance = beauty.at(x, y);
+
+                guide_planes.row(normal_x, y)[x] = static_cast<float>(normal[0]);
+                guide_planes.row(normal_y, y)[x] = static_cast<float>(normal[1]);
+                guide_planes.row(normal_z, y)[x] = static_cast<float>(normal[2]);
+                // misses are infinitely far away, non-finite values are told apart by their bits as release builds use
+                // -ffast-math, under which comparisons with them (and std::isinf) are not reliable
+                guide_planes.row(depth, y)[x] = detail::is_finite(depth_value) ? static_cast<float>(std::clamp<real>(depth_value, 0, 1e10)) : 1e10f;
+                guide_planes.row(valid, y)[x] = 1.f;
+
+                for (usize c = 0; c < 3; c++) {
+                    // near-black albedos (e.g. emitters) would amplify noise, leave those alone
+                    float modulation = settings.demodulate_albedo && albedo[c] > 0.01 ? static_cast<float>(albedo[c]) : 1.f;
+                    // a single NaN or infinity would spread over the whole kernel footprint with every iteration
+                    float value = detail::is_finite(radiance[c]) ? static_cast<float>(std::clamp<real>(radiance[c], -max_radiance, max_radiance)) : 0.f;
+
+                    guide_planes.row(modulation_r + c, y)[x] = modulation;
+                    color_ping.row(c, y)[x] = value / modulation;
+                }
+            }
+        }
+    });
+
+    const float inv_sigma_normal_sq = static_cast<float>(1 / (settings.sigma_normal * settings.sigma_normal));
+    const float inv_sigma_depth = static_cast<float>(1 / settings.sigma_depth);
+
+    detail::padded_planes* source = &color_ping;
+    detail::padded_planes* destination = &color_pong;
+
+    for (usize iteration = 0; iteration < settings.iterations; iteration++) {
+        const isize step = 1z << iteration;
+        const real sigma_color = settings.sigma_color / static_cast<real>(1uz << iteration);
+        const float inv_sigma_color_sq = static_cast<float>(1 / (sigma_color * sigma_color));
+
+        detail::parallel_for(height, settings.threads, [&](usize row_begin, usize row_end) {
+            std::vector<float> accumulators(width * 4);
+            float* acc_r = accumulators.data();
+            float* acc_g = acc_r + width;
+            float* acc_b = acc_g + width;
+            float* acc_w = acc_b + width;
+
+            std::vector<float> depth_scales_storage(width);
+            float* depth_scales = depth_scales_storage.data();
+
+            for (usize y = row_begin; y < row_end; y++) {
+                std::fill(accumulators.begin(), accumulators.end(), 0.f);
+
+                const float* center_r = source->row(0, y);
+                const float* center_g = source->row(1, y);
+                const float* center_b = source->row(2, y);
+                const float* center_nx = guide_planes.row(normal_x, y);
+                const float* center_ny = guide_planes.row(normal_y, y);
+                const float* center_nz = guide_planes.row(normal_z, y);
+                const float* center_depth = guide_planes.row(depth, y);
+
+                for (usize x = 0; x < width; x++) {
+                    depth_scales[x] = inv_sigma_depth / std::max(center_depth[x], 1e-3f);
+                }
+
+                for (isize ky = -2; ky <= 2; ky++) {
+                    const isize dy = ky * step;
+
+                    const float* tap_r_row = source->row_offset(0, y, dy);
+                    const float* tap_g_row = source->row_offset(1, y, dy);
+                    const float* tap_b_row = source->row_offset(2, y, dy);
+                    const float* tap_nx_row = guide_planes.row_offset(normal_x, y, dy);
+                    const float* tap_ny_row = guide_planes.row_offset(normal_y, y, dy);
+                    const float* tap_nz_row = guide_planes.row_offset(normal_z, y, dy);
+                    const float* tap_depth_row = guide_planes.row_offset(depth, y, dy);
+                    const float* tap_valid_row = guide_planes.row_offset(valid, y, dy);
+
+                    for (isize kx = -2; kx <= 2; kx++) {
+                        const isize dx = kx * step;
+                        const float spatial_weight = kernel[ky + 2] * kernel[kx + 2];
+
+                        detail::atrous_accumulate_row(
+                          tap_r_row + dx, tap_g_row + dx, tap_b_row + dx,
+                          tap_nx_row + dx, tap_ny_row + dx, tap_nz_row + dx,
+                          tap_depth_row + dx, tap_valid_row + dx,
+                          center_r, center_g, center_b,
+                          center_nx, center_ny, center_nz,
+                          center_depth, depth_scales,
+                          acc_r, acc_g, acc_b, acc_w,
+                          width, spatial_weight, inv_sigma_color_sq, inv_sigma_normal_sq
+                        );
+                    }
+                }
+
+                float* out_r = destination->row(0, y);
+                float* out_g = destination->row(1, y);
+                float* out_b = destination->row(2, y);
+
+                // the center tap always has a positive weight
+                for (usize x = 0; x < width; x++) {
+                    float inv_weight = 1.f / acc_w[x];
+                    out_r[x] = acc_r[x] * inv_weight;
+                    out_g[x] = acc_g[x] * inv_weight;
+                    out_b[x] = acc_b[x] * inv_weight;
+                }
+            }
+        });
+
+        std::swap(source, destination);
+    }
+
+    detail::parallel_for(height, settings.threads, [&](usize row_begin, usize row_end) {
+        std::vector<color> row(width);
+
+        for (usize y = row_begin; y < row_end; y++) {
+            for (usize x = 0; x < width; x++) {
+                row[x] = color{
+                  source->row(0, y)[x] * guide_planes.row(modulation_r, y)[x],
+                  source->row(1, y)[x] * guide_planes.row(modulation_g, y)[x],
+                  source->row(2, y)[x] * guide_planes.row(modulation_b, y)[x],
+                };
+            }
+
+            out.set_tile(0, y, width, 1, row);
+        }
+    });
+}
+
+}// namespace trc
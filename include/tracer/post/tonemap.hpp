@@ -0,0 +1,104 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/detail/fast_math.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/detail/srgb.hpp>
+
+#include <algorithm>
+#include <span>
+
+namespace trc {
+
+enum class tonemap_operator : int {
+    /// Values above 1 are clipped
+    clamp = 0,
+    /// x / (1 + x) per channel
+    reinhard,
+    /// Narkowicz's fit of the ACES reference rendering transform, per channel
+    aces,
+};
+
+struct tonemap_settings {
+    /// In stops, radiance is scaled by 2^exposure before tone mapping
+    real exposure = 0;
+    tonemap_operator op = tonemap_operator::clamp;
+    /// Apply the sRGB transfer function, off for targets that store linear values
+    bool srgb = true;
+
+    /// 0 means one thread per core
+    usize threads = 0;
+};
+
+namespace detail {
+
+template<tonemap_operator Op>
+inline void tonemap_block(const real* __restrict rgb, usize n_values, float scale, bool srgb, float* __restrict out) {
+    for (usize i = 0; i < n_values; i++) {
+        float v = static_cast<float>(rgb[i]) * scale;
+
+        if constexpr (Op == tonemap_operator::reinhard) {
+            v = v / (1.f + v);
+        } else if constexpr (Op == tonemap_operator::aces) {
+            v = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+        }
+
+        // NaNs fail the first comparison
+        v = v <= 1.f ? v : 1.f;
+        v = v >= 0.f ? v : 0.f;
+
+        out[i] = v;
+    }
+
+    if (srgb) {
+        srgb_encode_block(out, n_values);
+    }
+}
+
+/// Single-threaded <code>tonemap_rgba8</code> on the flat channel array of <code>n_pixels</code> colors.\n
+/// Works in blocks whose channels are processed as one contiguous array, the per-channel loops get vectorised across
+/// pixels and only the final interleaving into RGBA is scalar.
+inline void tonemap_rgba8(const real* rgb, usize n_pixels, u8* rgba, tonemap_settings const& settings) {
+    constexpr usize block_pixels = encode_block_pixels;
+
+    const float scale = fast_exp2(static_cast<float>(settings.exposure));
+    float block[block_pixels * 3];
+
+    for (usize begin = 0; begin < n_pixels; begin += block_pixels) {
+        const usize n = std::min(block_pixels, n_pixels - begin);
+        const real* source = rgb + begin * 3;
+
+        switch (settings.op) {
+            case tonemap_operator::clamp: tonemap_block<tonemap_operator::clamp>(source, n * 3, scale, settings.srgb, block); break;
+            case tonemap_operator::reinhard: tonemap_block<tonemap_operator::reinhard>(source, n * 3, scale, settings.srgb, block); break;
+            case tonemap_operator::aces: tonemap_block<tonemap_operator::aces>(source, n * 3, scale, settings.srgb, block); break;
+        }
+
+        store_rgba8(block, n, rgba + begin * 4);
+    }
+}
+
+static_assert(sizeof(color) == 3 * sizeof(real), "tone mapping treats spans of colors as flat arrays of channels");
+
+}// namespace detail
+
+/// Applies exposure, the tone mapping operator and the sRGB transfer function to <code>pixels</code> and quantises the
+/// result to 8 bits with rounding to the nearest integer, NaNs end up as 255.\n
+/// Pixels are split among threads, a 4K frame takes a few milliseconds.
+/// @param rgba 4 bytes per pixel, the alpha channel is set to 255
+inline void tonemap_rgba8(std::span<const color> pixels, std::span<u8> rgba, tonemap_settings const& settings = {}) {
+    // large enough for the threads not to share cache lines
+    constexpr usize chunk_pixels = 4096;
+
+    const usize n_pixels = std::min(pixels.size(), rgba.size() / 4);
+    const usize n_chunks = (n_pixels + chunk_pixels - 1) / chunk_pixels;
+
+    detail::parallel_for(n_chunks, settings.threads, [&](usize chunk_begin, usize chunk_end) {
+        const usize begin = chunk_begin * chunk_pixels;
+        const usize end = std::min(chunk_end * chunk_pixels, n_pixels);
+
+        detail::tonemap_rgba8(pixels.data()->data() + begin * 3, end - begin, rgba.data() + begin * 4, settings);
+    });
+}
+
+}// namespace trc
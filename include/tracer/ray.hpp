@@ -17,4 +17,23 @@ struct ray {
     vec3 direction_reciprocals;
 };
 
+/// The rays through the neighbouring pixels, one to the right and one upwards, see
+/// <code>camera::generate_ray_differential</code>.\n
+/// Only camera rays have these, they are kept apart from <code>ray</code> so that the rays of later bounces and shadow
+/// tests do not carry them around.
+struct ray_differentials {
+    /// Shrinks or widens the footprint described by the differentials around <code>center</code> by <code>scale</code>
+    constexpr void scale(ray const& center, real scale) {
+        x_origin = center.origin + (x_origin - center.origin) * scale;
+        x_direction = center.direction + (x_direction - center.direction) * scale;
+        y_origin = center.origin + (y_origin - center.origin) * scale;
+        y_direction = center.direction + (y_direction - center.direction) * scale;
+    }
+
+    vec3 x_origin;
+    vec3 x_direction;
+    vec3 y_origin;
+    vec3 y_direction;
+};
+
 }// namespace trc
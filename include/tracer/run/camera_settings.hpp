@@ -0,0 +1,52 @@
+#pragma once
+
+#include <tracer/camera.hpp>
+#include <tracer/common.hpp>
+
+#include <memory>
+
+namespace trc {
+
+enum class camera_type : int {
+    pinhole = 0,
+    environment = 1,
+    orthographic_raw = 2,
+    frustum_raw = 3,
+    orthographic = 4,
+    frustum = 5,
+};
+
+/// The parameters of every camera type, shared by the front-ends
+struct camera_settings {
+    camera_type type = camera_type::pinhole;
+
+    // common
+
+    vec3 center{};
+
+    // pinhole, frustum
+
+    real fov = 80;
+
+    // pinhole, orthographic, frustum
+
+    vec3 rotation{};
+
+    // orthographic
+
+    vec3 ray_rotation{};
+    real physical_width = 5;
+
+    // orthographic_raw and frustum_raw
+
+    real left = -5;
+    real right = 5;
+    real bottom = -5;
+    real top = 5;
+    real near = 0;
+    real far = 5;
+
+    auto operator()(usize width, usize height) const -> std::shared_ptr<camera>;
+};
+
+}// namespace trc
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <tracer/run/program.hpp>
+
+#include <stuff/expected.hpp>
+
+#include <tracer/aov.hpp>
+#include <tracer/common.hpp>
+#include <tracer/integrator/integrator.hpp>
+#include <tracer/post/tonemap.hpp>
+#include <tracer/run/camera_settings.hpp>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace trc {
+
+/// Renders a single image without any UI, for machines without a display.
+struct cli_program final : program {
+    cli_program(int argc, char** argv);
+
+    ~cli_program() final override = default;
+
+    auto run() -> int final override;
+
+private:
+    enum class integrator_type : int {
+        cosine_albedo = 0,
+        light_visibility = 1,
+        unidirectional_pt = 2,
+    };
+
+    struct options {
+        /// "test" for the built-in scene, the path to a scene file (see <code>scene_file</code>) or to a mesh
+        std::string scene = "test";
+        std::string output = "render.qoi";
+
+        usize width = 400;
+        usize height = 300;
+
+        integrator_type integrator = integrator_type::unidirectional_pt;
+        integration_settings integrator_settings{
+          .samples = 16,
+        };
+
+        camera_settings camera{};
+
+        /// Seeds the random number generator
+        u64 seed = 1;
+        bool denoise = false;
+        tonemap_settings tonemap{};
+        /// Written as additional layers, only tiled float outputs can hold them
+        std::vector<aov> aovs{};
+        bool help = false;
+
+        /// Hands out tiles to the workers connecting to this address instead of rendering them
+        std::string coordinator_address{};
+        /// Renders tiles for the coordinator at this address, all other options come from the coordinator
+        std::string worker_address{};
+        /// Worker processes to start on this machine, implies a coordinator on a random local port if none is given
+        usize local_workers = 0;
+        /// Tiles taking longer than this are handed to another worker as well
+        std::chrono::milliseconds tile_timeout = std::chrono::seconds(30);
+    };
+
+    std::vector<std::string_view> m_args{};
+
+    /// @param ret The options to start from, the arguments override them
+    static auto parse_options(std::span<const std::string_view> args, options ret) -> stf::expected<options, std::string>;
+    /// Parses the arguments on top of the settings of the scene file they name, if they name one
+    static auto resolve_options(std::span<const std::string_view> args) -> stf::expected<options, std::string>;
+    static auto integrator_of(std::string_view name) -> std::optional<integrator_type>;
+    static void print_usage(std::string_view program_name);
+
+    static auto create_integrator(options const& opts, std::shared_ptr<scene> scene) -> std::shared_ptr<integrator>;
+    /// Tone maps <code>rendered</code> into an 8-bit image, float outputs are written through the writers instead
+    static auto write_output(image_like const& rendered, options const& opts) -> bool;
+
+    /// Renders tiles for a coordinator until it is done with the frame
+    static auto run_worker(options const& opts) -> int;
+    /// Distributes the frame among workers, <code>args</code> are forwarded to them as the job description
+    static auto run_coordinator(options const& opts, std::span<const std::string_view> args) -> int;
+};
+
+}// namespace trc
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stuff/expected.hpp>
+
+#include <tracer/common.hpp>
+#include <tracer/io/json.hpp>
+#include <tracer/run/camera_settings.hpp>
+#include <tracer/scene.hpp>
+
+#include <array>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace trc {
+
+/// The render settings a scene file suggests, front-ends use them unless told otherwise
+struct scene_render_settings {
+    std::optional<std::array<usize, 2>> resolution = std::nullopt;
+    std::optional<usize> samples = std::nullopt;
+    std::optional<u64> seed = std::nullopt;
+    /// "albedo", "visibility" or "pt", front-ends reject the ones they do not have
+    std::optional<std::string> integrator = std::nullopt;
+    std::optional<real> exposure = std::nullopt;
+    /// "clamp", "reinhard" or "aces"
+    std::optional<std::string> tonemap = std::nullopt;
+};
+
+/// A scene described by a JSON document instead of code. The top level object has the members:\n
+/// <code>textures</code>: name -> <code>{"file", "wrapping": "repeat"|"clamp", "scaling": "nearest"|"bilinear"|"bicubic"}</code>\n
+/// <code>materials</code>: name -> <code>{"type": "lambertian"|"oren_nayar"|"conductor"|"dielectric", "albedo", "emission",
+/// "sigma" (oren_nayar, degrees), "ior" and "outside_ior" (dielectric)}</code>, albedos and emissions are an RGB array, a
+/// single number, a texture name or <code>{"type": "uv"|"normal", "scale"}</code>\n
+/// <code>meshes</code>: name -> <code>{"file", "resident_budget"}</code>, a PLY, STL, OBJ or GLB file, PLY and STL meshes
+/// with a <code>resident_budget</code> (MiB) are kept out of core (see <code>shapes::mapped_mesh</code>)\n
+/// <code>shapes</code>: an array of <code>{"type": "sphere"|"disc"|"box"|"triangle"|"plane"|"mesh", "material", ...}</code>,
+/// meshes are placed by name with an optional <code>transform</code> of <code>{"scale", "rotate" (degrees about x, then y,
+/// then z), "translate"}</code> or <code>{"matrix"}</code> (16 numbers, column-major)\n
+/// <code>camera</code>: <code>{"type": "pinhole"|"environment"|"orthographic", "position", "rotation" (degrees), "fov", "width"}</code>\n
+/// <code>render</code>: <code>{"resolution": [w, h], "spp", "seed", "integrator", "exposure", "tonemap"}</code>\n
+/// Only the textures, materials and meshes the shapes refer to are loaded, each of them once. Files are looked up relative to
+/// the scene file.
+struct scene_file {
+    /// Reads the document and the camera and render settings, assets are left alone until <code>build</code>
+    static auto open(std::filesystem::path const& path) -> stf::expected<scene_file, std::string>;
+
+    /// Loads the assets the shapes refer to and puts the shapes into a new scene
+    auto build() const -> stf::expected<scene, std::string>;
+
+    std::optional<camera_settings> camera = std::nullopt;
+    scene_render_settings render{};
+
+private:
+    io::json::value m_document{};
+    std::filesystem::path m_directory{};
+};
+
+/// Whether <code>path</code> names a scene file rather than a mesh
+inline auto is_scene_file(std::filesystem::path const& path) -> bool { return path.extension() == ".json"; }
+
+}// namespace trc
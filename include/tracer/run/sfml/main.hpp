@@ -10,6 +10,8 @@
 #include <tracer/camera.hpp>
 #include <tracer/common.hpp>
 #include <tracer/integrator/integrator.hpp>
+#include <tracer/post/denoise.hpp>
+#include <tracer/run/camera_settings.hpp>
 
 #include <SFML/Graphics/RenderWindow.hpp>
 #include <SFML/Graphics/Texture.hpp>
@@ -17,13 +19,16 @@
 
 #include <imgui.h>
 
+#include <future>
 #include <memory>
+#include <stop_token>
 #include <unordered_set>
 
 namespace trc {
 
 struct sfml_program final : program {
-    sfml_program();
+    /// @param argv May name a scene file to show instead of the test scene
+    sfml_program(int argc, char** argv);
 
     ~sfml_program() final override;
 
@@ -36,54 +41,23 @@ private:
         unidirectional_pt = 1,
     };
 
-    enum class camera_type : int {
-        pinhole = 0,
-        environment = 1,
-        orthographic_raw = 2,
-        frustum_raw = 3,
-        orthographic = 4,
-        frustum = 5,
-    };
-
-    struct camera_settings {
-        camera_type type = camera_type::pinhole;
-
-        // common
-
-        vec3 center{};
-
-        // pinhole, frustum
-
-        real fov = 80;
-
-        // pinhole, orthographic, frustum
-
-        vec3 rotation{};
-
-        // orthographic
-
-        vec3 ray_rotation{};
-        real physical_width = 5;
-
-        // orthographic_raw and frustum_raw
-
-        real left = -5;
-        real right = 5;
-        real bottom = -5;
-        real top = 5;
-        real near = 0;
-        real far = 5;
-
-        auto operator()(sf::Vector2u window_dimensions) const -> std::shared_ptr<camera>;
-    };
-
     struct render_configuration {
         sf::Vector2u m_resolution;
 
         integrator_type m_integrator;
         integration_settings m_integrator_settings;
 
+        bool m_denoise;
+        atrous_settings m_denoise_settings;
+
         camera_settings m_camera_settings;
+
+        /// Set when a material was edited since the last request. The scene is shared with the render thread, which
+        /// invalidates its light table itself so that the flag is never touched by both threads.
+        bool m_lights_changed = false;
+
+        /// Set for every request, the render thread gives up on the request once a stop is requested
+        std::stop_token m_stop_token{};
     };
 
     render_configuration m_configuration{
@@ -92,10 +66,14 @@ private:
       .m_integrator_settings = {
         .samples = 1,
       },
+      .m_denoise = false,
+      .m_denoise_settings = {},
       .m_camera_settings = {},
     };
 
+    /// Null until <code>m_scene_loading</code> is done, the window is up and running in the meantime
     std::shared_ptr<scene> m_scene = nullptr;
+    std::future<std::shared_ptr<scene>> m_scene_loading;
     u32 m_current_material_index = 0;
     std::unordered_set<u32> m_soft_deleted_materials{};
 
@@ -116,6 +94,8 @@ private:
     stf::channel<render_configuration> m_render_request_channel{};
     stf::channel<void> m_render_complete_channel{};
     std::atomic_bool m_ongoing_render{};
+    /// Owned by the UI thread, the render thread only ever sees tokens of it
+    std::stop_source m_render_stop_source{};
     std::thread m_render_thread;
 
     // UI state
@@ -123,6 +103,14 @@ private:
     bool m_ui_render_on_invalidate = true;
 
     bool m_invalidated = true;
+    /// A render was asked for while another one was being preempted
+    bool m_render_pending = false;
+
+    /// Builds the scene on a thread of its own. The render settings of the scene file, if there is one, are applied to
+    /// <code>configuration</code> right away.
+    static auto start_loading_scene(int argc, char** argv, render_configuration& configuration) -> std::future<std::shared_ptr<scene>>;
+    /// Takes the scene once it is built, the first render is requested then
+    void poll_scene_loading();
 
     void load_fonts();
 
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <tracer/affine_transform.hpp>
+#include <tracer/common.hpp>
+#include <tracer/io/glb.hpp>
+#include <tracer/io/mesh_cache.hpp>
+#include <tracer/io/obj.hpp>
+#include <tracer/io/ply.hpp>
+#include <tracer/io/stl.hpp>
+#include <tracer/scene.hpp>
+#include <tracer/shape/mapped_mesh.hpp>
+#include <tracer/shape/mesh.hpp>
+#include <tracer/shape/mesh_instance.hpp>
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace trc {
+
+namespace detail {
+
+/// Where the mesh cache keeps the mesh <code>loader</code> makes out of <code>filename</code> with <code>transform</code>
+/// applied, and its key
+/// @return nullopt if caching is disabled or the file cannot be read
+inline auto cache_entry(std::filesystem::path const& filename, std::string_view loader, mat4x4 const& transform) -> std::optional<std::pair<std::filesystem::path, u64>> {
+    auto directory = io::mesh_cache::default_directory();
+    if (!directory) {
+        return std::nullopt;
+    }
+
+    // the transform is keyed by the images of the basis vectors, its columns
+    std::vector<real> numbers{};
+    for (usize column = 0; column < 4; column++) {
+        vec4 basis{};
+        basis[column] = 1;
+
+        const vec4 image = transform * basis;
+        numbers.insert(numbers.end(), {image[0], image[1], image[2], image[3]});
+    }
+
+    std::vector<std::byte> parameters{};
+    for (std::span<const std::byte> bytes : {std::as_bytes(std::span(loader)), std::as_bytes(std::span(numbers))}) {
+        parameters.insert(parameters.end(), bytes.begin(), bytes.end());
+    }
+
+    auto key = io::mesh_cache::source_key(filename.string(), parameters);
+    if (!key) {
+        return std::nullopt;
+    }
+
+    return std::pair{*directory / fmt::format("{:016x}.mesh", *key), *key};
+}
+
+/// Returns the mesh <code>build</code> makes out of <code>filename</code>, read back from the mesh cache (see
+/// <code>io::mesh_cache</code>) if the file, the loader and the transform are the same as when it was stored
+template<std::unsigned_integral IndexType, typename BuildFn>
+auto cached_mesh(std::filesystem::path const& filename, std::string_view loader, u32 mat_idx, mat4x4 const& transform, BuildFn&& build) -> shapes::mesh<IndexType> {
+    auto entry = cache_entry(filename, loader, transform);
+    if (!entry) {
+        return std::invoke(build);
+    }
+
+    auto const& [path, key] = *entry;
+
+    if (auto cached = io::mesh_cache::load<IndexType>(path.string(), key, mat_idx); cached) {
+        return std::move(*cached);
+    }
+
+    shapes::mesh<IndexType> ret = std::invoke(build);
+
+    // meshes that failed to load are not worth remembering
+    if (ret.triangles().empty()) {
+        return ret;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    if (auto res = io::mesh_cache::store(path.string(), key, ret); !res) {
+        spdlog::warn("could not cache \"{}\": {}", filename.string(), res.error());
+    }
+
+    return ret;
+}
+
+}// namespace detail
+
+template<std::unsigned_integral IndexType = u32>
+auto read_stl(std::filesystem::path filename, u32 mat_idx, mat4x4 transform = mat4x4::identity()) -> shapes::mesh<IndexType> {
+    return detail::cached_mesh<IndexType>(filename, "stl", mat_idx, transform, [&] {
+        shapes::mesh<IndexType> mesh{mat_idx};
+
+        if (auto res = io::stl::read_triangles(filename.string()); res) {
+            std::vector<std::array<vec3, 3>> soup(res->size());
+            for (usize i = 0; io::stl::triangle const& tri : *res) {
+                soup[i++] = {vec3(tri.vertices[0]), vec3(tri.vertices[1]), vec3(tri.vertices[2])};
+            }
+
+            mesh.push_triangles(soup);
+            mesh.weld_vertices();
+        } else {
+            spdlog::error("could not read a mesh: {}", res.error());
+        }
+
+        mesh.transform(transform);
+        mesh.finish_construction();
+
+        return mesh;
+    });
+}
+
+template<std::unsigned_integral IndexType = u32>
+auto read_ply(std::filesystem::path filename, u32 mat_idx, mat4x4 transform = mat4x4::identity()) -> shapes::mesh<IndexType> {
+    return detail::cached_mesh<IndexType>(filename, "ply", mat_idx, transform, [&] {
+        shapes::mesh<IndexType> mesh{mat_idx};
+
+        if (auto res = io::ply::read_mesh<IndexType>(filename.string()); res) {
+            mesh.push_vertices(res->vertices);
+            mesh.push_triangles(res->triangles);
+        } else {
+            spdlog::error("could not read a mesh: {}", res.error());
+        }
+
+        mesh.transform(transform);
+        mesh.finish_construction();
+
+        return mesh;
+    });
+}
+
+/// Reads a PLY or STL file into a mesh that stays out of core, see <code>shapes::mapped_mesh</code>.\n
+/// The file is streamed into the mesh cache the first time (see <code>io::mesh_cache::builder</code>), later runs map
+/// the cache without reading the file. The mesh is never held in memory as a whole, so meshes larger than the memory
+/// of the machine can be rendered.\n
+/// PLY files share their cache with <code>read_ply</code>. The vertices of STL files are not welded like
+/// <code>read_stl</code> does, which needs all of them in memory, so they are cached separately.
+/// @param budget The number of bytes of geometry to keep resident
+template<std::unsigned_integral IndexType = u32>
+auto read_mapped(std::filesystem::path filename, u32 mat_idx, usize budget, mat4x4 transform = mat4x4::identity()) -> stf::expected<shapes::mapped_mesh<IndexType>, std::string> {
+    const std::filesystem::path extension = filename.extension();
+    if (extension != ".ply" && extension != ".stl") {
+        return stf::unexpected{fmt::format("\"{}\" cannot be kept out of core, only PLY and STL files can", filename.string())};
+    }
+
+    auto entry = detail::cache_entry(filename, extension == ".ply" ? "ply" : "stl-unwelded", transform);
+    if (!entry) {
+        return stf::unexpected{fmt::format("\"{}\" cannot be kept out of core without a mesh cache, see TRACER_CACHE_DIR", filename.string())};
+    }
+
+    auto const& [path, key] = *entry;
+
+    if (auto mapped = shapes::mapped_mesh<IndexType>::open(path.string(), key, mat_idx, budget); mapped) {
+        return std::move(*mapped);
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    auto builder_res = io::mesh_cache::builder<IndexType>::create(path.string(), transform);
+    if (!builder_res) {
+        return stf::unexpected{fmt::format("could not cache \"{}\": {}", filename.string(), builder_res.error())};
+    }
+
+    io::mesh_cache::builder<IndexType>& builder = *builder_res;
+
+    auto read_res = extension == ".ply"
+                      ? io::ply::read_mesh_chunked<IndexType>(
+                          filename.string(),//
+                          [&builder](std::span<const vec3> vertices) { builder.push_vertices(vertices); },
+                          [&builder](std::span<const std::array<IndexType, 3>> triangles) { builder.push_triangles(triangles); })
+                      : io::stl::for_each_triangle(
+                          filename.string(),
+                          [&builder](io::stl::triangle const& tri) {
+                              const std::array<vec3, 3> vertices{vec3(tri.vertices[0]), vec3(tri.vertices[1]), vec3(tri.vertices[2])};
+
+                              // welding would remove the triangles that collapse to a line or a point this way
+                              if (vertices[0] != vertices[1] && vertices[1] != vertices[2] && vertices[2] != vertices[0]) {
+                                  builder.push_triangles(std::span(&vertices, 1));
+                              }
+                          },
+                          [&builder] { builder.clear(); });
+
+    if (!read_res) {
+        return stf::unexpected{read_res.error()};
+    }
+
+    if (auto res = builder.finish(key); !res) {
+        return stf::unexpected{fmt::format("could not cache \"{}\": {}", filename.string(), res.error())};
+    }
+
+    if (auto mapped = shapes::mapped_mesh<IndexType>::open(path.string(), key, mat_idx, budget); mapped) {
+        return std::move(*mapped);
+    }
+
+    return stf::unexpected{fmt::format("could not cache \"{}\"", filename.string())};
+}
+
+/// Reads every group of an OBJ file into a mesh of its own, each holding only the vertices its triangles use
+template<std::unsigned_integral IndexType = u32>
+auto read_obj(std::filesystem::path filename, u32 mat_idx, mat4x4 transform = mat4x4::identity()) -> std::vector<shapes::mesh<IndexType>> {
+    auto res = io::obj::read_mesh<IndexType>(filename.string());
+    if (!res) {
+        spdlog::error("could not read a mesh: {}", res.error());
+        return {};
+    }
+
+    std::vector<shapes::mesh<IndexType>> ret{};
+
+    // the index of each position within the mesh being built, reset after each group
+    std::vector<IndexType> local_indices(res->positions.size(), shapes::mesh<IndexType>::bad_index);
+    std::vector<IndexType> used{};
+
+    for (io::obj::group<IndexType>& group : res->groups) {
+        shapes::mesh<IndexType> mesh{mat_idx};
+
+        for (std::array<IndexType, 3>& indices : group.triangles) {
+            for (IndexType& index : indices) {
+                if (local_indices[index] == shapes::mesh<IndexType>::bad_index) {
+                    local_indices[index] = mesh.push_vertex(res->positions[index]);
+                    used.push_back(index);
+                }
+
+                index = local_indices[index];
+            }
+        }
+
+        for (IndexType index : used) {
+            local_indices[index] = shapes::mesh<IndexType>::bad_index;
+        }
+        used.clear();
+
+        // exporters duplicate positions along texture seams and normal discontinuities
+        mesh.push_triangles(group.triangles);
+        mesh.weld_vertices();
+
+        mesh.transform(transform);
+        mesh.finish_construction();
+
+        ret.emplace_back(std::move(mesh));
+    }
+
+    return ret;
+}
+
+/// Builds each mesh of a binary glTF file once, the nodes of its default scene place instances of them.\n
+/// Positions are read from the mapped file straight into the vertices of the meshes, all primitives of a mesh end up in
+/// one shape.
+template<std::unsigned_integral IndexType = u32>
+auto read_glb(std::filesystem::path filename, u32 mat_idx, affine_transform const& transform = affine_transform::identity()) -> std::vector<shapes::mesh_instance<IndexType>> {
+    auto res = io::glb::read_document(filename.string());
+    if (!res) {
+        spdlog::error("could not read a mesh: {}", res.error());
+        return {};
+    }
+
+    std::vector<std::shared_ptr<const shapes::mesh<IndexType>>> meshes{};
+    std::vector<std::array<IndexType, 3>> triangles{};
+
+    for (io::glb::mesh const& source : res->meshes) {
+        auto mesh = std::make_shared<shapes::mesh<IndexType>>(mat_idx);
+        triangles.clear();
+
+        for (io::glb::primitive const& primitive : source.primitives) {
+            const usize n_triangles = triangles.size();
+
+            if (auto append_res = io::glb::append_triangles<IndexType>(primitive, mesh->vertices().size(), triangles); !append_res) {
+                spdlog::error("skipping a primitive of mesh \"{}\": {}", source.name, append_res.error());
+                triangles.resize(n_triangles);
+                continue;
+            }
+
+            mesh->reserve_vertices(primitive.positions.size());
+            for (usize i = 0; i < primitive.positions.size(); i++) {
+                const std::array<float, 3> position = primitive.positions[i];
+                mesh->push_vertex(vec3{position[0], position[1], position[2]});
+            }
+        }
+
+        mesh->push_triangles(triangles);
+        if (!triangles.empty()) {
+            mesh->finish_construction();
+        }
+
+        meshes.emplace_back(std::move(mesh));
+    }
+
+    std::vector<shapes::mesh_instance<IndexType>> ret{};
+
+    for (io::glb::instance const& instance : res->instances) {
+        if (meshes[instance.mesh]->triangles().empty()) {
+            continue;
+        }
+
+        ret.emplace_back(mat_idx, meshes[instance.mesh], transform * instance.transform);
+    }
+
+    return ret;
+}
+
+/// The hard-coded scene both front-ends start with, expects the assets under <code>run/</code> to be in the working directory.
+auto get_scene_test() -> scene;
+
+}// namespace trc
@@ -1,11 +1,21 @@
 #pragma once
 
+#include <tracer/alias_table.hpp>
 #include <tracer/common.hpp>
+#include <tracer/light/light_tree.hpp>
 #include <tracer/material/materials.hpp>
 #include <tracer/shape/shapes.hpp>
 
 namespace trc {
 
+struct light_pick {
+    /// Index of the emitter, see <code>scene::light_pdf</code>
+    usize index;
+    bound_shape const* shape;
+    /// The probability of picking this emitter
+    real pdf;
+};
+
 struct scene {
     constexpr scene() {}
 
@@ -24,25 +34,45 @@ struct scene {
         }
     }
 
+    /// Finds the closest intersection along <code>ray</code>.\n
+    /// Shapes are numbered in the order bound shapes, BVH shapes, unbound shapes; the number of the intersected shape
+    /// is stored in <code>intersection::shape_index</code>.
     constexpr auto intersect(ray const& ray, real best_t = infinity) const -> std::optional<intersection> {
         std::optional<intersection> best_isection = std::nullopt;
 
-        for_each_shape([&](concepts::shape auto const& shape) {
-            std::optional<intersection> isection = shape.intersect(ray, best_t);
+        auto iterate = [&](std::optional<intersection> isection, usize shape_index) {
             if (!isection)
                 return;
 
             if (best_t > isection->t) {
                 best_t = isection->t;
                 best_isection = isection;
+                best_isection->shape_index = static_cast<u32>(shape_index);
             }
-        });
+        };
+
+        for (usize i = 0; i < m_bound_shapes.size(); i++) {
+            iterate(VARIANT_CALL(m_bound_shapes[i], intersect, ray, best_t), i);
+        }
+
+        usize n_bvh_shapes = 0;
+        if (m_bvh) {
+            n_bvh_shapes = m_bvh->shapes().size();
+
+            std::optional<intersection> isection = m_bvh->intersect(ray, best_t);
+            iterate(isection, m_bound_shapes.size() + (isection ? isection->shape_index : 0));
+        }
+
+        for (usize i = 0; i < m_unbound_shapes.size(); i++) {
+            iterate(VARIANT_CALL(m_unbound_shapes[i], intersect, ray, best_t), m_bound_shapes.size() + n_bvh_shapes + i);
+        }
 
         return best_isection;
     }
 
-    constexpr auto add_material(material mat) -> u32 {
+    auto add_material(material mat) -> u32 {
         m_materials.emplace_back(std::move(mat));
+        invalidate_light_table();
         return static_cast<u32>(m_materials.size() - 1);
     }
 
@@ -50,16 +80,125 @@ struct scene {
         return m_materials[index];
     }
 
+    /// Picks an emitter with a probability proportional to its emitted power.\n
+    /// Returns nothing if there are no emitters.
     template<typename Gen>
-    constexpr auto pick_light(Gen& gen) const -> bound_shape {
-        bound_shape ret;
-        std::uniform_int_distribution<usize> dist(0, m_bound_shapes.size() - 1);
+    constexpr auto pick_light(Gen& gen) const -> std::optional<light_pick> {
+        if (m_light_table.empty()) {
+            return std::nullopt;
+        }
+
+        usize index = m_light_table.sample(gen);
 
-        do {
-            ret = m_bound_shapes[dist(gen)];
-        } while (!VARIANT_CALL(m_materials[VARIANT_CALL(ret, material_index)], is_light));
+        return light_pick{
+          .index = index,
+          .shape = &emitter(index),
+          .pdf = m_light_table.pdf(index),
+        };
+    }
+
+    /// Picks an emitter with a probability proportional to an estimate of its contribution to the point
+    /// <code>at</code> (with an optional surface normal), see <code>light_tree</code>.\n
+    /// Returns nothing if there are no emitters or if none of them can illuminate the point.
+    template<typename Gen>
+    constexpr auto pick_light(Gen& gen, vec3 at, std::optional<vec3> normal = std::nullopt) const -> std::optional<light_pick> {
+        auto res = TRYX(m_light_tree.pick(gen, at, normal));
+        auto [index, pdf] = res;
+
+        return light_pick{
+          .index = index,
+          .shape = &emitter(index),
+          .pdf = pdf,
+        };
+    }
+
+    /// The probability of <code>pick_light</code> returning the emitter at <code>index</code>
+    constexpr auto light_pdf(usize index) const -> real { return m_light_table.pdf(index); }
+
+    /// The probability of the point-aware <code>pick_light</code> returning the emitter at <code>index</code>
+    constexpr auto light_pdf(usize index, vec3 at, std::optional<vec3> normal = std::nullopt) const -> real {
+        return m_light_tree.pdf(index, at, normal);
+    }
+
+    constexpr auto n_emitters() const -> usize { return m_emitters.size(); }
+
+    constexpr auto emitter(usize index) const -> bound_shape const& {
+        usize shape_index = m_emitters[index];
+
+        if (shape_index < m_bound_shapes.size()) {
+            return m_bound_shapes[shape_index];
+        }
 
-        return ret;
+        return m_bvh->shapes()[shape_index - m_bound_shapes.size()];
+    }
+
+    /// Call this after modifying <code>m_materials</code> or the shapes directly, see <code>update_light_table</code>.\n
+    /// Like the mutators, this must not be called while the scene is being rendered.
+    constexpr void invalidate_light_table() { m_light_table_stale = true; }
+
+    /// Recollects the emissive shapes and their powers if the scene changed since the last call.\n
+    /// The shape and material mutators of this class only mark the light table as stale so that building a scene
+    /// stays linear in the number of shapes. Integrators call this before they render, do not call it while the scene
+    /// is being rendered.
+    void update_light_table() {
+        if (m_light_table_stale) {
+            rebuild_light_table();
+        }
+    }
+
+    /// Recollects the emissive shapes and their powers unconditionally
+    void rebuild_light_table() {
+        m_emitters.clear();
+        std::vector<real> powers{};
+        std::vector<light_tree::light_description> descriptions{};
+
+        std::span<const bound_shape> bvh_shapes{};
+        if (m_bvh) {
+            bvh_shapes = m_bvh->shapes();
+        }
+
+        auto visit_shapes = [&](std::span<const bound_shape> shapes, usize offset) {
+            for (usize i = 0; i < shapes.size(); i++) {
+                bound_shape const& shape = shapes[i];
+
+                u32 material_index = VARIANT_CALL(shape, material_index);
+                if (material_index >= m_materials.size()) {
+                    continue;
+                }
+
+                trc::material const& mat = m_materials[material_index];
+                if (!VARIANT_CALL(mat, is_light)) {
+                    continue;
+                }
+
+                real power = luminance(VARIANT_CALL(mat, average_emission)) * VARIANT_CALL(shape, surface_area);
+
+                // e.g. an empty mesh, it could never be picked and its bounds would throw the light tree off
+                if (!(power > 0)) {
+                    continue;
+                }
+
+                m_emitters.push_back(offset + i);
+                powers.push_back(power);
+
+                bounding_box bounds{};
+                bounds.bump(VARIANT_CALL(shape, bounds));
+
+                descriptions.push_back({
+                  .bounds = bounds,
+                  .cone = shape_normal_cone(shape),
+                  .power = power,
+                });
+            }
+        };
+
+        visit_shapes(m_bound_shapes, 0);
+        visit_shapes(bvh_shapes, m_bound_shapes.size());
+
+        m_light_table.create(powers);
+        m_light_tree.construct(descriptions);
+
+        m_light_table_stale = false;
     }
 
     constexpr auto visibility_check(vec3 a, vec3 b) const -> bool {
@@ -87,6 +226,7 @@ struct scene {
         m_bound_shapes.emplace_back(std::move(shape));
 
         append_if_over_threshold(split_threshold, split_depth);
+        invalidate_light_table();
     }
 
     constexpr void append_shape(unbound_shape shape) {
@@ -98,6 +238,7 @@ struct scene {
         std::copy(shapes.begin(), shapes.end(), std::back_inserter(m_bound_shapes));
 
         append_if_over_threshold(split_threshold, split_depth);
+        invalidate_light_table();
     }
 
     constexpr void append_shapes(std::vector<unbound_shape> shapes) {
@@ -118,9 +259,14 @@ struct scene {
 
         m_bvh = std::make_shared<BVHType>();
         m_bvh->construct_tree(std::move(m_bound_shapes), split_depth);
+        m_bound_shapes.clear();
+
+        invalidate_light_table();
     }
 
     std::vector<trc::material> m_materials;
+    /// The textures materials refer to
+    texture_registry m_textures{};
 
     std::vector<bound_shape> m_bound_shapes{};
     std::shared_ptr<dyn_shape<bound_shape>> m_bvh = nullptr;
@@ -128,6 +274,13 @@ struct scene {
     std::vector<unbound_shape> m_unbound_shapes{};
 
 private:
+    // emitters are stored as indices into the concatenation of m_bound_shapes and m_bvh->shapes()
+    // so that copies of the scene stay valid
+    std::vector<usize> m_emitters{};
+    alias_table m_light_table{};
+    light_tree m_light_tree{};
+    bool m_light_table_stale = false;
+
     void append_if_over_threshold(usize split_threshold, usize split_depth) {
         if (m_bvh == nullptr) [[unlikely]] {
             // throw?
@@ -136,6 +289,7 @@ private:
 
         if (m_bound_shapes.size() >= split_threshold) {
             m_bvh->append(std::move(m_bound_shapes), split_depth);
+            m_bound_shapes.clear();
         }
     }
 };
@@ -33,7 +33,9 @@ constexpr auto triangle::intersect(ray const& ray, real best_t) const -> std::op
     vec3 h = cross(ray.direction, edge_1);
     real a = dot(edge_0, h);
 
-    if (std::abs(a) <= epsilon)
+    // rays (nearly) parallel to the triangle, relative to its size so that the small triangles of meshes seen through
+    // instances in object space are not all rejected
+    if (a * a <= epsilon * epsilon * dot(edge_0, edge_0) * dot(edge_1, edge_1))
         return std::nullopt;
 
     real f = 1 / a;
@@ -57,6 +59,27 @@ constexpr auto triangle::intersect(ray const& ray, real best_t) const -> std::op
     return intersection(m_mat_idx, -ray.direction, t, global_pt, {u, v}, {edge_0, edge_1});
 }
 
+template<typename Gen>
+constexpr auto triangle::sample_surface(Gen& gen) const -> intersection {
+    stf::random::erand48_distribution<real> dist{};
+
+    real u = dist(gen);
+    real v = dist(gen);
+
+    // fold the upper half of the unit square back onto the triangle
+    if (u + v > 1) {
+        u = 1 - u;
+        v = 1 - v;
+    }
+
+    vec3 edge_0 = m_vertices[1] - m_vertices[0];
+    vec3 edge_1 = m_vertices[2] - m_vertices[0];
+
+    vec3 isection_point = m_vertices[0] + edge_0 * u + edge_1 * v;
+
+    return intersection(m_mat_idx, vec3(), 0, isection_point, {u, v}, {edge_0, edge_1});
+}
+
 constexpr auto triangle::compute_center(std::array<vec3, 3> const& vertices, center_type type) -> vec3 {
     real a = abs(vertices[1] - vertices[2]);
     real b = abs(vertices[2] - vertices[0]);
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/detail/hash.hpp>
+#include <tracer/detail/parallel.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <limits>
+#include <span>
+#include <vector>
+
+namespace trc::detail {
+
+using weld_cell = std::array<i64, 3>;
+
+/// The cell of a grid with <code>cell_size</code> sized cells a vertex falls into, its exact position for 0
+inline auto get_weld_cell(vec3 const& vertex, real cell_size) -> weld_cell {
+    weld_cell ret;
+
+    for (usize axis = 0; axis < 3; axis++) {
+        if (cell_size == 0) {
+            // the bits identify the exact value once -0 has become 0
+            ret[axis] = std::bit_cast<i64>(vertex[axis] + real(0));
+        } else {
+            // keeps the conversion defined, vertices this far out are not welded correctly anyway
+            const real limit = static_cast<real>(i64(1) << 60);
+            ret[axis] = static_cast<i64>(std::clamp(std::floor(vertex[axis] / cell_size), -limit, limit));
+        }
+    }
+
+    return ret;
+}
+
+constexpr auto hash_weld_cell(weld_cell const& cell) -> u64 {
+    u64 ret = 0;
+    for (i64 coord : cell) {
+        ret ^= static_cast<u64>(coord) + 0x9e3779b97f4a7c15ull + (ret << 6) + (ret >> 2);
+    }
+
+    // neighbouring cells should not end up in neighbouring slots
+    return mix_bits(ret);
+}
+
+/// An open addressing hash table from grid cells to the vertices in them, grows with the number of distinct cells.\n
+/// The vertices of a cell can be linked into a list in the order of their indices.\n
+/// <code>empty</code> ends the lists, it may also be the index of the last vertex of a mesh that uses the whole range of
+/// <code>IndexType</code>, which ends them just as well since no vertex follows it. Slots are marked as occupied
+/// separately for that reason.
+template<std::unsigned_integral IndexType>
+struct weld_table {
+    static constexpr IndexType empty = std::numeric_limits<IndexType>::max();
+
+    /// @return The first vertex of the cell, <code>empty</code> if there is none
+    auto head(weld_cell const& cell, u64 hash) const -> IndexType {
+        if (m_slots.empty()) {
+            return empty;
+        }
+
+        slot const& slot = m_slots[find(cell, hash)];
+        return slot.occupied ? slot.head : empty;
+    }
+
+    /// Vertices have to be inserted in the order of their indices
+    /// @param next Links the vertices of each cell if not empty
+    /// @return The first vertex of the cell of <code>index</code>, <code>index</code> itself if it is the first
+    auto insert(weld_cell const& cell, u64 hash, IndexType index, std::span<IndexType> next) -> IndexType {
+        if ((m_size + 1) * 2 > m_slots.size()) {
+            grow();
+        }
+
+        slot& slot = m_slots[find(cell, hash)];
+
+        if (!slot.occupied) {
+            slot = {cell, index, index, true};
+            m_size++;
+        } else if (!next.empty()) {
+            next[slot.tail] = index;
+            slot.tail = index;
+        }
+
+        return slot.head;
+    }
+
+private:
+    struct slot {
+        weld_cell cell{};
+        IndexType head = empty;
+        IndexType tail = empty;
+        bool occupied = false;
+    };
+
+    std::vector<slot> m_slots{};
+    usize m_size = 0;
+
+    auto find(weld_cell const& cell, u64 hash) const -> usize {
+        const usize mask = m_slots.size() - 1;
+
+        // slots keep their cell so that probing does not touch the vertices
+        for (usize i = hash & mask;; i = (i + 1) & mask) {
+            if (!m_slots[i].occupied || m_slots[i].cell == cell) {
+                return i;
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<slot> old = std::exchange(m_slots, std::vector<slot>(std::max<usize>(m_slots.size() * 2, 64)));
+
+        const usize mask = m_slots.size() - 1;
+
+        for (slot const& moved : old) {
+            if (!moved.occupied) {
+                continue;
+            }
+
+            usize i = hash_weld_cell(moved.cell) & mask;
+            while (m_slots[i].occupied) {
+                i = (i + 1) & mask;
+            }
+
+            m_slots[i] = moved;
+        }
+    }
+};
+
+/// Hash tables of the cells of a grid split into one shard per thread, each thread fills the table of the cells whose
+/// hashes fall into its shard
+template<std::unsigned_integral IndexType>
+struct sharded_weld_tables {
+    sharded_weld_tables(usize n_shards)
+        : m_tables(n_shards) {}
+
+    auto shard_of(u64 hash) const -> usize { return static_cast<usize>(hash >> 32) % m_tables.size(); }
+
+    auto head(weld_cell const& cell) const -> IndexType {
+        const u64 hash = hash_weld_cell(cell);
+        return m_tables[shard_of(hash)].head(cell, hash);
+    }
+
+    /// Inserts all vertices in the order of their indices
+    /// @return The first vertex in the cell of each vertex
+    auto insert(std::span<const vec3> vertices, real cell_size, usize n_threads, std::span<IndexType> next) -> std::vector<IndexType> {
+        const usize n = vertices.size();
+
+        std::vector<u64> hashes(n);
+        std::vector<IndexType> ret(n);
+
+        parallel_for(n, n_threads, [&](usize begin, usize end) {
+            for (usize i = begin; i < end; i++) {
+                hashes[i] = hash_weld_cell(get_weld_cell(vertices[i], cell_size));
+            }
+        });
+
+        parallel_for(m_tables.size(), m_tables.size(), [&](usize begin, usize end) {
+            for (usize shard = begin; shard < end; shard++) {
+                for (usize i = 0; i < n; i++) {
+                    if (shard_of(hashes[i]) == shard) {
+                        ret[i] = m_tables[shard].insert(get_weld_cell(vertices[i], cell_size), hashes[i], static_cast<IndexType>(i), next);
+                    }
+                }
+            }
+        });
+
+        return ret;
+    }
+
+private:
+    std::vector<weld_table<IndexType>> m_tables;
+};
+
+/// Finds vertices that are within <code>tolerance</code> of each other, there should be no exact duplicates.\n
+/// With cells twice the tolerance wide, the vertices close to one are in its cell or in the neighbouring ones on the
+/// side of the nearer face along each axis, 8 cells in total.
+template<std::unsigned_integral IndexType>
+inline auto find_close_vertices(std::span<const vec3> vertices, real tolerance, usize n_threads) -> std::vector<IndexType> {
+    const usize n = vertices.size();
+    const real cell_size = tolerance * 2;
+
+    std::vector<IndexType> next(n, weld_table<IndexType>::empty);
+    std::vector<IndexType> ret(n);
+
+    sharded_weld_tables<IndexType> tables(n_threads == 0 ? default_thread_count() : n_threads);
+    tables.insert(vertices, cell_size, n_threads, next);
+
+    parallel_for(n, n_threads, [&](usize begin, usize end) {
+        for (usize i = begin; i < end; i++) {
+            const weld_cell cell = get_weld_cell(vertices[i], cell_size);
+
+            weld_cell sides;
+            for (usize axis = 0; axis < 3; axis++) {
+                sides[axis] = vertices[i][axis] / cell_size - static_cast<real>(cell[axis]) < real(0.5) ? -1 : 1;
+            }
+
+            IndexType target = static_cast<IndexType>(i);
+
+            for (usize corner = 0; corner < 8; corner++) {
+                weld_cell neighbour = cell;
+                for (usize axis = 0; axis < 3; axis++) {
+                    neighbour[axis] += (corner >> axis) & 1 ? sides[axis] : 0;
+                }
+
+                // the first vertex of the list that is close enough has the lowest index
+                for (IndexType j = tables.head(neighbour); j < target; j = next[j]) {
+                    if (abs(vertices[j] - vertices[i]) <= tolerance) {
+                        target = j;
+                        break;
+                    }
+                }
+            }
+
+            ret[i] = target;
+        }
+    });
+
+    // targets have lower indices, they are resolved to the end of their chain by the time they are looked at
+    for (usize i = 0; i < n; i++) {
+        ret[i] = ret[ret[i]];
+    }
+
+    return ret;
+}
+
+/// Finds the vertices to merge, ones that are within <code>tolerance</code> of each other or equal if it is 0.\n
+/// Vertices are hashed by the cell of a grid they fall into, one per position for exact duplicates. The tolerance is
+/// then only applied to the remaining vertices, which are far fewer for triangle soups. Each vertex joins the group of
+/// the lowest indexed vertex close to it, which makes the result independent of the number of threads.
+/// @return The index of the vertex each vertex merges into, the lowest index of its group, which merges into itself
+template<std::unsigned_integral IndexType>
+inline auto find_weld_targets(std::span<const vec3> vertices, real tolerance, usize n_threads) -> std::vector<IndexType> {
+    sharded_weld_tables<IndexType> tables(n_threads == 0 ? default_thread_count() : n_threads);
+    std::vector<IndexType> ret = tables.insert(vertices, 0, n_threads, {});
+
+    if (tolerance == 0) {
+        return ret;
+    }
+
+    std::vector<IndexType> distinct{};
+    std::vector<vec3> distinct_vertices{};
+
+    // the position of each distinct vertex among them
+    std::vector<IndexType> positions(vertices.size());
+
+    for (usize i = 0; i < vertices.size(); i++) {
+        if (ret[i] == i) {
+            positions[i] = static_cast<IndexType>(distinct.size());
+            distinct.push_back(static_cast<IndexType>(i));
+            distinct_vertices.push_back(vertices[i]);
+        }
+    }
+
+    const std::vector<IndexType> close = find_close_vertices<IndexType>(distinct_vertices, tolerance, n_threads);
+
+    for (usize i = 0; i < vertices.size(); i++) {
+        ret[i] = distinct[close[positions[ret[i]]]];
+    }
+
+    return ret;
+}
+
+}// namespace trc::detail
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <tracer/affine_transform.hpp>
+#include <tracer/bvh/tree.hpp>
+#include <tracer/io/detail/mapped_file.hpp>
+#include <tracer/io/mesh_cache.hpp>
+#include <tracer/shape/box.hpp>
+#include <tracer/shape/mesh_instance.hpp>
+#include <tracer/shape/shape.hpp>
+#include <tracer/shape/triangle.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <stack>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace trc::detail {
+
+/// Keeps the number of bytes of a mapping that are resident within a budget, in units of clusters.\n
+/// Clusters are marked as they are used, once the budget is exceeded a clock hand goes over them and releases the ones
+/// that were not used since it last passed. Nothing relies on a cluster being resident, the kernel reads released pages
+/// back in when they are touched again, so the bookkeeping only needs to be roughly right and races between threads
+/// are harmless.
+struct residency {
+    static constexpr u8 resident = 1;
+    static constexpr u8 referenced = 2;
+
+    residency(std::vector<usize> cluster_bytes, usize budget)
+        : m_cluster_bytes(std::move(cluster_bytes))
+        , m_states(m_cluster_bytes.size())
+        , m_budget(budget) {}
+
+    /// Marks a cluster as used
+    /// @return Whether it was not resident before, its pages are worth prefetching then
+    auto touch(usize cluster) -> bool {
+        std::atomic<u8>& state = m_states[cluster];
+
+        // the common case does not write, so that threads do not fight over the cache lines of the states
+        if (state.load(std::memory_order::relaxed) == (resident | referenced)) {
+            return false;
+        }
+
+        if ((state.fetch_or(resident | referenced, std::memory_order::relaxed) & resident) != 0) {
+            return false;
+        }
+
+        m_resident_bytes.fetch_add(m_cluster_bytes[cluster], std::memory_order::relaxed);
+        return true;
+    }
+
+    auto is_resident(usize cluster) const -> bool { return (m_states[cluster].load(std::memory_order::relaxed) & resident) != 0; }
+
+    /// Calls <code>release(cluster)</code> for clusters until the resident bytes are within the budget again, another
+    /// thread already at it is left to it
+    template<typename ReleaseFn>
+    void enforce_budget(ReleaseFn&& release) {
+        if (m_resident_bytes.load(std::memory_order::relaxed) <= m_budget) {
+            return;
+        }
+
+        std::unique_lock lock(m_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+
+        // after two rounds every mark is cleared and the hand has passed every cluster that is not in use
+        for (usize step = 0; step < 2 * m_states.size() && m_resident_bytes.load(std::memory_order::relaxed) > m_budget; step++) {
+            const usize cluster = std::exchange(m_hand, (m_hand + 1) % m_states.size());
+            std::atomic<u8>& state = m_states[cluster];
+
+            u8 expected = resident;
+            if (state.compare_exchange_strong(expected, 0, std::memory_order::relaxed)) {
+                m_resident_bytes.fetch_sub(m_cluster_bytes[cluster], std::memory_order::relaxed);
+                std::invoke(release, cluster);
+            } else if ((expected & referenced) != 0) {
+                state.fetch_and(static_cast<u8>(~referenced), std::memory_order::relaxed);
+            }
+        }
+    }
+
+    auto resident_bytes() const -> usize { return m_resident_bytes.load(std::memory_order::relaxed); }
+
+private:
+    std::vector<usize> m_cluster_bytes;
+    std::vector<std::atomic<u8>> m_states;
+
+    usize m_budget;
+    std::atomic<usize> m_resident_bytes = 0;
+
+    std::mutex m_mutex{};
+    usize m_hand = 0;
+};
+
+}// namespace trc::detail
+
+namespace trc::shapes {
+
+/// A mesh that is rendered straight from its file in the mesh cache (see <code>io::mesh_cache</code>) instead of being
+/// read into memory, for meshes that do not fit.\n
+/// Triangles are in tree order in the file and vertices in the order the triangles use them, so every subtree is a few
+/// contiguous pages of geometry. Traversal prefetches the clusters of a subtree when it reaches one that spans at most
+/// <code>prefetch_clusters</code> of them, and clusters are released again once more than the budget is resident, rays
+/// through released parts of the mesh wait for the disk instead of the mesh failing to load. The nodes of the tree are
+/// left to the kernel, they are a small fraction of the file.\n
+/// Copies share the mapping.
+template<std::unsigned_integral IndexType = u32>
+struct mapped_mesh {
+    /// Subtrees spanning at most this many clusters are prefetched as a whole
+    static constexpr usize prefetch_clusters = 4;
+
+    /// @param budget The number of bytes of geometry to keep resident, this is a target the mesh keeps returning to
+    /// rather than a hard limit
+    /// @return nullopt if there is no cache for <code>key</code> at <code>path</code>, see <code>io::mesh_cache::load</code>
+    static auto open(std::string const& path, u64 key, u32 mat_idx, usize budget) -> std::optional<mapped_mesh> {
+        namespace cache = io::mesh_cache::detail;
+
+        auto file_res = io::detail::mapped_file::open(path);
+        if (!file_res || file_res->size() < sizeof(cache::header)) {
+            return std::nullopt;
+        }
+
+        auto storage = std::make_shared<mapped_mesh::storage>();
+        storage->file = std::move(*file_res);
+
+        std::span<const std::byte> data = storage->file.bytes();
+        std::memcpy(&storage->header, data.data(), sizeof(cache::header));
+
+        cache::header const& header = storage->header;
+        if (!cache::header_matches<IndexType>(header, key) || !cache::tree_matches(header) || header.n_clusters != (header.n_triangles + cache::cluster_size - 1) / cache::cluster_size) {
+            return std::nullopt;
+        }
+
+        storage->vertices = TRYX(cache::get_records<cache::vertex_record>(data, header.vertices_offset, header.n_vertices));
+        storage->triangles = TRYX(cache::get_records<cache::triangle_record<IndexType>>(data, header.triangles_offset, header.n_triangles));
+        storage->nodes = TRYX(cache::get_records<bvh_node_record>(data, header.nodes_offset, header.n_nodes));
+        std::span<const std::byte> clusters = TRYX(cache::get_records<u64>(data, header.clusters_offset, header.n_clusters + 1));
+        storage->area_sums = TRYX(cache::get_records<real>(data, header.areas_offset, header.n_triangles));
+
+        storage->first_vertices.resize(header.n_clusters + 1);
+        std::memcpy(storage->first_vertices.data(), clusters.data(), clusters.size());
+
+        std::vector<usize> cluster_bytes(header.n_clusters);
+        for (usize cluster = 0; cluster < header.n_clusters; cluster++) {
+            const u64 first = storage->first_vertices[cluster];
+            const u64 last = storage->first_vertices[cluster + 1];
+            if (first > last || last > header.n_vertices) {
+                return std::nullopt;
+            }
+
+            auto [triangles_begin, triangles_end] = storage->triangle_range(cluster);
+            cluster_bytes[cluster] = (triangles_end - triangles_begin) * sizeof(cache::triangle_record<IndexType>) + (last - first) * sizeof(cache::vertex_record);
+        }
+
+        storage->residency.emplace(std::move(cluster_bytes), budget);
+
+        // traversal jumps around the file, the kernel should not read ahead on its own
+        storage->file.advise(MADV_RANDOM);
+
+        mapped_mesh ret{};
+        ret.m_storage = std::move(storage);
+        ret.m_mat_idx = mat_idx;
+
+        return ret;
+    }
+
+    constexpr auto intersect(ray const& ray, real best_t = infinity) const -> std::optional<intersection> {
+        pixel_statistics stats{};
+        return intersect(ray, stats, best_t);
+    }
+
+    auto intersect(ray const& ray, pixel_statistics& stats, real best_t = infinity) const -> std::optional<intersection> {
+        storage& storage = *m_storage;
+        std::optional<intersection> best_isection = std::nullopt;
+
+        if (storage.header.n_nodes == 0) {
+            return std::nullopt;
+        }
+
+        // nodes and whether an ancestor prefetched their clusters already
+        std::stack<std::pair<usize, bool>> to_traverse{};
+        to_traverse.push({0, false});
+
+        while (!to_traverse.empty()) {
+            auto [handle, prefetched] = to_traverse.top();
+            to_traverse.pop();
+
+            const bvh_node_record node = storage.template record<bvh_node_record>(storage.nodes, handle);
+            const usize begin = static_cast<usize>(node.shape_extents[0]);
+            const usize end = static_cast<usize>(node.shape_extents[1]);
+
+            // empty, or a node of a tampered with cache
+            if (begin >= end || end > storage.header.n_triangles) {
+                continue;
+            }
+
+            if (!check_bounds_intersection(ray, {io::mesh_cache::detail::to_vec3(node.bounds_min), io::mesh_cache::detail::to_vec3(node.bounds_max)})) {
+                continue;
+            }
+
+            const bool is_leaf = node.is_leaf != 0;
+
+            if (!prefetched && (is_leaf || storage.cluster_of(end - 1) - storage.cluster_of(begin) < prefetch_clusters)) {
+                storage.use_clusters(begin, end);
+                prefetched = true;
+            }
+
+            if (is_leaf) {
+                for (usize i = begin; i < end; i++) {
+                    ++stats.shape_intersection_tests;
+
+                    std::optional<intersection> isection = intersect_triangle(ray, i, best_t);
+                    if (isection && isection->t < best_t) {
+                        best_t = isection->t;
+                        best_isection = isection;
+                    }
+                }
+
+                continue;
+            }
+
+            for (usize child : {handle * 2 + 1, handle * 2 + 2}) {
+                if (child < storage.header.n_nodes) {
+                    to_traverse.push({child, prefetched});
+                }
+            }
+        }
+
+        return best_isection;
+    }
+
+    auto intersects(ray const& ray) const -> bool { return intersect(ray) != std::nullopt; }
+
+    auto bounds() const -> std::pair<vec3, vec3> {
+        return {io::mesh_cache::detail::to_vec3(m_storage->header.bounds_min), io::mesh_cache::detail::to_vec3(m_storage->header.bounds_max)};
+    }
+
+    auto center() const -> vec3 { return io::mesh_cache::detail::to_vec3(m_storage->header.center); }
+
+    /// Picks a triangle proportionally to its area with a binary search over the running sums of the triangle areas
+    /// stored in the file, like <code>mesh</code> does, then a point on it uniformly. Only the pages of the sums the
+    /// search visits and those of the picked triangle are read.
+    template<typename Gen>
+    auto sample_surface(Gen& gen) const -> intersection {
+        stf::random::erand48_distribution<real> dist{};
+
+        storage const& storage = *m_storage;
+        const usize n_triangles = static_cast<usize>(storage.header.n_triangles);
+
+        // see mesh::sample_surface
+        if (n_triangles == 0) [[unlikely]] {
+            return intersection{};
+        }
+
+        const real target = dist(gen) * storage.template record<real>(storage.area_sums, n_triangles - 1);
+        const usize picked = std::min(n_triangles - 1, *std::ranges::partition_point(std::views::iota(0uz, n_triangles), [&](usize i) {
+            return storage.template record<real>(storage.area_sums, i) <= target;
+        }));
+
+        real u = dist(gen);
+        real v = dist(gen);
+
+        if (u + v > 1) {
+            u = 1 - u;
+            v = 1 - v;
+        }
+
+        auto [vertices, normal] = storage.triangle(picked);
+        vec3 edge_0 = vertices[1] - vertices[0];
+        vec3 edge_1 = vertices[2] - vertices[0];
+
+        intersection ret(m_mat_idx, vec3(), 0, vertices[0] + edge_0 * u + edge_1 * v, {u, v}, {edge_0, edge_1}, normal);
+        ret.primitive_index = static_cast<u32>(picked);
+
+        return ret;
+    }
+
+    auto surface_area() const -> real { return m_storage->header.surface_area; }
+
+    /// The area of the mesh once <code>to_world</code> is applied to it.\n
+    /// Transforms that rotate, mirror and scale uniformly scale all areas alike, for any other one the whole file is read
+    /// cluster by cluster, releasing each one that was brought in for this when done with it.
+    auto surface_area(affine_transform const& to_world) const -> real {
+        auto const& [x, y, z] = to_world.axes;
+        const real scale = dot(x, x);
+        const real tolerance = epsilon * scale;
+
+        if (std::abs(dot(y, y) - scale) <= tolerance && std::abs(dot(z, z) - scale) <= tolerance &&//
+            std::abs(dot(x, y)) <= tolerance && std::abs(dot(y, z)) <= tolerance && std::abs(dot(z, x)) <= tolerance) {
+            return surface_area() * scale;
+        }
+
+        storage& storage = *m_storage;
+        real ret = 0;
+
+        for (usize cluster = 0; cluster < storage.header.n_clusters; cluster++) {
+            auto [begin, end] = storage.triangle_range(cluster);
+
+            for (usize i = begin; i < end; i++) {
+                auto [vertices, normal] = storage.triangle(i);
+                ret += abs(cross(to_world.apply_vector(vertices[1] - vertices[0]), to_world.apply_vector(vertices[2] - vertices[0]))) / 2;
+            }
+
+            if (!storage.residency->is_resident(cluster)) {
+                storage.release_cluster(cluster);
+            }
+        }
+
+        return ret;
+    }
+
+    /// The number of bytes of geometry currently counted as resident
+    auto resident_bytes() const -> usize { return m_storage->residency->resident_bytes(); }
+
+    constexpr auto material_index() const -> u32 { return m_mat_idx; }
+
+    constexpr void set_material(u32 idx) { m_mat_idx = idx; }
+
+private:
+    struct storage {
+        io::detail::mapped_file file{};
+        io::mesh_cache::detail::header header{};
+
+        std::span<const std::byte> vertices{};
+        std::span<const std::byte> triangles{};
+        std::span<const std::byte> nodes{};
+        /// The running sums of the triangle areas
+        std::span<const std::byte> area_sums{};
+        /// The index of the first vertex each cluster introduces, and the number of vertices they introduce in total
+        std::vector<u64> first_vertices{};
+
+        std::optional<detail::residency> residency{};
+
+        template<typename Record>
+        static auto record(std::span<const std::byte> records, usize i) -> Record {
+            Record ret;
+            std::memcpy(&ret, records.data() + i * sizeof(Record), sizeof(Record));
+            return ret;
+        }
+
+        static constexpr auto cluster_of(usize triangle) -> usize { return triangle / io::mesh_cache::detail::cluster_size; }
+
+        auto triangle_range(usize cluster) const -> std::pair<usize, usize> {
+            const usize begin = cluster * io::mesh_cache::detail::cluster_size;
+            return {begin, std::min<usize>(begin + io::mesh_cache::detail::cluster_size, header.n_triangles)};
+        }
+
+        /// The vertices of triangle <code>i</code>, a triangle referring to vertices that do not exist is degenerate
+        auto triangle(usize i) const -> std::pair<std::array<vec3, 3>, vec3> {
+            const auto tri = record<io::mesh_cache::detail::triangle_record<IndexType>>(triangles, i);
+
+            std::array<vec3, 3> ret{};
+            for (usize j = 0; j < 3; j++) {
+                if (tri.vertex_indices[j] < header.n_vertices) {
+                    ret[j] = io::mesh_cache::detail::to_vec3(record<io::mesh_cache::detail::vertex_record>(vertices, tri.vertex_indices[j]));
+                }
+            }
+
+            return {ret, io::mesh_cache::detail::to_vec3(tri.normal)};
+        }
+
+        /// Calls <code>fn(offset, size)</code> with the byte ranges of the file holding the triangles of a cluster and
+        /// the vertices it introduces
+        template<typename Fn>
+        void for_each_range(usize cluster, Fn&& fn) const {
+            using triangle_record = io::mesh_cache::detail::triangle_record<IndexType>;
+            using vertex_record = io::mesh_cache::detail::vertex_record;
+
+            auto [begin, end] = triangle_range(cluster);
+            std::invoke(fn, header.triangles_offset + begin * sizeof(triangle_record), (end - begin) * sizeof(triangle_record));
+
+            const u64 first_vertex = first_vertices[cluster];
+            std::invoke(fn, header.vertices_offset + first_vertex * sizeof(vertex_record), (first_vertices[cluster + 1] - first_vertex) * sizeof(vertex_record));
+        }
+
+        /// Marks the clusters holding triangles [begin, end) as used, starts reading the ones that are not resident and
+        /// releases others if that goes over the budget
+        void use_clusters(usize begin, usize end) {
+            bool fetched = false;
+
+            for (usize cluster = cluster_of(begin); cluster <= cluster_of(end - 1); cluster++) {
+                if (!residency->touch(cluster)) {
+                    continue;
+                }
+
+                for_each_range(cluster, [this](usize offset, usize size) { file.advise(MADV_WILLNEED, offset, size); });
+                fetched = true;
+            }
+
+            if (fetched) {
+                residency->enforce_budget([this](usize cluster) { release_cluster(cluster); });
+            }
+        }
+
+        /// Only the pages lying completely within the ranges of the cluster are released, the ones shared with
+        /// neighbouring clusters may still be in use
+        void release_cluster(usize cluster) const {
+            for_each_range(cluster, [this](usize offset, usize size) { file.advise(MADV_DONTNEED, offset, size, true); });
+        }
+    };
+
+    std::shared_ptr<storage> m_storage{};
+    u32 m_mat_idx = 0;
+
+    auto intersect_triangle(ray const& ray, usize i, real best_t) const -> std::optional<intersection> {
+        auto [vertices, normal] = m_storage->triangle(i);
+
+        moller_trumbore_result res = TRYX(moller_trumbore(ray, vertices));
+        if (res.t >= best_t) {
+            return std::nullopt;
+        }
+
+        intersection isect(m_mat_idx, -ray.direction, res.t, ray.origin + res.t * ray.direction, res.uv, {res.edge_0, res.edge_1}, normal);
+        isect.primitive_index = static_cast<u32>(i);
+
+        return isect;
+    }
+};
+
+/// An out of core mesh placed into the scene
+template<std::unsigned_integral IndexType = u32>
+using mapped_mesh_instance = mesh_instance<IndexType, mapped_mesh<IndexType>>;
+
+static_assert(concepts::bound_shape<mapped_mesh<u32>>);
+static_assert(concepts::bound_shape<mapped_mesh_instance<u32>>);
+
+}// namespace trc::shapes
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <tracer/affine_transform.hpp>
 #include <tracer/bvh/tree.hpp>
+#include <tracer/shape/detail/weld.hpp>
 #include <tracer/shape/shape.hpp>
 #include <tracer/shape/triangle.hpp>
 
+#include <algorithm>
+
 namespace trc::shapes {
 
 template<std::unsigned_integral IndexType = u32>
@@ -12,6 +16,20 @@ struct pseudo_triangle {
     vec3 normal;
 };
 
+/// Everything a constructed mesh consists of, see <code>io::mesh_cache</code>
+template<std::unsigned_integral IndexType = u32>
+struct constructed_mesh {
+    std::vector<vec3> vertices;
+    /// In the order the tree left them in
+    std::vector<pseudo_triangle<IndexType>> triangles;
+    std::vector<generic_bvh_node<pseudo_triangle<IndexType>>> nodes;
+    usize depth;
+
+    std::pair<vec3, vec3> bounds;
+    vec3 center;
+    real surface_area;
+};
+
 template<std::unsigned_integral IndexType = u32>
 struct mesh : generic_bvh<pseudo_triangle<IndexType>> {
     static constexpr IndexType bad_index = -1;
@@ -21,10 +39,21 @@ struct mesh : generic_bvh<pseudo_triangle<IndexType>> {
     constexpr mesh(u32 mat_idx)
         : m_mat_idx(mat_idx) {}
 
+    /// Takes over a mesh that was constructed before, nothing is recomputed and finish_construction must not be called
+    constexpr mesh(u32 mat_idx, constructed_mesh<IndexType> constructed)
+        : m_vertices(std::move(constructed.vertices))
+        , m_bounds{constructed.bounds}
+        , m_surface_area(constructed.surface_area)
+        , m_center_sum(constructed.center * static_cast<real>(constructed.triangles.size()))
+        , m_mat_idx(mat_idx) {
+        this->restore_tree(std::move(constructed.triangles), std::move(constructed.nodes), constructed.depth);
+        compute_area_cdf();
+    }
+
     /// Adds a triangle to the mesh.\n
     /// Reduces the number of stored vertices on a best-effort basis; expect around 2/3 of the pushed vertices to be
     /// stored if you are pushing the triangles of an STL file (unlike PLY files where the mesh will contain exactly 1/3
-    /// of the vertices) (this is inexact and anecdotal).\n
+    /// of the vertices) (this is inexact and anecdotal), weld_vertices gets rid of the rest.\n
     /// Call finish_construction after pushing all triangles.
     constexpr void push_triangle(std::array<vec3, 3> vertices) {
         std::array<IndexType, 3> indices;
@@ -56,6 +85,82 @@ struct mesh : generic_bvh<pseudo_triangle<IndexType>> {
         this->m_shapes.push_back({indices, normalize(cross(edge_0, edge_1))});
     }
 
+    /// Adds triangles in bulk, their indices refer to vertices already in the mesh.\n
+    /// Call finish_construction after pushing all triangles.
+    constexpr void push_triangles(std::span<const std::array<IndexType, 3>> triangles) {
+        this->m_shapes.reserve(this->m_shapes.size() + triangles.size());
+
+        for (std::array<IndexType, 3> const& indices : triangles) {
+            push_triangle(indices);
+        }
+    }
+
+    /// Adds triangles that do not share vertices, like the ones of STL files, in bulk.\n
+    /// All vertices are stored, call weld_vertices afterwards to merge the duplicates.\n
+    /// Call finish_construction after pushing all triangles.
+    constexpr void push_triangles(std::span<const std::array<vec3, 3>> triangles) {
+        reserve_vertices(triangles.size() * 3);
+        this->m_shapes.reserve(this->m_shapes.size() + triangles.size());
+
+        for (std::array<vec3, 3> const& vertices : triangles) {
+            push_triangle(std::array<IndexType, 3>{push_vertex(vertices[0]), push_vertex(vertices[1]), push_vertex(vertices[2])});
+        }
+    }
+
+    /// Merges vertices that are within <code>tolerance</code> of each other, or equal for 0, so that triangles share
+    /// them. Triangles that collapse in the process are removed. The order of the remaining vertices is kept.\n
+    /// Do NOT Call this after finish_construction()
+    /// @param n_threads 0 means <code>detail::default_thread_count()</code>
+    constexpr void weld_vertices(real tolerance = 0, usize n_threads = 0) {
+        const std::vector<IndexType> targets = detail::find_weld_targets<IndexType>(m_vertices, tolerance, n_threads);
+
+        std::vector<IndexType> remap(m_vertices.size());
+        usize n_kept = 0;
+
+        for (usize i = 0; i < m_vertices.size(); i++) {
+            if (targets[i] != i) {
+                remap[i] = remap[targets[i]];
+                continue;
+            }
+
+            remap[i] = static_cast<IndexType>(n_kept);
+            m_vertices[n_kept++] = m_vertices[i];
+        }
+
+        m_vertices.resize(n_kept);
+        m_vertices.shrink_to_fit();
+
+        // merged vertices take the position of the one they merge into, which may lie further in
+        m_bounds = {};
+        for (vec3 const& vert : m_vertices) {
+            m_bounds.bump(vert);
+        }
+
+        detail::parallel_for(this->m_shapes.size(), n_threads, [&](usize begin, usize end) {
+            for (usize i = begin; i < end; i++) {
+                for (IndexType& index : this->m_shapes[i].vertex_indices) {
+                    index = remap[index];
+                }
+            }
+        });
+
+        const usize n_removed = std::erase_if(this->m_shapes, [](triangle_type const& tri) {
+            std::array<IndexType, 3> const& indices = tri.vertex_indices;
+            return indices[0] == indices[1] || indices[1] == indices[2] || indices[2] == indices[0];
+        });
+
+        if (n_removed == 0) {
+            return;
+        }
+
+        m_center_sum = vec3{};
+        m_surface_area = 0;
+        for (triangle_type const& tri : this->m_shapes) {
+            m_center_sum = m_center_sum + (m_vertices[tri.vertex_indices[0]] + m_vertices[tri.vertex_indices[1]] + m_vertices[tri.vertex_indices[2]]) / 3;
+            m_surface_area += triangle_area(tri);
+        }
+    }
+
     constexpr void reserve_vertices(usize amt) {
         m_vertices.reserve(m_vertices.size() + amt);
     }
@@ -66,6 +171,19 @@ struct mesh : generic_bvh<pseudo_triangle<IndexType>> {
         return static_cast<IndexType>(m_vertices.size() - 1);
     }
 
+    /// Adds vertices in bulk
+    /// @return The index of the first one
+    constexpr auto push_vertices(std::span<const vec3> vertices) -> IndexType {
+        const usize first = m_vertices.size();
+
+        reserve_vertices(vertices.size());
+        for (vec3 const& vert : vertices) {
+            push_vertex(vert);
+        }
+
+        return static_cast<IndexType>(first);
+    }
+
     /// Do NOT Call this after finish_construction()
     constexpr void transform(mat4x4 const& mat) {
         m_bounds = {};
@@ -113,6 +231,8 @@ struct mesh : generic_bvh<pseudo_triangle<IndexType>> {
 
               return bounds.bounds;
           });
+
+        compute_area_cdf();
     }
 
     friend constexpr void swap(mesh& lhs, mesh& rhs) {
@@ -152,7 +272,10 @@ struct mesh : generic_bvh<pseudo_triangle<IndexType>> {
 
                 vec3 global_pt = ray.origin + res.t * ray.direction;
 
-                return intersection(m_mat_idx, -ray.direction, res.t, global_pt, res.uv, {res.edge_0, res.edge_1}, shape.normal);
+                intersection isect(m_mat_idx, -ray.direction, res.t, global_pt, res.uv, {res.edge_0, res.edge_1}, shape.normal);
+                isect.primitive_index = static_cast<u32>(std::distance(this->m_shapes.data(), &shape));
+
+                return isect;
             }));
         });
 
@@ -165,11 +288,62 @@ struct mesh : generic_bvh<pseudo_triangle<IndexType>> {
 
     constexpr auto center() const -> vec3 { return m_center_sum / static_cast<real>(this->m_shapes.size()); }
 
+    /// Picks a triangle proportionally to its area with a binary search over the running sums of the triangle areas,
+    /// then a point on it uniformly.\n
+    /// An empty mesh, e.g. one that failed to load, has no surface to sample and yields a default intersection. The
+    /// scene never picks it as an emitter since its surface area is zero.
     template<typename Gen>
-    constexpr auto sample_surface(Gen&) const -> intersection;
+    constexpr auto sample_surface(Gen& gen) const -> intersection {
+        if (this->m_shapes.empty()) [[unlikely]] {
+            return intersection{};
+        }
+
+        stf::random::erand48_distribution<real> dist{};
+
+        const real target = dist(gen) * m_area_cdf.back();
+        const usize index = std::min<usize>(std::ranges::upper_bound(m_area_cdf, target) - m_area_cdf.begin(), m_area_cdf.size() - 1);
+        triangle_type const* picked = &this->m_shapes[index];
+
+        real u = dist(gen);
+        real v = dist(gen);
+
+        if (u + v > 1) {
+            u = 1 - u;
+            v = 1 - v;
+        }
+
+        vec3 const& vert_0 = m_vertices[picked->vertex_indices[0]];
+        vec3 edge_0 = m_vertices[picked->vertex_indices[1]] - vert_0;
+        vec3 edge_1 = m_vertices[picked->vertex_indices[2]] - vert_0;
+
+        intersection ret(m_mat_idx, vec3(), 0, vert_0 + edge_0 * u + edge_1 * v, {u, v}, {edge_0, edge_1}, picked->normal);
+        ret.primitive_index = static_cast<u32>(std::distance(this->m_shapes.data(), picked));
+
+        return ret;
+    }
 
     constexpr auto surface_area() const -> real { return m_surface_area; }
 
+    /// The area of the mesh once <code>to_world</code> is applied to it, areas do not scale uniformly unless the transform
+    /// does
+    constexpr auto surface_area(affine_transform const& to_world) const -> real {
+        real ret = 0;
+
+        for (triangle_type const& tri : this->m_shapes) {
+            vec3 const& vert_0 = m_vertices[tri.vertex_indices[0]];
+            ret += abs(cross(to_world.apply_vector(m_vertices[tri.vertex_indices[1]] - vert_0), to_world.apply_vector(m_vertices[tri.vertex_indices[2]] - vert_0))) / 2;
+        }
+
+        return ret;
+    }
+
+    constexpr auto triangles() const -> std::span<const triangle_type> { return this->m_shapes; }
+
+    constexpr auto vertices() const -> std::span<const vec3> { return m_vertices; }
+
+    /// The running sums of the triangle areas in the order of <code>triangles</code>
+    constexpr auto area_cdf() const -> std::span<const real> { return m_area_cdf; }
+
     constexpr auto material_index() const -> u32 { return m_mat_idx; }
 
     constexpr void set_material(u32 idx) { m_mat_idx = idx; }
@@ -181,8 +355,26 @@ private:
     real m_surface_area = 0;
     vec3 m_center_sum = 0;
 
+    /// The running sums of the triangle areas in the order the tree left the triangles in
+    std::vector<real> m_area_cdf{};
+
     u32 m_mat_idx;
 
+    constexpr void compute_area_cdf() {
+        m_area_cdf.resize(this->m_shapes.size());
+
+        real sum = 0;
+        for (usize i = 0; i < this->m_shapes.size(); i++) {
+            sum += triangle_area(this->m_shapes[i]);
+            m_area_cdf[i] = sum;
+        }
+    }
+
+    constexpr auto triangle_area(triangle_type const& tri) const -> real {
+        vec3 const& vert_0 = m_vertices[tri.vertex_indices[0]];
+        return abs(cross(m_vertices[tri.vertex_indices[1]] - vert_0, m_vertices[tri.vertex_indices[2]] - vert_0)) / 2;
+    }
+
     constexpr auto find_vertex(vec3 vert) -> IndexType {
         constexpr usize max_window_size = 3;
 
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <tracer/affine_transform.hpp>
+#include <tracer/shape/box.hpp>
+#include <tracer/shape/mesh.hpp>
+#include <tracer/shape/shape.hpp>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace trc::shapes {
+
+/// A mesh placed into the scene through a transform, any number of instances can share one mesh and its tree.\n
+/// Rays are brought into the space of the mesh instead of the mesh being transformed, hits are brought back out.
+/// @tparam MeshType <code>mesh</code>, or <code>mapped_mesh</code> for meshes that are kept out of core
+template<std::unsigned_integral IndexType = u32, typename MeshType = mesh<IndexType>>
+struct mesh_instance {
+    /// @param mesh Has to be constructed (see <code>mesh::finish_construction</code>)
+    /// @param to_world Has to be invertible
+    mesh_instance(u32 mat_idx, std::shared_ptr<const MeshType> mesh, affine_transform const& to_world)
+        : m_mesh(std::move(mesh))
+        , m_to_world(to_world)
+        , m_to_object(*to_world.inverse())
+        , m_normal_to_world(*to_world.normal_transform())
+        , m_mat_idx(mat_idx) {
+        auto [min, max] = m_mesh->bounds();
+
+        for (usize corner = 0; corner < 8; corner++) {
+            m_bounds.bump(m_to_world.apply_point(vec3{
+              corner & 1 ? max[0] : min[0],
+              corner & 2 ? max[1] : min[1],
+              corner & 4 ? max[2] : min[2],
+            }));
+        }
+    }
+
+    constexpr auto intersect(ray const& ray, real best_t = infinity) const -> std::optional<intersection> {
+        pixel_statistics stats{};
+        return intersect(ray, stats, best_t);
+    }
+
+    constexpr auto intersect(ray const& ray, pixel_statistics& stats, real best_t = infinity) const -> std::optional<intersection> {
+        // the direction is normalized so that the epsilons of the triangle test mean the same in both spaces, distances
+        // along the ray are scaled accordingly
+        const vec3 direction = m_to_object.apply_vector(ray.direction);
+        const real scale = abs(direction);
+
+        const ::trc::ray local_ray(m_to_object.apply_point(ray.origin), direction / scale);
+
+        intersection ret = TRYX(m_mesh->intersect(local_ray, stats, best_t * scale));
+
+        ret.t /= scale;
+        ret.wo = -ray.direction;
+        ret.isection_point = m_to_world.apply_point(ret.isection_point);
+        ret.dpduv = {m_to_world.apply_vector(ret.dpduv.first), m_to_world.apply_vector(ret.dpduv.second)};
+        ret.normal = normalize(m_normal_to_world.apply_vector(ret.normal));
+        ret.material_index = m_mat_idx;
+
+        return ret;
+    }
+
+    constexpr auto intersects(ray const& ray) const -> bool { return intersect(ray) != std::nullopt; }
+
+    constexpr auto bounds() const -> std::pair<vec3, vec3> { return m_bounds.bounds; }
+
+    constexpr auto center() const -> vec3 { return m_to_world.apply_point(m_mesh->center()); }
+
+    /// Samples the mesh and transforms the point, which is only uniform over the area of the instance if the transform
+    /// scales uniformly.
+    template<typename Gen>
+    constexpr auto sample_surface(Gen& gen) const -> intersection {
+        intersection ret = m_mesh->sample_surface(gen);
+
+        ret.isection_point = m_to_world.apply_point(ret.isection_point);
+        ret.dpduv = {m_to_world.apply_vector(ret.dpduv.first), m_to_world.apply_vector(ret.dpduv.second)};
+        ret.normal = normalize(m_normal_to_world.apply_vector(ret.normal));
+        ret.material_index = m_mat_idx;
+
+        return ret;
+    }
+
+    /// Computed on first use, only emitters need it and it takes reading all of a <code>mapped_mesh</code> under
+    /// transforms that do not scale uniformly
+    auto surface_area() const -> real {
+        std::call_once(m_surface_area->once, [this] { m_surface_area->value = m_mesh->surface_area(m_to_world); });
+        return m_surface_area->value;
+    }
+
+    /// The mesh this is an instance of, for placing more instances of it
+    constexpr auto shared_mesh() const -> std::shared_ptr<const MeshType> const& { return m_mesh; }
+
+    constexpr auto to_world() const -> affine_transform const& { return m_to_world; }
+
+    constexpr auto material_index() const -> u32 { return m_mat_idx; }
+
+    constexpr void set_material(u32 idx) { m_mat_idx = idx; }
+
+    friend constexpr void swap(mesh_instance& lhs, mesh_instance& rhs) {
+        using std::swap;
+
+        swap(lhs.m_mesh, rhs.m_mesh);
+        swap(lhs.m_to_world, rhs.m_to_world);
+        swap(lhs.m_to_object, rhs.m_to_object);
+        swap(lhs.m_normal_to_world, rhs.m_normal_to_world);
+        swap(lhs.m_bounds, rhs.m_bounds);
+        swap(lhs.m_surface_area, rhs.m_surface_area);
+        swap(lhs.m_mat_idx, rhs.m_mat_idx);
+    }
+
+private:
+    std::shared_ptr<const MeshType> m_mesh;
+
+    affine_transform m_to_world;
+    affine_transform m_to_object;
+    affine_transform m_normal_to_world;
+
+    bounding_box m_bounds{};
+
+    struct lazy_area {
+        std::once_flag once{};
+        real value = 0;
+    };
+
+    /// Shared by copies, which have the same mesh and transform
+    std::shared_ptr<lazy_area> m_surface_area = std::make_shared<lazy_area>();
+
+    u32 m_mat_idx;
+};
+
+static_assert(concepts::bound_shape<mesh_instance<u32>>);
+
+}// namespace trc::shapes
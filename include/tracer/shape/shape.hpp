@@ -54,6 +54,9 @@ struct dyn_shape {
     virtual constexpr void construct_tree(std::vector<ShapeT> shapes, usize depth) = 0;
     virtual constexpr auto deconstruct_tree() -> std::vector<ShapeT> = 0;
 
+    /// The shapes contained within the structure, in no particular order.
+    virtual constexpr auto shapes() const -> std::span<const ShapeT> = 0;
+
     virtual constexpr void append(std::vector<ShapeT> shapes, usize splits) {
         std::vector<ShapeT> existing_shapes = deconstruct_tree();
 
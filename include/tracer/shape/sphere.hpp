@@ -37,7 +37,7 @@ struct sphere {
     constexpr auto sample_surface(Gen& gen) const -> intersection;
 
     constexpr auto surface_area() const -> real {
-        return 4 * std::numbers::pi_v<real> * m_radius;
+        return 4 * std::numbers::pi_v<real> * m_radius * m_radius;
     }
 
     constexpr auto material_index() const -> u32 { return m_mat_idx; }
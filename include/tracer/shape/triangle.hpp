@@ -24,7 +24,9 @@ constexpr auto moller_trumbore(ray const& ray, std::span<const vec3, 3> vertices
     vec3 h = cross(ray.direction, edge_1);
     real a = dot(edge_0, h);
 
-    if (std::abs(a) <= epsilon)
+    // rays (nearly) parallel to the triangle, relative to its size so that the small triangles of meshes seen through
+    // instances in object space are not all rejected
+    if (a * a <= epsilon * epsilon * dot(edge_0, edge_0) * dot(edge_1, edge_1))
         return std::nullopt;
 
     real f = 1 / a;
@@ -69,6 +71,8 @@ struct triangle {
 
     constexpr auto center() const -> vec3 { return m_center; }
 
+    constexpr auto normal() const -> vec3 { return normalize(cross(m_vertices[1] - m_vertices[0], m_vertices[2] - m_vertices[0])); }
+
     template<typename Gen>
     constexpr auto sample_surface(Gen&) const -> intersection;
 
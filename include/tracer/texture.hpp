@@ -2,6 +2,10 @@
 
 #include <stuff/qoi.hpp>
 #include <tracer/common.hpp>
+#include <tracer/image.hpp>
+
+#include <array>
+#include <vector>
 
 namespace trc {
 
@@ -17,7 +21,16 @@ enum class scaling_method {
     bicubic,
 };
 
+/// An RGB texture, decoded once upon loading into linear single precision texels.\n
+/// Texels are padded to four floats so that filtering works on whole texels at a time and they are laid out in
+/// <code>block_extent</code> sized square blocks, a filter footprint or the lookups of neighbouring rays rarely touch
+/// more than a few of them while rows of a large texture are kilobytes apart.\n
+/// A mip pyramid is built along with the texture, lookups with a footprint larger than a texel are made at the level
+/// where it covers about one texel, which keeps distant surfaces from aliasing.
 struct texture {
+    /// Side length of the square blocks texels are stored in
+    static constexpr usize block_extent = 4;
+
     constexpr texture() = default;
 
     texture(std::string_view filename, wrapping_mode wrapping_mode, scaling_method scaling_method)
@@ -31,14 +44,28 @@ struct texture {
         create(std::move(image), wrapping_mode, scaling_method);
     }
 
+    /// Texels of images in the sRGB color space are converted to linear, the image is not needed afterwards
     template<typename Allocator>
     constexpr void create(stf::qoi::image<Allocator>&& image, wrapping_mode wrapping_mode, scaling_method scaling_method);
 
+    /// Leaves the texture unchanged on failure
     inline auto from_file(std::string_view filename, wrapping_mode wrapping_mode, scaling_method scaling_method) -> stf::expected<void, std::string_view>;
 
-    constexpr auto empty() const -> bool { return m_image.empty(); }
+    constexpr auto empty() const -> bool { return m_levels.empty(); }
+
+    constexpr auto width() const -> usize { return empty() ? 0 : m_levels.front().width; }
+    constexpr auto height() const -> usize { return empty() ? 0 : m_levels.front().height; }
+
+    /// The number of levels in the mip pyramid, including the full resolution one
+    constexpr auto levels() const -> usize { return m_levels.size(); }
 
-    constexpr auto sample(vec2 uv) const -> color;
+    /// Bilinear and bicubic lookups blend the two levels closest to the footprint, nearest ones pick the closest level.
+    /// @param duvdx, duvdy The footprint of the lookup as the change of <code>uv</code> per pixel, see
+    /// <code>intersection::uv_differentials</code>. The full resolution level is used if both are zero.
+    constexpr auto sample(vec2 uv, vec2 duvdx = {}, vec2 duvdy = {}) const -> color;
+
+    /// The mean of all texels, computed once upon loading
+    constexpr auto average() const -> color { return m_average; }
 
     constexpr auto get_wrapping_mode() -> wrapping_mode& { return m_wrapping_mode; }
     constexpr auto get_wrapping_mode() const -> wrapping_mode { return m_wrapping_mode; }
@@ -46,15 +73,45 @@ struct texture {
     constexpr auto get_scaling_method() const -> scaling_method { return m_scaling_method; }
 
 private:
-    stf::qoi::image<> m_image{};
+    struct alignas(16) texel {
+        std::array<float, 4> channels;
+    };
+
+    struct level {
+        constexpr level(usize width, usize height);
+
+        std::vector<texel> texels;
+        usize width;
+        usize height;
+        usize blocks_x;
+
+        constexpr auto index(usize x, usize y) const -> usize;
+
+        constexpr auto at(usize x, usize y) -> texel& { return texels[index(x, y)]; }
+        constexpr auto at(usize x, usize y) const -> texel const& { return texels[index(x, y)]; }
+    };
+
+    std::vector<level> m_levels{};
     wrapping_mode m_wrapping_mode = wrapping_mode::clamp;
     scaling_method m_scaling_method = scaling_method::nearest;
 
     // cache
-    real m_width = 0;
-    real m_height = 0;
+    color m_average{};
+
+    constexpr void compute_average();
+
+    /// Halves the last level until it is a single texel, every texel is the mean of the 2x2 texels above it
+    constexpr void build_pyramid();
+
+    /// Maps a texel coordinate that may lie outside of the texture according to the wrapping mode, for repeating
+    /// textures it must be less than one period away
+    constexpr auto wrap(i64 coord, usize extent) const -> usize;
+
+    constexpr auto sample_level(level const& level, vec2 uv) const -> color;
 
-    constexpr auto sample_nearest(vec2 xy) const -> color;
+    /// Weighted sum of the <code>N</code>x<code>N</code> texels whose top left corner is at <code>x</code>, <code>y</code>
+    template<usize N>
+    constexpr auto filter(level const& level, i64 x, i64 y, std::array<float, N> const& weights_x, std::array<float, N> const& weights_y) const -> color;
 };
 
 }
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <tracer/common.hpp>
+#include <tracer/texture.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace trc {
+
+/// Refers to a texture owned by a <code>texture_registry</code>, small and trivially copyable so that materials stay
+/// cheap to copy.\n
+/// Valid for as long as the registry or any copy of it lives, a default constructed handle refers to no texture.
+struct texture_handle {
+    constexpr texture_handle() = default;
+
+    /// The position of the texture within its registry
+    constexpr auto index() const -> u32 { return m_index; }
+
+    constexpr auto get() const -> texture const* { return m_texture; }
+
+    constexpr auto operator*() const -> texture const& { return *m_texture; }
+    constexpr auto operator->() const -> texture const* { return m_texture; }
+
+    constexpr explicit operator bool() const { return m_texture != nullptr; }
+
+private:
+    friend struct texture_registry;
+
+    constexpr texture_handle(u32 index, texture const* texture)
+        : m_index(index)
+        , m_texture(texture) {}
+
+    u32 m_index = 0;
+    texture const* m_texture = nullptr;
+};
+
+/// Owns the textures of a scene, loading the same file with the same settings twice gives the same texture.\n
+/// Copies of the registry share the textures. Not thread-safe.
+struct texture_registry {
+    /// Loads <code>filename</code> unless it was loaded with the same settings before
+    auto load(std::string const& filename, wrapping_mode wrapping_mode, scaling_method scaling_method) -> stf::expected<texture_handle, std::string_view> {
+        auto key = std::make_tuple(filename, wrapping_mode, scaling_method);
+
+        if (auto it = m_loaded.find(key); it != m_loaded.end()) {
+            return (*this)[it->second];
+        }
+
+        texture tex{};
+        TRYX(tex.from_file(filename, wrapping_mode, scaling_method));
+
+        texture_handle ret = add(std::move(tex));
+        m_loaded.emplace(std::move(key), ret.index());
+
+        return ret;
+    }
+
+    /// Textures that are not loaded from files are never de-duplicated
+    auto add(texture tex) -> texture_handle {
+        m_textures.emplace_back(std::make_shared<const texture>(std::move(tex)));
+        return (*this)[static_cast<u32>(m_textures.size() - 1)];
+    }
+
+    auto size() const -> usize { return m_textures.size(); }
+
+    auto operator[](u32 index) const -> texture_handle { return {index, m_textures[index].get()}; }
+
+private:
+    std::vector<std::shared_ptr<const texture>> m_textures{};
+    std::map<std::tuple<std::string, wrapping_mode, scaling_method>, u32> m_loaded{};
+};
+
+}// namespace trc
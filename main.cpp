@@ -1,6 +1,6 @@
 #include <tracer/run/sfml/main.hpp>
 
-int main() {
-    trc::sfml_program program{};
+int main(int argc, char** argv) {
+    trc::sfml_program program{argc, argv};
     return program.run();
 }
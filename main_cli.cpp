@@ -0,0 +1,6 @@
+#include <tracer/run/cli/main.hpp>
+
+int main(int argc, char** argv) {
+    trc::cli_program program{argc, argv};
+    return program.run();
+}
@@ -0,0 +1,36 @@
+#include <tracer/run/camera_settings.hpp>
+
+#include <tracer/camera/envrionment.hpp>
+#include <tracer/camera/orthographic.hpp>
+#include <tracer/camera/perspective.hpp>
+#include <tracer/camera/pinhole.hpp>
+
+namespace trc {
+
+auto camera_settings::operator()(usize width, usize height) const -> std::shared_ptr<camera> {
+    vec2 dimensions(width, height);
+
+    if (type == camera_type::pinhole) {
+        vec3 rad_rotation = rotation / 180 * std::numbers::pi_v<real>;
+        mat3x3 mat = mat3x3::rotate(rotation[0], rotation[1], rotation[2]);
+
+        return std::make_shared<pinhole_camera>(center, dimensions, fov / 180 * std::numbers::pi_v<real>, mat);
+    } else if (type == camera_type::environment) {
+        return std::make_shared<environment_camera>(center, dimensions);
+    } else if (type == camera_type::orthographic_raw) {
+        return std::make_shared<orthographic_camera>(dimensions, center, left, right, bottom, top, near, far, rotation, ray_rotation);
+    } else if (type == camera_type::frustum_raw) {
+        return std::make_shared<frustum_camera>(dimensions, left, right, bottom, top, near, far);
+    } else if (type == camera_type::orthographic) {
+        vec2 lr = vec2(-0.5, 0.5) * physical_width;
+        vec2 bt = vec2(-0.5, 0.5) * physical_width * dimensions[1] / dimensions[0];
+
+        return std::make_shared<orthographic_camera>(dimensions, center, lr[0], lr[1], bt[0], bt[1], near, far, rotation, ray_rotation);
+    } else if (type == camera_type::frustum) {
+        return std::make_shared<frustum_camera>(dimensions, left, right, bottom, top, near, far);
+    } else {
+        std::unreachable();
+    }
+}
+
+}// namespace trc
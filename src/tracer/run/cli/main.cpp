@@ -0,0 +1,826 @@
+#include <tracer/run/cli/main.hpp>
+
+#include <tracer/aov.hpp>
+#include <tracer/bvh/tree.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/distributed/coordinator.hpp>
+#include <tracer/distributed/worker.hpp>
+#include <tracer/framebuffer.hpp>
+#include <tracer/image.hpp>
+#include <tracer/integrator/cosine_albedo.hpp>
+#include <tracer/integrator/light_visibility.hpp>
+#include <tracer/integrator/unidirectional_pt.hpp>
+#include <tracer/io/pfm.hpp>
+#include <tracer/io/tiled_float.hpp>
+#include <tracer/post/denoise.hpp>
+#include <tracer/post/tonemap.hpp>
+#include <tracer/run/scene_file.hpp>
+#include <tracer/run/test_scene.hpp>
+#include <tracer/scene.hpp>
+
+#include <stuff/qoi.hpp>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <variant>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace trc {
+
+namespace {
+
+template<typename T>
+auto parse_number(std::string_view str) -> std::optional<T> {
+    T ret;
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), ret);
+
+    if (ec != std::errc{} || ptr != str.data() + str.size()) {
+        return std::nullopt;
+    }
+
+    return ret;
+}
+
+/// Parses <code>N</code> numbers separated by <code>separator</code>
+template<typename T, usize N>
+auto parse_numbers(std::string_view str, char separator) -> std::optional<std::array<T, N>> {
+    std::array<T, N> ret;
+
+    for (usize i = 0; i < N; i++) {
+        usize end = i + 1 == N ? str.size() : str.find(separator);
+        if (end == std::string_view::npos) {
+            return std::nullopt;
+        }
+
+        ret[i] = TRYX(parse_number<T>(str.substr(0, end)));
+        str = str.substr(std::min(end + 1, str.size()));
+    }
+
+    return ret;
+}
+
+auto parse_vec3(std::string_view str) -> std::optional<vec3> {
+    auto res = TRYX((parse_numbers<real, 3>(str, ',')));
+    return vec3{res[0], res[1], res[2]};
+}
+
+/// A mesh surrounded by a uniformly emitting sphere, for looking at models without a scene around them
+auto get_scene_mesh(std::filesystem::path const& filename) -> stf::expected<scene, std::string> {
+    if (!std::filesystem::exists(filename)) {
+        return stf::unexpected{fmt::format("\"{}\" does not exist", filename.string())};
+    }
+
+    scene scene{};
+
+    u32 midx_white = scene.add_material(materials::lambertian(vec3(.75), vec3(0)));
+    u32 midx_sky = scene.add_material(materials::lambertian(vec3(0), vec3(1)));
+
+    if (std::filesystem::path extension = filename.extension(); extension == ".ply") {
+        scene.append_shape(read_ply<u32>(filename, midx_white));
+    } else if (extension == ".stl") {
+        scene.append_shape(read_stl<u32>(filename, midx_white));
+    } else if (extension == ".obj") {
+        std::vector<bound_shape> meshes{};
+        for (shapes::mesh<u32>& mesh : read_obj<u32>(filename, midx_white)) {
+            meshes.emplace_back(std::move(mesh));
+        }
+
+        scene.append_shapes(std::move(meshes));
+    } else if (extension == ".glb") {
+        std::vector<bound_shape> instances{};
+        for (shapes::mesh_instance<u32>& instance : read_glb<u32>(filename, midx_white)) {
+            instances.emplace_back(std::move(instance));
+        }
+
+        scene.append_shapes(std::move(instances));
+    } else {
+        return stf::unexpected{fmt::format("unsupported mesh format \"{}\"", extension.string())};
+    }
+
+    scene.append_shape(shapes::sphere(midx_sky, vec3(0), 1000));
+
+    return scene;
+}
+
+auto load_scene(std::string_view name) -> stf::expected<scene, std::string> {
+    if (name == "test") {
+        return get_scene_test();
+    }
+
+    if (is_scene_file(name)) {
+        return TRYX(scene_file::open(name)).build();
+    }
+
+    return get_scene_mesh(name);
+}
+
+auto split(std::string_view str, char separator) -> std::vector<std::string_view> {
+    std::vector<std::string_view> ret{};
+
+    while (!str.empty()) {
+        usize end = std::min(str.find(separator), str.size());
+        ret.push_back(str.substr(0, end));
+        str = str.substr(std::min(end + 1, str.size()));
+    }
+
+    return ret;
+}
+
+auto tonemap_operator_of(std::string_view name) -> std::optional<tonemap_operator> {
+    if (name == "clamp") {
+        return tonemap_operator::clamp;
+    }
+
+    if (name == "reinhard") {
+        return tonemap_operator::reinhard;
+    }
+
+    if (name == "aces") {
+        return tonemap_operator::aces;
+    }
+
+    return std::nullopt;
+}
+
+enum class output_format {
+    qoi,
+    pfm,
+    tiled_float,
+};
+
+auto output_format_of(std::string_view filename) -> output_format {
+    std::filesystem::path extension = std::filesystem::path(filename).extension();
+
+    if (extension == ".pfm") {
+        return output_format::pfm;
+    }
+
+    if (extension == ".tfi") {
+        return output_format::tiled_float;
+    }
+
+    return output_format::qoi;
+}
+
+/// A float image file that tiles are written to as they arrive
+struct float_output {
+    std::variant<io::pfm::writer, io::tiled_float::writer> writer;
+
+    auto target() -> image_like& {
+        return std::visit([](auto& w) -> image_like& { return w; }, writer);
+    }
+
+    /// Writes AOVs that had to be buffered in bands of rows, only tiled float images have room for them
+    void write_aovs(aov_buffers const& aovs, std::span<const aov> channels) {
+        aov_image_like* aov_target = target().as_aov_image();
+        if (aov_target == nullptr) {
+            return;
+        }
+
+        const usize width = aovs.width();
+        const usize height = aovs.height();
+
+        for (usize y = 0; y < height; y += default_tile_extent) {
+            const usize band_height = std::min(default_tile_extent, height - y);
+
+            for (aov channel: channels) {
+                aov_target->set_aov_tile(channel, 0, y, width, band_height, aovs.channel(channel).pixels().subspan(y * width, width * band_height));
+            }
+        }
+    }
+
+    auto finish(std::string const& filename) -> bool {
+        auto res = std::visit([](auto& w) { return w.finish(); }, writer);
+        if (!res) {
+            spdlog::error("could not write to \"{}\": {}", filename, res.error());
+            return false;
+        }
+
+        spdlog::info("wrote to \"{}\"", filename);
+        return true;
+    }
+};
+
+/// The AOVs become additional layers of tiled float images, PFMs only hold the beauty image
+auto open_float_output(std::string const& filename, usize width, usize height, std::span<const aov> aovs) -> stf::expected<float_output, std::string> {
+    if (output_format_of(filename) == output_format::pfm) {
+        auto res = io::pfm::writer::create(filename, width, height);
+        if (!res) {
+            return stf::unexpected{res.error()};
+        }
+
+        return float_output{std::move(*res)};
+    }
+
+    std::vector<std::string> layers{std::string(aov_name(aov::beauty))};
+    for (aov channel: aovs) {
+        layers.emplace_back(aov_name(channel));
+    }
+
+    auto res = io::tiled_float::writer::create(filename, width, height, std::move(layers));
+    if (!res) {
+        return stf::unexpected{res.error()};
+    }
+
+    return float_output{std::move(*res)};
+}
+
+/// Starts copies of this executable in worker mode
+auto spawn_local_workers(std::string const& address, usize count, usize threads) -> std::vector<pid_t> {
+    std::vector<pid_t> ret{};
+
+    std::string threads_str = std::to_string(threads);
+
+    for (usize i = 0; i < count; i++) {
+        std::array<char*, 6> argv{
+          const_cast<char*>("tracer_cli"),
+          const_cast<char*>("--worker"),
+          const_cast<char*>(address.c_str()),
+          const_cast<char*>("--threads"),
+          threads_str.data(),
+          nullptr,
+        };
+
+        pid_t pid;
+        if (int res = posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, argv.data(), environ); res != 0) {
+            spdlog::error("could not start a local worker: {}", std::strerror(res));
+            continue;
+        }
+
+        ret.push_back(pid);
+    }
+
+    return ret;
+}
+
+}// namespace
+
+cli_program::cli_program(int argc, char** argv)
+    : m_args(argv, argv + argc) {}
+
+auto cli_program::run() -> int {
+    std::string_view program_name = m_args.empty() ? "tracer_cli" : m_args.front();
+    std::span<const std::string_view> args = m_args;
+
+    auto options_res = resolve_options(args.empty() ? args : args.subspan(1));
+    if (!options_res) {
+        spdlog::error("{}", options_res.error());
+        print_usage(program_name);
+        return 1;
+    }
+
+    options const& opts = *options_res;
+
+    if (opts.help) {
+        print_usage(program_name);
+        return 0;
+    }
+
+    if (!opts.worker_address.empty()) {
+        return run_worker(opts);
+    }
+
+    if (!opts.coordinator_address.empty() || opts.local_workers != 0) {
+        return run_coordinator(opts, args.empty() ? args : args.subspan(1));
+    }
+
+    std::chrono::time_point tp_0 = std::chrono::steady_clock::now();
+
+    auto scene_res = load_scene(opts.scene);
+    if (!scene_res) {
+        spdlog::error("could not load the scene: {}", scene_res.error());
+        return 2;
+    }
+
+    std::shared_ptr<scene> scene = std::make_shared<trc::scene>(std::move(*scene_res));
+
+    std::chrono::time_point tp_1 = std::chrono::steady_clock::now();
+    spdlog::info("loaded the scene in {} seconds", std::chrono::duration<double>(tp_1 - tp_0).count());
+
+    std::shared_ptr<integrator> integrator = create_integrator(opts, std::move(scene));
+
+    // float images and their AOVs are written as tiles finish, nothing frame-sized is kept in memory unless the denoiser
+    // needs the whole frame
+    std::optional<float_output> output{};
+    if (output_format_of(opts.output) != output_format::qoi) {
+        auto output_res = open_float_output(opts.output, opts.width, opts.height, opts.aovs);
+        if (!output_res) {
+            spdlog::error("could not write to \"{}\": {}", opts.output, output_res.error());
+            return 2;
+        }
+
+        output.emplace(std::move(*output_res));
+    }
+
+    const bool streamed = output && !opts.denoise;
+
+    framebuffer rendered{};
+    aov_buffers aovs(opts.width, opts.height);
+
+    if (!streamed) {
+        rendered.create(opts.width, opts.height);
+
+        if (opts.denoise) {
+            aovs.enable(aov::albedo);
+            aovs.enable(aov::normal);
+            aovs.enable(aov::depth);
+        }
+
+        for (aov channel: opts.aovs) {
+            aovs.enable(channel);
+        }
+    }
+
+    image_adapter_aov buffered{rendered, aovs};
+
+    default_rng gen{opts.seed};
+
+    std::chrono::time_point tp_2 = std::chrono::steady_clock::now();
+    integrator->integrate(streamed ? output->target() : buffered, opts.integrator_settings, gen);
+    std::chrono::time_point tp_3 = std::chrono::steady_clock::now();
+
+    const double render_seconds = std::chrono::duration<double>(tp_3 - tp_2).count();
+    const double n_samples = static_cast<double>(opts.width * opts.height * opts.integrator_settings.samples);
+
+    spdlog::info("rendered {}x{} at {} spp in {} seconds", opts.width, opts.height, opts.integrator_settings.samples, render_seconds);
+    spdlog::info("throughput: {:.3f} Msamples/s, {:.3f} Mpixels/s", n_samples / render_seconds / 1e6, static_cast<double>(opts.width * opts.height) / render_seconds / 1e6);
+
+    if (streamed) {
+        return output->finish(opts.output) ? 0 : 2;
+    }
+
+    if (!opts.denoise) {
+        return write_output(rendered, opts) ? 0 : 2;
+    }
+
+    // the denoiser works on row-major images
+    image beauty(opts.width, opts.height);
+    rendered.resolve_into(beauty);
+
+    image denoised{};
+    if (!output) {
+        denoised.create(opts.width, opts.height);
+    }
+
+    denoise_atrous(beauty, aovs, output ? output->target() : denoised, {.threads = opts.integrator_settings.threads});
+
+    std::chrono::time_point tp_4 = std::chrono::steady_clock::now();
+    spdlog::info("denoised in {} seconds", std::chrono::duration<double>(tp_4 - tp_3).count());
+
+    if (output) {
+        output->write_aovs(aovs, opts.aovs);
+        return output->finish(opts.output) ? 0 : 2;
+    }
+
+    return write_output(denoised, opts) ? 0 : 2;
+}
+
+auto cli_program::create_integrator(options const& opts, std::shared_ptr<scene> scene) -> std::shared_ptr<integrator> {
+    std::shared_ptr<camera> camera = opts.camera(opts.width, opts.height);
+
+    switch (opts.integrator) {
+        case integrator_type::cosine_albedo:
+            return std::make_shared<cosine_albedo_integrator>(std::move(camera), std::move(scene));
+        case integrator_type::light_visibility:
+            return std::make_shared<light_visibility_checker>(std::move(camera), std::move(scene));
+        case integrator_type::unidirectional_pt:
+            return std::make_shared<unidirectional_pt>(std::move(camera), std::move(scene));
+        default:
+            std::unreachable();
+    }
+}
+
+auto cli_program::write_output(image_like const& rendered, options const& opts) -> bool {
+    const usize width = rendered.width();
+    const usize height = rendered.height();
+
+    tonemap_settings settings = opts.tonemap;
+
+    stf::qoi::image<> output{};
+    output.create(width, height);
+
+    settings.srgb = output.get_color_space() == stf::qoi::color_space::srgb_linear_alpha;
+
+    // row by row, framebuffers are not laid out row-major
+    detail::parallel_for(height, settings.threads, [&](usize row_begin, usize row_end) {
+        std::vector<color> row(width);
+        std::vector<u8> rgba(width * 4);
+
+        for (usize y = row_begin; y < row_end; y++) {
+            for (usize x = 0; x < width; x++) {
+                row[x] = rendered.get(x, y);
+            }
+
+            detail::tonemap_rgba8(row.data()->data(), width, rgba.data(), settings);
+
+            for (usize x = 0; x < width; x++) {
+                const u8* p = rgba.data() + x * 4;
+                output.at(x, y) = stf::qoi::color{p[0], p[1], p[2], p[3]};
+            }
+        }
+    });
+
+    if (auto res = output.to_file(opts.output); !res) {
+        spdlog::error("could not write to \"{}\": {}", opts.output, res.error());
+        return false;
+    }
+
+    spdlog::info("wrote to \"{}\"", opts.output);
+
+    return true;
+}
+
+auto cli_program::run_worker(options const& opts) -> int {
+    auto prepare = [](std::string_view description) -> stf::expected<distributed::worker_job, std::string> {
+        std::vector<std::string_view> job_args = split(description, '\0');
+
+        options job_opts = TRYX(resolve_options(job_args));
+
+        std::chrono::time_point tp_0 = std::chrono::steady_clock::now();
+        std::shared_ptr<scene> scene = std::make_shared<trc::scene>(TRYX(load_scene(job_opts.scene)));
+        std::chrono::time_point tp_1 = std::chrono::steady_clock::now();
+
+        spdlog::info("loaded the scene in {} seconds", std::chrono::duration<double>(tp_1 - tp_0).count());
+
+        return distributed::worker_job{
+          .integrator = create_integrator(job_opts, std::move(scene)),
+          .settings = job_opts.integrator_settings,
+        };
+    };
+
+    spdlog::info("working for {}", opts.worker_address);
+
+    auto res = distributed::run_worker(opts.worker_address, prepare, opts.integrator_settings.threads);
+    if (!res) {
+        spdlog::error("worker failed: {}", res.error());
+        return 2;
+    }
+
+    spdlog::info("rendered {} tiles", res->tiles);
+
+    return 0;
+}
+
+auto cli_program::run_coordinator(options const& opts, std::span<const std::string_view> args) -> int {
+    if (opts.denoise || !opts.aovs.empty()) {
+        spdlog::error("--denoise and --aov are not supported with workers, tiles do not carry AOVs");
+        return 1;
+    }
+
+    std::string address = opts.coordinator_address.empty() ? std::string("127.0.0.1:0") : opts.coordinator_address;
+
+    auto coordinator_res = distributed::coordinator::listen(address);
+    if (!coordinator_res) {
+        spdlog::error("could not start the coordinator: {}", coordinator_res.error());
+        return 2;
+    }
+
+    distributed::coordinator& coordinator = *coordinator_res;
+
+    // workers receive the very same options and ignore the ones about distribution
+    std::string description{};
+    for (std::string_view arg: args) {
+        description += arg;
+        description += '\0';
+    }
+
+    std::vector<pid_t> local_workers{};
+    if (opts.local_workers != 0) {
+        std::string worker_address = address.starts_with("unix:") ? address : fmt::format("127.0.0.1:{}", coordinator.port().value_or(0));
+
+        usize threads = opts.integrator_settings.threads != 0
+                          ? opts.integrator_settings.threads
+                          : std::max<usize>(detail::default_thread_count() / opts.local_workers, 1);
+
+        local_workers = spawn_local_workers(worker_address, opts.local_workers, threads);
+    }
+
+    if (auto port = coordinator.port(); port) {
+        spdlog::info("waiting for workers on port {}", *port);
+    } else {
+        spdlog::info("waiting for workers on {}", address);
+    }
+
+    std::optional<float_output> streamed{};
+    if (output_format_of(opts.output) != output_format::qoi) {
+        auto output_res = open_float_output(opts.output, opts.width, opts.height, {});
+        if (!output_res) {
+            spdlog::error("could not write to \"{}\": {}", opts.output, output_res.error());
+            return 2;
+        }
+
+        streamed.emplace(std::move(*output_res));
+    }
+
+    framebuffer rendered{};
+    if (!streamed) {
+        rendered.create(opts.width, opts.height);
+    }
+
+    // the same frame seed a single process render would draw
+    default_rng gen{opts.seed};
+    const u64 frame_seed = gen();
+
+    std::chrono::time_point tp_0 = std::chrono::steady_clock::now();
+    auto res = coordinator.render(
+      streamed ? streamed->target() : rendered, description, frame_seed,
+      {
+        .tile_timeout = opts.tile_timeout,
+        // local workers all see the same files, one failing to load the scene means all of them will
+        .fail_on_worker_error = opts.coordinator_address.empty(),
+      }
+    );
+    std::chrono::time_point tp_1 = std::chrono::steady_clock::now();
+
+    for (pid_t pid: local_workers) {
+        if (!res) {
+            kill(pid, SIGTERM);
+        }
+
+        waitpid(pid, nullptr, 0);
+    }
+
+    if (!res) {
+        spdlog::error("could not render: {}", res.error());
+        return 2;
+    }
+
+    const double render_seconds = std::chrono::duration<double>(tp_1 - tp_0).count();
+
+    spdlog::info("rendered {}x{} at {} spp in {} seconds", opts.width, opts.height, opts.integrator_settings.samples, render_seconds);
+    spdlog::info("{} tiles by {} workers, {} reassigned, {} duplicates", res->tiles, res->workers_seen, res->reassigned, res->duplicates);
+
+    if (streamed) {
+        return streamed->finish(opts.output) ? 0 : 2;
+    }
+
+    return write_output(rendered, opts) ? 0 : 2;
+}
+
+auto cli_program::resolve_options(std::span<const std::string_view> args) -> stf::expected<options, std::string> {
+    options ret = TRYX(parse_options(args, {}));
+    if (ret.help || !is_scene_file(ret.scene)) {
+        return ret;
+    }
+
+    scene_file file = TRYX(scene_file::open(ret.scene));
+    scene_render_settings const& render = file.render;
+
+    options defaults{};
+
+    if (file.camera) {
+        defaults.camera = *file.camera;
+    }
+
+    if (render.resolution) {
+        defaults.width = (*render.resolution)[0];
+        defaults.height = (*render.resolution)[1];
+    }
+
+    defaults.integrator_settings.samples = render.samples.value_or(defaults.integrator_settings.samples);
+    defaults.seed = render.seed.value_or(defaults.seed);
+    defaults.tonemap.exposure = render.exposure.value_or(defaults.tonemap.exposure);
+
+    if (render.integrator) {
+        std::optional<integrator_type> type = integrator_of(*render.integrator);
+        if (!type) {
+            return stf::unexpected{fmt::format("\"{}\": unknown integrator \"{}\"", ret.scene, *render.integrator)};
+        }
+
+        defaults.integrator = *type;
+    }
+
+    if (render.tonemap) {
+        std::optional<tonemap_operator> op = tonemap_operator_of(*render.tonemap);
+        if (!op) {
+            return stf::unexpected{fmt::format("\"{}\": unknown tone mapping operator \"{}\"", ret.scene, *render.tonemap)};
+        }
+
+        defaults.tonemap.op = *op;
+    }
+
+    return parse_options(args, std::move(defaults));
+}
+
+auto cli_program::integrator_of(std::string_view name) -> std::optional<integrator_type> {
+    if (name == "albedo") {
+        return integrator_type::cosine_albedo;
+    }
+
+    if (name == "visibility") {
+        return integrator_type::light_visibility;
+    }
+
+    if (name == "pt") {
+        return integrator_type::unidirectional_pt;
+    }
+
+    return std::nullopt;
+}
+
+auto cli_program::parse_options(std::span<const std::string_view> args, options ret) -> stf::expected<options, std::string> {
+
+    for (usize i = 0; i < args.size(); i++) {
+        std::string_view arg = args[i];
+
+        if (arg == "-h" || arg == "--help") {
+            ret.help = true;
+            continue;
+        }
+
+        if (arg == "--denoise") {
+            ret.denoise = true;
+            continue;
+        }
+
+        if (i + 1 == args.size()) {
+            return stf::unexpected{fmt::format("unknown option or missing value for \"{}\"", arg)};
+        }
+
+        std::string_view value = args[++i];
+
+        auto bad_value = [&] { return stf::unexpected{fmt::format("bad value \"{}\" for \"{}\"", value, arg)}; };
+
+        if (arg == "-s" || arg == "--scene") {
+            ret.scene = value;
+        } else if (arg == "-o" || arg == "--output") {
+            ret.output = value;
+        } else if (arg == "-r" || arg == "--resolution") {
+            auto res = parse_numbers<usize, 2>(value, 'x');
+            if (!res || (*res)[0] == 0 || (*res)[1] == 0) {
+                return bad_value();
+            }
+
+            ret.width = (*res)[0];
+            ret.height = (*res)[1];
+        } else if (arg == "-i" || arg == "--integrator") {
+            std::optional<integrator_type> type = integrator_of(value);
+            if (!type) {
+                return bad_value();
+            }
+
+            ret.integrator = *type;
+        } else if (arg == "-n" || arg == "--spp") {
+            auto res = parse_number<usize>(value);
+            if (!res || *res == 0) {
+                return bad_value();
+            }
+
+            ret.integrator_settings.samples = *res;
+        } else if (arg == "-t" || arg == "--threads") {
+            auto res = parse_number<usize>(value);
+            if (!res) {
+                return bad_value();
+            }
+
+            ret.integrator_settings.threads = *res;
+            ret.tonemap.threads = *res;
+        } else if (arg == "--seed") {
+            auto res = parse_number<u64>(value);
+            if (!res) {
+                return bad_value();
+            }
+
+            ret.seed = *res;
+        } else if (arg == "--camera") {
+            if (value == "pinhole") {
+                ret.camera.type = camera_type::pinhole;
+            } else if (value == "environment") {
+                ret.camera.type = camera_type::environment;
+            } else if (value == "orthographic") {
+                ret.camera.type = camera_type::orthographic;
+            } else {
+                return bad_value();
+            }
+        } else if (arg == "--position") {
+            auto res = parse_vec3(value);
+            if (!res) {
+                return bad_value();
+            }
+
+            ret.camera.center = *res;
+        } else if (arg == "--rotation") {
+            auto res = parse_vec3(value);
+            if (!res) {
+                return bad_value();
+            }
+
+            ret.camera.rotation = *res / 180 * std::numbers::pi_v<real>;
+        } else if (arg == "--fov") {
+            auto res = parse_number<real>(value);
+            if (!res) {
+                return bad_value();
+            }
+
+            ret.camera.fov = *res;
+        } else if (arg == "--aov") {
+            std::optional<aov> channel = std::nullopt;
+            for (usize j = 1; j < n_aovs; j++) {
+                if (value == aov_name(static_cast<aov>(j))) {
+                    channel = static_cast<aov>(j);
+                }
+            }
+
+            if (!channel) {
+                return bad_value();
+            }
+
+            ret.aovs.push_back(*channel);
+        } else if (arg == "--exposure") {
+            auto res = parse_number<real>(value);
+            if (!res) {
+                return bad_value();
+            }
+
+            ret.tonemap.exposure = *res;
+        } else if (arg == "--tonemap") {
+            std::optional<tonemap_operator> op = tonemap_operator_of(value);
+            if (!op) {
+                return bad_value();
+            }
+
+            ret.tonemap.op = *op;
+        } else if (arg == "--coordinator") {
+            ret.coordinator_address = value;
+        } else if (arg == "--worker") {
+            ret.worker_address = value;
+        } else if (arg == "--local-workers") {
+            auto res = parse_number<usize>(value);
+            if (!res) {
+                return bad_value();
+            }
+
+            ret.local_workers = *res;
+        } else if (arg == "--tile-timeout") {
+            auto res = parse_number<real>(value);
+            if (!res || *res <= 0) {
+                return bad_value();
+            }
+
+            ret.tile_timeout = std::chrono::milliseconds(static_cast<i64>(*res * 1000));
+        } else {
+            return stf::unexpected{fmt::format("unknown option \"{}\"", arg)};
+        }
+    }
+
+    if (!ret.aovs.empty() && output_format_of(ret.output) != output_format::tiled_float) {
+        return stf::unexpected{std::string("--aov needs a .tfi output")};
+    }
+
+    if (!ret.worker_address.empty() && (!ret.coordinator_address.empty() || ret.local_workers != 0)) {
+        return stf::unexpected{std::string("--worker cannot be combined with --coordinator or --local-workers")};
+    }
+
+    return ret;
+}
+
+void cli_program::print_usage(std::string_view program_name) {
+    fmt::print(
+      "usage: {} [options]\n"
+      "  -h, --help                   print this message\n"
+      "  -s, --scene <test|file>      the built-in test scene, a JSON scene file or a PLY/STL/OBJ/GLB mesh\n"
+      "                               (default: test), scene files supply defaults for the options below\n"
+      "  -o, --output <file>          .qoi, or .pfm and .tfi for float images (default: render.qoi)\n"
+      "  -r, --resolution <W>x<H>     (default: 400x300)\n"
+      "  -i, --integrator <name>      albedo, visibility or pt (default: pt)\n"
+      "  -n, --spp <N>                samples per pixel (default: 16)\n"
+      "  -t, --threads <N>            worker threads, 0 picks a default (default: 0)\n"
+      "      --seed <N>               (default: 1)\n"
+      "      --denoise                run the denoiser on the result\n"
+      "      --exposure <stops>       scales the image by 2^stops before tone mapping (default: 0)\n"
+      "      --tonemap <name>         clamp, reinhard or aces (default: clamp)\n"
+      "      --aov <name>             adds a layer to .tfi outputs, repeatable: albedo, normal, depth,\n"
+      "                               material_index, primitive_id or sample_count\n"
+      "      --camera <name>          pinhole, environment or orthographic (default: pinhole)\n"
+      "      --position <x,y,z>       camera position\n"
+      "      --rotation <p,y,r>       camera pitch, yaw and roll in degrees\n"
+      "      --fov <degrees>          (default: 80)\n"
+      "\n"
+      "distributed rendering, addresses are <host>:<port> or unix:<path>:\n"
+      "      --coordinator <address>  hand out tiles to workers connecting here, port 0 picks one\n"
+      "      --local-workers <N>      start N worker processes on this machine\n"
+      "      --tile-timeout <seconds> hand slow tiles to another worker as well (default: 30)\n"
+      "      --worker <address>       render tiles for the coordinator at the address, the scene and\n"
+      "                               all other render options are taken from the coordinator\n"
+      "\n"
+      "PLY and STL meshes are cached after their first load in $TRACER_CACHE_DIR, $XDG_CACHE_HOME/tracer\n"
+      "or ~/.cache/tracer, an empty TRACER_CACHE_DIR disables the cache. Scene files can keep meshes\n"
+      "too large for memory out of core with a resident_budget, they are rendered from the cache.\n",
+      program_name
+    );
+}
+
+}// namespace trc
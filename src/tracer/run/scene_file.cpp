@@ -0,0 +1,588 @@
+#include <tracer/run/scene_file.hpp>
+
+#include <tracer/affine_transform.hpp>
+#include <tracer/bvh/tree.hpp>
+#include <tracer/detail/parallel.hpp>
+#include <tracer/io/detail/mapped_file.hpp>
+#include <tracer/run/test_scene.hpp>
+#include <tracer/shape/mapped_mesh.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <system_error>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace trc {
+
+namespace {
+
+using json_value = io::json::value;
+
+/// The type a converter from JSON values to <code>std::optional</code>s produces
+template<typename Fn>
+using converted_t = typename std::invoke_result_t<Fn, json_value const&>::value_type;
+
+auto as_number(json_value const& value) -> std::optional<real> { return value.number(); }
+
+auto as_string(json_value const& value) -> std::optional<std::string_view> { return value.string(); }
+
+/// Non-negative integers that survive the round trip through a double
+auto as_count(json_value const& value) -> std::optional<u64> {
+    const real number = TRYX(value.number());
+    if (number < 0 || number > 0x1p53 || std::floor(number) != number) {
+        return std::nullopt;
+    }
+
+    return static_cast<u64>(number);
+}
+
+auto as_vec3(json_value const& value) -> std::optional<vec3> {
+    std::span<const json_value> elements = value.elements();
+    if (elements.size() != 3) {
+        return std::nullopt;
+    }
+
+    return vec3{TRYX(elements[0].number()), TRYX(elements[1].number()), TRYX(elements[2].number())};
+}
+
+/// Normalized, zero vectors have no direction
+auto as_direction(json_value const& value) -> std::optional<vec3> {
+    const vec3 ret = TRYX(as_vec3(value));
+    if (abs(ret) == 0) {
+        return std::nullopt;
+    }
+
+    return normalize(ret);
+}
+
+/// A vector or a single number for all three components
+auto as_factors(json_value const& value) -> std::optional<vec3> {
+    if (std::optional<real> number = value.number(); number) {
+        return vec3(*number);
+    }
+
+    return as_vec3(value);
+}
+
+/// Converts the member <code>key</code> of <code>object</code>, nullopt if it is missing
+template<typename Fn>
+auto find_member(json_value const& object, std::string_view key, Fn&& convert) -> stf::expected<std::optional<converted_t<Fn>>, std::string> {
+    json_value const* member = object.find(key);
+    if (member == nullptr) {
+        return std::nullopt;
+    }
+
+    std::optional<converted_t<Fn>> ret = std::invoke(convert, *member);
+    if (!ret) {
+        return stf::unexpected{fmt::format("bad value for \"{}\"", key)};
+    }
+
+    return ret;
+}
+
+template<typename Fn>
+auto get_member(json_value const& object, std::string_view key, Fn&& convert) -> stf::expected<converted_t<Fn>, std::string> {
+    std::optional<converted_t<Fn>> ret = TRYX(find_member(object, key, std::forward<Fn>(convert)));
+    if (!ret) {
+        return stf::unexpected{fmt::format("missing \"{}\"", key)};
+    }
+
+    return std::move(*ret);
+}
+
+template<typename Fn>
+auto get_member_or(json_value const& object, std::string_view key, Fn&& convert, converted_t<Fn> fallback) -> stf::expected<converted_t<Fn>, std::string> {
+    std::optional<converted_t<Fn>> ret = TRYX(find_member(object, key, std::forward<Fn>(convert)));
+    return ret.value_or(std::move(fallback));
+}
+
+constexpr auto to_radians(real degrees) -> real { return degrees / 180 * std::numbers::pi_v<real>; }
+
+/// The rotation by <code>angle</code> radians about the unit vector <code>axis</code>
+auto rotation_about(vec3 axis, real angle) -> affine_transform {
+    const vec3 imaginary = axis * std::sin(angle / 2);
+    return affine_transform::rotate(vec4{imaginary[0], imaginary[1], imaginary[2], std::cos(angle / 2)});
+}
+
+auto read_transform(json_value const& object) -> stf::expected<affine_transform, std::string> {
+    if (json_value const* matrix = object.find("matrix"); matrix != nullptr) {
+        std::span<const json_value> elements = matrix->elements();
+        if (elements.size() != 16) {
+            return stf::unexpected{std::string("\"matrix\" needs 16 numbers")};
+        }
+
+        std::array<real, 16> numbers;
+        for (usize i = 0; i < 16; i++) {
+            std::optional<real> number = elements[i].number();
+            if (!number) {
+                return stf::unexpected{std::string("bad value for \"matrix\"")};
+            }
+
+            numbers[i] = *number;
+        }
+
+        return affine_transform::from_columns(numbers);
+    }
+
+    const vec3 scale = TRYX(get_member_or(object, "scale", as_factors, vec3(1)));
+    const vec3 rotation = TRYX(get_member_or(object, "rotate", as_vec3, vec3(0)));
+    const vec3 translation = TRYX(get_member_or(object, "translate", as_vec3, vec3(0)));
+
+    return affine_transform::translate(translation) *
+           rotation_about(vec3{0, 0, 1}, to_radians(rotation[2])) *
+           rotation_about(vec3{0, 1, 0}, to_radians(rotation[1])) *
+           rotation_about(vec3{1, 0, 0}, to_radians(rotation[0])) *
+           affine_transform::scale(scale);
+}
+
+auto read_camera(json_value const& object) -> stf::expected<camera_settings, std::string> {
+    camera_settings ret{};
+
+    if (std::string_view type = TRYX(get_member_or(object, "type", as_string, "pinhole")); type == "pinhole") {
+        ret.type = camera_type::pinhole;
+    } else if (type == "environment") {
+        ret.type = camera_type::environment;
+    } else if (type == "orthographic") {
+        ret.type = camera_type::orthographic;
+    } else {
+        return stf::unexpected{fmt::format("unknown camera type \"{}\"", type)};
+    }
+
+    ret.center = TRYX(get_member_or(object, "position", as_vec3, ret.center));
+    ret.rotation = TRYX(get_member_or(object, "rotation", as_vec3, vec3(0))) / 180 * std::numbers::pi_v<real>;
+    ret.fov = TRYX(get_member_or(object, "fov", as_number, ret.fov));
+    ret.physical_width = TRYX(get_member_or(object, "width", as_number, ret.physical_width));
+
+    return ret;
+}
+
+auto read_render_settings(json_value const& object) -> stf::expected<scene_render_settings, std::string> {
+    auto as_resolution = [](json_value const& value) -> std::optional<std::array<usize, 2>> {
+        std::span<const json_value> elements = value.elements();
+        if (elements.size() != 2) {
+            return std::nullopt;
+        }
+
+        const u64 width = TRYX(as_count(elements[0]));
+        const u64 height = TRYX(as_count(elements[1]));
+        if (width == 0 || height == 0) {
+            return std::nullopt;
+        }
+
+        return std::array<usize, 2>{static_cast<usize>(width), static_cast<usize>(height)};
+    };
+
+    auto as_samples = [](json_value const& value) -> std::optional<usize> {
+        const u64 ret = TRYX(as_count(value));
+        return ret == 0 ? std::nullopt : std::optional(static_cast<usize>(ret));
+    };
+
+    auto as_owned_string = [](json_value const& value) -> std::optional<std::string> {
+        return std::string(TRYX(value.string()));
+    };
+
+    return scene_render_settings{
+      .resolution = TRYX(find_member(object, "resolution", as_resolution)),
+      .samples = TRYX(find_member(object, "spp", as_samples)),
+      .seed = TRYX(find_member(object, "seed", as_count)),
+      .integrator = TRYX(find_member(object, "integrator", as_owned_string)),
+      .exposure = TRYX(find_member(object, "exposure", as_number)),
+      .tonemap = TRYX(find_member(object, "tonemap", as_owned_string)),
+    };
+}
+
+/// A mesh file and, for meshes kept out of core, the number of bytes of it to keep resident
+struct mesh_source {
+    std::filesystem::path path;
+    std::optional<usize> budget;
+
+    auto operator<=>(mesh_source const&) const = default;
+};
+
+/// The untransformed parts of a mesh, shapes place instances of them
+using mesh_part = std::variant<shapes::mesh_instance<u32>, shapes::mapped_mesh_instance<u32>>;
+using mesh_parts = std::vector<mesh_part>;
+
+auto load_mesh_parts(mesh_source const& source) -> stf::expected<mesh_parts, std::string> {
+    std::filesystem::path const& path = source.path;
+
+    if (!std::filesystem::exists(path)) {
+        return stf::unexpected{fmt::format("\"{}\" does not exist", path.string())};
+    }
+
+    // the material of the parts is replaced by that of each shape placing them
+    if (source.budget) {
+        shapes::mapped_mesh<u32> mesh = TRYX(read_mapped<u32>(path, 0, *source.budget));
+        return mesh_parts{shapes::mapped_mesh_instance<u32>(0, std::make_shared<const shapes::mapped_mesh<u32>>(std::move(mesh)), affine_transform::identity())};
+    }
+
+    mesh_parts ret{};
+
+    auto add_part = [&ret](shapes::mesh<u32> mesh) {
+        if (!mesh.triangles().empty()) {
+            ret.emplace_back(shapes::mesh_instance<u32>(0, std::make_shared<const shapes::mesh<u32>>(std::move(mesh)), affine_transform::identity()));
+        }
+    };
+
+    if (std::filesystem::path extension = path.extension(); extension == ".ply") {
+        add_part(read_ply<u32>(path, 0));
+    } else if (extension == ".stl") {
+        add_part(read_stl<u32>(path, 0));
+    } else if (extension == ".obj") {
+        for (shapes::mesh<u32>& part : read_obj<u32>(path, 0)) {
+            add_part(std::move(part));
+        }
+    } else if (extension == ".glb") {
+        for (shapes::mesh_instance<u32>& part : read_glb<u32>(path, 0)) {
+            ret.emplace_back(std::move(part));
+        }
+    } else {
+        return stf::unexpected{fmt::format("unsupported mesh format \"{}\"", extension.string())};
+    }
+
+    if (ret.empty()) {
+        return stf::unexpected{fmt::format("\"{}\" has no triangles", path.string())};
+    }
+
+    return ret;
+}
+
+/// Loads the named assets of a document the first time a shape refers to them, later references get the same texture,
+/// material or mesh
+struct asset_resolver {
+    json_value const& document;
+    std::filesystem::path const& directory;
+    trc::scene& scene;
+
+    std::map<std::string, texture_handle, std::less<>> textures{};
+    std::map<std::string, u32, std::less<>> materials{};
+    /// By source, meshes declared under several names are loaded once too
+    std::map<mesh_source, stf::expected<mesh_parts, std::string>> meshes{};
+
+    /// Loads the meshes the shapes refer to in parallel, which is where almost all of the time building a scene goes.\n
+    /// Each file is parsed, welded and gets its tree built on one thread, threads take the next file when done. The largest
+    /// files go first so that the time taken approaches that of the slowest file instead of the sum of all of them.
+    void load_meshes(std::span<const json_value> shapes) {
+        std::vector<std::pair<std::uintmax_t, mesh_source>> pending{};
+
+        for (json_value const& shape : shapes) {
+            // anything wrong with the reference is reported when the shape is added
+            json_value const* name = shape.find("mesh");
+            if (name == nullptr || !name->string()) {
+                continue;
+            }
+
+            auto source = mesh_source_of(*name->string());
+            if (!source || meshes.contains(*source) || std::ranges::any_of(pending, [&](auto const& entry) { return entry.second == *source; })) {
+                continue;
+            }
+
+            std::error_code ec;
+            const std::uintmax_t size = std::filesystem::file_size(source->path, ec);
+
+            pending.emplace_back(ec ? 0 : size, std::move(*source));
+        }
+
+        std::ranges::sort(pending, std::greater{}, [](auto const& entry) { return entry.first; });
+
+        std::vector<std::optional<stf::expected<mesh_parts, std::string>>> results(pending.size());
+        trc::detail::parallel_for_each_index(pending.size(), 0, [&](usize i) { results[i].emplace(load_mesh_parts(pending[i].second)); });
+
+        for (usize i = 0; i < pending.size(); i++) {
+            meshes.emplace(std::move(pending[i].second), std::move(*results[i]));
+        }
+    }
+
+    auto add_shape(json_value const& object, std::vector<bound_shape>& bound_shapes, std::vector<unbound_shape>& unbound_shapes) -> stf::expected<void, std::string> {
+        const std::string_view type = TRYX(get_member(object, "type", as_string));
+        const u32 mat_idx = TRYX(material(TRYX(get_member(object, "material", as_string))));
+
+        if (type == "sphere") {
+            const real radius = TRYX(get_member(object, "radius", as_number));
+            bound_shapes.emplace_back(shapes::sphere(mat_idx, TRYX(get_member(object, "center", as_vec3)), radius));
+        } else if (type == "disc") {
+            const real radius = TRYX(get_member(object, "radius", as_number));
+            bound_shapes.emplace_back(shapes::disc(mat_idx, TRYX(get_member(object, "center", as_vec3)), TRYX(get_member(object, "normal", as_direction)), radius));
+        } else if (type == "box") {
+            bound_shapes.emplace_back(shapes::box(mat_idx, {TRYX(get_member(object, "min", as_vec3)), TRYX(get_member(object, "max", as_vec3))}));
+        } else if (type == "triangle") {
+            auto as_vertices = [](json_value const& value) -> std::optional<std::array<vec3, 3>> {
+                std::span<const json_value> elements = value.elements();
+                if (elements.size() != 3) {
+                    return std::nullopt;
+                }
+
+                return std::array<vec3, 3>{TRYX(as_vec3(elements[0])), TRYX(as_vec3(elements[1])), TRYX(as_vec3(elements[2]))};
+            };
+
+            bound_shapes.emplace_back(shapes::triangle(mat_idx, TRYX(get_member(object, "vertices", as_vertices))));
+        } else if (type == "plane") {
+            unbound_shapes.emplace_back(shapes::plane(mat_idx, TRYX(get_member(object, "center", as_vec3)), TRYX(get_member(object, "normal", as_direction))));
+        } else if (type == "mesh") {
+            mesh_parts const& parts = *TRYX(mesh(TRYX(get_member(object, "mesh", as_string))));
+
+            affine_transform transform = affine_transform::identity();
+            if (json_value const* member = object.find("transform"); member != nullptr) {
+                transform = TRYX(read_transform(*member));
+            }
+
+            if (!transform.inverse()) {
+                return stf::unexpected{std::string("the transform is singular")};
+            }
+
+            for (mesh_part const& part : parts) {
+                std::visit([&]<typename Instance>(Instance const& instance) { bound_shapes.emplace_back(Instance(mat_idx, instance.shared_mesh(), transform * instance.to_world())); }, part);
+            }
+        } else {
+            return stf::unexpected{fmt::format("unknown shape type \"{}\"", type)};
+        }
+
+        return {};
+    }
+
+private:
+    auto declaration(std::string_view section, std::string_view kind, std::string_view name) const -> stf::expected<json_value const*, std::string> {
+        json_value const* declarations = document.find(section);
+        json_value const* ret = declarations != nullptr ? declarations->find(name) : nullptr;
+
+        if (ret == nullptr) {
+            return stf::unexpected{fmt::format("unknown {} \"{}\"", kind, name)};
+        }
+
+        return ret;
+    }
+
+    auto texture(std::string_view name) -> stf::expected<texture_handle, std::string> {
+        if (auto it = textures.find(name); it != textures.end()) {
+            return it->second;
+        }
+
+        json_value const& decl = *TRYX(declaration("textures", "texture", name));
+
+        auto res = read_texture(decl);
+        if (!res) {
+            return stf::unexpected{fmt::format("texture \"{}\": {}", name, res.error())};
+        }
+
+        return textures.emplace(std::string(name), *res).first->second;
+    }
+
+    auto read_texture(json_value const& decl) -> stf::expected<texture_handle, std::string> {
+        wrapping_mode wrapping;
+        if (std::string_view value = TRYX(get_member_or(decl, "wrapping", as_string, "repeat")); value == "repeat") {
+            wrapping = wrapping_mode::repeat;
+        } else if (value == "clamp") {
+            wrapping = wrapping_mode::clamp;
+        } else {
+            return stf::unexpected{fmt::format("unknown wrapping mode \"{}\"", value)};
+        }
+
+        scaling_method scaling;
+        if (std::string_view value = TRYX(get_member_or(decl, "scaling", as_string, "bilinear")); value == "nearest") {
+            scaling = scaling_method::nearest;
+        } else if (value == "bilinear") {
+            scaling = scaling_method::bilinear;
+        } else if (value == "bicubic") {
+            scaling = scaling_method::bicubic;
+        } else {
+            return stf::unexpected{fmt::format("unknown scaling method \"{}\"", value)};
+        }
+
+        const std::filesystem::path path = directory / TRYX(get_member(decl, "file", as_string));
+
+        auto res = scene.m_textures.load(path.string(), wrapping, scaling);
+        if (!res) {
+            return stf::unexpected{fmt::format("could not load \"{}\": {}", path.string(), res.error())};
+        }
+
+        return *res;
+    }
+
+    auto albedo(json_value const& value) -> stf::expected<albedo_source, std::string> {
+        if (std::optional<vec3> rgb = as_factors(value); rgb) {
+            return *rgb;
+        }
+
+        if (std::optional<std::string_view> name = value.string(); name) {
+            return TRYX(texture(*name));
+        }
+
+        const std::string_view type = TRYX(get_member(value, "type", as_string));
+        const color scale = TRYX(get_member_or(value, "scale", as_factors, color(1)));
+
+        if (type == "uv") {
+            return uv_albedo{.scale = scale};
+        }
+
+        if (type == "normal") {
+            return normal_albedo{.scale = scale};
+        }
+
+        return stf::unexpected{fmt::format("unknown albedo type \"{}\"", type)};
+    }
+
+    auto material(std::string_view name) -> stf::expected<u32, std::string> {
+        if (auto it = materials.find(name); it != materials.end()) {
+            return it->second;
+        }
+
+        json_value const& decl = *TRYX(declaration("materials", "material", name));
+
+        auto res = read_material(decl);
+        if (!res) {
+            return stf::unexpected{fmt::format("material \"{}\": {}", name, res.error())};
+        }
+
+        const u32 ret = scene.add_material(std::move(*res));
+        materials.emplace(std::string(name), ret);
+
+        return ret;
+    }
+
+    auto read_material(json_value const& decl) -> stf::expected<trc::material, std::string> {
+        auto get_source = [&](std::string_view key, color fallback) -> stf::expected<albedo_source, std::string> {
+            json_value const* member = decl.find(key);
+            return member != nullptr ? albedo(*member) : albedo_source{fallback};
+        };
+
+        const std::string_view type = TRYX(get_member(decl, "type", as_string));
+        const albedo_source emission = TRYX(get_source("emission", color(0)));
+
+        if (type == "lambertian") {
+            return materials::lambertian(TRYX(get_source("albedo", color(.75))), emission);
+        }
+
+        if (type == "oren_nayar") {
+            const real sigma = TRYX(get_member_or(decl, "sigma", as_number, 20));
+            return materials::oren_nayar(to_radians(sigma), TRYX(get_source("albedo", color(.75))), emission);
+        }
+
+        if (type == "conductor") {
+            return materials::fresnel_conductor(TRYX(get_source("albedo", color(1))), emission);
+        }
+
+        if (type == "dielectric") {
+            const real outside_ior = TRYX(get_member_or(decl, "outside_ior", as_number, 1));
+            const real ior = TRYX(get_member_or(decl, "ior", as_number, 1.5));
+            return materials::fresnel_dielectric(outside_ior, ior, TRYX(get_source("albedo", color(1))), emission);
+        }
+
+        return stf::unexpected{fmt::format("unknown material type \"{}\"", type)};
+    }
+
+    auto mesh_source_of(std::string_view name) const -> stf::expected<mesh_source, std::string> {
+        json_value const& decl = *TRYX(declaration("meshes", "mesh", name));
+
+        // in MiB
+        std::optional<u64> budget = TRYX(find_member(decl, "resident_budget", as_count));
+
+        return mesh_source{
+          .path = directory / TRYX(get_member(decl, "file", as_string)),
+          .budget = budget ? std::optional<usize>(static_cast<usize>(*budget) << 20) : std::nullopt,
+        };
+    }
+
+    auto mesh(std::string_view name) -> stf::expected<mesh_parts const*, std::string> {
+        mesh_source source = TRYX(mesh_source_of(name));
+
+        auto it = meshes.find(source);
+        if (it == meshes.end()) {
+            it = meshes.emplace(source, load_mesh_parts(source)).first;
+        }
+
+        if (!it->second) {
+            return stf::unexpected{fmt::format("mesh \"{}\": {}", name, it->second.error())};
+        }
+
+        return &*it->second;
+    }
+};
+
+}// namespace
+
+auto scene_file::open(std::filesystem::path const& path) -> stf::expected<scene_file, std::string> {
+    auto with_path = [&path](std::string_view error) { return stf::unexpected{fmt::format("\"{}\": {}", path.string(), error)}; };
+
+    auto file_res = io::detail::mapped_file::open(path.string());
+    if (!file_res) {
+        return stf::unexpected{file_res.error()};
+    }
+
+    auto document = io::json::parse(file_res->chars());
+    if (!document) {
+        return with_path(document.error());
+    }
+
+    if (document->get<json_value::object>() == nullptr) {
+        return with_path("expected an object");
+    }
+
+    scene_file ret{};
+    ret.m_document = std::move(*document);
+    ret.m_directory = path.parent_path();
+
+    if (json_value const* camera = ret.m_document.find("camera"); camera != nullptr) {
+        auto res = read_camera(*camera);
+        if (!res) {
+            return with_path(fmt::format("camera: {}", res.error()));
+        }
+
+        ret.camera = *res;
+    }
+
+    if (json_value const* render = ret.m_document.find("render"); render != nullptr) {
+        auto res = read_render_settings(*render);
+        if (!res) {
+            return with_path(fmt::format("render: {}", res.error()));
+        }
+
+        ret.render = std::move(*res);
+    }
+
+    return ret;
+}
+
+auto scene_file::build() const -> stf::expected<scene, std::string> {
+    json_value const* shapes = m_document.find("shapes");
+    if (shapes == nullptr || shapes->get<json_value::array>() == nullptr) {
+        return stf::unexpected{std::string("expected an array of shapes")};
+    }
+
+    scene ret{};
+    asset_resolver resolver{
+      .document = m_document,
+      .directory = m_directory,
+      .scene = ret,
+    };
+
+    resolver.load_meshes(shapes->elements());
+
+    std::vector<bound_shape> bound_shapes{};
+    std::vector<unbound_shape> unbound_shapes{};
+
+    for (usize i = 0; json_value const& shape : shapes->elements()) {
+        if (auto res = resolver.add_shape(shape, bound_shapes, unbound_shapes); !res) {
+            return stf::unexpected{fmt::format("shape {}: {}", i, res.error())};
+        }
+
+        i++;
+    }
+
+    ret.append_shapes(std::move(unbound_shapes));
+    ret.append_shapes(std::move(bound_shapes));
+    ret.reconstruct_bvh<binary_bvh<bound_shape>>(12);
+
+    return ret;
+}
+
+}// namespace trc
@@ -1,16 +1,11 @@
 #include <tracer/run/sfml/main.hpp>
 
-#include <tracer/bvh/tree.hpp>
-#include <tracer/camera/envrionment.hpp>
-#include <tracer/camera/orthographic.hpp>
-#include <tracer/camera/perspective.hpp>
-#include <tracer/camera/pinhole.hpp>
 #include <tracer/image.hpp>
 #include <tracer/imgui.hpp>
 #include <tracer/integrator/cosine_albedo.hpp>
 #include <tracer/integrator/unidirectional_pt.hpp>
-#include <tracer/io/ply.hpp>
-#include <tracer/io/stl.hpp>
+#include <tracer/run/scene_file.hpp>
+#include <tracer/run/test_scene.hpp>
 #include <tracer/scene.hpp>
 
 #include <SFML/Graphics.hpp>
@@ -20,170 +15,8 @@
 
 namespace trc {
 
-template<std::unsigned_integral IndexType = u32>
-static auto read_stl(std::filesystem::path filename, u32 mat_idx, mat4x4 transform = mat4x4::identity()) -> shapes::mesh<IndexType> {
-    std::ifstream stl_file(filename);
-    trc::io::stl::binary_stream triangle_stream{std::istreambuf_iterator<char>(stl_file), std::istreambuf_iterator<char>()};
-
-    shapes::mesh<IndexType> mesh{mat_idx};
-
-    for (;;) {
-        auto res = triangle_stream.next();
-        if (!res) {
-            break;
-        }
-
-        mesh.push_triangle({res->vertices[0], res->vertices[1], res->vertices[2]});
-    }
-
-    mesh.transform(transform);
-    mesh.finish_construction();
-
-    return mesh;
-}
-
-template<std::unsigned_integral IndexType = u32>
-static auto read_ply(std::filesystem::path filename, u32 mat_idx, mat4x4 transform = mat4x4::identity()) -> shapes::mesh<IndexType> {
-    std::ifstream ifs("bun_zipper.ply");
-    auto res_0 = io::ply::read_header(ifs);
-
-    shapes::mesh<IndexType> mesh{mat_idx};
-
-    auto get_real = []<typename T>(T const& v) -> real {
-        io::ply::primitive p_v;
-        if constexpr (std::is_same_v<T, io::ply::data>) {
-            p_v = std::get<io::ply::primitive>(v);
-        } else if constexpr (std::is_same_v<T, io::ply::primitive>) {
-            p_v = v;
-        } else {
-            std::unreachable();
-        }
-        return std::visit([](auto v) -> real { return static_cast<real>(v); }, p_v);
-    };
-
-    auto res_1 = io::ply::read_element(res_0->elements[0], ifs, [&](std::vector<io::ply::data> args) {
-        mesh.push_vertex(vec3(get_real(args[0]), get_real(args[1]), get_real(args[2])));
-    });
-
-    auto res_2 = io::ply::read_element(res_0->elements[1], ifs, [&](std::vector<io::ply::data> args) {
-        io::ply::list list = std::get<io::ply::list>(args[0]);
-        mesh.push_triangle(std::array<IndexType, 3>{
-          static_cast<IndexType>(std::get<int>(list[0])),
-          static_cast<IndexType>(std::get<int>(list[1])),
-          static_cast<IndexType>(std::get<int>(list[2])),
-        });
-    });
-
-    mesh.transform(transform);
-    mesh.finish_construction();
-
-    return mesh;
-}
-
-static auto get_scene_test() -> scene {
-    scene scene{};
-
-    u32 midx_red_on = scene.add_material(materials::oren_nayar(20. / 180. * std::numbers::pi_v<real>, vec3{.75, .25, .25}, vec3(0)));
-    u32 midx_blue_on = scene.add_material(materials::oren_nayar(20. / 180. * std::numbers::pi_v<real>, vec3{.25, .25, .75}, vec3(0)));
-    u32 midx_white_on = scene.add_material(materials::oren_nayar(20. / 180. * std::numbers::pi_v<real>, vec3(.75), vec3(0)));
-    u32 midx_red = scene.add_material(materials::lambertian(vec3{.75, .25, .25}, vec3(0)));
-    u32 midx_green = scene.add_material(materials::lambertian(vec3{.25, .75, .25}, vec3(0)));
-    u32 midx_blue = scene.add_material(materials::lambertian(vec3{.25, .25, .75}, vec3(0)));
-    u32 midx_white = scene.add_material(materials::lambertian(vec3(.75), vec3(0)));
-
-    u32 midx_normal_light = scene.add_material(materials::lambertian(vec3(0), uv_albedo{.scale = vec3(15)}));
-    u32 midx_white_light = scene.add_material(materials::lambertian(vec3(0), vec3(15)));
-    u32 midx_red_light = scene.add_material(materials::lambertian(vec3(0), vec3{12, 0, 0}));
-    u32 midx_green_light = scene.add_material(materials::lambertian(vec3(0), vec3{0, 12, 0}));
-    u32 midx_blue_light = scene.add_material(materials::lambertian(vec3(0), vec3{0, 0, 12}));
-
-    u32 midx_uv = scene.add_material(materials::lambertian(uv_albedo{}, vec3(0)));
-    u32 midx_uv0 = scene.add_material(materials::lambertian(texture("uv_grid_0.qoi", wrapping_mode::repeat, scaling_method::nearest), vec3(0)));
-    u32 midx_uv1 = scene.add_material(materials::lambertian(texture("uv_grid_1.qoi", wrapping_mode::repeat, scaling_method::nearest), vec3(0)));
-    u32 midx_uv2 = scene.add_material(materials::lambertian(texture("uv_grid_2.qoi", wrapping_mode::repeat, scaling_method::nearest), vec3(0)));
-    u32 midx_surf = scene.add_material(materials::lambertian(texture("kodim10.qoi", wrapping_mode::repeat, scaling_method::nearest), vec3(0)));
-    u32 midx_parrot = scene.add_material(materials::lambertian(texture("kodim23.qoi", wrapping_mode::repeat, scaling_method::nearest), vec3(0)));
-    u32 midx_mirror = scene.add_material(materials::fresnel_conductor(vec3(0.999), vec3(0)));
-    u32 midx_glass = scene.add_material(materials::fresnel_dielectric(1, 1.5, vec3(0.999), vec3(0)));
-
-    real obj_radius = 0.85;
-    vec3 left_obj_center{-1.3, -2.25 + obj_radius, 8.5};
-    vec3 right_obj_center{1.3, -2.25 + obj_radius, 7.3};
-
-    // scene.append_shape(shapes::sphere(midx_mirror, left_obj_center, obj_radius));
-    // scene.append_shape(shapes::sphere(midx_glass, right_obj_center, obj_radius));
-    // scene.append_shape(shapes::disc(midx_white_light, {0, 2.2499, 7.5}, {0, -1, 0}, 0.71));
-    scene.append_shape(shapes::disc(midx_white_light, {-1, 0.2499, 7.5}, normalize(vec3{1, -1, 0}), 0.71));
-    scene.append_shape(shapes::disc(midx_white, {-1, 0.25001, 7.5}, normalize(vec3{1, -1, 0}), 0.72));
-
-    // rgb lights
-    /*scene.append_shape(shapes::disc(midx_red_light, {-0.9, 2.2499, 8}, {0, -1, 0}, 0.71));
-    scene.append_shape(shapes::disc(midx_green_light, {0, 2.2499, 6.5}, {0, -1, 0}, 0.71));
-    scene.append_shape(shapes::disc(midx_blue_light, {0.9, 2.2499, 8}, {0, -1, 0}, 0.71));*/
-
-    // scene.append_shape(shapes::box(midx_mirror, {left_obj_center - vec3(obj_radius), left_obj_center + vec3(obj_radius)}));
-    // scene.append_shape(shapes::sphere(midx_normal_light, right_obj_center, 0.25));
-    // scene.append_shape(shapes::box(midx_magdonal, {{-2.5, -2.25, 5}, {-0.5, -1.25, 7}}));
-    // scene.append_shape(shapes::triangle(midx_green, {{left_obj_center + vec3{0, 0 - obj_radius, -2}, left_obj_center + vec3{1, 0 - obj_radius, -2}, left_obj_center + vec3{0, 1 - obj_radius, -2}}}));
-
-    mat4x4 teapot_mat_0 =
-      mat4x4::translate(right_obj_center[0], right_obj_center[1] - obj_radius * 0.75f, right_obj_center[2]) *
-      mat4x4::scale(0.1666, 0.1666, 0.1666) *
-      mat4x4::rotate(std::numbers::pi_v<real> * -90 / 180, 0, std::numbers::pi_v<real> * 135 / 180);
-
-    //scene.append_shape(read_stl<u16>("Utah_teapot_(solid).stl", midx_glass, teapot_mat_0));
-
-    mat4x4 teapot_mat_1 =
-      mat4x4::translate(left_obj_center[0], left_obj_center[1] - obj_radius * 0.75f, left_obj_center[2]) *
-      mat4x4::scale(0.1666, 0.1666, 0.1666) *
-      mat4x4::rotate(std::numbers::pi_v<real> * -90 / 180, 0, std::numbers::pi_v<real> * 45 / 180);
-
-    //scene.append_shape(read_stl<u16>("Utah_teapot_(solid).stl", midx_mirror, teapot_mat_1));
-
-    scene.append_shape(read_ply<u32>("", midx_glass, mat4x4::translate(0, -2.75, 8) * mat4x4::scale(15, 15, 15) * mat4x4::rotate(0, std::numbers::pi_v<real>, 0)));
-
-    std::vector<unbound_shape> unbound_shapes{
-      shapes::plane(midx_red, {-2.8, 0, 10}, {1, 0, 0}),   // left
-      shapes::plane(midx_uv0, {0, 0, 10}, {0, 0, -1}),     // back
-      shapes::plane(midx_blue, {2.8, 0, 10}, {-1, 0, 0}),  // right
-      shapes::plane(midx_white, {0, 2.25, 10}, {0, -1, 0}),// top
-      shapes::plane(midx_white, {0, -2.25, 10}, {0, 1, 0}),// bottom
-    };
-
-    scene.append_shapes(std::move(unbound_shapes));
-    scene.reconstruct_bvh<binary_bvh<bound_shape>>(12);
-
-    return scene;
-}
-
-auto sfml_program::camera_settings::operator()(sf::Vector2u window_dimensions) const -> std::shared_ptr<camera> {
-    vec2 dimensions(window_dimensions.x, window_dimensions.y);
-
-    if (type == camera_type::pinhole) {
-        vec3 rad_rotation = rotation / 180 * std::numbers::pi_v<real>;
-        mat3x3 mat = mat3x3::rotate(rotation[0], rotation[1], rotation[2]);
-
-        return std::make_shared<pinhole_camera>(center, dimensions, fov / 180 * std::numbers::pi_v<real>, mat);
-    } else if (type == camera_type::environment) {
-        return std::make_shared<environment_camera>(center, dimensions);
-    } else if (type == camera_type::orthographic_raw) {
-        return std::make_shared<orthographic_camera>(dimensions, center, left, right, bottom, top, near, far, rotation, ray_rotation);
-    } else if (type == camera_type::frustum_raw) {
-        return std::make_shared<frustum_camera>(dimensions, left, right, bottom, top, near, far);
-    } else if (type == camera_type::orthographic) {
-        vec2 lr = vec2(-0.5, 0.5) * physical_width;
-        vec2 bt = vec2(-0.5, 0.5) * physical_width * dimensions[1] / dimensions[0];
-
-        return std::make_shared<orthographic_camera>(dimensions, center, lr[0], lr[1], bt[0], bt[1], near, far, rotation, ray_rotation);
-    } else if (type == camera_type::frustum) {
-        return std::make_shared<frustum_camera>(dimensions, left, right, bottom, top, near, far);
-    } else {
-        std::unreachable();
-    }
-}
-
-sfml_program::sfml_program()
-    : m_scene(std::make_shared<scene>(std::move(get_scene_test())))
+sfml_program::sfml_program(int argc, char** argv)
+    : m_scene_loading(start_loading_scene(argc, argv, m_configuration))
     , m_window(sf::VideoMode({1280, 720}), "tracer")
     , m_image(m_configuration.m_resolution.x, m_configuration.m_resolution.y)
     , m_render_thread([this] { render_worker(); }) {
@@ -201,6 +34,8 @@ sfml_program::sfml_program()
 }
 
 sfml_program::~sfml_program() {
+    m_render_stop_source.request_stop();
+
     m_render_complete_channel.close();
     m_render_request_channel.close();
 
@@ -223,6 +58,8 @@ auto sfml_program::run() -> int {
                 m_window.close();
         }
 
+        poll_scene_loading();
+
         ImGui::SFML::Update(m_window, frame_delta_clock.restart());
         ImGui::PushFont(m_font);
 
@@ -257,7 +94,9 @@ auto sfml_program::run() -> int {
             {
                 auto group_guard = imgui::guarded_group();
 
-                if (ImGui::BeginTabBar("MaterialObjectEditor")) {
+                if (m_scene == nullptr) {
+                    ImGui::TextUnformatted("loading the scene...");
+                } else if (ImGui::BeginTabBar("MaterialObjectEditor")) {
                     if (ImGui::BeginTabItem("Materials")) {
                         if (ImGui::TreeNode("Material Editor")) {
                             gui_render_material_editor();
@@ -290,8 +129,8 @@ auto sfml_program::run() -> int {
         }
         ImGui::End();
 
-        if (m_ui_render_on_invalidate && m_invalidated) {
-            m_invalidated = !request_render();
+        if (m_scene != nullptr && (m_render_pending || (m_ui_render_on_invalidate && m_invalidated))) {
+            m_render_pending = m_invalidated = !request_render();
             //request_render();
             //m_invalidated = false;
         }
@@ -306,6 +145,62 @@ auto sfml_program::run() -> int {
     return 0;
 }
 
+auto sfml_program::start_loading_scene(int argc, char** argv, render_configuration& configuration) -> std::future<std::shared_ptr<scene>> {
+    auto load_test_scene = [] { return std::make_shared<scene>(get_scene_test()); };
+
+    if (argc < 2) {
+        return std::async(std::launch::async, load_test_scene);
+    }
+
+    // the document is small, only building the scene out of it takes time
+    auto file_res = scene_file::open(argv[1]);
+    if (!file_res) {
+        spdlog::error("could not load the scene: {}, showing the test scene", file_res.error());
+        return std::async(std::launch::async, load_test_scene);
+    }
+
+    scene_render_settings const& render = file_res->render;
+
+    if (file_res->camera) {
+        configuration.m_camera_settings = *file_res->camera;
+    }
+
+    if (render.resolution) {
+        configuration.m_resolution = sf::Vector2u(static_cast<unsigned>((*render.resolution)[0]), static_cast<unsigned>((*render.resolution)[1]));
+    }
+
+    configuration.m_integrator_settings.samples = render.samples.value_or(configuration.m_integrator_settings.samples);
+
+    if (render.integrator == "albedo") {
+        configuration.m_integrator = integrator_type::cosine_albedo;
+    } else if (render.integrator == "pt") {
+        configuration.m_integrator = integrator_type::unidirectional_pt;
+    } else if (render.integrator) {
+        spdlog::warn("the \"{}\" integrator is not available here", *render.integrator);
+    }
+
+    return std::async(std::launch::async, [file = std::move(*file_res), load_test_scene] {
+        auto scene_res = file.build();
+        if (!scene_res) {
+            spdlog::error("could not load the scene: {}, showing the test scene", scene_res.error());
+            return load_test_scene();
+        }
+
+        return std::make_shared<scene>(std::move(*scene_res));
+    });
+}
+
+void sfml_program::poll_scene_loading() {
+    if (!m_scene_loading.valid() || m_scene_loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+
+    m_scene = m_scene_loading.get();
+    m_invalidated = true;
+
+    spdlog::info("loaded the scene");
+}
+
 void sfml_program::load_fonts() {
     ImGuiIO& io = ImGui::GetIO();
     m_fonts["ImGUI Default"] = io.Fonts->AddFontDefault();
@@ -345,12 +240,24 @@ auto sfml_program::request_render() -> bool {
           stf::channel_selector(m_render_complete_channel, [](auto) { return false; }),
           stf::default_channel_selector{[] { return true; }}//
           )) {
-        spdlog::warn("cannot request another render as there's an ongoing one");
+        // the caller retries every frame until the render thread gives up on the ongoing render
+        if (!m_render_stop_source.stop_requested()) {
+            spdlog::info("preempting the ongoing render");
+            m_render_stop_source.request_stop();
+        }
+
         return false;
     }
 
     recreate_images();
-    send(m_render_request_channel, m_configuration);
+
+    m_render_stop_source = std::stop_source{};
+
+    render_configuration request = m_configuration;
+    request.m_stop_token = m_render_stop_source.get_token();
+    m_configuration.m_lights_changed = false;
+
+    send(m_render_request_channel, request);
 
     return true;
 }
@@ -358,6 +265,9 @@ auto sfml_program::request_render() -> bool {
 void sfml_program::render_worker() {
     stf::random::xoshiro_256p gen{std::random_device{}()};
 
+    // kept across renders to avoid reallocating it every frame
+    aov_buffers aovs{};
+
     for (;;) {
         m_ongoing_render.store(false, std::memory_order::relaxed);
         send(m_render_complete_channel);
@@ -373,7 +283,12 @@ void sfml_program::render_worker() {
         spdlog::info("render request received");
         m_ongoing_render.store(true, std::memory_order::relaxed);
 
-        std::shared_ptr<camera> camera = request.m_camera_settings(sf::Vector2u(m_image.width(), m_image.height()));
+        // the emission might have changed, the integrator recollects the emitters
+        if (request.m_lights_changed) {
+            m_scene->invalidate_light_table();
+        }
+
+        std::shared_ptr<camera> camera = request.m_camera_settings(m_image.width(), m_image.height());
         std::shared_ptr<integrator> integrator = nullptr;
 
         switch (m_configuration.m_integrator) {
@@ -395,11 +310,39 @@ void sfml_program::render_worker() {
         image_adapter_srgb srgb_sf_image{adapted_sf_image};
         image_adapter_tee images_tee{adapted_qoi_image, srgb_sf_image, m_image};
 
+        // the denoiser is guided by AOVs produced alongside the render
+        for (aov channel: {aov::albedo, aov::normal, aov::depth}) {
+            if (request.m_denoise) {
+                aovs.enable(channel);
+            } else {
+                aovs.disable(channel);
+            }
+        }
+
+        aovs.create(m_image.width(), m_image.height());
+        image_adapter_aov aov_images{images_tee, aovs};
+
         std::chrono::time_point tp_0 = std::chrono::system_clock::now();
-        integrator->integrate(images_tee, request.m_integrator_settings, gen);
+        integrator->integrate(aov_images, request.m_integrator_settings, gen, request.m_stop_token);
         std::chrono::time_point tp_1 = std::chrono::system_clock::now();
 
+        if (request.m_stop_token.stop_requested()) {
+            spdlog::info("render preempted after {} seconds", std::chrono::duration_cast<std::chrono::microseconds>(tp_1 - tp_0).count() / 1000000.);
+            continue;
+        }
+
         spdlog::info("render completed in {} seconds", std::chrono::duration_cast<std::chrono::microseconds>(tp_1 - tp_0).count() / 1000000.);
+
+        if (!request.m_denoise) {
+            continue;
+        }
+
+        // m_image is part of the tee, the denoiser is done reading it before it writes anything
+        denoise_atrous(m_image, aovs, images_tee, request.m_denoise_settings);
+
+        std::chrono::time_point tp_2 = std::chrono::system_clock::now();
+
+        spdlog::info("denoising completed in {} seconds", std::chrono::duration_cast<std::chrono::microseconds>(tp_2 - tp_1).count() / 1000000.);
     }
 
     spdlog::info("render thread is exiting");
@@ -557,18 +500,34 @@ void sfml_program::gui_render_settings() {
     ImGui::Checkbox("Render upon invalidation", &m_ui_render_on_invalidate);
 
     if (ImGui::Button("begin render")) {
-        request_render();
+        // before the scene is loaded, the render is requested once it is
+        m_render_pending = m_scene == nullptr || !request_render();
     }
 
     if (m_ongoing_render.load(std::memory_order::relaxed)) {
         ImGui::SameLine();
         ImGui::TextColored(ImVec4(255, 0, 0, 255), "Render in progress...");
+
+        ImGui::SameLine();
+        if (ImGui::Button("cancel")) {
+            m_render_stop_source.request_stop();
+            m_render_pending = false;
+        }
     }
 
     if (ImGui::TreeNode("Integrator Settings")) {
         ImGui::Combo("Integrator", &reinterpret_cast<int&>(m_configuration.m_integrator), integrator_names, std::size(integrator_names));
         imgui::input_scalar("Samples per Pixel", m_configuration.m_integrator_settings.samples);
 
+        ImGui::Checkbox("Denoise", &m_configuration.m_denoise);
+        if (m_configuration.m_denoise) {
+            imgui::input_scalar("Filter Iterations", m_configuration.m_denoise_settings.iterations);
+            imgui::input_scalar<real>("Color Sigma", m_configuration.m_denoise_settings.sigma_color);
+            imgui::input_scalar<real>("Normal Sigma", m_configuration.m_denoise_settings.sigma_normal);
+            imgui::input_scalar<real>("Depth Sigma", m_configuration.m_denoise_settings.sigma_depth);
+            ImGui::Checkbox("Demodulate Albedo", &m_configuration.m_denoise_settings.demodulate_albedo);
+        }
+
         ImGui::TreePop();
     }
 
@@ -649,7 +608,7 @@ auto sfml_program::gui_render_albedo_source_editor(albedo_source& source) -> boo
       [](uv_albedo&) { return 0; },
       [](normal_albedo&) { return 1; },
       [](color&) { return 2; },
-      [](texture&) { return 3; },
+      [](texture_handle&) { return 3; },
     };
 
     int current_source_index = std::visit(index_visitor, source);
@@ -669,7 +628,7 @@ auto sfml_program::gui_render_albedo_source_editor(albedo_source& source) -> boo
                 source = color{};
                 break;
             case 3:
-                source = texture{};
+                source = texture_handle{};
                 break;
             default:
                 std::unreachable();
@@ -702,7 +661,7 @@ auto sfml_program::gui_render_albedo_source_editor(albedo_source& source) -> boo
 
           return imgui::input_scalar_n<real>("color", {&source[0], 3});
       },
-      [](texture& mat) {
+      [](texture_handle&) {
           ImGui::Text("Cannot edit texture settings.");
           return false;
       },
@@ -763,6 +722,11 @@ auto sfml_program::gui_render_material_editor() -> bool {
         ImGui::TreePop();
     }
 
+    if (changed) {
+        // the render thread might be reading the light table, leave invalidating it to the next render request
+        m_configuration.m_lights_changed = true;
+    }
+
     return changed;
 }
 
@@ -813,7 +777,7 @@ auto sfml_program::gui_render_material_list() -> bool {
               [](uv_albedo const&) -> const char* { return "UV Visualiser"; },
               [](normal_albedo const&) -> const char* { return "Surface Normal Visualiser"; },
               [](color const&) -> const char* { return "Color"; },
-              [](texture const&) -> const char* { return "Texture"; },
+              [](texture_handle const&) -> const char* { return "Texture"; },
             };
 
             ImGui::TableNextColumn();
@@ -0,0 +1,88 @@
+#include <tracer/run/test_scene.hpp>
+
+#include <tracer/bvh/tree.hpp>
+
+namespace trc {
+
+auto get_scene_test() -> scene {
+    scene scene{};
+
+    u32 midx_red_on = scene.add_material(materials::oren_nayar(20. / 180. * std::numbers::pi_v<real>, vec3{.75, .25, .25}, vec3(0)));
+    u32 midx_blue_on = scene.add_material(materials::oren_nayar(20. / 180. * std::numbers::pi_v<real>, vec3{.25, .25, .75}, vec3(0)));
+    u32 midx_white_on = scene.add_material(materials::oren_nayar(20. / 180. * std::numbers::pi_v<real>, vec3(.75), vec3(0)));
+    u32 midx_red = scene.add_material(materials::lambertian(vec3{.75, .25, .25}, vec3(0)));
+    u32 midx_green = scene.add_material(materials::lambertian(vec3{.25, .75, .25}, vec3(0)));
+    u32 midx_blue = scene.add_material(materials::lambertian(vec3{.25, .25, .75}, vec3(0)));
+    u32 midx_white = scene.add_material(materials::lambertian(vec3(.75), vec3(0)));
+
+    u32 midx_normal_light = scene.add_material(materials::lambertian(vec3(0), uv_albedo{.scale = vec3(15)}));
+    u32 midx_white_light = scene.add_material(materials::lambertian(vec3(0), vec3(15)));
+    u32 midx_red_light = scene.add_material(materials::lambertian(vec3(0), vec3{12, 0, 0}));
+    u32 midx_green_light = scene.add_material(materials::lambertian(vec3(0), vec3{0, 12, 0}));
+    u32 midx_blue_light = scene.add_material(materials::lambertian(vec3(0), vec3{0, 0, 12}));
+
+    // missing files leave the surfaces black
+    auto load_texture = [&scene](std::string const& filename) {
+        return scene.m_textures.load(filename, wrapping_mode::repeat, scaling_method::nearest).value_or(texture_handle{});
+    };
+
+    u32 midx_uv = scene.add_material(materials::lambertian(uv_albedo{}, vec3(0)));
+    u32 midx_uv0 = scene.add_material(materials::lambertian(load_texture("uv_grid_0.qoi"), vec3(0)));
+    u32 midx_uv1 = scene.add_material(materials::lambertian(load_texture("uv_grid_1.qoi"), vec3(0)));
+    u32 midx_uv2 = scene.add_material(materials::lambertian(load_texture("uv_grid_2.qoi"), vec3(0)));
+    u32 midx_surf = scene.add_material(materials::lambertian(load_texture("kodim10.qoi"), vec3(0)));
+    u32 midx_parrot = scene.add_material(materials::lambertian(load_texture("kodim23.qoi"), vec3(0)));
+    u32 midx_mirror = scene.add_material(materials::fresnel_conductor(vec3(0.999), vec3(0)));
+    u32 midx_glass = scene.add_material(materials::fresnel_dielectric(1, 1.5, vec3(0.999), vec3(0)));
+
+    real obj_radius = 0.85;
+    vec3 left_obj_center{-1.3, -2.25 + obj_radius, 8.5};
+    vec3 right_obj_center{1.3, -2.25 + obj_radius, 7.3};
+
+    // scene.append_shape(shapes::sphere(midx_mirror, left_obj_center, obj_radius));
+    // scene.append_shape(shapes::sphere(midx_glass, right_obj_center, obj_radius));
+    // scene.append_shape(shapes::disc(midx_white_light, {0, 2.2499, 7.5}, {0, -1, 0}, 0.71));
+    scene.append_shape(shapes::disc(midx_white_light, {-1, 0.2499, 7.5}, normalize(vec3{1, -1, 0}), 0.71));
+    scene.append_shape(shapes::disc(midx_white, {-1, 0.25001, 7.5}, normalize(vec3{1, -1, 0}), 0.72));
+
+    // rgb lights
+    /*scene.append_shape(shapes::disc(midx_red_light, {-0.9, 2.2499, 8}, {0, -1, 0}, 0.71));
+    scene.append_shape(shapes::disc(midx_green_light, {0, 2.2499, 6.5}, {0, -1, 0}, 0.71));
+    scene.append_shape(shapes::disc(midx_blue_light, {0.9, 2.2499, 8}, {0, -1, 0}, 0.71));*/
+
+    // scene.append_shape(shapes::box(midx_mirror, {left_obj_center - vec3(obj_radius), left_obj_center + vec3(obj_radius)}));
+    // scene.append_shape(shapes::sphere(midx_normal_light, right_obj_center, 0.25));
+    // scene.append_shape(shapes::box(midx_magdonal, {{-2.5, -2.25, 5}, {-0.5, -1.25, 7}}));
+    // scene.append_shape(shapes::triangle(midx_green, {{left_obj_center + vec3{0, 0 - obj_radius, -2}, left_obj_center + vec3{1, 0 - obj_radius, -2}, left_obj_center + vec3{0, 1 - obj_radius, -2}}}));
+
+    mat4x4 teapot_mat_0 =
+      mat4x4::translate(right_obj_center[0], right_obj_center[1] - obj_radius * 0.75f, right_obj_center[2]) *
+      mat4x4::scale(0.1666, 0.1666, 0.1666) *
+      mat4x4::rotate(std::numbers::pi_v<real> * -90 / 180, 0, std::numbers::pi_v<real> * 135 / 180);
+
+    //scene.append_shape(read_stl<u16>("Utah_teapot_(solid).stl", midx_glass, teapot_mat_0));
+
+    mat4x4 teapot_mat_1 =
+      mat4x4::translate(left_obj_center[0], left_obj_center[1] - obj_radius * 0.75f, left_obj_center[2]) *
+      mat4x4::scale(0.1666, 0.1666, 0.1666) *
+      mat4x4::rotate(std::numbers::pi_v<real> * -90 / 180, 0, std::numbers::pi_v<real> * 45 / 180);
+
+    //scene.append_shape(read_stl<u16>("Utah_teapot_(solid).stl", midx_mirror, teapot_mat_1));
+
+    scene.append_shape(read_ply<u32>("bun_zipper.ply", midx_glass, mat4x4::translate(0, -2.75, 8) * mat4x4::scale(15, 15, 15) * mat4x4::rotate(0, std::numbers::pi_v<real>, 0)));
+
+    std::vector<unbound_shape> unbound_shapes{
+      shapes::plane(midx_red, {-2.8, 0, 10}, {1, 0, 0}),   // left
+      shapes::plane(midx_uv0, {0, 0, 10}, {0, 0, -1}),     // back
+      shapes::plane(midx_blue, {2.8, 0, 10}, {-1, 0, 0}),  // right
+      shapes::plane(midx_white, {0, 2.25, 10}, {0, -1, 0}),// top
+      shapes::plane(midx_white, {0, -2.25, 10}, {0, 1, 0}),// bottom
+    };
+
+    scene.append_shapes(std::move(unbound_shapes));
+    scene.reconstruct_bvh<binary_bvh<bound_shape>>(12);
+
+    return scene;
+}
+
+}// namespace trc
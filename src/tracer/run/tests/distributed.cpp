@@ -0,0 +1,104 @@
+#include <tracer/camera/pinhole.hpp>
+#include <tracer/distributed/coordinator.hpp>
+#include <tracer/distributed/worker.hpp>
+#include <tracer/image.hpp>
+#include <tracer/integrator/unidirectional_pt.hpp>
+#include <tracer/scene.hpp>
+
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// not divisible by the tile size, the tiles on the right and bottom edges are cut short
+constexpr usize width = 45;
+constexpr usize height = 35;
+constexpr u64 seed = 42;
+
+auto make_integrator() -> std::shared_ptr<trc::integrator> {
+    using namespace trc;
+
+    std::shared_ptr<scene> scene = std::make_shared<trc::scene>();
+
+    u32 midx_red = scene->add_material(materials::lambertian(vec3{.75, .25, .25}, vec3(0)));
+    u32 midx_white = scene->add_material(materials::lambertian(vec3(.75), vec3(0)));
+    u32 midx_light = scene->add_material(materials::lambertian(vec3(0), vec3(4)));
+
+    scene->append_shape(shapes::sphere(midx_red, vec3(-1, 0, 5), 1));
+    scene->append_shape(shapes::sphere(midx_white, vec3(1.5, 0.5, 6), 1.25));
+    scene->append_shape(shapes::sphere(midx_white, vec3(0, -1001, 5), 1000));
+    scene->append_shape(shapes::sphere(midx_light, vec3(0, 4, 7), 2));
+
+    std::shared_ptr<camera> camera = std::make_shared<pinhole_camera>(vec3(0), vec2(width, height), std::numbers::pi_v<real> / 2);
+
+    return std::make_shared<unidirectional_pt>(std::move(camera), std::move(scene));
+}
+
+const trc::integration_settings settings{.samples = 4, .threads = 2};
+
+}// namespace
+
+TEST(tracer_distributed, matches_single_process) {
+    using namespace trc;
+
+    image single(width, height);
+    {
+        default_rng gen{seed};
+        make_integrator()->integrate(single, settings, gen);
+    }
+
+    const std::string address = fmt::format("unix:{}/tracer_test_{}.sock", testing::TempDir(), ::getpid());
+
+    auto coordinator_res = distributed::coordinator::listen(address);
+    ASSERT_TRUE(coordinator_res) << coordinator_res.error();
+
+    // separate processes load their own copy of the scene, like workers started by the command line interface
+    std::vector<pid_t> workers{};
+    for (usize i = 0; i < 2; i++) {
+        const pid_t pid = ::fork();
+        ASSERT_NE(pid, -1);
+
+        if (pid == 0) {
+            auto prepare = [](std::string_view) -> stf::expected<distributed::worker_job, std::string> {
+                return distributed::worker_job{.integrator = make_integrator(), .settings = settings};
+            };
+
+            ::_exit(distributed::run_worker(address, prepare, 1) ? 0 : 1);
+        }
+
+        workers.push_back(pid);
+    }
+
+    image distributed(width, height);
+
+    default_rng gen{seed};
+    auto res = coordinator_res->render(distributed, "", gen(), {.tile_size{16, 16}, .fail_on_worker_error = true});
+
+    for (pid_t pid: workers) {
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    ASSERT_TRUE(res) << res.error();
+    EXPECT_EQ(res->tiles, 9);
+
+    // a black frame would match no matter what the workers did
+    ASSERT_GT(single.at(width / 2, 4)[0], 0);
+
+    for (usize y = 0; y < height; y++) {
+        for (usize x = 0; x < width; x++) {
+            for (usize c = 0; c < 3; c++) {
+                ASSERT_EQ(single.at(x, y)[c], distributed.at(x, y)[c]) << "at " << x << ", " << y;
+            }
+        }
+    }
+}
@@ -0,0 +1,180 @@
+#include <tracer/io/mesh_cache.hpp>
+#include <tracer/io/ply.hpp>
+#include <tracer/shape/mapped_mesh.hpp>
+#include <tracer/shape/mesh.hpp>
+
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+auto temp_path(std::string_view name) -> std::string {
+    return fmt::format("{}/tracer_test_{}_{}", testing::TempDir(), ::getpid(), name);
+}
+
+auto read_file(std::string const& path) -> std::vector<char> {
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+/// A bumpy grid of quads, enough of them that the tree has a few layers
+void write_grid(std::string const& path, usize size) {
+    std::ofstream file(path);
+
+    file << fmt::format("ply\nformat ascii 1.0\nelement vertex {}\nproperty float x\nproperty float y\nproperty float z\n", size * size);
+    file << fmt::format("element face {}\nproperty list uchar int vertex_indices\nend_header\n", (size - 1) * (size - 1));
+
+    for (usize y = 0; y < size; y++) {
+        for (usize x = 0; x < size; x++) {
+            file << fmt::format("{} {} {}\n", x, y, (x * 7 + y * 3) % 5);
+        }
+    }
+
+    for (usize y = 0; y + 1 < size; y++) {
+        for (usize x = 0; x + 1 < size; x++) {
+            const usize i = y * size + x;
+            file << fmt::format("4 {} {} {} {}\n", i, i + 1, i + size + 1, i + size);
+        }
+    }
+}
+
+}// namespace
+
+TEST(tracer_io, mesh_cache_streamed_build) {
+    using namespace trc;
+
+    const std::string source = temp_path("grid.ply");
+    const std::string stored = temp_path("stored.mesh");
+    const std::string built = temp_path("built.mesh");
+    const mat4x4 transform = mat4x4::scale(2, 0.5, 3);
+    constexpr u64 key = 42;
+
+    write_grid(source, 40);
+
+    shapes::mesh<u32> mesh{0};
+    {
+        auto res = io::ply::read_mesh<u32>(source);
+        ASSERT_TRUE(res) << res.error();
+
+        mesh.push_vertices(res->vertices);
+        mesh.push_triangles(res->triangles);
+        mesh.transform(transform);
+        mesh.finish_construction();
+
+        auto store_res = io::mesh_cache::store(stored, key, mesh);
+        ASSERT_TRUE(store_res) << store_res.error();
+    }
+
+    {
+        auto builder = io::mesh_cache::builder<u32>::create(built, transform);
+        ASSERT_TRUE(builder) << builder.error();
+
+        auto res = io::ply::read_mesh_chunked<u32>(
+          source,//
+          [&](std::span<const vec3> vertices) { builder->push_vertices(vertices); },
+          [&](std::span<const std::array<u32, 3>> triangles) { builder->push_triangles(triangles); });
+        ASSERT_TRUE(res) << res.error();
+
+        auto finish_res = builder->finish(key);
+        ASSERT_TRUE(finish_res) << finish_res.error();
+    }
+
+    const std::vector<char> stored_bytes = read_file(stored);
+    const std::vector<char> built_bytes = read_file(built);
+
+    std::remove(source.c_str());
+    std::remove(stored.c_str());
+
+    // the caches are interchangeable, a mesh streamed in is built exactly like one read into memory
+    ASSERT_FALSE(stored_bytes.empty());
+    ASSERT_EQ(stored_bytes, built_bytes);
+
+    auto mapped = shapes::mapped_mesh<u32>::open(built, key, 0, 1 << 20);
+    std::remove(built.c_str());
+
+    ASSERT_TRUE(mapped);
+    ASSERT_DOUBLE_EQ(mapped->surface_area(), mesh.surface_area());
+
+    default_rng mesh_gen{7};
+    default_rng mapped_gen{7};
+
+    for (usize i = 0; i < 1000; i++) {
+        const intersection expected = mesh.sample_surface(mesh_gen);
+        const intersection sampled = mapped->sample_surface(mapped_gen);
+
+        ASSERT_EQ(sampled.primitive_index, expected.primitive_index);
+    }
+}
+
+TEST(tracer_io, mesh_cache_rejects_broken_trees) {
+    using namespace trc;
+
+    const std::string source = temp_path("broken_grid.ply");
+    const std::string stored = temp_path("broken.mesh");
+    constexpr u64 key = 42;
+
+    write_grid(source, 16);
+
+    {
+        auto res = io::ply::read_mesh<u32>(source);
+        std::remove(source.c_str());
+        ASSERT_TRUE(res) << res.error();
+
+        shapes::mesh<u32> mesh{0};
+        mesh.push_vertices(res->vertices);
+        mesh.push_triangles(res->triangles);
+        mesh.finish_construction();
+
+        auto store_res = io::mesh_cache::store(stored, key, mesh);
+        ASSERT_TRUE(store_res) << store_res.error();
+    }
+
+    const std::vector<char> bytes = read_file(stored);
+    std::remove(stored.c_str());
+
+    io::mesh_cache::detail::header header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    ASSERT_GT(header.n_nodes, 1);
+
+    auto load_modified = [&](auto&& modify) {
+        std::vector<char> modified = bytes;
+        modify(modified);
+
+        std::ofstream(stored, std::ios::binary).write(modified.data(), static_cast<std::streamsize>(modified.size()));
+        auto ret = io::mesh_cache::load<u32>(stored, key, 0);
+        std::remove(stored.c_str());
+
+        return ret.has_value();
+    };
+
+    ASSERT_TRUE(load_modified([](std::vector<char>&) {}));
+
+    // the node count has to follow from the depth
+    ASSERT_FALSE(load_modified([&](std::vector<char>& data) {
+        io::mesh_cache::detail::header modified = header;
+        modified.depth += 1;
+        std::memcpy(data.data(), &modified, sizeof(modified));
+    }));
+
+    // a node of the last layer that claims to have children
+    ASSERT_FALSE(load_modified([&](std::vector<char>& data) {
+        const usize offset = header.nodes_offset + (header.n_nodes - 1) * sizeof(bvh_node_record);
+
+        bvh_node_record record;
+        std::memcpy(&record, data.data() + offset, sizeof(record));
+        record.is_leaf = 0;
+        std::memcpy(data.data() + offset, &record, sizeof(record));
+    }));
+}
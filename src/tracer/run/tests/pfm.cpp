@@ -0,0 +1,89 @@
+#include <tracer/io/pfm.hpp>
+
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+auto temp_path(std::string_view name) -> std::string {
+    return fmt::format("{}/tracer_test_{}_{}", testing::TempDir(), ::getpid(), name);
+}
+
+auto test_color(usize x, usize y) -> trc::color {
+    return trc::color{static_cast<trc::real>(x) * 0.25, static_cast<trc::real>(y) * -1.5, 1e20};
+}
+
+}// namespace
+
+TEST(tracer_io, pfm_round_trip) {
+    using namespace trc;
+
+    const std::string path = temp_path("round_trip.pfm");
+    constexpr usize width = 7;
+    constexpr usize height = 5;
+
+    {
+        auto res = io::pfm::writer::create(path, width, height);
+        ASSERT_TRUE(res) << res.error();
+
+        // two tiles, out of order, the bottom-right pixel is never written
+        std::vector<color> bottom{};
+        for (usize y = 3; y < height; y++) {
+            for (usize x = 0; x < width - 1; x++) {
+                bottom.push_back(test_color(x, y));
+            }
+        }
+
+        std::vector<color> top{};
+        for (usize y = 0; y < 3; y++) {
+            for (usize x = 0; x < width; x++) {
+                top.push_back(test_color(x, y));
+            }
+        }
+
+        res->set_tile(0, 3, width - 1, 2, bottom);
+        res->set_tile(0, 0, width, 3, top);
+
+        ASSERT_TRUE(res->finish());
+    }
+
+    auto res = io::pfm::read(path);
+    std::remove(path.c_str());
+
+    ASSERT_TRUE(res) << res.error();
+    ASSERT_EQ(res->width(), width);
+    ASSERT_EQ(res->height(), height);
+
+    for (usize y = 0; y < height; y++) {
+        for (usize x = 0; x < width; x++) {
+            const color expected = x == width - 1 && y >= 3 ? color{} : test_color(x, y);
+
+            for (usize c = 0; c < 3; c++) {
+                ASSERT_FLOAT_EQ(res->at(x, y)[c], expected[c]) << "at " << x << ", " << y;
+            }
+        }
+    }
+}
+
+TEST(tracer_io, pfm_truncated) {
+    const std::string path = temp_path("truncated.pfm");
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "PF\n2 2\n-1.0\n";
+        file.write("\0\0\0\0\0\0\0\0", 8);
+    }
+
+    auto res = trc::io::pfm::read(path);
+    std::remove(path.c_str());
+
+    ASSERT_FALSE(res);
+}
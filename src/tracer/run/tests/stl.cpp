@@ -1,84 +1,155 @@
-#include <stuff/trilang.hpp>
+#include <tracer/io/stl.hpp>
 
 #include <gtest/gtest.h>
 
-TEST(tracer_io, stl) {
-    uint8_t test_file[] = {
-      'H',  'e',  'l',  'l',  'o',  ',',  ' ',  'w',  'o',  'r',   //
-      'l',  'd',  '!',  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
-      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
-      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
-      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
-      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
-      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
-      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
-
-      0x04, 0x00, 0x00, 0x00,  // 4 triangles
-
-      0x7c, 0xd9, 0xa0, 0x3e,  // 0.31415925
-      0x7c, 0xd9, 0xa0, 0x3e,  //
-      0x7c, 0xd9, 0xa0, 0x3e,  //
-      0x5f, 0x36, 0xa8, 0x3f,  // 1.31415925
-      0x5f, 0x36, 0xa8, 0x3f,  //
-      0x5f, 0x36, 0xa8, 0x3f,  //
-      0x2f, 0x1b, 0x14, 0x40,  // 2.31415925
-      0x2f, 0x1b, 0x14, 0x40,  //
-      0x2f, 0x1b, 0x14, 0x40,  //
-      0x2f, 0x1b, 0x54, 0x40,  // 3.31415925
-      0x2f, 0x1b, 0x54, 0x40,  //
-      0x2f, 0x1b, 0x54, 0x40,  //
-      0x00, 0x00,              // 0 attrib bytes
-
-      0x98, 0x0d, 0x8a, 0x40,  // 4.31415925
-      0x98, 0x0d, 0x8a, 0x40,  //
-      0x98, 0x0d, 0x8a, 0x40,  //
-      0x98, 0x0d, 0xaa, 0x40,  // 5.31415925
-      0x98, 0x0d, 0xaa, 0x40,  //
-      0x98, 0x0d, 0xaa, 0x40,  //
-      0x98, 0x0d, 0xca, 0x40,  // 6.31415925
-      0x98, 0x0d, 0xca, 0x40,  //
-      0x98, 0x0d, 0xca, 0x40,  //
-      0x98, 0x0d, 0xea, 0x40,  // 7.31415925
-      0x98, 0x0d, 0xea, 0x40,  //
-      0x98, 0x0d, 0xea, 0x40,  //
-      0x01, 0x00,              // 1 attrib byte
-      0xAA,
-
-      0xcc, 0x06, 0x05, 0x41,  // 8.31415925
-      0xcc, 0x06, 0x05, 0x41,  //
-      0xcc, 0x06, 0x05, 0x41,  //
-      0xcc, 0x06, 0x15, 0x41,  // 9.31415925
-      0xcc, 0x06, 0x15, 0x41,  //
-      0xcc, 0x06, 0x15, 0x41,  //
-      0xcc, 0x06, 0x25, 0x41,  // 10.31415925
-      0xcc, 0x06, 0x25, 0x41,  //
-      0xcc, 0x06, 0x25, 0x41,  //
-      0xcc, 0x06, 0x35, 0x41,  // 11.31415925
-      0xcc, 0x06, 0x35, 0x41,  //
-      0xcc, 0x06, 0x35, 0x41,  //
-      0x02, 0x00,              // 2 attrib bytes
-      0xBB, 0xCC,
-    };
-
-    stf::trilang::stl::binary_stream stream(std::begin(test_file), std::end(test_file));
-    std::vector<stf::trilang::stl::triangle> vec {};
-
-    for (;;) {
-        std::optional<stf::trilang::stl::triangle> res = stream.next();
-        if (!res) {
-            break;
-        }
-        vec.emplace_back(*res);
-    }
+#include <algorithm>
+#include <array>
+#include <span>
+#include <string_view>
+
+namespace {
+
+// 3 triangles, the last two followed by attribute bytes
+std::array<uint8_t, 84 + 3 * 50 + 3> binary_test_file{
+  'H',  'e',  'l',  'l',  'o',  ',',  ' ',  'w',  'o',  'r',   //
+  'l',  'd',  '!',  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  //
+
+  0x03, 0x00, 0x00, 0x00,  // 3 triangles
+
+  0x7c, 0xd9, 0xa0, 0x3e,  // 0.31415925
+  0x7c, 0xd9, 0xa0, 0x3e,  //
+  0x7c, 0xd9, 0xa0, 0x3e,  //
+  0x5f, 0x36, 0xa8, 0x3f,  // 1.31415925
+  0x5f, 0x36, 0xa8, 0x3f,  //
+  0x5f, 0x36, 0xa8, 0x3f,  //
+  0x2f, 0x1b, 0x14, 0x40,  // 2.31415925
+  0x2f, 0x1b, 0x14, 0x40,  //
+  0x2f, 0x1b, 0x14, 0x40,  //
+  0x2f, 0x1b, 0x54, 0x40,  // 3.31415925
+  0x2f, 0x1b, 0x54, 0x40,  //
+  0x2f, 0x1b, 0x54, 0x40,  //
+  0x00, 0x00,              // 0 attrib bytes
+
+  0x98, 0x0d, 0x8a, 0x40,  // 4.31415925
+  0x98, 0x0d, 0x8a, 0x40,  //
+  0x98, 0x0d, 0x8a, 0x40,  //
+  0x98, 0x0d, 0xaa, 0x40,  // 5.31415925
+  0x98, 0x0d, 0xaa, 0x40,  //
+  0x98, 0x0d, 0xaa, 0x40,  //
+  0x98, 0x0d, 0xca, 0x40,  // 6.31415925
+  0x98, 0x0d, 0xca, 0x40,  //
+  0x98, 0x0d, 0xca, 0x40,  //
+  0x98, 0x0d, 0xea, 0x40,  // 7.31415925
+  0x98, 0x0d, 0xea, 0x40,  //
+  0x98, 0x0d, 0xea, 0x40,  //
+  0x01, 0x00,              // 1 attrib byte
+  0xAA,
+
+  0xcc, 0x06, 0x05, 0x41,  // 8.31415925
+  0xcc, 0x06, 0x05, 0x41,  //
+  0xcc, 0x06, 0x05, 0x41,  //
+  0xcc, 0x06, 0x15, 0x41,  // 9.31415925
+  0xcc, 0x06, 0x15, 0x41,  //
+  0xcc, 0x06, 0x15, 0x41,  //
+  0xcc, 0x06, 0x25, 0x41,  // 10.31415925
+  0xcc, 0x06, 0x25, 0x41,  //
+  0xcc, 0x06, 0x25, 0x41,  //
+  0xcc, 0x06, 0x35, 0x41,  // 11.31415925
+  0xcc, 0x06, 0x35, 0x41,  //
+  0xcc, 0x06, 0x35, 0x41,  //
+  0x02, 0x00,              // 2 attrib bytes
+  0xBB, 0xCC,
+};
 
-    ASSERT_EQ(vec.size(), 3);
+void check_binary_test_triangles(std::vector<trc::io::stl::triangle> const& triangles) {
+    ASSERT_EQ(triangles.size(), 3);
 
-    for (size_t i = 0; auto tri : vec) {
+    for (size_t i = 0; auto tri : triangles) {
         float base = 0.31415925f;
 
-        ASSERT_FLOAT_EQ(tri.normal[0], base + i++);
-        ASSERT_FLOAT_EQ(tri.vertices[0][0], base + i++);
-        ASSERT_FLOAT_EQ(tri.vertices[1][0], base + i++);
-        ASSERT_FLOAT_EQ(tri.vertices[2][0], base + i++);
+        for (size_t axis = 0; axis < 3; axis++) {
+            ASSERT_FLOAT_EQ(tri.normal[axis], base + i);
+            ASSERT_FLOAT_EQ(tri.vertices[0][axis], base + i + 1);
+            ASSERT_FLOAT_EQ(tri.vertices[1][axis], base + i + 2);
+            ASSERT_FLOAT_EQ(tri.vertices[2][axis], base + i + 3);
+        }
+
+        i += 4;
     }
 }
+
+}// namespace
+
+TEST(tracer_io, stl_binary) {
+    auto res = trc::io::stl::detail::read_triangles(std::as_bytes(std::span(binary_test_file)), 1);
+
+    ASSERT_TRUE(res) << res.error();
+    check_binary_test_triangles(*res);
+}
+
+TEST(tracer_io, stl_binary_truncated) {
+    auto res = trc::io::stl::detail::read_triangles(std::as_bytes(std::span(binary_test_file)).first(84 + 2 * 50), 1);
+
+    ASSERT_FALSE(res);
+}
+
+TEST(tracer_io, stl_binary_solid_header) {
+    // the attribute bytes keep the size from matching the triangle count, the ASCII parse fails on the records
+    std::array<uint8_t, binary_test_file.size()> file = binary_test_file;
+    std::ranges::copy(std::string_view("solid binary"), file.begin());
+
+    auto res = trc::io::stl::detail::read_triangles(std::as_bytes(std::span(file)), 1);
+
+    ASSERT_TRUE(res) << res.error();
+    check_binary_test_triangles(*res);
+}
+
+TEST(tracer_io, stl_ascii) {
+    constexpr std::string_view test_file =
+      "solid two triangles\n"
+      "  facet normal 0 0 1\n"
+      "    outer loop\n"
+      "      vertex 0 0 0\n"
+      "      vertex 1 0 0\n"
+      "      vertex 0 1 0\n"
+      "    endloop\n"
+      "  endfacet\n"
+      "  facet normal 0 0 -1\n"
+      "    outer loop\n"
+      "      vertex 0 0 2.5\n"
+      "      vertex 0 1 2.5\n"
+      "      vertex 1e1 0 2.5\n"
+      "    endloop\n"
+      "  endfacet\n"
+      "endsolid two triangles\n";
+
+    auto res = trc::io::stl::detail::read_triangles(std::as_bytes(std::span(test_file)), 1);
+
+    ASSERT_TRUE(res) << res.error();
+    ASSERT_EQ(res->size(), 2);
+
+    ASSERT_FLOAT_EQ((*res)[0].normal[2], 1.f);
+    ASSERT_FLOAT_EQ((*res)[0].vertices[1][0], 1.f);
+    ASSERT_FLOAT_EQ((*res)[1].normal[2], -1.f);
+    ASSERT_FLOAT_EQ((*res)[1].vertices[0][2], 2.5f);
+    ASSERT_FLOAT_EQ((*res)[1].vertices[2][0], 10.f);
+}
+
+TEST(tracer_io, stl_ascii_malformed) {
+    constexpr std::string_view test_file =
+      "solid broken\n"
+      "  facet normal 0 0 1\n"
+      "    outer loop\n"
+      "      vertex 0 0 0\n"
+      "      vertex 1 0\n";
+
+    auto res = trc::io::stl::detail::read_triangles(std::as_bytes(std::span(test_file)), 1);
+
+    ASSERT_FALSE(res);
+}
@@ -0,0 +1,186 @@
+#include <tracer/aov.hpp>
+#include <tracer/camera/pinhole.hpp>
+#include <tracer/integrator/cosine_albedo.hpp>
+#include <tracer/io/tiled_float.hpp>
+#include <tracer/scene.hpp>
+
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+auto temp_path(std::string_view name) -> std::string {
+    return fmt::format("{}/tracer_test_{}_{}", testing::TempDir(), ::getpid(), name);
+}
+
+}// namespace
+
+TEST(tracer_io, tiled_float_rle) {
+    using namespace trc::io::tiled_float;
+
+    std::vector<u32> words{1, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3, 4, 5, 5, 5, 6};
+
+    std::vector<std::byte> encoded{};
+    detail::rle_encode(words, encoded);
+
+    // the run of eight threes is a packet of two words
+    ASSERT_LT(encoded.size(), words.size() * sizeof(u32));
+
+    std::vector<u32> decoded(words.size());
+    ASSERT_TRUE(detail::rle_decode(encoded, decoded));
+    ASSERT_EQ(decoded, words);
+
+    std::vector<u32> too_short(words.size() - 1);
+    ASSERT_FALSE(detail::rle_decode(encoded, too_short));
+}
+
+TEST(tracer_io, tiled_float_round_trip) {
+    using namespace trc;
+
+    const std::string path = temp_path("round_trip.tfi");
+    constexpr usize width = 9;
+    constexpr usize height = 6;
+
+    // a constant tile is run-length encoded, a gradient is stored raw
+    std::vector<color> constant(4 * 3, color{0.5, -2, 1e-3});
+    std::vector<color> gradient{};
+    for (usize i = 0; i < 5 * 6; i++) {
+        gradient.push_back(color{static_cast<real>(i), static_cast<real>(i) * 0.5, -static_cast<real>(i)});
+    }
+
+    {
+        auto res = io::tiled_float::writer::create(path, width, height, {"beauty", "albedo", "custom"});
+        ASSERT_TRUE(res) << res.error();
+
+        ASSERT_TRUE(res->has_aov(aov::beauty));
+        ASSERT_TRUE(res->has_aov(aov::albedo));
+        ASSERT_FALSE(res->has_aov(aov::normal));
+
+        res->set_tile(4, 0, 5, 6, gradient);
+        res->set_aov_tile(aov::albedo, 0, 2, 4, 3, constant);
+        res->write_tile(2, 0, 0, 4, 3, constant);
+
+        // not a layer of this file, ignored
+        res->set_aov_tile(aov::normal, 0, 0, 4, 3, constant);
+
+        ASSERT_TRUE(res->finish());
+    }
+
+    auto res = io::tiled_float::read(path);
+    std::remove(path.c_str());
+
+    ASSERT_TRUE(res) << res.error();
+    ASSERT_EQ(res->layer_names, (std::vector<std::string>{"beauty", "albedo", "custom"}));
+    ASSERT_EQ(res->width(), width);
+    ASSERT_EQ(res->height(), height);
+
+    auto check = [&](usize layer, usize x0, usize y0, usize tile_width, usize tile_height, std::vector<color> const& expected) {
+        for (usize y = 0; y < height; y++) {
+            for (usize x = 0; x < width; x++) {
+                const bool inside = x >= x0 && x < x0 + tile_width && y >= y0 && y < y0 + tile_height;
+                const color c = inside ? expected[(y - y0) * tile_width + (x - x0)] : color{};
+
+                for (usize i = 0; i < 3; i++) {
+                    ASSERT_FLOAT_EQ(res->layers[layer].at(x, y)[i], c[i]) << "layer " << layer << " at " << x << ", " << y;
+                }
+            }
+        }
+    };
+
+    check(0, 4, 0, 5, 6, gradient);
+    check(1, 0, 2, 4, 3, constant);
+    check(2, 0, 0, 4, 3, constant);
+}
+
+TEST(tracer_io, tiled_float_interrupted) {
+    using namespace trc;
+
+    const std::string path = temp_path("interrupted.tfi");
+    std::vector<color> pixels(4, color(1));
+
+    {
+        auto res = io::tiled_float::writer::create(path, 2, 4);
+        ASSERT_TRUE(res) << res.error();
+
+        res->set_tile(0, 0, 2, 2, pixels);
+        res->set_tile(0, 2, 2, 2, pixels);
+
+        ASSERT_TRUE(res->finish());
+    }
+
+    // cut the second record short, the first one is still intact
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+    auto res = io::tiled_float::read(path);
+    std::remove(path.c_str());
+
+    ASSERT_TRUE(res) << res.error();
+    ASSERT_FLOAT_EQ(res->layers[0].at(1, 1)[0], 1);
+    ASSERT_FLOAT_EQ(res->layers[0].at(1, 3)[0], 0);
+}
+
+TEST(tracer_io, tiled_float_streams_aovs) {
+    using namespace trc;
+
+    constexpr usize width = 40;
+    constexpr usize height = 30;
+
+    std::shared_ptr<scene> scene = std::make_shared<trc::scene>();
+    u32 midx = scene->add_material(materials::lambertian(vec3{.75, .25, .25}, vec3(0)));
+    scene->append_shape(shapes::sphere(midx, vec3(0, 0, 4), 1.5));
+
+    std::shared_ptr<camera> camera = std::make_shared<pinhole_camera>(vec3(0), vec2(width, height), std::numbers::pi_v<real> / 2);
+    cosine_albedo_integrator integrator(std::move(camera), std::move(scene));
+
+    const integration_settings settings{.samples = 2, .threads = 2};
+
+    image beauty(width, height);
+    aov_buffers buffers(width, height);
+    buffers.enable(aov::albedo);
+    buffers.enable(aov::depth);
+
+    {
+        image_adapter_aov buffered{beauty, buffers};
+        default_rng gen{7};
+        integrator.integrate(buffered, settings, gen);
+    }
+
+    const std::string path = temp_path("streamed.tfi");
+
+    {
+        auto res = io::tiled_float::writer::create(path, width, height, {"beauty", "depth", "albedo"});
+        ASSERT_TRUE(res) << res.error();
+
+        default_rng gen{7};
+        integrator.integrate(*res, settings, gen);
+
+        ASSERT_TRUE(res->finish());
+    }
+
+    auto res = io::tiled_float::read(path);
+    std::remove(path.c_str());
+
+    ASSERT_TRUE(res) << res.error();
+
+    // a miss in the middle of the frame would mean the test checks nothing
+    ASSERT_GT(buffers.channel(aov::albedo).at(width / 2, height / 2)[0], 0);
+
+    for (usize y = 0; y < height; y++) {
+        for (usize x = 0; x < width; x++) {
+            for (usize c = 0; c < 3; c++) {
+                ASSERT_FLOAT_EQ(res->layers[0].at(x, y)[c], static_cast<float>(beauty.at(x, y)[c]));
+                ASSERT_FLOAT_EQ(res->layers[1].at(x, y)[c], static_cast<float>(buffers.channel(aov::depth).at(x, y)[c]));
+                ASSERT_FLOAT_EQ(res->layers[2].at(x, y)[c], static_cast<float>(buffers.channel(aov::albedo).at(x, y)[c]));
+            }
+        }
+    }
+}